@@ -0,0 +1,502 @@
+/***************************************************************************//**
+* @file    parson_test.c
+* @version 1.0.0
+*
+* @brief Host test and benchmark of parson number parsing and formatting.
+*
+* @par Description
+*    Checks the exact parse fast path and Grisu2 number formatting of the
+*    parson copy used by the device application and measures their speed
+*    against strtod and sprintf("%1.17g"). Runs on a development host, see
+*    README.md for build instructions.
+*
+* @author  Jaroslav Groman
+*
+* @par Notes
+*    .
+*
+*******************************************************************************/
+
+#include <stdbool.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parson.h"
+
+/*******************************************************************************
+*   Macros and #define Constants
+*******************************************************************************/
+
+#define DEFAULT_COUNT       1000000     // Random numbers per exactness check
+#define BENCH_COUNT         20000       // Numbers per benchmark array
+#define BENCH_ROUNDS        20          // Benchmark repetitions
+
+/*******************************************************************************
+*   Types
+*******************************************************************************/
+
+typedef struct parse_case_s
+{
+    const char *p_text;         // JSON text
+    bool b_is_valid;            // Text is accepted by parser
+    double value;               // Expected value if accepted
+} parse_case_t;
+
+typedef struct format_case_s
+{
+    double value;               // Number to serialize
+    const char *p_text;         // Expected JSON text
+} format_case_t;
+
+/*******************************************************************************
+*   Global variables
+*******************************************************************************/
+
+// Fast path, strtod fallback and inputs rejected by the original parser
+static const parse_case_t g_parse_cases[] = {
+    { "0", true, 0.0 },
+    { "-0", true, -0.0 },
+    { "42", true, 42.0 },
+    { "-17", true, -17.0 },
+    { "1E5", true, 1e5 },
+    { "-1.0e+2", true, -100.0 },
+    { "0.1", true, 0.1 },
+    { "1.5e-7", true, 1.5e-7 },
+    { "1e22", true, 1e22 },
+    { "1e23", true, 1e23 },
+    { "9007199254740993", true, 9007199254740992.0 },
+    { "123456789012345678", true, 123456789012345678.0 },
+    { "0.30000000000000004", true, 0.30000000000000004 },
+    { "2.2250738585072014e-308", true, 2.2250738585072014e-308 },
+    { "1.7976931348623157e308", true, 1.7976931348623157e308 },
+    { "01", false, 0.0 },
+    { ".5", false, 0.0 },
+    { "1e400", false, 0.0 },
+    { "5e-324", false, 0.0 }
+};
+
+// Integers are printed directly, other numbers as shortest Grisu2 digits
+static const format_case_t g_format_cases[] = {
+    { 0.0, "0" },
+    { -0.0, "-0" },
+    { 1.0, "1" },
+    { -1.0, "-1" },
+    { 100.0, "100" },
+    { 4294967295.0, "4294967295" },
+    { 9007199254740992.0, "9007199254740992" },
+    { 0.1, "0.1" },
+    { 0.3, "0.3" },
+    { 1.0 / 3.0, "0.3333333333333333" },
+    { 123456.789, "123456.789" },
+    { 5e-7, "5e-07" },
+    { 1e-6, "0.000001" },
+    { 1e21, "1e+21" },
+    { 1e23, "9.999999999999999e+22" },
+    { 1e100, "1e+100" },
+    { 1.7976931348623157e308, "1.7976931348623157e+308" },
+    { 2.2250738585072014e-308, "2.2250738585072014e-308" }
+};
+
+static uint64_t g_random_state = 88172645463325252ULL;
+
+/*******************************************************************************
+*   Function declarations
+*******************************************************************************/
+
+/**
+ * @brief Xorshift pseudo random generator, runs are repeatable.
+ *
+ * @return Next pseudo random number.
+ */
+static uint64_t
+random_next(void);
+
+/**
+ * @brief Get CLOCK_MONOTONIC time.
+ *
+ * @return Time in seconds.
+ */
+static double
+time_now(void);
+
+/**
+ * @brief Check parse and serialize results for fixed cases.
+ *
+ * @return Number of failed cases.
+ */
+static long
+check_fixed_cases(void);
+
+/**
+ * @brief Serialize random doubles and parse them back, count results not
+ *    equal to the original value and results longer than the shortest
+ *    representation. Grisu2 is not guaranteed to be shortest, longer
+ *    results are reported but are not errors.
+ *
+ * @param count Number of random doubles.
+ *
+ * @return Number of values not surviving round trip.
+ */
+static long
+check_round_trip(long count);
+
+/**
+ * @brief Parse random decimal strings and compare results with strtod.
+ *
+ * @param count Number of random strings.
+ *
+ * @return Number of results differing from strtod.
+ */
+static long
+check_parse_exact(long count);
+
+/**
+ * @brief Measure parsing and serializing of integer and fractional number
+ *    arrays, strtod and sprintf("%1.17g") are measured as a baseline.
+ */
+static void
+run_benchmark(void);
+
+/*******************************************************************************
+*   Function definitions
+*******************************************************************************/
+
+int
+main(int argc, char *argv[])
+{
+    long count = (argc > 1) ? strtol(argv[1], NULL, 10) : DEFAULT_COUNT;
+    long failures = 0;
+
+    failures += check_fixed_cases();
+    failures += check_round_trip(count);
+    failures += check_parse_exact(count);
+
+    run_benchmark();
+
+    printf("%s: %ld failures\n", (failures == 0) ? "PASSED" : "FAILED",
+        failures);
+
+    return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static uint64_t
+random_next(void)
+{
+    g_random_state ^= g_random_state << 13;
+    g_random_state ^= g_random_state >> 7;
+    g_random_state ^= g_random_state << 17;
+    return g_random_state;
+}
+
+static double
+time_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static long
+check_fixed_cases(void)
+{
+    long failures = 0;
+
+    for (size_t i = 0; i < sizeof(g_parse_cases) / sizeof(g_parse_cases[0]);
+        i++)
+    {
+        const parse_case_t *p_case = &g_parse_cases[i];
+        JSON_Value *p_value = json_parse_string(p_case->p_text);
+
+        bool b_is_ok = (p_value != NULL) == p_case->b_is_valid;
+        if (b_is_ok && (p_value != NULL))
+        {
+            double number = json_value_get_number(p_value);
+            b_is_ok = (number == p_case->value) &&
+                (signbit(number) == signbit(p_case->value));
+        }
+        if (!b_is_ok)
+        {
+            printf("parse \"%s\": got %s %.17g\n", p_case->p_text,
+                (p_value != NULL) ? "valid" : "invalid",
+                (p_value != NULL) ? json_value_get_number(p_value) : 0.0);
+            failures++;
+        }
+        json_value_free(p_value);
+    }
+
+    for (size_t i = 0; i < sizeof(g_format_cases) / sizeof(g_format_cases[0]);
+        i++)
+    {
+        const format_case_t *p_case = &g_format_cases[i];
+        JSON_Value *p_value = json_value_init_number(p_case->value);
+        char *p_text = json_serialize_to_string(p_value);
+
+        if ((p_text == NULL) || (strcmp(p_text, p_case->p_text) != 0))
+        {
+            printf("format %.17g: got \"%s\", expected \"%s\"\n",
+                p_case->value, (p_text != NULL) ? p_text : "(null)",
+                p_case->p_text);
+            failures++;
+        }
+        json_free_serialized_string(p_text);
+        json_value_free(p_value);
+    }
+
+    printf("Fixed cases: %ld failures\n", failures);
+    return failures;
+}
+
+static long
+check_round_trip(long count)
+{
+    long failures = 0;
+    long checked = 0;
+    long longer = 0;
+    char shortest[32];
+
+    for (long i = 0; i < count; i++)
+    {
+        // Every third value has few significant digits, like typical data
+        double number;
+        uint64_t bits = random_next();
+        memcpy(&number, &bits, sizeof(number));
+        if ((i % 3) == 0)
+        {
+            number = (double)(random_next() % 1000000) /
+                (double)(1 + random_next() % 1000);
+        }
+
+        // Parser rejects subnormals, strtod reports ERANGE for them
+        if (!isfinite(number) || (fpclassify(number) == FP_SUBNORMAL))
+        {
+            continue;
+        }
+        checked++;
+
+        JSON_Value *p_value = json_value_init_number(number);
+        char *p_text = json_serialize_to_string(p_value);
+        JSON_Value *p_parsed = json_parse_string(p_text);
+
+        if ((p_parsed == NULL) || (json_value_get_number(p_parsed) != number))
+        {
+            if (failures < 5)
+            {
+                printf("round trip %.17g: got \"%s\"\n", number, p_text);
+            }
+            failures++;
+        }
+        else
+        {
+            // Count significant digits of the result and of the shortest
+            // %g representation parsing back to the same number
+            int precision = 1;
+            while (precision < 17)
+            {
+                snprintf(shortest, sizeof(shortest), "%.*g", precision, number);
+                if (strtod(shortest, NULL) == number)
+                {
+                    break;
+                }
+                precision++;
+            }
+
+            int digits = 0;
+            bool b_is_leading = true;
+            for (const char *p = p_text; (*p != '\0') && (*p != 'e'); p++)
+            {
+                if ((*p >= '0') && (*p <= '9') && !(b_is_leading && (*p == '0')))
+                {
+                    b_is_leading = false;
+                    digits++;
+                }
+            }
+            // Integers are printed in full, trailing zeros are not counted
+            if (strpbrk(p_text, ".e") == NULL)
+            {
+                for (const char *p = p_text + strlen(p_text) - 1;
+                    (p > p_text) && (*p == '0'); p--)
+                {
+                    digits--;
+                }
+            }
+            if (digits > precision)
+            {
+                longer++;
+            }
+        }
+
+        json_free_serialized_string(p_text);
+        json_value_free(p_parsed);
+        json_value_free(p_value);
+    }
+
+    printf("Round trip: %ld checked, %ld failures, %ld not shortest\n",
+        checked, failures, longer);
+    return failures;
+}
+
+static long
+check_parse_exact(long count)
+{
+    long failures = 0;
+    long checked = 0;
+    char text[64];
+
+    for (long i = 0; i < count; i++)
+    {
+        // Up to 17 significant digits, optional fraction and exponent
+        int length = 0;
+        int digits = 1 + (int)(random_next() % 17);
+        if ((random_next() % 2) == 0)
+        {
+            text[length++] = '-';
+        }
+        text[length++] = (char)('1' + random_next() % 9);
+        for (int j = 1; j < digits; j++)
+        {
+            text[length++] = (char)('0' + random_next() % 10);
+        }
+        if ((random_next() % 2) == 0)
+        {
+            text[length++] = '.';
+            int fraction = 1 + (int)(random_next() % 6);
+            for (int j = 0; j < fraction; j++)
+            {
+                text[length++] = (char)('0' + random_next() % 10);
+            }
+        }
+        if ((random_next() % 2) == 0)
+        {
+            length += sprintf(&text[length], "e%d",
+                (int)(random_next() % 80) - 40);
+        }
+        text[length] = '\0';
+
+        JSON_Value *p_value = json_parse_string(text);
+        if (p_value == NULL)
+        {
+            continue;
+        }
+        checked++;
+
+        double expected = strtod(text, NULL);
+        if (json_value_get_number(p_value) != expected)
+        {
+            if (failures < 5)
+            {
+                printf("parse \"%s\": got %.17g, strtod %.17g\n", text,
+                    json_value_get_number(p_value), expected);
+            }
+            failures++;
+        }
+        json_value_free(p_value);
+    }
+
+    printf("Parse exactness: %ld checked, %ld failures\n", checked, failures);
+    return failures;
+}
+
+static void
+run_benchmark(void)
+{
+    static char text_int[BENCH_COUNT * 12 + 2];
+    static char text_frac[BENCH_COUNT * 24 + 2];
+    static double numbers_int[BENCH_COUNT];
+    static double numbers_frac[BENCH_COUNT];
+    char buffer[64];
+
+    // JSON arrays of integers, like reported twin properties, and of
+    // fractional numbers with few digits
+    char *p_int = text_int;
+    char *p_frac = text_frac;
+    *p_int++ = '[';
+    *p_frac++ = '[';
+    for (int i = 0; i < BENCH_COUNT; i++)
+    {
+        numbers_int[i] = (double)(random_next() % 100000);
+        numbers_frac[i] = (double)(random_next() % 10000000) / 1000.0;
+        p_int += sprintf(p_int, "%s%.0f", (i > 0) ? "," : "", numbers_int[i]);
+        p_frac += sprintf(p_frac, "%s%.3f", (i > 0) ? "," : "",
+            numbers_frac[i]);
+    }
+    *p_int++ = ']';
+    *p_frac++ = ']';
+    *p_int = '\0';
+    *p_frac = '\0';
+
+    struct
+    {
+        const char *p_name;
+        const char *p_text;
+        const double *p_numbers;
+    } sets[] = {
+        { "integers", text_int, numbers_int },
+        { "fractions", text_frac, numbers_frac }
+    };
+
+    double sink = 0;
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++)
+    {
+        double start = time_now();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+        {
+            JSON_Value *p_value = json_parse_string(sets[s].p_text);
+            sink += json_array_get_number(json_value_get_array(p_value), 0);
+            json_value_free(p_value);
+        }
+        double parse_ns = (time_now() - start) * 1e9 /
+            (BENCH_ROUNDS * BENCH_COUNT);
+
+        start = time_now();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+        {
+            const char *p = sets[s].p_text + 1;
+            char *p_end;
+            for (int i = 0; i < BENCH_COUNT; i++)
+            {
+                sink += strtod(p, &p_end);
+                p = p_end + 1;
+            }
+        }
+        double strtod_ns = (time_now() - start) * 1e9 /
+            (BENCH_ROUNDS * BENCH_COUNT);
+
+        JSON_Value *p_value = json_parse_string(sets[s].p_text);
+        start = time_now();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+        {
+            char *p_text = json_serialize_to_string(p_value);
+            sink += (double)strlen(p_text);
+            json_free_serialized_string(p_text);
+        }
+        double format_ns = (time_now() - start) * 1e9 /
+            (BENCH_ROUNDS * BENCH_COUNT);
+        json_value_free(p_value);
+
+        start = time_now();
+        for (int r = 0; r < BENCH_ROUNDS; r++)
+        {
+            for (int i = 0; i < BENCH_COUNT; i++)
+            {
+                sink += (double)sprintf(buffer, "%1.17g", sets[s].p_numbers[i]);
+            }
+        }
+        double sprintf_ns = (time_now() - start) * 1e9 /
+            (BENCH_ROUNDS * BENCH_COUNT);
+
+        printf("Benchmark %s, ns per number: parse %.0f (strtod %.0f), "
+            "serialize %.0f (sprintf %%1.17g %.0f)\n", sets[s].p_name,
+            parse_ns, strtod_ns, format_ns, sprintf_ns);
+    }
+
+    // Keep results alive
+    if (sink == 0.5)
+    {
+        printf("\n");
+    }
+}
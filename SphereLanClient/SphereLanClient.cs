@@ -0,0 +1,90 @@
+﻿// Sends set_item_data payload to Azure Sphere device local network listener,
+// bypassing the web application and IoT Hub, and prints device responses
+// with round trip times.
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.IO;
+using System.Linq;
+using System.Net.Sockets;
+using System.Text.Json;
+using System.Threading.Tasks;
+
+using SpherePasswordManager.Services;
+
+namespace sphere_lan_client
+{
+    class SphereLanClient
+    {
+        private static readonly int s_timeoutMs = 1000;
+
+        private static async Task<int> Main(string[] args)
+        {
+            if (args.Length < 2)
+            {
+                Console.WriteLine("Usage: SphereLanClient <device-address> <pre-shared-key> [item.json] [count]");
+                return 1;
+            }
+
+            string address = args[0];
+            var protocol = new LocalDeviceProtocol(args[1]);
+            string itemJson = (args.Length > 2) ? File.ReadAllText(args[2]) :
+                "{\"Name\":\"LanTest\",\"Username\":\"user\",\"Password\":\"password\"}";
+            int count = (args.Length > 3) ? int.Parse(args[3]) : 1;
+
+            var roundTrips = new long[count];
+            int answered = 0;
+            Task<UdpReceiveResult> receive = null;
+
+            using (var udpClient = new UdpClient())
+            {
+                udpClient.Connect(address, LocalDeviceProtocol.DefaultPort);
+
+                for (int i = 0; i < count; i++)
+                {
+                    // Every request gets its own ID, device drops repeated IDs
+                    var item = JsonSerializer.Deserialize<Dictionary<string, object>>(itemJson);
+                    item["RequestId"] = Guid.NewGuid().ToString("N").Substring(0, 12);
+                    string payload = JsonSerializer.Serialize(item);
+
+                    byte[] request = protocol.EncodeRequest(payload, out byte[] header);
+                    Stopwatch stopwatch = Stopwatch.StartNew();
+                    await udpClient.SendAsync(request, request.Length);
+
+                    // Late responses to previous requests are skipped
+                    Task timeout = Task.Delay(s_timeoutMs);
+                    while (true)
+                    {
+                        receive ??= udpClient.ReceiveAsync();
+                        if (await Task.WhenAny(receive, timeout) == timeout)
+                        {
+                            Console.WriteLine("{0} > No response in {1} ms", DateTime.Now, s_timeoutMs);
+                            break;
+                        }
+
+                        UdpReceiveResult result = await receive;
+                        receive = null;
+                        if (protocol.TryDecodeResponse(header, result.Buffer, out int status, out string response))
+                        {
+                            roundTrips[answered++] = stopwatch.ElapsedTicks * 1000000 / Stopwatch.Frequency;
+                            Console.WriteLine("{0} > {1} {2} ({3} us)", DateTime.Now, status, response,
+                                roundTrips[answered - 1]);
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (answered > 1)
+            {
+                long[] sorted = roundTrips.Take(answered).OrderBy(t => t).ToArray();
+                Console.WriteLine("{0} of {1} answered, round trip p50 {2} us, p99 {3} us, max {4} us",
+                    answered, count, sorted[(answered - 1) / 2], sorted[(answered * 99 - 1) / 100],
+                    sorted[answered - 1]);
+            }
+
+            return (answered == count) ? 0 : 2;
+        }
+    }
+}
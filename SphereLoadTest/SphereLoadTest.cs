@@ -0,0 +1,242 @@
+﻿// Drives web application item services concurrently against in-memory
+// secret store and simulated Azure Sphere devices, prints latency percentiles,
+// secret store request counts and device statistics.
+
+using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text.Json;
+using System.Threading;
+using System.Threading.Tasks;
+
+using Microsoft.Extensions.Configuration;
+using Microsoft.Extensions.DependencyInjection;
+using Microsoft.Extensions.Logging;
+
+using SpherePasswordManager.Models;
+using SpherePasswordManager.Services;
+
+namespace sphere_load_test
+{
+    class SphereLoadTest
+    {
+        private static readonly Dictionary<string, string> s_defaults = new Dictionary<string, string>()
+        {
+            ["items"] = "1000",
+            ["clients"] = "16",
+            ["requests"] = "5000",
+            ["loadAndSend"] = "false",
+            ["readAllWeight"] = "1",
+            ["readWeight"] = "4",
+            ["sendWeight"] = "2",
+
+            ["ConfigKeys:prefix"] = "Config--",
+            ["ConfigKeys:iotHubServiceConnStr"] = "IotHubServiceConnStr",
+            ["ConfigKeys:azureSphereDeviceName"] = "AzureSphereDeviceName",
+            ["AzureSphereDevice:directMethodName"] = "set_item_data",
+            ["AzureSphereDevice:directMethodCallTimeout"] = "30",
+            ["SecretStore:maxAttempts"] = "4",
+            ["SecretStore:retryBaseDelayMs"] = "200",
+            ["DeviceSimulation:latencyMs"] = "50",
+            ["DeviceSimulation:jitterMs"] = "0",
+            ["Logging:LogLevel:Default"] = "Warning"
+        };
+
+        private static async Task<int> Main(string[] args)
+        {
+            IConfiguration config = new ConfigurationBuilder()
+                .AddInMemoryCollection(s_defaults)
+                .AddCommandLine(args)
+                .Build();
+
+            int itemCount = config.GetValue<int>("items");
+            int clients = config.GetValue<int>("clients");
+            int requests = config.GetValue<int>("requests");
+
+            var secretStore = new InMemorySecretStore(
+                config.GetSection("SecretStore:InMemory").Get<InMemorySecretStoreOptions>() ??
+                new InMemorySecretStoreOptions());
+            Seed(secretStore, config, itemCount);
+
+            var services = new ServiceCollection();
+            services.AddSingleton(config);
+            services.AddLogging(logging => logging
+                .AddConfiguration(config.GetSection("Logging"))
+                .AddConsole());
+            services.AddMemoryCache();
+            services.AddSingleton<ISecretStore>(provider => new RetryingSecretStore(secretStore,
+                config.GetValue<int>("SecretStore:maxAttempts"),
+                TimeSpan.FromMilliseconds(config.GetValue<int>("SecretStore:retryBaseDelayMs")),
+                provider.GetRequiredService<ILogger<RetryingSecretStore>>()));
+            services.AddSingleton<IItemStore, ItemStore>();
+            services.AddSingleton<IItemPrefetcher, ItemPrefetcher>();
+            services.AddSingleton<ILocalDeviceClient, LocalDeviceClient>();
+            var fleet = new SimulatedDeviceFleet(
+                config.GetSection("DeviceSimulation").Get<SimulatedDeviceFleetOptions>() ??
+                new SimulatedDeviceFleetOptions());
+            services.AddSingleton<IDeviceMethodInvoker>(fleet);
+            services.AddSingleton<IDevicePresenceSource>(fleet);
+            services.AddSingleton<IDevicePresence, DevicePresenceCache>();
+            services.AddTransient<IConfigDataService, ConfigDataService>();
+            services.AddTransient<IItemService, ItemService>();
+
+            using (fleet)
+            using (ServiceProvider provider = services.BuildServiceProvider())
+            {
+                var itemStore = provider.GetRequiredService<IItemStore>();
+                var retryingStore = (RetryingSecretStore)provider.GetRequiredService<ISecretStore>();
+
+                // Cold item list load, starts content prefetch
+                Stopwatch stopwatch = Stopwatch.StartNew();
+                IReadOnlyList<Item> items = await provider.GetRequiredService<IItemService>().ReadAllAsync();
+                Console.WriteLine("Item list of {0} items loaded in {1} ms", items.Count,
+                    stopwatch.ElapsedMilliseconds);
+
+                Task<long> prefetched = WaitForContentAsync(itemStore, items, stopwatch);
+
+                var latencies = new ConcurrentDictionary<string, ConcurrentBag<double>>();
+                int errors = 0;
+                int busy = 0;
+                int issued = 0;
+
+                int[] weights =
+                {
+                    config.GetValue<int>("readAllWeight"),
+                    config.GetValue<int>("readWeight"),
+                    config.GetValue<int>("sendWeight")
+                };
+
+                Stopwatch loadStopwatch = Stopwatch.StartNew();
+                await Task.WhenAll(Enumerable.Range(0, clients).Select(client => Task.Run(async () =>
+                {
+                    var random = new Random(client);
+
+                    while (Interlocked.Increment(ref issued) <= requests)
+                    {
+                        // Transient service per request, as in the web application
+                        var itemService = provider.GetRequiredService<IItemService>();
+                        int id = items[random.Next(items.Count)].Id;
+                        string operation = Pick(weights, random);
+
+                        long started = Stopwatch.GetTimestamp();
+                        switch (operation)
+                        {
+                            case "ReadAll":
+                                await itemService.ReadAllAsync();
+                                break;
+
+                            case "Read":
+                                Item item = await itemService.ReadAsync(id);
+                                if (item == null || !item.IsHydrated)
+                                {
+                                    Interlocked.Increment(ref errors);
+                                }
+                                break;
+
+                            default:
+                                string message = await itemService.SendAsync(id);
+                                if (message.Contains("Device busy"))
+                                {
+                                    Interlocked.Increment(ref busy);
+                                }
+                                else if (message.Contains("ERROR"))
+                                {
+                                    Interlocked.Increment(ref errors);
+                                }
+                                break;
+                        }
+
+                        latencies.GetOrAdd(operation, _ => new ConcurrentBag<double>()).Add(
+                            (Stopwatch.GetTimestamp() - started) * 1000.0 / Stopwatch.Frequency);
+                    }
+                })));
+                loadStopwatch.Stop();
+
+                Console.WriteLine("{0} requests from {1} clients in {2} ms, {3} errors, {4} device busy",
+                    requests, clients, loadStopwatch.ElapsedMilliseconds, errors, busy);
+                foreach (var operation in latencies.OrderBy(entry => entry.Key))
+                {
+                    double[] sorted = operation.Value.OrderBy(ms => ms).ToArray();
+                    Console.WriteLine("  {0,-8} {1,6} requests, p50 {2,8:F2} ms, p99 {3,8:F2} ms, max {4,8:F2} ms",
+                        operation.Key, sorted.Length, sorted[(sorted.Length - 1) / 2],
+                        sorted[(sorted.Length * 99 - 1) / 100], sorted[sorted.Length - 1]);
+                }
+
+                long prefetchedMs = await prefetched;
+                Console.WriteLine("All item contents cached {0}", (prefetchedMs < 0) ? "never" :
+                    $"{prefetchedMs} ms after start");
+
+                Console.WriteLine("Secret store requests: {0}, throttled {1}, retried {2}",
+                    string.Join(", ", secretStore.Calls.OrderBy(entry => entry.Key)
+                        .Select(entry => $"{entry.Key} {entry.Value}")),
+                    secretStore.Throttled, retryingStore.Retries);
+
+                foreach (SimulatedDevice device in fleet.Devices)
+                {
+                    Console.WriteLine("Device {0}: received {1}, rejected {2}, busy {3}, duplicates {4}, typed {5}",
+                        device.DeviceId, device.Received, device.Rejected, device.Busy, device.Duplicates,
+                        device.Typed);
+                }
+
+                return (errors == 0) ? 0 : 2;
+            }
+        }
+
+        private static void Seed(InMemorySecretStore secretStore, IConfiguration config, int itemCount)
+        {
+            string prefix = config.GetValue<string>("ConfigKeys:prefix");
+            secretStore.Seed(prefix + config.GetValue<string>("ConfigKeys:iotHubServiceConnStr"),
+                "HostName=localhost;SharedAccessKeyName=service;SharedAccessKey=AAAA");
+            secretStore.Seed(prefix + config.GetValue<string>("ConfigKeys:azureSphereDeviceName"),
+                "AzureSphere");
+
+            for (int i = 1; i <= itemCount; i++)
+            {
+                var item = new Item()
+                {
+                    Id = i,
+                    Name = $"Item-{i:D5}",
+                    Username = $"user{i}@example.com",
+                    Password = Guid.NewGuid().ToString("N"),
+                    PasswordEnter = true,
+                    LoadAndSend = config.GetValue<bool>("loadAndSend")
+                };
+                secretStore.Seed(item.Name, JsonSerializer.Serialize(item));
+            }
+        }
+
+        private static string Pick(int[] weights, Random random)
+        {
+            string[] operations = { "ReadAll", "Read", "Send" };
+
+            int pick = random.Next(weights.Sum());
+            for (int i = 0; i < weights.Length; i++)
+            {
+                if (pick < weights[i])
+                {
+                    return operations[i];
+                }
+                pick -= weights[i];
+            }
+            return operations[operations.Length - 1];
+        }
+
+        /// <returns>Time of stopwatch when all listed items had content cached,
+        /// -1 if not within a minute</returns>
+        private static async Task<long> WaitForContentAsync(IItemStore itemStore,
+            IReadOnlyList<Item> items, Stopwatch stopwatch)
+        {
+            while (stopwatch.Elapsed < TimeSpan.FromMinutes(1))
+            {
+                if (items.All(item => itemStore.GetContent(item) != null))
+                {
+                    return stopwatch.ElapsedMilliseconds;
+                }
+                await Task.Delay(10);
+            }
+            return -1;
+        }
+    }
+}
@@ -1,6 +1,15 @@
-﻿using System.Threading.Tasks;
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text.Json;
+using System.Threading;
+using System.Threading.Channels;
+using System.Threading.Tasks;
+using Microsoft.AspNetCore.Http;
 using Microsoft.AspNetCore.Mvc;
+using Microsoft.Extensions.Configuration;
 
+using SpherePasswordManager.Models;
 using SpherePasswordManager.Services;
 
 namespace SpherePasswordManager.Controllers
@@ -9,18 +18,153 @@ namespace SpherePasswordManager.Controllers
     [ApiController]
     public class IotController : ControllerBase
     {
-        private readonly IItemService _itemService;
+        private readonly IConfigDataService _configDataService;
+        private readonly ISendJobQueue _sendJobQueue;
+        private readonly IDevicePresence _devicePresence;
 
-        public IotController(IItemService itemService)
+        private readonly int EventStreamSec;
+
+        private static readonly JsonSerializerOptions s_jsonOptions = new JsonSerializerOptions()
+        {
+            PropertyNamingPolicy = JsonNamingPolicy.CamelCase
+        };
+
+        public IotController(IConfiguration config, IConfigDataService configDataService,
+            ISendJobQueue sendJobQueue, IDevicePresence devicePresence)
         {
-            _itemService = itemService;
+            _configDataService = configDataService;
+            _sendJobQueue = sendJobQueue;
+            _devicePresence = devicePresence;
+
+            EventStreamSec = config.GetValue<int>("SendJobs:eventStreamSec", 120);
         }
 
-        // POST: api/iot/send/5
+        // POST: api/iot/send/5?device=sphere1&device=sphere2
+        // Item is sent to default device if none is given
         [HttpPost("send/{id}")]
-        public async Task<string> SendAsync(int id)
+        public async Task<ActionResult<IReadOnlyList<SendJob>>> SendAsync(int id,
+            [FromQuery(Name = "device")] string[] devices)
+        {
+            ConfigData configData = await _configDataService.ReadAsync();
+
+            if (devices == null || devices.Length == 0)
+            {
+                devices = new[] { configData.AzureSphereDevice };
+            }
+
+            IReadOnlyList<string> registeredDevices = configData.Devices;
+            if (registeredDevices.Count == 0)
+            {
+                return BadRequest("ERROR: No Azure Sphere device configured");
+            }
+
+            string unknownDevice = devices.FirstOrDefault(device => !registeredDevices.Contains(device));
+            if (unknownDevice != null)
+            {
+                return BadRequest($"ERROR: Device {unknownDevice} not configured");
+            }
+
+            // Item is sent to every device in background, progress is followed by job ID
+            IReadOnlyList<SendJob> jobs = _sendJobQueue.Enqueue(id, devices.Distinct().ToList());
+            if (jobs == null)
+            {
+                return StatusCode(StatusCodes.Status503ServiceUnavailable,
+                    "ERROR: Too many items waiting for sending");
+            }
+
+            return StatusCode(StatusCodes.Status202Accepted, jobs);
+        }
+
+        // GET: api/iot/devices
+        // Configured devices, default first, with presence and send statistics
+        [HttpGet("devices")]
+        public async Task<IEnumerable<object>> GetDevicesAsync()
+        {
+            ConfigData configData = await _configDataService.ReadAsync();
+            Dictionary<string, DeviceSendStats> stats = _sendJobQueue.GetDeviceStats()
+                .ToDictionary(deviceStats => deviceStats.DeviceId);
+
+            return configData.Devices.Select(device => new
+            {
+                DeviceId = device,
+                Presence = _devicePresence.GetState(device).ToString(),
+                Sends = stats.TryGetValue(device, out DeviceSendStats deviceStats) ?
+                    deviceStats : new DeviceSendStats() { DeviceId = device }
+            });
+        }
+
+        // GET: api/iot/jobs/0123456789ab
+        [HttpGet("jobs/{jobId}")]
+        public ActionResult<SendJob> GetJob(string jobId)
+        {
+            SendJob job = _sendJobQueue.Find(jobId);
+            if (job == null)
+            {
+                return NotFound();
+            }
+
+            return job;
+        }
+
+        // GET: api/iot/jobs/0123456789ab/events
+        // Server-sent events with job state, stream ends when job is finished
+        [HttpGet("jobs/{jobId}/events")]
+        public async Task GetJobEventsAsync(string jobId)
+        {
+            var changes = Channel.CreateUnbounded<SendJob>();
+            Action<SendJob> onJobChanged = job =>
+            {
+                if (job.Id == jobId)
+                {
+                    changes.Writer.TryWrite(job);
+                }
+            };
+
+            // Subscribed before reading current state, so no change is missed
+            _sendJobQueue.JobChanged += onJobChanged;
+            try
+            {
+                SendJob job = _sendJobQueue.Find(jobId);
+                if (job == null)
+                {
+                    Response.StatusCode = StatusCodes.Status404NotFound;
+                    return;
+                }
+
+                Response.ContentType = "text/event-stream";
+                Response.Headers["Cache-Control"] = "no-cache";
+
+                using (var timeout = CancellationTokenSource.CreateLinkedTokenSource(
+                    HttpContext.RequestAborted))
+                {
+                    timeout.CancelAfter(TimeSpan.FromSeconds(EventStreamSec));
+
+                    try
+                    {
+                        await WriteEventAsync(job, timeout.Token);
+                        while (!job.IsFinished)
+                        {
+                            job = await changes.Reader.ReadAsync(timeout.Token);
+                            await WriteEventAsync(job, timeout.Token);
+                        }
+                    }
+                    catch (OperationCanceledException)
+                    {
+                        // Client went away or job did not finish in time
+                    }
+                }
+            }
+            finally
+            {
+                _sendJobQueue.JobChanged -= onJobChanged;
+            }
+        }
+
+        private async Task WriteEventAsync(SendJob job, CancellationToken cancellationToken)
         {
-            return await _itemService.SendAsync(id);
+            await Response.WriteAsync("data: " + JsonSerializer.Serialize(job, s_jsonOptions) + "\n\n",
+                cancellationToken);
+            await Response.Body.FlushAsync(cancellationToken);
         }
 
     }
@@ -0,0 +1,37 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Threading.Tasks;
+using Microsoft.AspNetCore.Mvc;
+
+using SpherePasswordManager.Models;
+using SpherePasswordManager.Services;
+
+namespace SpherePasswordManager.Controllers
+{
+    [Route("api/[controller]")]
+    [ApiController]
+    public class ItemsController : ControllerBase
+    {
+        private const int SearchLimitMax = 100;
+
+        private readonly IItemService _itemService;
+
+        public ItemsController(IItemService itemService)
+        {
+            _itemService = itemService;
+        }
+
+        // GET: api/items/search?q=bank&limit=20
+        [HttpGet("search")]
+        public async Task<IEnumerable<object>> SearchAsync(string q, int limit = 20)
+        {
+            List<Item> items = await _itemService.SearchAsync(q,
+                Math.Clamp(limit, 1, SearchLimitMax));
+
+            // Names only, item content stays on server
+            return items.Select(item => new { item.Id, item.Name });
+        }
+
+    }
+}
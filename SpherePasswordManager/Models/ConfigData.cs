@@ -12,8 +12,40 @@ namespace SpherePasswordManager.Models
         [Display(Name = "IoT Hub Service Connection String")]
         public string IotHubService { get; set; }
 
+        // Policy with registry read permission, device presence is not
+        // queried without it
+        [Display(Name = "IoT Hub Registry Read Connection String")]
+        public string IotHubRegistry { get; set; }
+
         [Required]
         [Display(Name = "Azure Sphere Device Name")]
         public string AzureSphereDevice { get; set; }
+
+        // Separated by commas or whitespace
+        [Display(Name = "Other Azure Sphere Device Names")]
+        public string OtherDevices { get; set; }
+
+        /// <summary>
+        /// Devices items can be sent to, default device first.
+        /// </summary>
+        public IReadOnlyList<string> Devices
+        {
+            get
+            {
+                var devices = new List<string>();
+                if (!string.IsNullOrEmpty(AzureSphereDevice))
+                {
+                    devices.Add(AzureSphereDevice);
+                }
+
+                if (!string.IsNullOrEmpty(OtherDevices))
+                {
+                    devices.AddRange(OtherDevices.Split(new[] { ',', ' ', '\t', '\r', '\n' },
+                        StringSplitOptions.RemoveEmptyEntries));
+                }
+
+                return devices.Distinct().ToList();
+            }
+        }
     }
 }
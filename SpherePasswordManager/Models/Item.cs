@@ -3,6 +3,7 @@ using System;
 using System.Collections.Generic;
 using System.ComponentModel.DataAnnotations;
 using System.Linq;
+using System.Text.Json.Serialization;
 using System.Threading.Tasks;
 
 namespace SpherePasswordManager.Models
@@ -24,5 +25,9 @@ namespace SpherePasswordManager.Models
         public bool UnameTabPass { get; set; }
 
         public bool LoadAndSend { get; set; }
+
+        // Full item content is loaded from KeyVault, listed items carry Name only
+        [JsonIgnore]
+        public bool IsHydrated { get; set; }
     }
 }
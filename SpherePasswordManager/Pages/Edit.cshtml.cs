@@ -130,15 +130,24 @@ namespace SpherePasswordManager.Pages
                 LoadAndSend = LoadAndSend
             };
 
-            if (Id == 0)
+            try
             {
-                // Create new item
-                await _itemService.CreateAsync(item);
+                if (Id == 0)
+                {
+                    // Create new item
+                    await _itemService.CreateAsync(item);
+                }
+                else
+                {
+                    // Update existing item
+                    await _itemService.UpdateAsync(item);
+                }
             }
-            else
+            catch (SecretStoreException ex)
             {
-                // Update existing item
-                await _itemService.UpdateAsync(item);
+                // Keep form data, the user may submit again
+                ModelState.AddModelError(nameof(Name), ex.Message);
+                return Page();
             }
 
             return RedirectToPage("Index");
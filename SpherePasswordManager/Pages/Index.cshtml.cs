@@ -10,7 +10,7 @@ namespace SpherePasswordManager.Pages
 {
     public class IndexModel : PageModel
     {
-        public List<Item> Items = new List<Item>();
+        public IReadOnlyList<Item> Items = new List<Item>();
 
         private readonly IItemService _itemService;
 
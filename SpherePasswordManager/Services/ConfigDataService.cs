@@ -6,12 +6,7 @@ using System.Threading.Tasks;
 using Microsoft.Extensions.Configuration;
 using Microsoft.Extensions.Caching.Memory;
 
-using Microsoft.Azure.KeyVault;
-using Microsoft.Azure.KeyVault.Models;
-using Microsoft.Azure.Services.AppAuthentication;
-
 using SpherePasswordManager.Models;
-using System.Net.Http;
 
 namespace SpherePasswordManager.Services
 {
@@ -27,31 +22,24 @@ namespace SpherePasswordManager.Services
 
         private readonly IConfiguration _config;
         private readonly IMemoryCache _cache;
+        private readonly ISecretStore _secretStore;
 
-        private static AzureServiceTokenProvider azureServiceTokenProvider =
-            new AzureServiceTokenProvider();
-
-        private readonly static KeyVaultClient keyVaultClient =
-            new KeyVaultClient(
-                new KeyVaultClient.AuthenticationCallback(
-                    azureServiceTokenProvider.KeyVaultTokenCallback));
-
-        private readonly string KeyVaultHostName, KeyVaultBaseUrl, ConfigKeyPrefix;
+        private readonly string ConfigKeyPrefix;
 
-        private readonly string IotHubServiceKey, AzureSphereDeviceKey;
+        private readonly string IotHubServiceKey, IotHubRegistryKey, AzureSphereDeviceKey, OtherDevicesKey;
 
-        public ConfigDataService(IConfiguration config, IMemoryCache cache)
+        public ConfigDataService(IConfiguration config, IMemoryCache cache, ISecretStore secretStore)
         {
             _config = config;
             _cache = cache;
-
-            KeyVaultHostName = _config.GetValue<String>("KeyVaultName");
-            KeyVaultBaseUrl = $"https://{KeyVaultHostName}.vault.azure.net/";
+            _secretStore = secretStore;
 
             ConfigKeyPrefix = _config.GetValue<String>("ConfigKeys:prefix");
 
             IotHubServiceKey = config.GetValue<String>("ConfigKeys:iotHubServiceConnStr");
+            IotHubRegistryKey = config.GetValue<String>("ConfigKeys:iotHubRegistryConnStr", "IotHubRegistryConnStr");
             AzureSphereDeviceKey = config.GetValue<String>("ConfigKeys:azureSphereDeviceName");
+            OtherDevicesKey = config.GetValue<String>("ConfigKeys:otherDeviceNames", "OtherDeviceNames");
         }
 
         public async Task<ConfigData> ReadAsync()
@@ -61,51 +49,73 @@ namespace SpherePasswordManager.Services
             {
 
 
-                SecretBundle bundle;
+                // Missing secrets read as empty, failed reads are not cached so
+                // the next call tries again
+                bool isComplete = true;
 
                 string iotHubService = "";
+                string iotHubRegistry = "";
                 string azureSphereDevice = "";
+                string otherDevices = "";
 
                 try
                 {
-                    // Try to read IoT Hub Service connection string from KeyVault
-                    bundle = await keyVaultClient.GetSecretAsync(KeyVaultBaseUrl, ConfigKeyPrefix + IotHubServiceKey)
-                            .ConfigureAwait(false);
+                    // Try to read IoT Hub Service connection string from KeyVault,
+                    // empty if secret doesn't exist
+                    iotHubService = await _secretStore.GetAsync(ConfigKeyPrefix + IotHubServiceKey)
+                            .ConfigureAwait(false) ?? "";
+                }
+                catch (SecretStoreException)
+                {
+                    isComplete = false;
+                }
 
-                    iotHubService = bundle.Value;
+                try
+                {
+                    // Try to read IoT Hub registry read connection string
+                    iotHubRegistry = await _secretStore.GetAsync(ConfigKeyPrefix + IotHubRegistryKey)
+                            .ConfigureAwait(false) ?? "";
                 }
-                catch (KeyVaultErrorException kvex)
+                catch (SecretStoreException)
                 {
-                    if (kvex.Body.Error.Code.Equals("SecretNotFound"))
-                    {
-                        // IoT Hub Service Connection string Secret doesn't exist in KeyVault
-                        iotHubService = "";
-                    }
+                    isComplete = false;
                 }
 
                 try
                 {
                     // Try to read Azure Sphere Device Name from KeyVault
-                    bundle = await keyVaultClient.GetSecretAsync(KeyVaultBaseUrl, ConfigKeyPrefix + AzureSphereDeviceKey)
-                            .ConfigureAwait(false);
+                    azureSphereDevice = await _secretStore.GetAsync(ConfigKeyPrefix + AzureSphereDeviceKey)
+                            .ConfigureAwait(false) ?? "";
+                }
+                catch (SecretStoreException)
+                {
+                    isComplete = false;
+                }
 
-                    azureSphereDevice = bundle.Value;
+                try
+                {
+                    // Try to read other device names, comma separated
+                    otherDevices = await _secretStore.GetAsync(ConfigKeyPrefix + OtherDevicesKey)
+                            .ConfigureAwait(false) ?? "";
                 }
-                catch (KeyVaultErrorException kvex)
+                catch (SecretStoreException)
                 {
-                    if (kvex.Body.Error.Code.Equals("SecretNotFound"))
-                    {
-                        // IoT Hub Service Connection string Secret doesn't exist in KeyVault
-                        azureSphereDevice = "";
-                    }
+                    isComplete = false;
                 }
 
                 ConfigData configData = new ConfigData()
                 {
                     IotHubService = iotHubService,
-                    AzureSphereDevice = azureSphereDevice
+                    IotHubRegistry = iotHubRegistry,
+                    AzureSphereDevice = azureSphereDevice,
+                    OtherDevices = otherDevices
                 };
 
+                if (!isComplete)
+                {
+                    return configData;
+                }
+
                 _cache.Set("ConfigData", configData);
             }
             return _cache.Get<ConfigData>("ConfigData");
@@ -114,7 +124,7 @@ namespace SpherePasswordManager.Services
         public async Task WriteAsync(ConfigData configData)
         {
             bool updateCache = false;
-            ConfigData oldConfigData = _cache.Get<ConfigData>("ConfigData");
+            ConfigData oldConfigData = await ReadAsync();
 
             if (!string.IsNullOrEmpty(configData.IotHubService) &&
                 (configData.IotHubService != oldConfigData.IotHubService))
@@ -123,14 +133,36 @@ namespace SpherePasswordManager.Services
                 updateCache = true;
                 try
                 {
-                    await keyVaultClient.SetSecretAsync(
-                            KeyVaultBaseUrl, ConfigKeyPrefix + IotHubServiceKey, configData.IotHubService);
+                    await _secretStore.SetAsync(
+                            ConfigKeyPrefix + IotHubServiceKey, configData.IotHubService);
                 }
-                catch (KeyVaultErrorException)
+                catch (SecretStoreException)
                 {
                 }
             }
 
+            // Optional, may also be cleared
+            string iotHubRegistry = configData.IotHubRegistry?.Trim() ?? "";
+            if (iotHubRegistry != (oldConfigData.IotHubRegistry ?? ""))
+            {
+                updateCache = true;
+                try
+                {
+                    if (iotHubRegistry.Length > 0)
+                    {
+                        await _secretStore.SetAsync(ConfigKeyPrefix + IotHubRegistryKey, iotHubRegistry);
+                    }
+                    else
+                    {
+                        await _secretStore.DeleteAsync(ConfigKeyPrefix + IotHubRegistryKey);
+                    }
+                }
+                catch (SecretStoreException)
+                {
+                }
+            }
+            configData.IotHubRegistry = iotHubRegistry;
+
             if (!string.IsNullOrEmpty(configData.AzureSphereDevice) &&
                 (configData.AzureSphereDevice != oldConfigData.AzureSphereDevice))
             {
@@ -138,13 +170,36 @@ namespace SpherePasswordManager.Services
                 updateCache = true;
                 try
                 {
-                    await keyVaultClient.SetSecretAsync(
-                            KeyVaultBaseUrl, ConfigKeyPrefix + AzureSphereDeviceKey, configData.AzureSphereDevice);
+                    await _secretStore.SetAsync(
+                            ConfigKeyPrefix + AzureSphereDeviceKey, configData.AzureSphereDevice);
+                }
+                catch (SecretStoreException)
+                {
+                }
+            }
+
+            // Stored normalized, list may also be cleared
+            string otherDevices = string.Join(",", configData.Devices
+                .Where(device => device != configData.AzureSphereDevice));
+            if (otherDevices != (oldConfigData.OtherDevices ?? ""))
+            {
+                updateCache = true;
+                try
+                {
+                    if (otherDevices.Length > 0)
+                    {
+                        await _secretStore.SetAsync(ConfigKeyPrefix + OtherDevicesKey, otherDevices);
+                    }
+                    else
+                    {
+                        await _secretStore.DeleteAsync(ConfigKeyPrefix + OtherDevicesKey);
+                    }
                 }
-                catch (KeyVaultErrorException)
+                catch (SecretStoreException)
                 {
                 }
             }
+            configData.OtherDevices = otherDevices;
 
             if (updateCache)
             {
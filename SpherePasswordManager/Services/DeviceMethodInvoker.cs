@@ -0,0 +1,44 @@
+﻿using System;
+using System.Threading.Tasks;
+
+namespace SpherePasswordManager.Services
+{
+
+    public class DeviceMethodResult
+    {
+        public int Status { get; set; }
+        public string PayloadJson { get; set; }
+
+        // Time spent obtaining a connected client before the call itself
+        public long AcquireMs { get; set; }
+    }
+
+    /// <summary>
+    /// Device method call failed before device answered, message is shown to user.
+    /// </summary>
+    public class DeviceMethodException : Exception
+    {
+        public DeviceMethodException(string message, bool deviceOffline = false,
+            bool timedOut = false) : base(message)
+        {
+            DeviceOffline = deviceOffline;
+            TimedOut = timedOut;
+        }
+
+        // Device is not connected to IoT Hub
+        public bool DeviceOffline { get; }
+
+        // Call ended by response timeout, device may still process the request
+        public bool TimedOut { get; }
+    }
+
+    /// <summary>
+    /// Invokes direct methods on Azure Sphere devices. Keeps item sending
+    /// independent of the service used to reach the device.
+    /// </summary>
+    public interface IDeviceMethodInvoker
+    {
+        Task<DeviceMethodResult> InvokeAsync(string deviceId, string methodName,
+            string payloadJson, TimeSpan responseTimeout);
+    }
+}
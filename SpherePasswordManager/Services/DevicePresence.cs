@@ -0,0 +1,244 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Threading;
+using System.Threading.Tasks;
+
+using Microsoft.Extensions.Configuration;
+using Microsoft.Extensions.Hosting;
+using Microsoft.Extensions.Logging;
+
+namespace SpherePasswordManager.Services
+{
+
+    public enum DevicePresenceState
+    {
+        // Not seen recently, send is attempted
+        Unknown,
+        Online,
+        Offline
+    }
+
+    /// <summary>
+    /// Connection state of devices as known to the service used to reach them.
+    /// </summary>
+    public interface IDevicePresenceSource
+    {
+        /// <returns>Connected flag by device ID, null if the service is not configured</returns>
+        Task<IReadOnlyDictionary<string, bool>> QueryConnectedAsync(CancellationToken cancellationToken);
+    }
+
+    public interface IDevicePresence
+    {
+        DevicePresenceState GetState(string deviceId);
+
+        /// <summary>
+        /// Record device state seen when sending to it.
+        /// </summary>
+        void Report(string deviceId, bool online);
+
+        Task RefreshAsync(CancellationToken cancellationToken);
+
+        /// <returns>false if device did not come online within timeout</returns>
+        Task<bool> WaitOnlineAsync(string deviceId, TimeSpan timeout, CancellationToken cancellationToken);
+    }
+
+    /// <summary>
+    /// Device presence cache fed by periodic connection state queries and by
+    /// outcomes of sends. Sends to a device known to be offline fail without
+    /// waiting for the device method timeout. State not refreshed for MaxAge
+    /// becomes unknown again.
+    /// </summary>
+    public class DevicePresenceCache : IDevicePresence
+    {
+        private readonly IDevicePresenceSource _source;
+        private readonly ILogger<DevicePresenceCache> _logger;
+
+        private readonly TimeSpan MaxAge;
+
+        // Connection state in IoT Hub lags behind, state seen by a send is
+        // not overwritten by queries for this long
+        private readonly TimeSpan ReportedHold;
+
+        private static readonly TimeSpan WaitCheckPeriod = TimeSpan.FromSeconds(5);
+
+        private class Entry
+        {
+            public bool Online;
+            public long UpdatedAt;
+            public bool Reported;
+        }
+
+        private readonly ConcurrentDictionary<string, Entry> _entries =
+            new ConcurrentDictionary<string, Entry>();
+
+        // Completed when device comes online
+        private readonly ConcurrentDictionary<string, TaskCompletionSource<bool>> _onlineWaiters =
+            new ConcurrentDictionary<string, TaskCompletionSource<bool>>();
+
+        public DevicePresenceCache(IConfiguration config, IDevicePresenceSource source,
+            ILogger<DevicePresenceCache> logger)
+        {
+            _source = source;
+            _logger = logger;
+
+            int refreshSec = Math.Max(5, config.GetValue<int>("DevicePresence:refreshSec", 30));
+            MaxAge = TimeSpan.FromSeconds(Math.Max(refreshSec, config.GetValue<int>("DevicePresence:maxAgeSec", 120)));
+            ReportedHold = TimeSpan.FromSeconds(refreshSec * 2);
+        }
+
+        public DevicePresenceState GetState(string deviceId)
+        {
+            if (deviceId == null || !_entries.TryGetValue(deviceId, out Entry entry))
+            {
+                return DevicePresenceState.Unknown;
+            }
+
+            lock (entry)
+            {
+                if (Age(entry) > MaxAge)
+                {
+                    return DevicePresenceState.Unknown;
+                }
+                return entry.Online ? DevicePresenceState.Online : DevicePresenceState.Offline;
+            }
+        }
+
+        public void Report(string deviceId, bool online)
+        {
+            Update(deviceId, online, true);
+        }
+
+        public async Task RefreshAsync(CancellationToken cancellationToken)
+        {
+            IReadOnlyDictionary<string, bool> connected = await _source.QueryConnectedAsync(cancellationToken);
+            if (connected == null)
+            {
+                return;
+            }
+
+            foreach (KeyValuePair<string, bool> device in connected)
+            {
+                Update(device.Key, device.Value, false);
+            }
+        }
+
+        public async Task<bool> WaitOnlineAsync(string deviceId, TimeSpan timeout,
+            CancellationToken cancellationToken)
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+
+            while (GetState(deviceId) == DevicePresenceState.Offline)
+            {
+                TimeSpan remaining = timeout - stopwatch.Elapsed;
+                if (remaining <= TimeSpan.Zero)
+                {
+                    return false;
+                }
+
+                TaskCompletionSource<bool> waiter = _onlineWaiters.GetOrAdd(deviceId,
+                    _ => new TaskCompletionSource<bool>(TaskCreationOptions.RunContinuationsAsynchronously));
+
+                // Device may have come online before the waiter was added
+                if (GetState(deviceId) != DevicePresenceState.Offline)
+                {
+                    break;
+                }
+
+                // State may also age out to unknown, checked again after a while
+                await Task.WhenAny(waiter.Task,
+                    Task.Delay((remaining < WaitCheckPeriod) ? remaining : WaitCheckPeriod, cancellationToken));
+                cancellationToken.ThrowIfCancellationRequested();
+            }
+
+            return true;
+        }
+
+        private void Update(string deviceId, bool online, bool reported)
+        {
+            if (string.IsNullOrEmpty(deviceId))
+            {
+                return;
+            }
+
+            Entry entry = _entries.GetOrAdd(deviceId, _ => new Entry());
+            bool changed;
+            lock (entry)
+            {
+                if (!reported && entry.Reported && entry.Online != online && Age(entry) < ReportedHold)
+                {
+                    return;
+                }
+
+                changed = entry.UpdatedAt == 0 || entry.Online != online;
+                entry.Online = online;
+                entry.UpdatedAt = Stopwatch.GetTimestamp();
+                entry.Reported = reported;
+            }
+
+            if (changed)
+            {
+                _logger.LogInformation("Device {Device} is {State}", deviceId, online ? "online" : "offline");
+            }
+
+            if (online && _onlineWaiters.TryRemove(deviceId, out TaskCompletionSource<bool> waiter))
+            {
+                waiter.TrySetResult(true);
+            }
+        }
+
+        private static TimeSpan Age(Entry entry)
+        {
+            return TimeSpan.FromSeconds((double)(Stopwatch.GetTimestamp() - entry.UpdatedAt) / Stopwatch.Frequency);
+        }
+    }
+
+    /// <summary>
+    /// Refreshes device presence cache in background.
+    /// </summary>
+    public class DevicePresenceMonitor : BackgroundService
+    {
+        private readonly IDevicePresence _devicePresence;
+        private readonly ILogger<DevicePresenceMonitor> _logger;
+
+        private readonly int RefreshSec;
+
+        public DevicePresenceMonitor(IDevicePresence devicePresence, IConfiguration config,
+            ILogger<DevicePresenceMonitor> logger)
+        {
+            _devicePresence = devicePresence;
+            _logger = logger;
+
+            RefreshSec = Math.Max(5, config.GetValue<int>("DevicePresence:refreshSec", 30));
+        }
+
+        protected override async Task ExecuteAsync(CancellationToken stoppingToken)
+        {
+            while (!stoppingToken.IsCancellationRequested)
+            {
+                try
+                {
+                    await _devicePresence.RefreshAsync(stoppingToken);
+                }
+                catch (OperationCanceledException) when (stoppingToken.IsCancellationRequested)
+                {
+                    return;
+                }
+                catch (Exception ex)
+                {
+                    // Known states age out, sends are attempted meanwhile
+                    _logger.LogWarning("Device presence refresh failed: {Error}", ex.Message);
+                }
+
+                try
+                {
+                    await Task.Delay(TimeSpan.FromSeconds(RefreshSec), stoppingToken);
+                }
+                catch (TaskCanceledException)
+                {
+                }
+            }
+        }
+    }
+}
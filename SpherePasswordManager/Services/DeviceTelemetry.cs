@@ -0,0 +1,25 @@
+﻿using System;
+
+namespace SpherePasswordManager.Services
+{
+
+    /// <summary>
+    /// Device finished typing an item, see item_typed telemetry event of device
+    /// application.
+    /// </summary>
+    public class ItemTypedEvent
+    {
+        public string DeviceId { get; set; }
+        public string RequestId { get; set; }
+        public bool Success { get; set; }
+        public string Error { get; set; }
+    }
+
+    /// <summary>
+    /// Source of telemetry events sent by Azure Sphere devices.
+    /// </summary>
+    public interface IDeviceTelemetrySource
+    {
+        event Action<ItemTypedEvent> ItemTyped;
+    }
+}
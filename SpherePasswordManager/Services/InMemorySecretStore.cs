@@ -0,0 +1,176 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SpherePasswordManager.Services
+{
+
+    public class InMemorySecretStoreOptions
+    {
+        // Delay of every request
+        public int LatencyMs { get; set; } = 20;
+
+        // Random extra delay up to this value
+        public int JitterMs { get; set; } = 10;
+
+        // Requests accepted per second before answering 429, 0 for no limit
+        public int RequestsPerSecond { get; set; } = 0;
+
+        // Requests accepted at once before throttling starts
+        public int Burst { get; set; } = 10;
+    }
+
+    /// <summary>
+    /// Secret store kept in process memory, standing in for KeyVault when running
+    /// without Azure. Simulates request latency and KeyVault throttling, counts
+    /// requests by kind.
+    /// </summary>
+    public class InMemorySecretStore : ISecretStore
+    {
+        private readonly InMemorySecretStoreOptions _options;
+
+        private readonly ConcurrentDictionary<string, string> _secrets =
+            new ConcurrentDictionary<string, string>(StringComparer.OrdinalIgnoreCase);
+
+        private readonly ConcurrentDictionary<string, long> _calls =
+            new ConcurrentDictionary<string, long>();
+
+        private readonly object _bucketLock = new object();
+        private double _tokens;
+        private long _refilledAt;
+
+        private readonly Random _random = new Random();
+
+        private long _throttled;
+
+        public InMemorySecretStore(InMemorySecretStoreOptions options)
+        {
+            _options = options;
+
+            _tokens = Math.Max(1, options.Burst);
+            _refilledAt = Stopwatch.GetTimestamp();
+        }
+
+        /// <summary>
+        /// Store secret without delay or counting, for filling the store.
+        /// </summary>
+        public void Seed(string name, string value)
+        {
+            _secrets[name] = value;
+        }
+
+        public long Throttled => Interlocked.Read(ref _throttled);
+
+        /// <summary>
+        /// Requests answered so far by kind (List, Get, Set, Delete), including throttled.
+        /// </summary>
+        public IReadOnlyDictionary<string, long> Calls =>
+            _calls.ToDictionary(entry => entry.Key, entry => entry.Value);
+
+        public async Task<SecretPage> ListPageAsync(string pageToken, int maxResults,
+            CancellationToken cancellationToken = default)
+        {
+            await SimulateAsync("List", cancellationToken);
+
+            // Page token is the last name on the previous page
+            List<string> names = _secrets.Keys
+                .Where(name => pageToken == null ||
+                    StringComparer.OrdinalIgnoreCase.Compare(name, pageToken) > 0)
+                .OrderBy(name => name, StringComparer.OrdinalIgnoreCase)
+                .Take(maxResults + 1)
+                .ToList();
+
+            bool more = names.Count > maxResults;
+            if (more)
+            {
+                names.RemoveAt(maxResults);
+            }
+
+            return new SecretPage()
+            {
+                Names = names,
+                NextPageToken = more ? names[names.Count - 1] : null
+            };
+        }
+
+        public async Task<string> GetAsync(string name, CancellationToken cancellationToken = default)
+        {
+            await SimulateAsync("Get", cancellationToken);
+
+            return _secrets.TryGetValue(name, out string value) ? value : null;
+        }
+
+        public async Task SetAsync(string name, string value, CancellationToken cancellationToken = default)
+        {
+            await SimulateAsync("Set", cancellationToken);
+
+            _secrets[name] = value;
+        }
+
+        public async Task DeleteAsync(string name, CancellationToken cancellationToken = default)
+        {
+            await SimulateAsync("Delete", cancellationToken);
+
+            if (!_secrets.TryRemove(name, out _))
+            {
+                throw new SecretStoreException($"Secret {name} not found", false);
+            }
+        }
+
+        private async Task SimulateAsync(string kind, CancellationToken cancellationToken)
+        {
+            _calls.AddOrUpdate(kind, 1, (_, count) => count + 1);
+
+            int delayMs;
+            lock (_random)
+            {
+                delayMs = _options.LatencyMs + _random.Next(Math.Max(0, _options.JitterMs) + 1);
+            }
+            if (delayMs > 0)
+            {
+                await Task.Delay(delayMs, cancellationToken);
+            }
+
+            if (!TryTakeToken(out TimeSpan retryAfter))
+            {
+                Interlocked.Increment(ref _throttled);
+                throw new SecretStoreException("Too many requests", true, retryAfter);
+            }
+        }
+
+        /// <summary>
+        /// Token bucket refilled at RequestsPerSecond.
+        /// </summary>
+        private bool TryTakeToken(out TimeSpan retryAfter)
+        {
+            retryAfter = TimeSpan.Zero;
+
+            if (_options.RequestsPerSecond <= 0)
+            {
+                return true;
+            }
+
+            lock (_bucketLock)
+            {
+                long now = Stopwatch.GetTimestamp();
+                double elapsedSec = (double)(now - _refilledAt) / Stopwatch.Frequency;
+                _tokens = Math.Min(Math.Max(1, _options.Burst),
+                    _tokens + elapsedSec * _options.RequestsPerSecond);
+                _refilledAt = now;
+
+                if (_tokens >= 1)
+                {
+                    _tokens -= 1;
+                    return true;
+                }
+
+                retryAfter = TimeSpan.FromSeconds((1 - _tokens) / _options.RequestsPerSecond);
+                return false;
+            }
+        }
+    }
+}
@@ -0,0 +1,57 @@
+﻿using System;
+using System.Threading;
+using System.Threading.Tasks;
+
+using Microsoft.Extensions.Configuration;
+using Microsoft.Extensions.Hosting;
+using Microsoft.Extensions.Logging;
+
+namespace SpherePasswordManager.Services
+{
+
+    /// <summary>
+    /// Opens IoT Hub client at application start and keeps it checked, so the
+    /// first send does not wait for connection setup and a broken connection
+    /// or changed configuration is picked up between sends.
+    /// </summary>
+    public class IotHubClientWarmup : BackgroundService
+    {
+        private readonly IotHubDeviceMethodInvoker _invoker;
+        private readonly ILogger<IotHubClientWarmup> _logger;
+
+        private readonly int HealthCheckSec;
+
+        public IotHubClientWarmup(IotHubDeviceMethodInvoker invoker, IConfiguration config,
+            ILogger<IotHubClientWarmup> logger)
+        {
+            _invoker = invoker;
+            _logger = logger;
+
+            HealthCheckSec = Math.Max(5, config.GetValue<int>("IotHub:healthCheckSec", 60));
+        }
+
+        protected override async Task ExecuteAsync(CancellationToken stoppingToken)
+        {
+            while (!stoppingToken.IsCancellationRequested)
+            {
+                try
+                {
+                    await _invoker.CheckHealthAsync();
+                }
+                catch (Exception ex)
+                {
+                    // Configuration not readable yet, try again next period
+                    _logger.LogWarning("IoT Hub warm up failed: {Error}", ex.Message);
+                }
+
+                try
+                {
+                    await Task.Delay(TimeSpan.FromSeconds(HealthCheckSec), stoppingToken);
+                }
+                catch (TaskCanceledException)
+                {
+                }
+            }
+        }
+    }
+}
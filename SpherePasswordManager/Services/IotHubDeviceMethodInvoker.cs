@@ -0,0 +1,208 @@
+﻿using System;
+using System.Diagnostics;
+using System.Threading.Tasks;
+
+using Microsoft.Azure.Devices;
+using Microsoft.Azure.Devices.Common.Exceptions;
+
+using Microsoft.Extensions.Logging;
+
+using SpherePasswordManager.Models;
+
+namespace SpherePasswordManager.Services
+{
+
+    /// <summary>
+    /// Invokes device methods via IoT Hub using a long-lived ServiceClient.
+    /// Client is created for the configured IoT Hub connection string and
+    /// reused by all sends, so connection and token setup is not paid on
+    /// every send. Changed connection string or failed health check builds
+    /// a new client.
+    /// </summary>
+    public class IotHubDeviceMethodInvoker : IDeviceMethodInvoker, IDisposable
+    {
+        private readonly IConfigDataService _configDataService;
+        private readonly ILogger<IotHubDeviceMethodInvoker> _logger;
+
+        // Replaced client may still have calls in progress
+        private static readonly TimeSpan RetireDelay = TimeSpan.FromMinutes(2);
+
+        private readonly object _lock = new object();
+        private string _connectionString;
+        private ServiceClient _serviceClient;
+
+        public IotHubDeviceMethodInvoker(IConfigDataService configDataService,
+            ILogger<IotHubDeviceMethodInvoker> logger)
+        {
+            _configDataService = configDataService;
+            _logger = logger;
+        }
+
+        public async Task<DeviceMethodResult> InvokeAsync(string deviceId, string methodName,
+            string payloadJson, TimeSpan responseTimeout)
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+
+            ConfigData configData = await _configDataService.ReadAsync();
+
+            var methodInvocation = new CloudToDeviceMethod(methodName)
+            {
+                ResponseTimeout = responseTimeout
+            };
+
+            methodInvocation.SetPayloadJson(payloadJson);
+
+            ServiceClient serviceClient = null;
+
+            try
+            {
+                serviceClient = Acquire(configData.IotHubService);
+                long acquireMs = stopwatch.ElapsedMilliseconds;
+
+                // Invoke the direct method asynchronously and get the response from IoT device.
+                CloudToDeviceMethodResult deviceResult =
+                    await serviceClient.InvokeDeviceMethodAsync(deviceId, methodInvocation);
+
+                return new DeviceMethodResult()
+                {
+                    Status = deviceResult.Status,
+                    PayloadJson = deviceResult.GetPayloadAsJson(),
+                    AcquireMs = acquireMs
+                };
+            }
+            catch (FormatException fex)
+            {
+                if (fex.Message.Equals("Malformed Token"))
+                {
+                    throw new DeviceMethodException("ERROR: Invalid Iot Hub Service Connection String");
+                }
+                else
+                {
+                    throw new DeviceMethodException("ERROR: Iot Hub Message Format Exception");
+                }
+            }
+            catch (ArgumentException)
+            {
+                throw new DeviceMethodException("ERROR: Invalid Iot Hub Service Connection String");
+            }
+            catch (DeviceNotFoundException dnfex)
+            {
+
+                if (dnfex.Message.Contains(":404001,"))
+                {
+                    // errorCode 404001: Device not registered or incorrect name
+                    throw new DeviceMethodException("ERROR: Device not registered in IoT Hub");
+                }
+                else if (dnfex.Message.Contains(":404103,"))
+                {
+                    // errorCode 404103: Timeout
+                    throw new DeviceMethodException("ERROR: Timeout connecting device", true, true);
+                }
+                else
+                {
+                    throw new DeviceMethodException("ERROR: Device not found");
+                }
+            }
+            catch (IotHubCommunicationException)
+            {
+                // Connection of this client is broken, next send starts over
+                Evict(serviceClient);
+                throw new DeviceMethodException("ERROR: IoT Hub not reachable");
+            }
+            catch (IotHubException ihex) when (ihex.Message.Contains(":504101,"))
+            {
+                // errorCode 504101: GatewayTimeout, device connected but did not
+                // answer within response timeout
+                throw new DeviceMethodException("ERROR: Timeout waiting for device response", false, true);
+            }
+        }
+
+        /// <summary>
+        /// Create client for configured connection string ahead of the first send
+        /// and check that IoT Hub answers through it.
+        /// </summary>
+        /// <returns>false if IoT Hub is not configured or not reachable</returns>
+        public async Task<bool> CheckHealthAsync()
+        {
+            ConfigData configData = await _configDataService.ReadAsync();
+            if (string.IsNullOrEmpty(configData.IotHubService))
+            {
+                return false;
+            }
+
+            ServiceClient serviceClient = null;
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            try
+            {
+                serviceClient = Acquire(configData.IotHubService);
+                await serviceClient.GetServiceStatisticsAsync();
+
+                _logger.LogDebug("IoT Hub health check passed in {ElapsedMs} ms",
+                    stopwatch.ElapsedMilliseconds);
+                return true;
+            }
+            catch (Exception ex) when (ex is FormatException || ex is ArgumentException)
+            {
+                _logger.LogWarning("IoT Hub connection string is not valid: {Error}", ex.Message);
+                return false;
+            }
+            catch (IotHubException ex)
+            {
+                _logger.LogWarning("IoT Hub health check failed after {ElapsedMs} ms: {Error}",
+                    stopwatch.ElapsedMilliseconds, ex.Message);
+                Evict(serviceClient);
+                return false;
+            }
+        }
+
+        public void Dispose()
+        {
+            lock (_lock)
+            {
+                _serviceClient?.Dispose();
+                _serviceClient = null;
+                _connectionString = null;
+            }
+        }
+
+        private ServiceClient Acquire(string connectionString)
+        {
+            lock (_lock)
+            {
+                if (_serviceClient == null || _connectionString != connectionString)
+                {
+                    ServiceClient newClient = ServiceClient.CreateFromConnectionString(connectionString);
+
+                    if (_serviceClient != null)
+                    {
+                        _logger.LogInformation("IoT Hub connection string changed, replacing client");
+                        Retire(_serviceClient);
+                    }
+
+                    _serviceClient = newClient;
+                    _connectionString = connectionString;
+                }
+                return _serviceClient;
+            }
+        }
+
+        private void Evict(ServiceClient serviceClient)
+        {
+            lock (_lock)
+            {
+                if (serviceClient == null || serviceClient != _serviceClient)
+                {
+                    return;
+                }
+                _serviceClient = null;
+                _connectionString = null;
+            }
+            Retire(serviceClient);
+        }
+
+        private static void Retire(ServiceClient serviceClient)
+        {
+            _ = Task.Delay(RetireDelay).ContinueWith(_ => serviceClient.Dispose());
+        }
+    }
+}
@@ -0,0 +1,110 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Text.Json;
+using System.Threading;
+using System.Threading.Tasks;
+
+using Microsoft.Azure.Devices;
+
+using SpherePasswordManager.Models;
+
+namespace SpherePasswordManager.Services
+{
+
+    /// <summary>
+    /// Reads connection state of configured devices from IoT Hub device twins.
+    /// Twin queries need registry read permission the service policy does not
+    /// have, the separate registry read connection string is used. Registry
+    /// client is kept for the configured connection string.
+    /// </summary>
+    public class IotHubDevicePresenceSource : IDevicePresenceSource, IDisposable
+    {
+        private readonly IConfigDataService _configDataService;
+
+        private const int QueryPageSize = 1000;
+
+        private readonly object _lock = new object();
+        private string _connectionString;
+        private RegistryManager _registryManager;
+
+        public IotHubDevicePresenceSource(IConfigDataService configDataService)
+        {
+            _configDataService = configDataService;
+        }
+
+        public async Task<IReadOnlyDictionary<string, bool>> QueryConnectedAsync(
+            CancellationToken cancellationToken)
+        {
+            ConfigData configData = await _configDataService.ReadAsync();
+            if (string.IsNullOrEmpty(configData.IotHubRegistry))
+            {
+                return null;
+            }
+
+            // Device IDs may contain quotes, such devices are not queried
+            List<string> deviceIds = configData.Devices
+                .Where(deviceId => deviceId.IndexOfAny(new[] { '\'', '"', '\\' }) < 0)
+                .ToList();
+            if (deviceIds.Count == 0)
+            {
+                return null;
+            }
+
+            RegistryManager registryManager = Acquire(configData.IotHubRegistry);
+
+            var connected = new Dictionary<string, bool>();
+            IQuery query = registryManager.CreateQuery(
+                "SELECT deviceId, connectionState FROM devices WHERE deviceId IN [" +
+                string.Join(", ", deviceIds.Select(deviceId => "'" + deviceId + "'")) + "]",
+                QueryPageSize);
+            while (query.HasMoreResults)
+            {
+                cancellationToken.ThrowIfCancellationRequested();
+
+                foreach (string twinJson in await query.GetNextAsJsonAsync())
+                {
+                    using (JsonDocument document = JsonDocument.Parse(twinJson))
+                    {
+                        JsonElement root = document.RootElement;
+                        if (root.TryGetProperty("deviceId", out JsonElement deviceId) &&
+                            root.TryGetProperty("connectionState", out JsonElement connectionState))
+                        {
+                            connected[deviceId.GetString()] = connectionState.GetString() == "Connected";
+                        }
+                    }
+                }
+            }
+
+            return connected;
+        }
+
+        public void Dispose()
+        {
+            lock (_lock)
+            {
+                _registryManager?.Dispose();
+                _registryManager = null;
+                _connectionString = null;
+            }
+        }
+
+        private RegistryManager Acquire(string connectionString)
+        {
+            lock (_lock)
+            {
+                if (_registryManager == null || _connectionString != connectionString)
+                {
+                    RegistryManager newManager = RegistryManager.CreateFromConnectionString(connectionString);
+
+                    // Queried by presence monitor only, replaced client is not in use
+                    _registryManager?.Dispose();
+
+                    _registryManager = newManager;
+                    _connectionString = connectionString;
+                }
+                return _registryManager;
+            }
+        }
+    }
+}
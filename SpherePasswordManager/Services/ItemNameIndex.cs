@@ -0,0 +1,280 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Collections.Immutable;
+
+using SpherePasswordManager.Models;
+
+namespace SpherePasswordManager.Services
+{
+
+    /// <summary>
+    /// Immutable n-gram index of item names for substring search. Each name is
+    /// indexed under all its substrings of up to three characters. Query of up
+    /// to three characters is looked up directly, longer query matches items
+    /// present under all its trigrams and containing the whole query.
+    /// </summary>
+    public class ItemNameIndex
+    {
+        private const int GramLengthMax = 3;
+
+        public static readonly ItemNameIndex Empty =
+            new ItemNameIndex(ImmutableDictionary<string, Item[]>.Empty);
+
+        private static readonly IComparer<Item> IdComparer =
+            Comparer<Item>.Create((a, b) => a.Id.CompareTo(b.Id));
+
+        // Items under each gram, ordered by Id
+        private readonly ImmutableDictionary<string, Item[]> _postings;
+
+        private ItemNameIndex(ImmutableDictionary<string, Item[]> postings)
+        {
+            _postings = postings;
+        }
+
+        public static ItemNameIndex Create(IEnumerable<Item> items)
+        {
+            var postings = new Dictionary<string, List<Item>>();
+
+            foreach (Item item in items)
+            {
+                foreach (string gram in Grams(item.Name))
+                {
+                    if (!postings.TryGetValue(gram, out var gramItems))
+                    {
+                        gramItems = new List<Item>();
+                        postings.Add(gram, gramItems);
+                    }
+                    gramItems.Add(item);
+                }
+            }
+
+            var builder = ImmutableDictionary.CreateBuilder<string, Item[]>();
+            foreach (var posting in postings)
+            {
+                Item[] gramItems = posting.Value.ToArray();
+                Array.Sort(gramItems, IdComparer);
+                builder.Add(posting.Key, gramItems);
+            }
+
+            return new ItemNameIndex(builder.ToImmutable());
+        }
+
+        public ItemNameIndex WithAdded(Item item)
+        {
+            var builder = _postings.ToBuilder();
+
+            foreach (string gram in Grams(item.Name))
+            {
+                if (!builder.TryGetValue(gram, out Item[] gramItems))
+                {
+                    gramItems = Array.Empty<Item>();
+                }
+
+                int index = Array.BinarySearch(gramItems, item, IdComparer);
+                if (index < 0)
+                {
+                    index = ~index;
+
+                    Item[] newItems = new Item[gramItems.Length + 1];
+                    Array.Copy(gramItems, 0, newItems, 0, index);
+                    newItems[index] = item;
+                    Array.Copy(gramItems, index, newItems, index + 1, gramItems.Length - index);
+                    builder[gram] = newItems;
+                }
+            }
+
+            return new ItemNameIndex(builder.ToImmutable());
+        }
+
+        public ItemNameIndex WithRemoved(Item item)
+        {
+            var builder = _postings.ToBuilder();
+
+            foreach (string gram in Grams(item.Name))
+            {
+                if (!builder.TryGetValue(gram, out Item[] gramItems))
+                {
+                    continue;
+                }
+
+                int index = Array.BinarySearch(gramItems, item, IdComparer);
+                if (index < 0)
+                {
+                    continue;
+                }
+
+                if (gramItems.Length == 1)
+                {
+                    builder.Remove(gram);
+                }
+                else
+                {
+                    Item[] newItems = new Item[gramItems.Length - 1];
+                    Array.Copy(gramItems, 0, newItems, 0, index);
+                    Array.Copy(gramItems, index + 1, newItems, index, gramItems.Length - index - 1);
+                    builder[gram] = newItems;
+                }
+            }
+
+            return new ItemNameIndex(builder.ToImmutable());
+        }
+
+        /// <summary>
+        /// Find items with name containing query. Exact match ranks first, then
+        /// names starting with query, then query at start of a dash separated
+        /// word, then other matches, earlier and shorter matches first.
+        /// </summary>
+        public List<Item> Search(string query, int limit)
+        {
+            var best = new List<Match>(limit + 1);
+            string normalized = query.ToUpperInvariant();
+
+            if (normalized.Length <= GramLengthMax)
+            {
+                if (_postings.TryGetValue(normalized, out Item[] gramItems))
+                {
+                    foreach (Item item in gramItems)
+                    {
+                        AddMatch(best, limit, query, item);
+                    }
+                }
+            }
+            else
+            {
+                foreach (Item item in Candidates(normalized))
+                {
+                    AddMatch(best, limit, query, item);
+                }
+            }
+
+            var results = new List<Item>(best.Count);
+            foreach (Match match in best)
+            {
+                results.Add(match.Item);
+            }
+            return results;
+        }
+
+        /// <returns>Items indexed under all trigrams of normalized query</returns>
+        private List<Item> Candidates(string normalized)
+        {
+            var postings = new List<Item[]>();
+
+            for (int i = 0; i + GramLengthMax <= normalized.Length; i++)
+            {
+                if (!_postings.TryGetValue(normalized.Substring(i, GramLengthMax), out Item[] gramItems))
+                {
+                    return new List<Item>();
+                }
+                postings.Add(gramItems);
+            }
+
+            // Walk the shortest posting list, look items up in the others
+            postings.Sort((a, b) => a.Length.CompareTo(b.Length));
+
+            var candidates = new List<Item>();
+            foreach (Item item in postings[0])
+            {
+                bool inAll = true;
+                for (int i = 1; i < postings.Count && inAll; i++)
+                {
+                    inAll = Array.BinarySearch(postings[i], item, IdComparer) >= 0;
+                }
+
+                if (inAll)
+                {
+                    candidates.Add(item);
+                }
+            }
+            return candidates;
+        }
+
+        private struct Match
+        {
+            public int Rank;
+            public int Position;
+            public Item Item;
+
+            public int CompareTo(Match other)
+            {
+                int comparison = Rank.CompareTo(other.Rank);
+                if (comparison == 0)
+                {
+                    comparison = Position.CompareTo(other.Position);
+                }
+                if (comparison == 0)
+                {
+                    comparison = Item.Name.Length.CompareTo(other.Item.Name.Length);
+                }
+                if (comparison == 0)
+                {
+                    comparison = ItemSnapshot.NameComparer.Compare(Item.Name, other.Item.Name);
+                }
+                return comparison;
+            }
+        }
+
+        /// <summary>
+        /// Keep item if it is among the limit best matches, best kept sorted.
+        /// </summary>
+        private static void AddMatch(List<Match> best, int limit, string query, Item item)
+        {
+            int position = item.Name.IndexOf(query, StringComparison.OrdinalIgnoreCase);
+            if (position < 0)
+            {
+                return;
+            }
+
+            var match = new Match()
+            {
+                Position = position,
+                Item = item
+            };
+
+            if (position == 0)
+            {
+                match.Rank = (item.Name.Length == query.Length) ? 0 : 1;
+            }
+            else if (item.Name[position - 1] == '-')
+            {
+                match.Rank = 2;
+            }
+            else
+            {
+                match.Rank = 3;
+            }
+
+            if (best.Count == limit && match.CompareTo(best[limit - 1]) >= 0)
+            {
+                return;
+            }
+
+            int index = best.Count;
+            while (index > 0 && match.CompareTo(best[index - 1]) < 0)
+            {
+                index--;
+            }
+            best.Insert(index, match);
+
+            if (best.Count > limit)
+            {
+                best.RemoveAt(limit);
+            }
+        }
+
+        private static IEnumerable<string> Grams(string text)
+        {
+            string normalized = text.ToUpperInvariant();
+
+            var grams = new HashSet<string>(StringComparer.Ordinal);
+            for (int length = 1; length <= GramLengthMax; length++)
+            {
+                for (int i = 0; i + length <= normalized.Length; i++)
+                {
+                    grams.Add(normalized.Substring(i, length));
+                }
+            }
+            return grams;
+        }
+    }
+}
@@ -0,0 +1,205 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Text.Json;
+using System.Threading;
+using System.Threading.Tasks;
+
+using Microsoft.Extensions.Configuration;
+using Microsoft.Extensions.Logging;
+
+using SpherePasswordManager.Models;
+
+namespace SpherePasswordManager.Services
+{
+
+    public interface IItemPrefetcher
+    {
+        void Prefetch(IEnumerable<Item> items);
+        Task<Item> HydrateAsync(Item item);
+    }
+
+    /// <summary>
+    /// Loads full item content from KeyVault into item store. After the item
+    /// list loads, all item contents are fetched in background with bounded
+    /// parallelism, so sending an item does not wait for KeyVault. Concurrent
+    /// requests for the same item share one KeyVault call. Expired content is
+    /// loaded again.
+    /// </summary>
+    public class ItemPrefetcher : IItemPrefetcher
+    {
+        private readonly IItemStore _itemStore;
+        private readonly ISecretStore _secretStore;
+        private readonly ILogger<ItemPrefetcher> _logger;
+
+        private readonly bool PrefetchEnabled;
+        private readonly int MaxParallel;
+
+        // Failed item is tried again later, waiting longer after each attempt
+        private const int MaxAttempts = 3;
+        private static readonly TimeSpan RetryPause = TimeSpan.FromSeconds(1);
+
+        // Items waiting for prefetch, worked off by up to MaxParallel workers
+        private readonly ConcurrentQueue<(Item Item, int Attempt)> _queue =
+            new ConcurrentQueue<(Item Item, int Attempt)>();
+        private int _workers;
+
+        // Item loads in progress by item name
+        private readonly ConcurrentDictionary<string, Lazy<Task<Item>>> _loading =
+            new ConcurrentDictionary<string, Lazy<Task<Item>>>(ItemSnapshot.NameComparer);
+
+        public ItemPrefetcher(IConfiguration config, IItemStore itemStore, ISecretStore secretStore,
+            ILogger<ItemPrefetcher> logger)
+        {
+            _itemStore = itemStore;
+            _secretStore = secretStore;
+            _logger = logger;
+
+            PrefetchEnabled = config.GetValue<bool>("ItemPrefetch:enabled", true);
+            MaxParallel = Math.Max(1, config.GetValue<int>("ItemPrefetch:maxParallel", 4));
+
+            _itemStore.ContentExpired += OnContentExpired;
+        }
+
+        /// <summary>
+        /// Start loading content of all items not cached, does not wait.
+        /// </summary>
+        public void Prefetch(IEnumerable<Item> items)
+        {
+            if (!PrefetchEnabled)
+            {
+                return;
+            }
+
+            foreach (Item item in items)
+            {
+                _queue.Enqueue((item, 1));
+            }
+            StartWorkers();
+        }
+
+        /// <summary>
+        /// Get listed item with its content, loading the content unless cached.
+        /// </summary>
+        /// <returns>Item with content, copy of listed item with IsHydrated
+        /// false if loading failed</returns>
+        public async Task<Item> HydrateAsync(Item item)
+        {
+            Item fullItem = _itemStore.GetContent(item);
+            if (fullItem != null)
+            {
+                return fullItem;
+            }
+
+            string itemName = item.Name;
+            Lazy<Task<Item>> loading = _loading.GetOrAdd(itemName,
+                name => new Lazy<Task<Item>>(() => LoadAsync(name)));
+            try
+            {
+                await loading.Value;
+            }
+            finally
+            {
+                // Remove only this load, not one started after it
+                ((ICollection<KeyValuePair<string, Lazy<Task<Item>>>>)_loading).Remove(
+                    new KeyValuePair<string, Lazy<Task<Item>>>(itemName, loading));
+            }
+
+            return _itemStore.GetContent(item) ?? new Item()
+            {
+                Id = item.Id,
+                Name = item.Name
+            };
+        }
+
+        private void StartWorkers()
+        {
+            while (!_queue.IsEmpty)
+            {
+                int workers = Volatile.Read(ref _workers);
+                if (workers >= MaxParallel)
+                {
+                    return;
+                }
+
+                if (Interlocked.CompareExchange(ref _workers, workers + 1, workers) == workers)
+                {
+                    _ = Task.Run(RunWorkerAsync);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Load queued items one by one. Item becomes a shared load only when a
+        /// worker takes it, so requests for an item never wait behind the queue.
+        /// </summary>
+        private async Task RunWorkerAsync()
+        {
+            try
+            {
+                while (_queue.TryDequeue(out var entry))
+                {
+                    Item fullItem = await HydrateAsync(entry.Item).ConfigureAwait(false);
+
+                    if (!fullItem.IsHydrated && entry.Attempt < MaxAttempts)
+                    {
+                        // Store is likely overloaded, leave its capacity to requests for a while
+                        _queue.Enqueue((entry.Item, entry.Attempt + 1));
+                        await Task.Delay(RetryPause * entry.Attempt).ConfigureAwait(false);
+                    }
+                }
+            }
+            finally
+            {
+                Interlocked.Decrement(ref _workers);
+            }
+
+            // Items queued while this worker was finishing
+            StartWorkers();
+        }
+
+        private void OnContentExpired(string itemName)
+        {
+            // Reload only items still listed
+            Item item = _itemStore.Snapshot?.FindByName(itemName);
+            if (item != null)
+            {
+                Prefetch(new[] { item });
+            }
+        }
+
+        /// <returns>Item content, null if it could not be loaded</returns>
+        private async Task<Item> LoadAsync(string itemName)
+        {
+            string itemJson;
+
+            try
+            {
+                // Secret has no content yet if it does not exist
+                itemJson = await _secretStore.GetAsync(itemName).ConfigureAwait(false) ?? "{}";
+            }
+            catch (SecretStoreException ex)
+            {
+                _logger.LogWarning("Item {Name} loading failed: {Error}", itemName, ex.Message);
+                return null;
+            }
+
+            Item content;
+            try
+            {
+                content = JsonSerializer.Deserialize<Item>(itemJson) ?? new Item();
+            }
+            catch (JsonException)
+            {
+                // Malformed content is treated as empty item
+                content = new Item();
+            }
+
+            // Cached before the load is finished, so no other request starts it again
+            content.Name = itemName;
+            _itemStore.SetContent(content, false);
+
+            return content;
+        }
+    }
+}
@@ -1,128 +1,107 @@
 ﻿using System;
 using System.Collections.Generic;
+using System.Diagnostics;
 using System.Linq;
-using System.Net.Http;
+using System.Runtime.CompilerServices;
 using System.Text.Json;
+using System.Threading;
 using System.Threading.Tasks;
 
-using Microsoft.Azure.Devices;
-using Microsoft.Azure.Devices.Common.Exceptions;
-using Microsoft.Azure.KeyVault;
-using Microsoft.Azure.KeyVault.Models;
-using Microsoft.Azure.Services.AppAuthentication;
-
-using Microsoft.Extensions.Caching.Memory;
 using Microsoft.Extensions.Configuration;
-
-using Microsoft.Rest;
+using Microsoft.Extensions.Logging;
 
 using SpherePasswordManager.Models;
 
 namespace SpherePasswordManager.Services
 {
 
+    public class SendResult
+    {
+        public bool Success { get; set; }
+
+        // Shown to user, starts with ERROR when sending failed
+        public string Message { get; set; }
+
+        // Device types the item right after loading and reports when done
+        public bool TypingExpected { get; set; }
+
+        // Device is not connected, item can be sent again when it is
+        public bool DeviceOffline { get; set; }
+
+        // Sending waited for the device until the call timed out
+        public bool TimedOut { get; set; }
+    }
+
     public interface IItemService
     {
-        Task<List<Item>> ReadAllAsync();
+        Task<IReadOnlyList<Item>> ReadAllAsync();
+        Task<List<Item>> SearchAsync(string query, int limit);
         Task<bool> CheckItemNameExistsAsync(string itemName);
         Task CreateAsync(Item item);
         Task<Item> ReadAsync(int id);
         Task UpdateAsync(Item modifiedItem);
         Task DeleteAsync(int id);
         Task<string> SendAsync(int id);
+        Task<SendResult> SendAsync(int id, string deviceId, string requestId, Action sending = null);
     }
 
     public class ItemService : IItemService
     {
         private readonly IConfiguration _config;
-        private readonly IMemoryCache _cache;
+        private readonly IItemStore _itemStore;
         private readonly IConfigDataService _configDataService;
+        private readonly ILocalDeviceClient _localDeviceClient;
+        private readonly IItemPrefetcher _itemPrefetcher;
+        private readonly IDeviceMethodInvoker _deviceMethodInvoker;
+        private readonly ISecretStore _secretStore;
+        private readonly IDevicePresence _devicePresence;
+        private readonly ILogger<ItemService> _logger;
 
-        private readonly static AzureServiceTokenProvider azureServiceTokenProvider =
-            new AzureServiceTokenProvider();
+        private readonly string ConfigKeyPrefix;
 
-        private readonly static KeyVaultClient keyVaultClient =
-            new KeyVaultClient(
-                new KeyVaultClient.AuthenticationCallback(
-                    azureServiceTokenProvider.KeyVaultTokenCallback));
-
-        private readonly string KeyVaultHostName, KeyVaultBaseUrl, ConfigKeyPrefix;
+        private readonly string DirectMethodName;
+        private readonly int DirectMethodCallTimeout;
 
+        // Largest page Key Vault returns
         private readonly static int MaxGetSecretsResults = 25;
 
-        public ItemService(IConfiguration config, IMemoryCache cache, IConfigDataService configDataService)
+        public ItemService(IConfiguration config, IItemStore itemStore, IConfigDataService configDataService,
+            ILocalDeviceClient localDeviceClient, IItemPrefetcher itemPrefetcher,
+            IDeviceMethodInvoker deviceMethodInvoker, ISecretStore secretStore,
+            IDevicePresence devicePresence, ILogger<ItemService> logger)
         {
             _config = config;
-            _cache = cache;
+            _itemStore = itemStore;
             _configDataService = configDataService;
-
-            KeyVaultHostName = _config.GetValue<String>("KeyVaultName");
-            KeyVaultBaseUrl = $"https://{KeyVaultHostName}.vault.azure.net/";
+            _localDeviceClient = localDeviceClient;
+            _itemPrefetcher = itemPrefetcher;
+            _deviceMethodInvoker = deviceMethodInvoker;
+            _secretStore = secretStore;
+            _devicePresence = devicePresence;
+            _logger = logger;
 
             ConfigKeyPrefix = _config.GetValue<String>("ConfigKeys:prefix");
+
+            DirectMethodName = _config.GetValue<string>("AzureSphereDevice:directMethodName");
+            DirectMethodCallTimeout = _config.GetValue<int>("AzureSphereDevice:directMethodCallTimeout");
         }
 
-        public async Task<List<Item>> ReadAllAsync()
+        public async Task<IReadOnlyList<Item>> ReadAllAsync()
         {
-            if (_cache.Get("ItemList") == null)
-            {
-
-                int splitMark;
-                string secretName;
-                List<Item> items = new List<Item>();
-                Item item;
-                int itemId = 1;
-
-                // Load secrets from KeyVault
-                try
-                {
-                    var secrets = await keyVaultClient.GetSecretsAsync(
-                        KeyVaultBaseUrl, MaxGetSecretsResults);
-
-                    // Get items and store them in List
-                    foreach (SecretItem secret in secrets)
-                    {
-                        // Secret name follows after the last forward slash in secret.Id
-                        splitMark = secret.Id.LastIndexOf('/');
-                        secretName = secret.Id.Substring(splitMark + 1);
-
-                        // Skip prefixed configuration keys 
-                        if (!secretName.StartsWith(ConfigKeyPrefix))
-                        {
-
-                            item = new Item()
-                            {
-                                Id = itemId,
-                                Name = secretName
-                            };
-
-                            items.Add(item);
-                            itemId++;
-                        }
-                    }
-
-                }
-                catch (HttpRequestException)
-                {
-                }
-
-                // Order list by name ascending
-                List<Item> sortedItems = items.OrderBy(o => o.Name).ToList();
+            ItemSnapshot snapshot = await ReadSnapshotAsync();
+            return snapshot.Items;
+        }
 
-                _cache.Set("ItemList", sortedItems);
-            }
-            return _cache.Get<List<Item>>("ItemList");
+        public async Task<List<Item>> SearchAsync(string query, int limit)
+        {
+            ItemSnapshot snapshot = await ReadSnapshotAsync();
+            return snapshot.Search(query?.Trim(), limit);
         }
 
         public async Task<bool> CheckItemNameExistsAsync(string itemName)
         {
-            var items = await ReadAllAsync();
-            var item = items.SingleOrDefault(c => c.Name == itemName);
-            if (item == null)
-            {
-                return false;
-            }
-            return true;
+            ItemSnapshot snapshot = await ReadSnapshotAsync();
+            return snapshot.FindByName(itemName) != null;
         }
 
         public async Task CreateAsync(Item newItem)
@@ -133,105 +112,89 @@ namespace SpherePasswordManager.Services
                 return;
             }
 
-            // Get cached list of all items
-            var items = await ReadAllAsync();
+            await AddAsync(newItem);
+        }
 
-            // Compute Id for new item
-            if (items.Count == 0)
+        /// <summary>
+        /// Add item to the list and store it in KeyVault. Store errors are passed
+        /// on with the item taken out of the list again.
+        /// </summary>
+        /// <returns>Added item, null if item name exists</returns>
+        private async Task<Item> AddAsync(Item newItem)
+        {
+            // Make sure item list is loaded
+            await ReadSnapshotAsync();
+
+            // Add item to list, Id is assigned by the list
+            Item addedItem = null;
+            if (_itemStore.Update(snapshot => snapshot.WithAdded(newItem.Name, out addedItem)) == null)
             {
-                newItem.Id = 1;
+                throw ItemListNotLoaded();
             }
-            else
+            if (addedItem == null)
             {
-                newItem.Id = items.Max(c => c.Id) + 1;
+                // Item name exists
+                return null;
             }
 
-            // Add item to list
-            items.Add(newItem);
+            newItem.Id = addedItem.Id;
+            newItem.IsHydrated = true;
+            _itemStore.SetContent(newItem, true);
 
             // Store item in KeyVault
             string itemJson = JsonSerializer.Serialize(newItem);
 
             try
             {
-                await keyVaultClient.SetSecretAsync(
-                    KeyVaultBaseUrl, newItem.Name, itemJson);
+                await _secretStore.SetAsync(newItem.Name, itemJson);
             }
-            catch (ValidationException)
+            catch (SecretStoreException)
             {
+                // Item was not stored, it must not stay listed, so it can be
+                // submitted again
+                _itemStore.Update(snapshot => snapshot.WithRemoved(addedItem.Id, out _));
+                _itemStore.RemoveContent(addedItem.Name);
+                throw;
             }
 
-            // Order item list by name ascending
-            List<Item> sortedItems = items.OrderBy(o => o.Name).ToList();
-
-            // Update item cache
-            _cache.Set("ItemList", sortedItems);
+            return addedItem;
         }
 
         public async Task DeleteAsync(int id)
         {
-            // Get list of all items
-            var items = await ReadAllAsync();
-
-            // Get item to delete
-            var deletedItem = items.Single(c => c.Id == id);
+            // Make sure item list is loaded
+            await ReadSnapshotAsync();
 
             // Remove item from list
-            items.Remove(deletedItem);
+            Item deletedItem = null;
+            if (_itemStore.Update(snapshot => snapshot.WithRemoved(id, out deletedItem)) == null)
+            {
+                throw ItemListNotLoaded();
+            }
+            if (deletedItem == null)
+            {
+                return;
+            }
 
-            // Update liad cache, no reorder necessary
-            _cache.Set("ItemList", items);
+            _itemStore.RemoveContent(deletedItem.Name);
 
             // Remove item from KeyVault
-            await keyVaultClient.DeleteSecretAsync(
-                KeyVaultBaseUrl, deletedItem.Name);
+            await _secretStore.DeleteAsync(deletedItem.Name);
         }
 
         public async Task<Item> ReadAsync(int id)
         {
-            // Get cached list of all items
-            List<Item> items = await ReadAllAsync();
-
-            // Check if item content was already loaded from KeyVault
-            // Since item.Password is mandatory, we'll check if password is present
-            Item currentItem = items.Single(c => c.Id == id);
+            ItemSnapshot snapshot = await ReadSnapshotAsync();
 
-            if (string.IsNullOrEmpty(currentItem.Password))
+            Item listedItem = snapshot.FindById(id);
+            if (listedItem == null)
             {
-                string itemJson;
-
-                // Load full item content JSON from KeyVault
-                try
-                {
-                    SecretBundle bundle = await keyVaultClient.GetSecretAsync(
-                        KeyVaultBaseUrl, currentItem.Name)
-                        .ConfigureAwait(false);
-
-                    itemJson = bundle.Value;
-                }
-                catch (KeyVaultErrorException)
-                {
-                    itemJson = "{}";
-                }
-
-                // Get item from JSON
-                try
-                {
-                    var fullItem = JsonSerializer.Deserialize<Item>(itemJson);
-
-                    // Update item in cached list, no name change
-                    fullItem.Id = currentItem.Id;
-                    await UpdateAsync(fullItem);
-                }
-                catch (JsonException)
-                {
-                }
-
-                // Get full item data from cached list
-                currentItem = items.Single(c => c.Id == id);
+                return null;
             }
 
-            return currentItem;
+            // Item content is usually prefetched already, otherwise it is loaded
+            // now or joins prefetch of this item in progress
+            return await _itemPrefetcher.HydrateAsync(listedItem);
         }
 
         public async Task UpdateAsync(Item modifiedItem)
@@ -242,113 +205,261 @@ namespace SpherePasswordManager.Services
                 return;
             }
 
-            // Get cached list of all items
-            var items = await ReadAllAsync();
+            ItemSnapshot snapshot = await ReadSnapshotAsync();
 
             // Get current item state from the list
-            var item = items.Single(c => c.Id == modifiedItem.Id);
+            Item item = snapshot.FindById(modifiedItem.Id);
+            if (item == null)
+            {
+                return;
+            }
 
-            // If item name changed, recreate item including KeyVault secrets
+            // If item name changed, recreate item including KeyVault secrets.
+            // New item is stored first, a failed rename keeps the current one.
             if (item.Name != modifiedItem.Name)
             {
+                // Create new item
+                if (await AddAsync(modifiedItem) == null)
+                {
+                    return;
+                }
+
                 // Delete current item
                 await DeleteAsync(item.Id);
-
-                // Create new item
-                await CreateAsync(modifiedItem);
             }
             else
             {
                 // Update all item properties except for Name and Id
-                item.Username = modifiedItem.Username;
-                item.UsernameEnter = modifiedItem.UsernameEnter;
-                item.Password = modifiedItem.Password;
-                item.PasswordEnter = modifiedItem.PasswordEnter;
-                item.UnameTabPass = modifiedItem.UnameTabPass;
-                item.LoadAndSend = modifiedItem.LoadAndSend;
-
-                // Update cached list
-                _cache.Set("ItemList", items);
+                _itemStore.SetContent(modifiedItem, true);
 
                 // Update item in KeyVault
-                string itemJson = JsonSerializer.Serialize(item);
-                await keyVaultClient.SetSecretAsync(
-                    KeyVaultBaseUrl, item.Name, itemJson);
+                string itemJson = JsonSerializer.Serialize(modifiedItem);
+                await _secretStore.SetAsync(item.Name, itemJson);
             }
         }
 
-        public async Task<string> SendAsync(int id)
+        // Ids are numbered per enumeration, only valid for building the item list snapshot
+        private async IAsyncEnumerable<Item> StreamAllAsync(
+            [EnumeratorCancellation] CancellationToken cancellationToken = default)
         {
+            int itemId = 1;
 
-            // Get full item content
-            Item item = await ReadAsync(id);
+            Task<SecretPage> pageTask = _secretStore.ListPageAsync(
+                null, MaxGetSecretsResults, cancellationToken);
 
-            // Obtain IoT Hub connection string and Azure Sphere device name
-            ConfigData configData = await _configDataService.ReadAsync();
+            while (pageTask != null)
+            {
+                SecretPage page = await pageTask;
 
-            // Prepare device method call via Iot Hub
-            string methodName = _config.GetValue<string>("AzureSphereDevice:directMethodName");
-            int methodTimeout = _config.GetValue<int>("AzureSphereDevice:directMethodCallTimeout");
+                // Request the following page while this one is handed out
+                pageTask = (page.NextPageToken == null) ? null :
+                    _secretStore.ListPageAsync(page.NextPageToken, MaxGetSecretsResults,
+                        cancellationToken);
 
-            var methodInvocation = new CloudToDeviceMethod(methodName)
-            {
-                ResponseTimeout = TimeSpan.FromSeconds(methodTimeout)
-            };
+                foreach (string secretName in page.Names)
+                {
+                    // Skip prefixed configuration keys 
+                    if (!secretName.StartsWith(ConfigKeyPrefix))
+                    {
+                        yield return new Item()
+                        {
+                            Id = itemId,
+                            Name = secretName
+                        };
+                        itemId++;
+                    }
+                }
+            }
+        }
 
-            methodInvocation.SetPayloadJson(JsonSerializer.Serialize(item));
+        /// <summary>
+        /// Get current item list, loading it from KeyVault on first use.
+        /// </summary>
+        private async Task<ItemSnapshot> ReadSnapshotAsync()
+        {
+            ItemSnapshot snapshot = _itemStore.Snapshot;
+            if (snapshot != null)
+            {
+                return snapshot;
+            }
 
-            ServiceClient serviceClient;
-            CloudToDeviceMethodResult deviceResult;
+            List<Item> items = new List<Item>();
 
+            // Load secrets from KeyVault
             try
             {
-                serviceClient = ServiceClient.CreateFromConnectionString(configData.IotHubService);
-                using(serviceClient)
+                await foreach (Item item in StreamAllAsync())
                 {
-                    // Invoke the direct method asynchronously and get the response from IoT device.
-                    deviceResult = await serviceClient.InvokeDeviceMethodAsync(configData.AzureSphereDevice, methodInvocation);
+                    items.Add(item);
                 }
             }
-            catch (FormatException fex)
+            catch (SecretStoreException ex)
             {
-                if (fex.Message.Equals("Malformed Token"))
+                // Do not keep incomplete list, next call tries again
+                _logger.LogWarning("Item list loading stopped after {Count} items: {Error}",
+                    items.Count, ex.Message);
+                return ItemSnapshot.Create(items);
+            }
+
+            snapshot = ItemSnapshot.Create(items);
+            if (_itemStore.TryInitialize(snapshot))
+            {
+                // Warm up item content before it is needed for sending
+                _itemPrefetcher.Prefetch(snapshot.Items);
+            }
+
+            return _itemStore.Snapshot;
+        }
+
+        // Item list failed to load, changes would be lost when it is loaded again
+        private static SecretStoreException ItemListNotLoaded()
+        {
+            return new SecretStoreException("Item list could not be loaded from KeyVault", true);
+        }
+
+        public async Task<string> SendAsync(int id)
+        {
+            // Obtain Azure Sphere device name
+            ConfigData configData = await _configDataService.ReadAsync();
+
+            // Request ID is carried in the payload and reported back by the device
+            // in its telemetry, so both sides of a delivery can be correlated
+            SendResult result = await SendAsync(id, configData.AzureSphereDevice,
+                Guid.NewGuid().ToString("N").Substring(0, 12));
+
+            return result.Message;
+        }
+
+        /// <param name="sending">Called when item is handed over for delivery</param>
+        public async Task<SendResult> SendAsync(int id, string deviceId, string requestId,
+            Action sending = null)
+        {
+            Stopwatch stopwatch = Stopwatch.StartNew();
+
+            // Get full item content
+            Item item = await ReadAsync(id);
+            if (item == null)
+            {
+                return new SendResult()
                 {
-                    return ("ERROR: Invalid Iot Hub Service Connection String");
-                }
-                return ("ERROR: Iot Hub Message Format Exception");
+                    Message = "ERROR: Item not found"
+                };
             }
-            catch (ArgumentException)
+            if (!item.IsHydrated)
             {
-                return ("ERROR: Invalid Iot Hub Service Connection String");
+                // Item without password must not reach the device
+                return new SendResult()
+                {
+                    Message = "ERROR: Item content could not be loaded"
+                };
             }
-            catch (DeviceNotFoundException dnfex)
+
+            long prepareMs = stopwatch.ElapsedMilliseconds;
+
+            // Same payload is accepted by the direct method and by the device
+            // local network listener
+            string payload = JsonSerializer.Serialize(new
             {
+                item.Id,
+                item.Name,
+                item.Password,
+                item.Username,
+                item.UsernameEnter,
+                item.PasswordEnter,
+                item.UnameTabPass,
+                item.LoadAndSend,
+                RequestId = requestId
+            });
+
+            string route = "LAN";
+            int status = 0;
+            string responseJson = null;
+            string error = null;
+            bool deviceOffline = false;
+            bool timedOut = false;
+            long acquireMs = 0;
+
+            // Try local network first, device retried via IoT Hub recognizes
+            // the request ID if the local response got lost
+            long invokeStartMs = stopwatch.ElapsedMilliseconds;
+            sending?.Invoke();
+            LocalDeviceResponse localResponse = await _localDeviceClient.TrySendAsync(deviceId, payload);
+            if (localResponse != null)
+            {
+                status = localResponse.Status;
+                responseJson = localResponse.Payload;
+                _devicePresence.Report(deviceId, true);
+            }
+            else if (_devicePresence.GetState(deviceId) == DevicePresenceState.Offline)
+            {
+                // Known offline, do not wait for device method timeout
+                route = "IoT Hub";
+                error = "ERROR: Device offline";
+                deviceOffline = true;
+            }
+            else
+            {
+                route = "IoT Hub";
 
-                if (dnfex.Message.Contains(":404001,"))
+                try
                 {
-                    // errorCode 404001: Device not registered or incorrect name
-                    return ("ERROR: Device not registered in IoT Hub");
+                    DeviceMethodResult deviceResult = await _deviceMethodInvoker.InvokeAsync(
+                        deviceId, DirectMethodName, payload,
+                        TimeSpan.FromSeconds(DirectMethodCallTimeout));
+                    status = deviceResult.Status;
+                    responseJson = deviceResult.PayloadJson;
+                    acquireMs = deviceResult.AcquireMs;
+                    _devicePresence.Report(deviceId, true);
                 }
-                else if (dnfex.Message.Contains(":404103,"))
+                catch (DeviceMethodException dmex)
                 {
-                    // errorCode 404103: Timeout
-                    return ("ERROR: Timeout connecting device");
+                    error = dmex.Message;
+                    deviceOffline = dmex.DeviceOffline;
+                    timedOut = dmex.TimedOut;
+                    if (deviceOffline)
+                    {
+                        _devicePresence.Report(deviceId, false);
+                    }
                 }
+            }
+            long invokeMs = stopwatch.ElapsedMilliseconds - invokeStartMs;
 
-                return ("ERROR: Device not found");
+            if (error != null)
+            {
+                _logger.LogWarning(
+                    "Item send {RequestId} to {Device} failed after {TotalMs} ms " +
+                    "(prepare {PrepareMs} ms, invoke {InvokeMs} ms): {Error}",
+                    requestId, deviceId, stopwatch.ElapsedMilliseconds,
+                    prepareMs, invokeMs, error);
+                return new SendResult()
+                {
+                    Message = error,
+                    DeviceOffline = deviceOffline,
+                    TimedOut = timedOut
+                };
             }
 
             // Azure Sphere returns status and message property
             bool success = true;
+            bool parsed = true;
             string message;
             try
             {
-                JsonDocument document = JsonDocument.Parse(deviceResult.GetPayloadAsJson());
+                JsonDocument document = JsonDocument.Parse(responseJson);
                 message = document.RootElement.GetProperty("message").GetString();
                 success = document.RootElement.GetProperty("success").GetBoolean();
+
+                if (document.RootElement.TryGetProperty("requestId", out JsonElement deviceRequestId) &&
+                    deviceRequestId.ValueKind == JsonValueKind.String &&
+                    deviceRequestId.GetString() != requestId)
+                {
+                    _logger.LogWarning("Item send {RequestId} answered for request {DeviceRequestId}",
+                        requestId, deviceRequestId.GetString());
+                }
             }
             catch (JsonException)
             {
+                parsed = false;
                 message = "ERROR: Response parsing failed";
             }
 
@@ -357,7 +468,19 @@ namespace SpherePasswordManager.Services
                 message += "ERROR: ";
             }
 
-            return message;
+            _logger.LogInformation(
+                "Item send {RequestId} to {Device} via {Route} completed in {TotalMs} ms " +
+                "(prepare {PrepareMs} ms, client {AcquireMs} ms, invoke {InvokeMs} ms), " +
+                "status {Status}, success {Success}",
+                requestId, deviceId, route, stopwatch.ElapsedMilliseconds,
+                prepareMs, acquireMs, invokeMs - acquireMs, status, success);
+
+            return new SendResult()
+            {
+                Success = success && parsed,
+                Message = message,
+                TypingExpected = success && parsed && item.LoadAndSend
+            };
         }
     }
 }
@@ -0,0 +1,172 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Collections.Immutable;
+using System.Linq;
+
+using SpherePasswordManager.Models;
+
+namespace SpherePasswordManager.Services
+{
+
+    /// <summary>
+    /// Immutable state of the item list. Items are sorted by name and indexed
+    /// by Id and name n-grams, modifications return a new snapshot sharing
+    /// unchanged items.
+    /// Listed items carry Id and Name only and must not be modified.
+    /// </summary>
+    public class ItemSnapshot
+    {
+        // KeyVault secret names are case insensitive
+        public static readonly StringComparer NameComparer = StringComparer.OrdinalIgnoreCase;
+
+        public static readonly ItemSnapshot Empty =
+            new ItemSnapshot(Array.Empty<Item>(), ImmutableDictionary<int, Item>.Empty,
+                ItemNameIndex.Empty, 1);
+
+        private static readonly IComparer<Item> ItemNameComparer =
+            Comparer<Item>.Create((a, b) => NameComparer.Compare(a.Name, b.Name));
+
+        private readonly Item[] _sorted;
+        private readonly ImmutableDictionary<int, Item> _byId;
+        private readonly ItemNameIndex _nameIndex;
+
+        public int NextId { get; }
+
+        private ItemSnapshot(Item[] sorted, ImmutableDictionary<int, Item> byId,
+            ItemNameIndex nameIndex, int nextId)
+        {
+            _sorted = sorted;
+            _byId = byId;
+            _nameIndex = nameIndex;
+            NextId = nextId;
+        }
+
+        /// <summary>
+        /// Create snapshot from items with unique names and Ids.
+        /// </summary>
+        public static ItemSnapshot Create(IEnumerable<Item> items)
+        {
+            var builder = ImmutableDictionary.CreateBuilder<int, Item>();
+            int nextId = 1;
+
+            foreach (Item item in items)
+            {
+                builder.Add(item.Id, item);
+                nextId = Math.Max(nextId, item.Id + 1);
+            }
+
+            Item[] sorted = builder.Values.ToArray();
+            Array.Sort(sorted, ItemNameComparer);
+
+            return new ItemSnapshot(sorted, builder.ToImmutable(),
+                ItemNameIndex.Create(sorted), nextId);
+        }
+
+        /// <summary>
+        /// Items ordered by name ascending.
+        /// </summary>
+        public IReadOnlyList<Item> Items => _sorted;
+
+        public int Count => _sorted.Length;
+
+        public Item FindById(int id)
+        {
+            return _byId.TryGetValue(id, out Item item) ? item : null;
+        }
+
+        public Item FindByName(string name)
+        {
+            int index = IndexOfName(name);
+            return index >= 0 ? _sorted[index] : null;
+        }
+
+        /// <summary>
+        /// Find items with name containing query, best matches first.
+        /// </summary>
+        public List<Item> Search(string query, int limit)
+        {
+            if (string.IsNullOrEmpty(query))
+            {
+                return new List<Item>();
+            }
+
+            return _nameIndex.Search(query, limit);
+        }
+
+        /// <summary>
+        /// Add item, its Id is assigned from NextId.
+        /// </summary>
+        /// <returns>New snapshot, this one if item name already exists</returns>
+        public ItemSnapshot WithAdded(string name, out Item addedItem)
+        {
+            addedItem = null;
+
+            int index = IndexOfName(name);
+            if (index >= 0)
+            {
+                return this;
+            }
+            index = ~index;
+
+            addedItem = new Item()
+            {
+                Id = NextId,
+                Name = name
+            };
+
+            Item[] sorted = new Item[_sorted.Length + 1];
+            Array.Copy(_sorted, 0, sorted, 0, index);
+            sorted[index] = addedItem;
+            Array.Copy(_sorted, index, sorted, index + 1, _sorted.Length - index);
+
+            return new ItemSnapshot(sorted, _byId.Add(addedItem.Id, addedItem),
+                _nameIndex.WithAdded(addedItem), NextId + 1);
+        }
+
+        /// <returns>New snapshot, this one if item does not exist</returns>
+        public ItemSnapshot WithRemoved(int id, out Item removedItem)
+        {
+            removedItem = FindById(id);
+            if (removedItem == null)
+            {
+                return this;
+            }
+
+            int index = IndexOfName(removedItem.Name);
+
+            Item[] sorted = new Item[_sorted.Length - 1];
+            Array.Copy(_sorted, 0, sorted, 0, index);
+            Array.Copy(_sorted, index + 1, sorted, index, _sorted.Length - index - 1);
+
+            return new ItemSnapshot(sorted, _byId.Remove(id),
+                _nameIndex.WithRemoved(removedItem), NextId);
+        }
+
+        /// <returns>Index of item, bitwise complement of insertion point if not found</returns>
+        private int IndexOfName(string name)
+        {
+            int low = 0;
+            int high = _sorted.Length - 1;
+
+            while (low <= high)
+            {
+                int middle = low + (high - low) / 2;
+                int comparison = NameComparer.Compare(_sorted[middle].Name, name);
+
+                if (comparison == 0)
+                {
+                    return middle;
+                }
+                else if (comparison < 0)
+                {
+                    low = middle + 1;
+                }
+                else
+                {
+                    high = middle - 1;
+                }
+            }
+            return ~low;
+        }
+    }
+}
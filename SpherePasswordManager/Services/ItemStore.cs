@@ -0,0 +1,155 @@
+﻿using System;
+using System.Threading;
+
+using Microsoft.Extensions.Caching.Memory;
+using Microsoft.Extensions.Configuration;
+
+using SpherePasswordManager.Models;
+
+namespace SpherePasswordManager.Services
+{
+
+    public interface IItemStore
+    {
+        ItemSnapshot Snapshot { get; }
+        bool TryInitialize(ItemSnapshot snapshot);
+        ItemSnapshot Update(Func<ItemSnapshot, ItemSnapshot> change);
+
+        event Action<string> ContentExpired;
+        Item GetContent(Item listedItem);
+        void SetContent(Item item, bool replace);
+        void RemoveContent(string name);
+    }
+
+    /// <summary>
+    /// Shared item state. Item list is an immutable snapshot replaced atomically,
+    /// readers never see a list being modified. Item content (username, password
+    /// and flags) is cached per item and expires independently of the list.
+    /// </summary>
+    public class ItemStore : IItemStore
+    {
+        private readonly IMemoryCache _cache;
+
+        private readonly TimeSpan ContentExpiry;
+
+        // Null until item list is loaded from KeyVault
+        private ItemSnapshot _snapshot;
+
+        private readonly object _contentLock = new object();
+
+        public event Action<string> ContentExpired;
+
+        public ItemStore(IConfiguration config, IMemoryCache cache)
+        {
+            _cache = cache;
+
+            ContentExpiry = TimeSpan.FromMinutes(
+                Math.Max(1, config.GetValue<int>("ItemCache:contentExpiryMin", 60)));
+        }
+
+        public ItemSnapshot Snapshot => Volatile.Read(ref _snapshot);
+
+        /// <returns>false if other request loaded item list first</returns>
+        public bool TryInitialize(ItemSnapshot snapshot)
+        {
+            return Interlocked.CompareExchange(ref _snapshot, snapshot, null) == null;
+        }
+
+        /// <summary>
+        /// Apply change to current snapshot. Change may be called again if other
+        /// request replaced the snapshot meanwhile, so it must have no side effects
+        /// except for out values.
+        /// </summary>
+        /// <returns>Snapshot after change, null if item list is not loaded</returns>
+        public ItemSnapshot Update(Func<ItemSnapshot, ItemSnapshot> change)
+        {
+            while (true)
+            {
+                ItemSnapshot current = Volatile.Read(ref _snapshot);
+                if (current == null)
+                {
+                    return null;
+                }
+
+                ItemSnapshot changed = change(current);
+                if (changed == current ||
+                    Interlocked.CompareExchange(ref _snapshot, changed, current) == current)
+                {
+                    return changed;
+                }
+            }
+        }
+
+        /// <returns>Copy of listed item with cached content, null if content is not cached</returns>
+        public Item GetContent(Item listedItem)
+        {
+            if (!_cache.TryGetValue(ContentKey(listedItem.Name), out Item content))
+            {
+                return null;
+            }
+
+            return new Item()
+            {
+                Id = listedItem.Id,
+                Name = listedItem.Name,
+                Username = content.Username,
+                UsernameEnter = content.UsernameEnter,
+                Password = content.Password,
+                PasswordEnter = content.PasswordEnter,
+                UnameTabPass = content.UnameTabPass,
+                LoadAndSend = content.LoadAndSend,
+                IsHydrated = true
+            };
+        }
+
+        /// <param name="replace">false keeps content already cached, content loaded
+        /// from KeyVault must not overwrite an edit made while it was loading</param>
+        public void SetContent(Item item, bool replace)
+        {
+            // Own copy, callers keep modifying their items
+            var content = new Item()
+            {
+                Username = item.Username,
+                UsernameEnter = item.UsernameEnter,
+                Password = item.Password,
+                PasswordEnter = item.PasswordEnter,
+                UnameTabPass = item.UnameTabPass,
+                LoadAndSend = item.LoadAndSend
+            };
+
+            string key = ContentKey(item.Name);
+            var options = new MemoryCacheEntryOptions()
+                .SetAbsoluteExpiration(ContentExpiry)
+                .RegisterPostEvictionCallback(OnContentEvicted, item.Name);
+
+            lock (_contentLock)
+            {
+                if (replace || !_cache.TryGetValue(key, out _))
+                {
+                    _cache.Set(key, content, options);
+                }
+            }
+        }
+
+        public void RemoveContent(string name)
+        {
+            lock (_contentLock)
+            {
+                _cache.Remove(ContentKey(name));
+            }
+        }
+
+        private void OnContentEvicted(object key, object value, EvictionReason reason, object state)
+        {
+            if (reason == EvictionReason.Expired)
+            {
+                ContentExpired?.Invoke((string)state);
+            }
+        }
+
+        private static string ContentKey(string name)
+        {
+            return "ItemContent:" + name.ToUpperInvariant();
+        }
+    }
+}
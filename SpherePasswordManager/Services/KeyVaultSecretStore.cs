@@ -0,0 +1,141 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Linq;
+using System.Net;
+using System.Net.Http;
+using System.Threading;
+using System.Threading.Tasks;
+
+using Microsoft.Azure.KeyVault;
+using Microsoft.Azure.KeyVault.Models;
+using Microsoft.Azure.Services.AppAuthentication;
+
+using Microsoft.Extensions.Configuration;
+
+using Microsoft.Rest;
+using Microsoft.Rest.Azure;
+
+namespace SpherePasswordManager.Services
+{
+
+    /// <summary>
+    /// Secrets stored in Azure KeyVault, accessed with the managed identity
+    /// of the application.
+    /// </summary>
+    public class KeyVaultSecretStore : ISecretStore
+    {
+        private readonly static AzureServiceTokenProvider azureServiceTokenProvider =
+            new AzureServiceTokenProvider();
+
+        private readonly static KeyVaultClient keyVaultClient =
+            new KeyVaultClient(
+                new KeyVaultClient.AuthenticationCallback(
+                    azureServiceTokenProvider.KeyVaultTokenCallback));
+
+        private readonly string KeyVaultHostName, KeyVaultBaseUrl;
+
+        public KeyVaultSecretStore(IConfiguration config)
+        {
+            KeyVaultHostName = config.GetValue<String>("KeyVaultName");
+            KeyVaultBaseUrl = $"https://{KeyVaultHostName}.vault.azure.net/";
+        }
+
+        public async Task<SecretPage> ListPageAsync(string pageToken, int maxResults,
+            CancellationToken cancellationToken = default)
+        {
+            IPage<SecretItem> page = await Call(() => (pageToken == null) ?
+                keyVaultClient.GetSecretsAsync(KeyVaultBaseUrl, maxResults, cancellationToken) :
+                keyVaultClient.GetSecretsNextAsync(pageToken, cancellationToken));
+
+            return new SecretPage()
+            {
+                // Secret name follows after the last forward slash in secret.Id
+                Names = page.Select(secret => secret.Id.Substring(secret.Id.LastIndexOf('/') + 1))
+                    .ToList(),
+                NextPageToken = string.IsNullOrEmpty(page.NextPageLink) ? null : page.NextPageLink
+            };
+        }
+
+        public async Task<string> GetAsync(string name, CancellationToken cancellationToken = default)
+        {
+            try
+            {
+                SecretBundle bundle = await keyVaultClient.GetSecretAsync(
+                    KeyVaultBaseUrl, name, cancellationToken)
+                    .ConfigureAwait(false);
+
+                return bundle.Value;
+            }
+            catch (KeyVaultErrorException kvex) when (kvex.Body?.Error?.Code == "SecretNotFound")
+            {
+                return null;
+            }
+            catch (KeyVaultErrorException kvex)
+            {
+                throw Translate(kvex);
+            }
+            catch (HttpRequestException hrex)
+            {
+                throw new SecretStoreException(hrex.Message, true, null, hrex);
+            }
+        }
+
+        public Task SetAsync(string name, string value, CancellationToken cancellationToken = default)
+        {
+            return Call(() => keyVaultClient.SetSecretAsync(
+                KeyVaultBaseUrl, name, value, cancellationToken: cancellationToken));
+        }
+
+        public Task DeleteAsync(string name, CancellationToken cancellationToken = default)
+        {
+            return Call(() => keyVaultClient.DeleteSecretAsync(
+                KeyVaultBaseUrl, name, cancellationToken));
+        }
+
+        private static async Task<T> Call<T>(Func<Task<T>> request)
+        {
+            try
+            {
+                return await request().ConfigureAwait(false);
+            }
+            catch (KeyVaultErrorException kvex)
+            {
+                throw Translate(kvex);
+            }
+            catch (ValidationException vex)
+            {
+                // Secret name or value rejected before sending
+                throw new SecretStoreException(vex.Message, false, null, vex);
+            }
+            catch (HttpRequestException hrex)
+            {
+                throw new SecretStoreException(hrex.Message, true, null, hrex);
+            }
+        }
+
+        private static SecretStoreException Translate(KeyVaultErrorException kvex)
+        {
+            // Throttled or service side failure
+            HttpStatusCode? status = kvex.Response?.StatusCode;
+            bool transient = status == (HttpStatusCode)429 ||
+                status == HttpStatusCode.InternalServerError ||
+                status == HttpStatusCode.BadGateway ||
+                status == HttpStatusCode.ServiceUnavailable ||
+                status == HttpStatusCode.GatewayTimeout;
+
+            return new SecretStoreException(kvex.Body?.Error?.Message ?? kvex.Message,
+                transient, RetryAfter(kvex), kvex);
+        }
+
+        private static TimeSpan? RetryAfter(KeyVaultErrorException kvex)
+        {
+            if (kvex.Response?.Headers != null &&
+                kvex.Response.Headers.TryGetValue("Retry-After", out IEnumerable<string> values) &&
+                int.TryParse(values.FirstOrDefault(), out int seconds))
+            {
+                return TimeSpan.FromSeconds(seconds);
+            }
+            return null;
+        }
+    }
+}
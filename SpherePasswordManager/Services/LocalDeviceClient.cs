@@ -0,0 +1,160 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Net.Sockets;
+using System.Text;
+using System.Threading;
+using System.Threading.Tasks;
+
+using Microsoft.Extensions.Configuration;
+using Microsoft.Extensions.Logging;
+
+namespace SpherePasswordManager.Services
+{
+
+    public class LocalDeviceResponse
+    {
+        public int Status { get; set; }
+        public string Payload { get; set; }
+    }
+
+    public interface ILocalDeviceClient
+    {
+        bool IsEnabled { get; }
+        Task<LocalDeviceResponse> TrySendAsync(string deviceId, string payload);
+    }
+
+    /// <summary>
+    /// Sends item payload to Azure Sphere device directly over local network.
+    /// Each device has its own address and pre-shared key, responses carry no
+    /// device ID, so only the device the endpoint is configured for is sent
+    /// to. Device not answering is skipped for a while, so sends not on the
+    /// same network are not delayed by waiting for the timeout every time.
+    /// </summary>
+    public class LocalDeviceClient : ILocalDeviceClient
+    {
+        private class Endpoint
+        {
+            public string Address { get; set; }
+            public int Port { get; set; }
+            public LocalDeviceProtocol Protocol { get; set; }
+
+            // Ticks of Stopwatch until which the device is considered unreachable
+            public long UnreachableUntil;
+        }
+
+        private readonly ILogger<LocalDeviceClient> _logger;
+
+        private readonly Dictionary<string, Endpoint> _endpoints = new Dictionary<string, Endpoint>();
+
+        private readonly int TimeoutMs, RetryAfterSec;
+
+        public LocalDeviceClient(IConfiguration config, ILogger<LocalDeviceClient> logger)
+        {
+            _logger = logger;
+
+            TimeoutMs = config.GetValue<int>("LocalDevice:timeoutMs", 300);
+            RetryAfterSec = config.GetValue<int>("LocalDevice:retryAfterSec", 60);
+
+            // One device may be set in the section itself, more in devices list
+            AddEndpoint(config.GetSection("LocalDevice"));
+            foreach (IConfigurationSection device in config.GetSection("LocalDevice:devices").GetChildren())
+            {
+                AddEndpoint(device);
+            }
+        }
+
+        public bool IsEnabled => _endpoints.Count > 0;
+
+        /// <returns>Device response, null if device is not reachable on local network</returns>
+        public async Task<LocalDeviceResponse> TrySendAsync(string deviceId, string payload)
+        {
+            if (deviceId == null ||
+                !_endpoints.TryGetValue(deviceId, out Endpoint endpoint) ||
+                Stopwatch.GetTimestamp() < Interlocked.Read(ref endpoint.UnreachableUntil) ||
+                Encoding.UTF8.GetByteCount(payload) > LocalDeviceProtocol.PayloadMax)
+            {
+                return null;
+            }
+
+            byte[] request = endpoint.Protocol.EncodeRequest(payload, out byte[] header);
+
+            try
+            {
+                using (var udpClient = new UdpClient())
+                {
+                    udpClient.Connect(endpoint.Address, endpoint.Port);
+                    await udpClient.SendAsync(request, request.Length);
+
+                    // Device does not answer unauthenticated datagrams, wait for
+                    // the response to this request only
+                    Task timeout = Task.Delay(TimeoutMs);
+                    while (true)
+                    {
+                        Task<UdpReceiveResult> receive = udpClient.ReceiveAsync();
+                        if (await Task.WhenAny(receive, timeout) == timeout)
+                        {
+                            break;
+                        }
+
+                        UdpReceiveResult result = await receive;
+                        if (endpoint.Protocol.TryDecodeResponse(header, result.Buffer,
+                            out int status, out string responsePayload))
+                        {
+                            return new LocalDeviceResponse()
+                            {
+                                Status = status,
+                                Payload = responsePayload
+                            };
+                        }
+                    }
+                }
+            }
+            catch (SocketException ex)
+            {
+                _logger.LogDebug("Local device {Device} at {Address}:{Port} send failed: {Error}",
+                    deviceId, endpoint.Address, endpoint.Port, ex.Message);
+            }
+
+            _logger.LogInformation(
+                "Local device {Device} at {Address}:{Port} not reachable, using IoT Hub for {RetryAfterSec} s",
+                deviceId, endpoint.Address, endpoint.Port, RetryAfterSec);
+            Interlocked.Exchange(ref endpoint.UnreachableUntil,
+                Stopwatch.GetTimestamp() + RetryAfterSec * Stopwatch.Frequency);
+
+            return null;
+        }
+
+        private void AddEndpoint(IConfiguration section)
+        {
+            string address = section.GetValue<string>("address");
+            if (string.IsNullOrEmpty(address))
+            {
+                return;
+            }
+
+            // Response would be accounted to whichever device is being sent to
+            string deviceId = section.GetValue<string>("deviceId");
+            if (string.IsNullOrEmpty(deviceId))
+            {
+                _logger.LogWarning("Local device {Address} ignored, its deviceId is not set", address);
+                return;
+            }
+
+            try
+            {
+                _endpoints[deviceId] = new Endpoint()
+                {
+                    Address = address,
+                    Port = section.GetValue<int>("port", LocalDeviceProtocol.DefaultPort),
+                    Protocol = new LocalDeviceProtocol(section.GetValue<string>("preSharedKey"))
+                };
+            }
+            catch (ArgumentException ex)
+            {
+                _logger.LogWarning("Local device delivery to {Device} disabled: {Error}",
+                    deviceId, ex.Message);
+            }
+        }
+    }
+}
@@ -0,0 +1,146 @@
+﻿using System;
+using System.Buffers.Binary;
+using System.Security.Cryptography;
+using System.Text;
+
+namespace SpherePasswordManager.Services
+{
+    /// <summary>
+    /// Frame format of requests sent to Azure Sphere device over local network,
+    /// see lan_listener.h in device application.
+    ///
+    /// magic "SPM1" | timestamp | nonce | ciphertext | tag
+    ///
+    /// Keystream block i is HMAC-SHA256(encryption key, nonce | i), tag is
+    /// HMAC-SHA256(authentication key, all preceding bytes). Keys are derived
+    /// from pre-shared key, separately for requests and responses.
+    /// </summary>
+    public class LocalDeviceProtocol
+    {
+        public const int DefaultPort = 50505;
+        public const int PayloadMax = 512;
+        public const int PreSharedKeyLengthMin = 16;
+
+        private const int MagicLength = 4;
+        private const int TimestampLength = 8;
+        private const int NonceLength = 16;
+        private const int HeaderLength = MagicLength + TimestampLength + NonceLength;
+        private const int TagLength = 32;
+        private const int StatusLength = 2;
+
+        private static readonly byte[] Magic = Encoding.ASCII.GetBytes("SPM1");
+
+        private readonly byte[] _requestEncryptionKey, _requestAuthenticationKey;
+        private readonly byte[] _responseEncryptionKey, _responseAuthenticationKey;
+
+        public LocalDeviceProtocol(string preSharedKey)
+        {
+            if (string.IsNullOrEmpty(preSharedKey) || preSharedKey.Length < PreSharedKeyLengthMin)
+            {
+                throw new ArgumentException(
+                    $"Pre-shared key must have at least {PreSharedKeyLengthMin} characters",
+                    nameof(preSharedKey));
+            }
+
+            byte[] psk = Encoding.UTF8.GetBytes(preSharedKey);
+            _requestEncryptionKey = DeriveKey(psk, "SPM1 request encryption");
+            _requestAuthenticationKey = DeriveKey(psk, "SPM1 request authentication");
+            _responseEncryptionKey = DeriveKey(psk, "SPM1 response encryption");
+            _responseAuthenticationKey = DeriveKey(psk, "SPM1 response authentication");
+        }
+
+        /// <summary>
+        /// Build encrypted request frame. Header is needed to match the response.
+        /// </summary>
+        public byte[] EncodeRequest(string payload, out byte[] header)
+        {
+            byte[] plaintext = Encoding.UTF8.GetBytes(payload);
+            if (plaintext.Length > PayloadMax)
+            {
+                throw new ArgumentException("Payload too long", nameof(payload));
+            }
+
+            header = new byte[HeaderLength];
+            Magic.CopyTo(header, 0);
+            BinaryPrimitives.WriteInt64BigEndian(header.AsSpan(MagicLength),
+                DateTimeOffset.UtcNow.ToUnixTimeSeconds());
+            RandomNumberGenerator.Fill(header.AsSpan(MagicLength + TimestampLength, NonceLength));
+
+            byte[] frame = new byte[HeaderLength + plaintext.Length + TagLength];
+            header.CopyTo(frame, 0);
+            plaintext.CopyTo(frame, HeaderLength);
+            Array.Clear(plaintext, 0, plaintext.Length);
+
+            Crypt(_requestEncryptionKey, header, frame, HeaderLength, frame.Length - HeaderLength - TagLength);
+            Tag(_requestAuthenticationKey, frame, frame.Length - TagLength)
+                .CopyTo(frame, frame.Length - TagLength);
+
+            return frame;
+        }
+
+        /// <summary>
+        /// Check and decrypt response to request with given header.
+        /// </summary>
+        /// <returns>false if frame is not an authentic response to the request</returns>
+        public bool TryDecodeResponse(byte[] header, byte[] frame, out int status, out string payload)
+        {
+            status = 0;
+            payload = null;
+
+            if (frame.Length < HeaderLength + StatusLength + TagLength ||
+                !frame.AsSpan(0, HeaderLength).SequenceEqual(header))
+            {
+                return false;
+            }
+
+            byte[] tag = Tag(_responseAuthenticationKey, frame, frame.Length - TagLength);
+            if (!CryptographicOperations.FixedTimeEquals(tag, frame.AsSpan(frame.Length - TagLength)))
+            {
+                return false;
+            }
+
+            int length = frame.Length - HeaderLength - TagLength;
+            Crypt(_responseEncryptionKey, header, frame, HeaderLength, length);
+            status = BinaryPrimitives.ReadUInt16BigEndian(frame.AsSpan(HeaderLength));
+            payload = Encoding.UTF8.GetString(frame, HeaderLength + StatusLength, length - StatusLength);
+
+            return true;
+        }
+
+        private static byte[] DeriveKey(byte[] psk, string label)
+        {
+            using (var hmac = new HMACSHA256(psk))
+            {
+                return hmac.ComputeHash(Encoding.ASCII.GetBytes(label));
+            }
+        }
+
+        private static byte[] Tag(byte[] key, byte[] frame, int length)
+        {
+            using (var hmac = new HMACSHA256(key))
+            {
+                return hmac.ComputeHash(frame, 0, length);
+            }
+        }
+
+        private static void Crypt(byte[] key, byte[] header, byte[] data, int offset, int length)
+        {
+            byte[] blockInput = new byte[NonceLength + 4];
+            Array.Copy(header, MagicLength + TimestampLength, blockInput, 0, NonceLength);
+
+            using (var hmac = new HMACSHA256(key))
+            {
+                for (int block = 0; block * TagLength < length; block++)
+                {
+                    BinaryPrimitives.WriteUInt32BigEndian(blockInput.AsSpan(NonceLength), (uint)block);
+                    byte[] keystream = hmac.ComputeHash(blockInput);
+
+                    for (int i = 0; i < keystream.Length && block * TagLength + i < length; i++)
+                    {
+                        data[offset + block * TagLength + i] ^= keystream[i];
+                    }
+                }
+            }
+        }
+    }
+}
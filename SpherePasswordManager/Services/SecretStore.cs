@@ -0,0 +1,148 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Threading;
+using System.Threading.Tasks;
+
+using Microsoft.Extensions.Logging;
+
+namespace SpherePasswordManager.Services
+{
+
+    public class SecretPage
+    {
+        public IReadOnlyList<string> Names { get; set; }
+
+        // Null on the last page
+        public string NextPageToken { get; set; }
+    }
+
+    /// <summary>
+    /// Secret store request failed. Transient failures (throttling, service
+    /// unavailable, network errors) may succeed when repeated.
+    /// </summary>
+    public class SecretStoreException : Exception
+    {
+        public bool IsTransient { get; }
+
+        // Delay requested by the store before next request, if any
+        public TimeSpan? RetryAfter { get; }
+
+        public SecretStoreException(string message, bool isTransient,
+            TimeSpan? retryAfter = null, Exception innerException = null)
+            : base(message, innerException)
+        {
+            IsTransient = isTransient;
+            RetryAfter = retryAfter;
+        }
+    }
+
+    /// <summary>
+    /// Named secret storage holding items and configuration.
+    /// </summary>
+    public interface ISecretStore
+    {
+        /// <param name="pageToken">Null for the first page</param>
+        Task<SecretPage> ListPageAsync(string pageToken, int maxResults,
+            CancellationToken cancellationToken = default);
+
+        /// <returns>Secret value, null if secret does not exist</returns>
+        Task<string> GetAsync(string name, CancellationToken cancellationToken = default);
+
+        Task SetAsync(string name, string value, CancellationToken cancellationToken = default);
+
+        Task DeleteAsync(string name, CancellationToken cancellationToken = default);
+    }
+
+    /// <summary>
+    /// Repeats requests failing with transient errors with exponential backoff,
+    /// waiting at least as long as the store asked for.
+    /// </summary>
+    public class RetryingSecretStore : ISecretStore
+    {
+        private readonly ISecretStore _inner;
+        private readonly ILogger _logger;
+
+        private readonly int MaxAttempts;
+        private readonly TimeSpan BaseDelay;
+
+        private static readonly TimeSpan MaxDelay = TimeSpan.FromSeconds(10);
+
+        [ThreadStatic]
+        private static Random t_random;
+
+        private long _retries;
+
+        public RetryingSecretStore(ISecretStore inner, int maxAttempts, TimeSpan baseDelay,
+            ILogger logger)
+        {
+            _inner = inner;
+            _logger = logger;
+
+            MaxAttempts = Math.Max(1, maxAttempts);
+            BaseDelay = baseDelay;
+        }
+
+        public long Retries => Interlocked.Read(ref _retries);
+
+        public Task<SecretPage> ListPageAsync(string pageToken, int maxResults,
+            CancellationToken cancellationToken = default)
+        {
+            return RunAsync(() => _inner.ListPageAsync(pageToken, maxResults, cancellationToken),
+                cancellationToken);
+        }
+
+        public Task<string> GetAsync(string name, CancellationToken cancellationToken = default)
+        {
+            return RunAsync(() => _inner.GetAsync(name, cancellationToken), cancellationToken);
+        }
+
+        public Task SetAsync(string name, string value, CancellationToken cancellationToken = default)
+        {
+            return RunAsync(async () =>
+            {
+                await _inner.SetAsync(name, value, cancellationToken);
+                return true;
+            }, cancellationToken);
+        }
+
+        public Task DeleteAsync(string name, CancellationToken cancellationToken = default)
+        {
+            return RunAsync(async () =>
+            {
+                await _inner.DeleteAsync(name, cancellationToken);
+                return true;
+            }, cancellationToken);
+        }
+
+        private async Task<T> RunAsync<T>(Func<Task<T>> request, CancellationToken cancellationToken)
+        {
+            for (int attempt = 1; ; attempt++)
+            {
+                try
+                {
+                    return await request();
+                }
+                catch (SecretStoreException ex) when (ex.IsTransient && attempt < MaxAttempts)
+                {
+                    // Full jitter spreads retries of concurrent requests
+                    t_random ??= new Random(Environment.CurrentManagedThreadId ^ Environment.TickCount);
+                    double backoffMs = Math.Min(MaxDelay.TotalMilliseconds,
+                        BaseDelay.TotalMilliseconds * (1 << (attempt - 1)));
+                    TimeSpan delay = TimeSpan.FromMilliseconds(t_random.NextDouble() * backoffMs);
+
+                    if (ex.RetryAfter.HasValue && ex.RetryAfter.Value > delay)
+                    {
+                        delay = ex.RetryAfter.Value;
+                    }
+
+                    Interlocked.Increment(ref _retries);
+                    _logger.LogDebug("Secret store request failed ({Error}), attempt {Attempt} " +
+                        "of {MaxAttempts} in {DelayMs} ms", ex.Message, attempt + 1, MaxAttempts,
+                        (long)delay.TotalMilliseconds);
+
+                    await Task.Delay(delay, cancellationToken);
+                }
+            }
+        }
+    }
+}
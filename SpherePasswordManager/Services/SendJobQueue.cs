@@ -0,0 +1,424 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Text.Json.Serialization;
+using System.Threading;
+using System.Threading.Tasks;
+
+using Microsoft.Extensions.Caching.Memory;
+using Microsoft.Extensions.Configuration;
+using Microsoft.Extensions.DependencyInjection;
+using Microsoft.Extensions.Logging;
+
+namespace SpherePasswordManager.Services
+{
+
+    public enum SendJobState
+    {
+        // Waiting for the device
+        Queued,
+        // Handed over to local network or IoT Hub
+        Sent,
+        // Device accepted the item
+        Acknowledged,
+        // Device typed the item
+        Typed,
+        Failed
+    }
+
+    public class SendJob
+    {
+        // Also sent as request ID, device telemetry refers to it
+        public string Id { get; set; }
+        public int ItemId { get; set; }
+        public string DeviceId { get; set; }
+
+        [JsonConverter(typeof(JsonStringEnumConverter))]
+        public SendJobState State { get; set; }
+
+        public string Message { get; set; }
+
+        // Time since the job was queued
+        public long ElapsedMs { get; set; }
+
+        [JsonIgnore]
+        public bool TypingExpected { get; set; }
+
+        public bool IsFinished => State == SendJobState.Typed || State == SendJobState.Failed ||
+            (State == SendJobState.Acknowledged && !TypingExpected);
+
+        public SendJob Copy()
+        {
+            return (SendJob)MemberwiseClone();
+        }
+    }
+
+    public class DeviceSendStats
+    {
+        public string DeviceId { get; set; }
+        public int Queued { get; set; }
+        public int InFlight { get; set; }
+        public long Acknowledged { get; set; }
+        public long Failed { get; set; }
+
+        // Sends that waited for the device until the call timed out
+        public long Timeouts { get; set; }
+        public long TimeoutMs { get; set; }
+
+        public long AverageSendMs { get; set; }
+    }
+
+    public interface ISendJobQueue
+    {
+        /// <returns>Queued job, null if too many jobs are waiting</returns>
+        SendJob Enqueue(int itemId, string deviceId);
+
+        /// <returns>Job for every device, null and nothing queued if there is
+        /// not room for all of them</returns>
+        IReadOnlyList<SendJob> Enqueue(int itemId, IReadOnlyList<string> deviceIds);
+
+        /// <returns>Current job state, null if job is not known</returns>
+        SendJob Find(string jobId);
+
+        // Raised with a copy of the job on every state change
+        event Action<SendJob> JobChanged;
+
+        IReadOnlyList<DeviceSendStats> GetDeviceStats();
+    }
+
+    /// <summary>
+    /// Sends items in background, so requests do not wait for the device. Every
+    /// device has its own queue worked off by up to MaxParallelPerDevice workers,
+    /// a slow device does not hold up sends to other devices. Job state follows
+    /// the item from queue to typing on device, finished jobs are kept for
+    /// a while for late status requests. Jobs for an offline device wait in
+    /// its queue until the device connects, or fail right away if configured.
+    /// With one worker per device, items reach each device in the order they
+    /// were sent. Sends to a device are spaced by its rate limit.
+    /// </summary>
+    public class SendJobQueue : ISendJobQueue
+    {
+        private readonly IServiceProvider _services;
+        private readonly IMemoryCache _cache;
+        private readonly IDevicePresence _devicePresence;
+        private readonly ILogger<SendJobQueue> _logger;
+
+        private readonly int MaxQueued;
+        private readonly int MaxParallelPerDevice;
+        private readonly TimeSpan Retention;
+        private readonly bool QueueWhileOffline;
+        private readonly TimeSpan OfflineWait;
+
+        // Stopwatch ticks between sends to one device, 0 for no limit
+        private readonly long SendInterval;
+
+        // Typing is reported only if device telemetry is received
+        private readonly bool TypingReported;
+
+        private class DeviceLane
+        {
+            public readonly ConcurrentQueue<(SendJob Job, long QueuedAt)> Jobs =
+                new ConcurrentQueue<(SendJob Job, long QueuedAt)>();
+            public int Workers;
+
+            // Earliest Stopwatch ticks of the next send, guarded by lane lock
+            public long NextSendAt;
+
+            public int InFlight;
+            public long Acknowledged, Failed, Timeouts, TimeoutTicks, Sends, SendTicks;
+        }
+
+        private readonly ConcurrentDictionary<string, DeviceLane> _lanes =
+            new ConcurrentDictionary<string, DeviceLane>();
+        private int _queued;
+
+        public event Action<SendJob> JobChanged;
+
+        public SendJobQueue(IConfiguration config, IServiceProvider services, IMemoryCache cache,
+            IDevicePresence devicePresence, IEnumerable<IDeviceTelemetrySource> telemetrySources,
+            ILogger<SendJobQueue> logger)
+        {
+            _services = services;
+            _cache = cache;
+            _devicePresence = devicePresence;
+            _logger = logger;
+
+            MaxQueued = Math.Max(1, config.GetValue<int>("SendJobs:maxQueued", 1000));
+            MaxParallelPerDevice = Math.Max(1, config.GetValue<int>("SendJobs:maxParallelPerDevice", 1));
+            Retention = TimeSpan.FromMinutes(Math.Max(1, config.GetValue<int>("SendJobs:retentionMin", 10)));
+            QueueWhileOffline = config.GetValue<bool>("SendJobs:queueWhileOffline", true);
+            OfflineWait = TimeSpan.FromMinutes(Math.Max(0, config.GetValue<int>("SendJobs:offlineWaitMin", 10)));
+
+            int sendsPerMin = config.GetValue<int>("SendJobs:perDeviceSendsPerMin", 60);
+            SendInterval = (sendsPerMin > 0) ? Stopwatch.Frequency * 60 / sendsPerMin : 0;
+
+            foreach (IDeviceTelemetrySource telemetrySource in telemetrySources)
+            {
+                telemetrySource.ItemTyped += OnItemTyped;
+                TypingReported = true;
+            }
+        }
+
+        public SendJob Enqueue(int itemId, string deviceId)
+        {
+            return Enqueue(itemId, new[] { deviceId })?[0];
+        }
+
+        public IReadOnlyList<SendJob> Enqueue(int itemId, IReadOnlyList<string> deviceIds)
+        {
+            // Room is reserved for all jobs at once, a request is never queued
+            // for some devices only
+            if (Interlocked.Add(ref _queued, deviceIds.Count) > MaxQueued)
+            {
+                Interlocked.Add(ref _queued, -deviceIds.Count);
+                return null;
+            }
+
+            return deviceIds.Select(deviceId => EnqueueReserved(itemId, deviceId)).ToList();
+        }
+
+        private SendJob EnqueueReserved(int itemId, string deviceId)
+        {
+            var job = new SendJob()
+            {
+                Id = Guid.NewGuid().ToString("N").Substring(0, 12),
+                ItemId = itemId,
+                DeviceId = deviceId ?? "",
+                State = SendJobState.Queued
+            };
+            long queuedAt = Stopwatch.GetTimestamp();
+
+            // Kept without expiry until delivery is settled
+            _cache.Set(CacheKey(job.Id), (job, queuedAt));
+            JobChanged?.Invoke(job.Copy());
+
+            DeviceLane lane = _lanes.GetOrAdd(job.DeviceId, _ => new DeviceLane());
+            lane.Jobs.Enqueue((job, queuedAt));
+            StartWorkers(lane);
+
+            return job.Copy();
+        }
+
+        public SendJob Find(string jobId)
+        {
+            if (jobId == null || !_cache.TryGetValue(CacheKey(jobId), out (SendJob Job, long QueuedAt) entry))
+            {
+                return null;
+            }
+
+            lock (entry.Job)
+            {
+                return entry.Job.Copy();
+            }
+        }
+
+        public IReadOnlyList<DeviceSendStats> GetDeviceStats()
+        {
+            var stats = new List<DeviceSendStats>();
+            foreach (KeyValuePair<string, DeviceLane> entry in _lanes)
+            {
+                DeviceLane lane = entry.Value;
+                long sends = Interlocked.Read(ref lane.Sends);
+                stats.Add(new DeviceSendStats()
+                {
+                    DeviceId = entry.Key,
+                    Queued = lane.Jobs.Count,
+                    InFlight = Volatile.Read(ref lane.InFlight),
+                    Acknowledged = Interlocked.Read(ref lane.Acknowledged),
+                    Failed = Interlocked.Read(ref lane.Failed),
+                    Timeouts = Interlocked.Read(ref lane.Timeouts),
+                    TimeoutMs = Interlocked.Read(ref lane.TimeoutTicks) * 1000 / Stopwatch.Frequency,
+                    AverageSendMs = (sends > 0) ?
+                        Interlocked.Read(ref lane.SendTicks) * 1000 / Stopwatch.Frequency / sends : 0
+                });
+            }
+            return stats;
+        }
+
+        private void StartWorkers(DeviceLane lane)
+        {
+            while (!lane.Jobs.IsEmpty)
+            {
+                int workers = Volatile.Read(ref lane.Workers);
+                if (workers >= MaxParallelPerDevice)
+                {
+                    return;
+                }
+
+                if (Interlocked.CompareExchange(ref lane.Workers, workers + 1, workers) == workers)
+                {
+                    _ = Task.Run(() => RunWorkerAsync(lane));
+                }
+            }
+        }
+
+        private async Task RunWorkerAsync(DeviceLane lane)
+        {
+            try
+            {
+                while (lane.Jobs.TryDequeue(out var entry))
+                {
+                    Interlocked.Decrement(ref _queued);
+                    await SendAsync(lane, entry.Job, entry.QueuedAt).ConfigureAwait(false);
+                }
+            }
+            finally
+            {
+                Interlocked.Decrement(ref lane.Workers);
+            }
+
+            // Jobs queued while this worker was finishing
+            StartWorkers(lane);
+        }
+
+        private async Task SendAsync(DeviceLane lane, SendJob job, long queuedAt)
+        {
+            // Transient service per job, as per request in the web application
+            var itemService = _services.GetRequiredService<IItemService>();
+
+            SendResult result;
+            Stopwatch offlineStopwatch = null;
+            while (true)
+            {
+                await WaitForTurnAsync(lane).ConfigureAwait(false);
+
+                Interlocked.Increment(ref lane.InFlight);
+                long sendStart = Stopwatch.GetTimestamp();
+                try
+                {
+                    result = await itemService.SendAsync(job.ItemId, job.DeviceId, job.Id,
+                        () => Change(job, queuedAt, SendJobState.Sent, null)).ConfigureAwait(false);
+                }
+                catch (Exception ex)
+                {
+                    _logger.LogError(ex, "Send job {JobId} of item {ItemId} failed", job.Id, job.ItemId);
+                    result = new SendResult()
+                    {
+                        Message = "ERROR: Sending failed"
+                    };
+                }
+                finally
+                {
+                    Interlocked.Decrement(ref lane.InFlight);
+                }
+                Account(lane, result, Stopwatch.GetTimestamp() - sendStart);
+
+                if (!result.DeviceOffline || !QueueWhileOffline)
+                {
+                    break;
+                }
+
+                // Following jobs for the device wait behind this one, keeping their order
+                offlineStopwatch = offlineStopwatch ?? Stopwatch.StartNew();
+                TimeSpan remaining = OfflineWait - offlineStopwatch.Elapsed;
+                Change(job, queuedAt, SendJobState.Queued, "Waiting for device to connect");
+                if (remaining <= TimeSpan.Zero || !await _devicePresence.WaitOnlineAsync(
+                    job.DeviceId, remaining, CancellationToken.None).ConfigureAwait(false))
+                {
+                    result.Message = "ERROR: Device offline";
+                    break;
+                }
+            }
+
+            lock (job)
+            {
+                job.TypingExpected = result.TypingExpected && TypingReported;
+            }
+            Change(job, queuedAt, result.Success ? SendJobState.Acknowledged : SendJobState.Failed,
+                result.Message);
+        }
+
+        /// <summary>
+        /// Wait until the rate limit of the device allows next send.
+        /// </summary>
+        private async Task WaitForTurnAsync(DeviceLane lane)
+        {
+            if (SendInterval == 0)
+            {
+                return;
+            }
+
+            long now = Stopwatch.GetTimestamp();
+            long sendAt;
+            lock (lane)
+            {
+                sendAt = Math.Max(now, lane.NextSendAt);
+                lane.NextSendAt = sendAt + SendInterval;
+            }
+
+            if (sendAt > now)
+            {
+                await Task.Delay(TimeSpan.FromSeconds((double)(sendAt - now) / Stopwatch.Frequency))
+                    .ConfigureAwait(false);
+            }
+        }
+
+        private static void Account(DeviceLane lane, SendResult result, long elapsedTicks)
+        {
+            Interlocked.Increment(ref lane.Sends);
+            Interlocked.Add(ref lane.SendTicks, elapsedTicks);
+
+            if (result.Success)
+            {
+                Interlocked.Increment(ref lane.Acknowledged);
+            }
+            else
+            {
+                Interlocked.Increment(ref lane.Failed);
+            }
+
+            if (result.TimedOut)
+            {
+                Interlocked.Increment(ref lane.Timeouts);
+                Interlocked.Add(ref lane.TimeoutTicks, elapsedTicks);
+            }
+        }
+
+        private void OnItemTyped(ItemTypedEvent typedEvent)
+        {
+            if (typedEvent.RequestId == null ||
+                !_cache.TryGetValue(CacheKey(typedEvent.RequestId), out (SendJob Job, long QueuedAt) entry) ||
+                entry.Job.DeviceId != typedEvent.DeviceId)
+            {
+                return;
+            }
+
+            Change(entry.Job, entry.QueuedAt,
+                typedEvent.Success ? SendJobState.Typed : SendJobState.Failed,
+                typedEvent.Success ? null : $"ERROR: Typing failed ({typedEvent.Error})");
+        }
+
+        private void Change(SendJob job, long queuedAt, SendJobState state, string message)
+        {
+            SendJob changed;
+            lock (job)
+            {
+                // Typing report may arrive before device response is processed
+                if (job.IsFinished)
+                {
+                    return;
+                }
+
+                job.State = state;
+                job.Message = message ?? job.Message;
+                job.ElapsedMs = (Stopwatch.GetTimestamp() - queuedAt) * 1000 / Stopwatch.Frequency;
+                changed = job.Copy();
+            }
+
+            if (state == SendJobState.Acknowledged || changed.IsFinished)
+            {
+                // Device answered, typing report is not waited for longer than this
+                _cache.Set(CacheKey(job.Id), (job, queuedAt), Retention);
+            }
+
+            JobChanged?.Invoke(changed);
+        }
+
+        private static string CacheKey(string jobId)
+        {
+            return "SendJob:" + jobId;
+        }
+    }
+}
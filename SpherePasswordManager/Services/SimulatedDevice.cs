@@ -0,0 +1,217 @@
+﻿using System;
+using System.Linq;
+using System.Text;
+using System.Text.Json;
+using System.Threading;
+using System.Threading.Channels;
+using System.Threading.Tasks;
+
+namespace SpherePasswordManager.Services
+{
+
+    public class SimulatedDeviceOptions
+    {
+        // Payloads of this size and longer are rejected
+        public int PayloadMax { get; set; } = 400;
+
+        // Items waiting for typing, more are answered 503
+        public int QueueCapacity { get; set; } = 4;
+
+        // Typing speed, see chunkLength and chunkDelayMs device tunables
+        public int ChunkLength { get; set; } = 32;
+        public int ChunkDelayMs { get; set; } = 150;
+    }
+
+    /// <summary>
+    /// Azure Sphere device answering direct methods the way the device
+    /// application does (see cb_direct_method_call and item_data_parse in
+    /// azsphere_pwd_man/main.c). Accepted items are queued, items marked
+    /// LoadAndSend keep the device busy typing for the time the keyboard
+    /// would need.
+    /// </summary>
+    public class SimulatedDevice : IDisposable
+    {
+        private const int NameLength = 30;
+        private const int UsernameLength = 50;
+        private const int PasswordLength = 50;
+        private const int RequestIdLength = 16;
+
+        private const string ResponseNoPayload = "{ \"success\" : false, \"message\" : " +
+            "\"Request does not contain an identifiable payload\" }";
+        private const string ResponseBusy = "{ \"success\" : false, \"message\" : \"Device busy\" }";
+
+        private readonly SimulatedDeviceOptions _options;
+        private readonly Channel<(int TypedLength, string RequestId)> _itemQueue;
+
+        // Accessed by typing task only
+        private string _lastRequestId = "";
+
+        private long _received, _rejected, _busy, _duplicates, _typed;
+
+        public string DeviceId { get; }
+
+        // Raised with request ID after an item sent with request ID is typed
+        public event Action<string> ItemTyped;
+
+        public SimulatedDevice(string deviceId, SimulatedDeviceOptions options)
+        {
+            DeviceId = deviceId;
+            _options = options;
+
+            _itemQueue = Channel.CreateBounded<(int, string)>(Math.Max(1, options.QueueCapacity));
+            _ = Task.Run(TypeItemsAsync);
+        }
+
+        public long Received => Interlocked.Read(ref _received);
+        public long Rejected => Interlocked.Read(ref _rejected);
+        public long Busy => Interlocked.Read(ref _busy);
+        public long Duplicates => Interlocked.Read(ref _duplicates);
+        public long Typed => Interlocked.Read(ref _typed);
+
+        /// <returns>Direct method status and response payload</returns>
+        public DeviceMethodResult Invoke(string methodName, string payloadJson)
+        {
+            if (Encoding.UTF8.GetByteCount(payloadJson) >= _options.PayloadMax)
+            {
+                return Reject();
+            }
+
+            if (methodName != "set_item_data")
+            {
+                return new DeviceMethodResult()
+                {
+                    Status = 404,
+                    PayloadJson = $"\"method not found '{methodName}'\""
+                };
+            }
+
+            string name, username, password, requestId;
+            bool loadAndSend, unameTabPass;
+            try
+            {
+                using (JsonDocument document = JsonDocument.Parse(payloadJson))
+                {
+                    JsonElement root = document.RootElement;
+                    if (root.ValueKind != JsonValueKind.Object)
+                    {
+                        return Reject();
+                    }
+
+                    name = Truncate(GetString(root, "Name"), NameLength);
+                    username = Truncate(GetString(root, "Username"), UsernameLength);
+                    password = Truncate(GetString(root, "Password"), PasswordLength);
+                    requestId = GetString(root, "RequestId");
+                    loadAndSend = GetBoolean(root, "LoadAndSend");
+                    unameTabPass = GetBoolean(root, "UnameTabPass");
+                }
+            }
+            catch (JsonException)
+            {
+                return Reject();
+            }
+
+            if (name.Length == 0 || password.Length == 0)
+            {
+                return Reject();
+            }
+
+            // Device echoes only request IDs safe to put in JSON
+            if (requestId.Length > RequestIdLength || !requestId.All(IsRequestIdChar))
+            {
+                requestId = "";
+            }
+
+            // Typed text is username and password joined by TAB or Enter
+            int typedLength = password.Length;
+            if (username.Length > 0)
+            {
+                typedLength += username.Length + 1;
+            }
+
+            if (!_itemQueue.Writer.TryWrite((loadAndSend ? typedLength : 0, requestId)))
+            {
+                Interlocked.Increment(ref _busy);
+                return new DeviceMethodResult()
+                {
+                    Status = 503,
+                    PayloadJson = ResponseBusy
+                };
+            }
+
+            Interlocked.Increment(ref _received);
+
+            return new DeviceMethodResult()
+            {
+                Status = 200,
+                PayloadJson = $"{{ \"success\" : true, \"message\" : \"'{name}' loaded\", " +
+                    $"\"requestId\" : \"{requestId}\" }}"
+            };
+        }
+
+        public void Dispose()
+        {
+            _itemQueue.Writer.TryComplete();
+        }
+
+        private DeviceMethodResult Reject()
+        {
+            Interlocked.Increment(ref _rejected);
+            return new DeviceMethodResult()
+            {
+                Status = 400,
+                PayloadJson = ResponseNoPayload
+            };
+        }
+
+        private async Task TypeItemsAsync()
+        {
+            while (await _itemQueue.Reader.WaitToReadAsync())
+            {
+                while (_itemQueue.Reader.TryRead(out var item))
+                {
+                    // Item retried after lost response is not typed twice
+                    if (item.RequestId.Length > 0 && item.RequestId == _lastRequestId)
+                    {
+                        Interlocked.Increment(ref _duplicates);
+                        continue;
+                    }
+                    _lastRequestId = item.RequestId;
+
+                    if (item.TypedLength > 0)
+                    {
+                        int chunks = (item.TypedLength + _options.ChunkLength - 1) / _options.ChunkLength;
+                        await Task.Delay(chunks * _options.ChunkDelayMs);
+                        Interlocked.Increment(ref _typed);
+
+                        if (item.RequestId.Length > 0)
+                        {
+                            ItemTyped?.Invoke(item.RequestId);
+                        }
+                    }
+                }
+            }
+        }
+
+        private static string GetString(JsonElement root, string propertyName)
+        {
+            return (root.TryGetProperty(propertyName, out JsonElement value) &&
+                value.ValueKind == JsonValueKind.String) ? value.GetString() : "";
+        }
+
+        private static bool GetBoolean(JsonElement root, string propertyName)
+        {
+            return root.TryGetProperty(propertyName, out JsonElement value) &&
+                value.ValueKind == JsonValueKind.True;
+        }
+
+        private static bool IsRequestIdChar(char c)
+        {
+            return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F') || c == '-';
+        }
+
+        private static string Truncate(string value, int length)
+        {
+            return (value.Length > length) ? value.Substring(0, length) : value;
+        }
+    }
+}
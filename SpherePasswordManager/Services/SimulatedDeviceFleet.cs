@@ -0,0 +1,175 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace SpherePasswordManager.Services
+{
+
+    public class SimulatedDeviceFleetOptions : SimulatedDeviceOptions
+    {
+        public bool Enabled { get; set; } = false;
+
+        // Registered device IDs, any device ID is accepted when empty
+        public string[] Devices { get; set; } = new string[0];
+
+        // Delay of every call through IoT Hub
+        public int LatencyMs { get; set; } = 80;
+
+        // Random extra delay up to this value
+        public int JitterMs { get; set; } = 40;
+
+        // Devices not connected, calls to them time out
+        public string[] OfflineDevices { get; set; } = new string[0];
+    }
+
+    /// <summary>
+    /// IoT Hub direct method calls answered by simulated devices in process,
+    /// standing in for IoT Hub and Azure Sphere devices when running without Azure.
+    /// Devices report typed items as telemetry and can be disconnected.
+    /// </summary>
+    public class SimulatedDeviceFleet : IDeviceMethodInvoker, IDeviceTelemetrySource,
+        IDevicePresenceSource, IDisposable
+    {
+        private readonly SimulatedDeviceFleetOptions _options;
+
+        private readonly ConcurrentDictionary<string, SimulatedDevice> _devices =
+            new ConcurrentDictionary<string, SimulatedDevice>();
+
+        private readonly ConcurrentDictionary<string, bool> _offline =
+            new ConcurrentDictionary<string, bool>();
+
+        private readonly Random _random = new Random();
+
+        public event Action<ItemTypedEvent> ItemTyped;
+
+        public SimulatedDeviceFleet(SimulatedDeviceFleetOptions options)
+        {
+            _options = options;
+
+            foreach (string deviceId in options.Devices ?? new string[0])
+            {
+                _devices.TryAdd(deviceId, CreateDevice(deviceId));
+            }
+
+            foreach (string deviceId in options.OfflineDevices ?? new string[0])
+            {
+                _offline[deviceId] = true;
+            }
+        }
+
+        public IReadOnlyList<SimulatedDevice> Devices => _devices.Values.ToList();
+
+        /// <summary>
+        /// Connect or disconnect device.
+        /// </summary>
+        public void SetConnected(string deviceId, bool connected)
+        {
+            if (connected)
+            {
+                _offline.TryRemove(deviceId, out _);
+                FindDevice(deviceId);
+            }
+            else
+            {
+                _offline[deviceId] = true;
+            }
+        }
+
+        public Task<IReadOnlyDictionary<string, bool>> QueryConnectedAsync(CancellationToken cancellationToken)
+        {
+            var connected = new Dictionary<string, bool>();
+            foreach (string deviceId in _devices.Keys)
+            {
+                connected[deviceId] = true;
+            }
+            foreach (string deviceId in _offline.Keys)
+            {
+                connected[deviceId] = false;
+            }
+
+            return Task.FromResult<IReadOnlyDictionary<string, bool>>(connected);
+        }
+
+        public async Task<DeviceMethodResult> InvokeAsync(string deviceId, string methodName,
+            string payloadJson, TimeSpan responseTimeout)
+        {
+            SimulatedDevice device = FindDevice(deviceId);
+            if (device == null)
+            {
+                throw new DeviceMethodException("ERROR: Device not registered in IoT Hub");
+            }
+
+            int delayMs;
+            lock (_random)
+            {
+                delayMs = _options.LatencyMs + _random.Next(Math.Max(0, _options.JitterMs) + 1);
+            }
+
+            // IoT Hub waits for device to connect until the call times out
+            if (_offline.ContainsKey(deviceId ?? ""))
+            {
+                await Task.Delay(responseTimeout);
+                throw new DeviceMethodException("ERROR: Timeout connecting device", true, true);
+            }
+
+            // Request reaches the device after half of the round trip
+            Stopwatch stopwatch = Stopwatch.StartNew();
+            await Task.Delay(delayMs / 2);
+
+            if (stopwatch.Elapsed > responseTimeout)
+            {
+                throw new DeviceMethodException("ERROR: Timeout waiting for device response", false, true);
+            }
+
+            DeviceMethodResult result = device.Invoke(methodName, payloadJson);
+
+            await Task.Delay(delayMs - delayMs / 2);
+
+            return result;
+        }
+
+        /// <returns>Registered device, null if not registered</returns>
+        private SimulatedDevice FindDevice(string deviceId)
+        {
+            if (_devices.TryGetValue(deviceId ?? "", out SimulatedDevice device))
+            {
+                return device;
+            }
+
+            if (_options.Devices != null && _options.Devices.Length > 0)
+            {
+                return null;
+            }
+
+            // Any device is registered, created once as it runs its own typing task
+            lock (_devices)
+            {
+                return _devices.GetOrAdd(deviceId ?? "", CreateDevice);
+            }
+        }
+
+        private SimulatedDevice CreateDevice(string deviceId)
+        {
+            var device = new SimulatedDevice(deviceId, _options);
+            device.ItemTyped += requestId => ItemTyped?.Invoke(new ItemTypedEvent()
+            {
+                DeviceId = deviceId,
+                RequestId = requestId,
+                Success = true
+            });
+            return device;
+        }
+
+        public void Dispose()
+        {
+            foreach (SimulatedDevice device in _devices.Values)
+            {
+                device.Dispose();
+            }
+        }
+    }
+}
@@ -8,6 +8,7 @@ using Microsoft.AspNetCore.HttpsPolicy;
 using Microsoft.Extensions.Configuration;
 using Microsoft.Extensions.DependencyInjection;
 using Microsoft.Extensions.Hosting;
+using Microsoft.Extensions.Logging;
 
 using SpherePasswordManager.Services;
 
@@ -29,8 +30,65 @@ namespace SpherePasswordManager
             services.AddControllers();
 
             services.AddMemoryCache();
+
+            // Items and configuration are kept in KeyVault, in-memory store
+            // allows running without Azure
+            services.AddSingleton<ISecretStore>(provider =>
+            {
+                ISecretStore secretStore;
+                if (Configuration.GetValue<string>("SecretStore:provider") == "InMemory")
+                {
+                    secretStore = new InMemorySecretStore(
+                        Configuration.GetSection("SecretStore:InMemory").Get<InMemorySecretStoreOptions>() ??
+                        new InMemorySecretStoreOptions());
+                }
+                else
+                {
+                    secretStore = new KeyVaultSecretStore(Configuration);
+                }
+
+                return new RetryingSecretStore(secretStore,
+                    Configuration.GetValue<int>("SecretStore:maxAttempts", 4),
+                    TimeSpan.FromMilliseconds(Configuration.GetValue<int>("SecretStore:retryBaseDelayMs", 200)),
+                    provider.GetRequiredService<ILogger<RetryingSecretStore>>());
+            });
+
             services.AddTransient<IItemService, ItemService>();
             services.AddTransient<IConfigDataService, ConfigDataService>();
+            services.AddSingleton<ILocalDeviceClient, LocalDeviceClient>();
+            services.AddSingleton<IItemStore, ItemStore>();
+            services.AddSingleton<IItemPrefetcher, ItemPrefetcher>();
+
+            // Simulated devices answer direct methods when running without Azure
+            SimulatedDeviceFleetOptions simulationOptions =
+                Configuration.GetSection("DeviceSimulation").Get<SimulatedDeviceFleetOptions>() ??
+                new SimulatedDeviceFleetOptions();
+            if (simulationOptions.Enabled)
+            {
+                services.AddSingleton(new SimulatedDeviceFleet(simulationOptions));
+                services.AddSingleton<IDeviceMethodInvoker>(
+                    provider => provider.GetRequiredService<SimulatedDeviceFleet>());
+                services.AddSingleton<IDeviceTelemetrySource>(
+                    provider => provider.GetRequiredService<SimulatedDeviceFleet>());
+                services.AddSingleton<IDevicePresenceSource>(
+                    provider => provider.GetRequiredService<SimulatedDeviceFleet>());
+            }
+            else
+            {
+                // Single IoT Hub client shared by all sends, opened at startup
+                services.AddSingleton<IotHubDeviceMethodInvoker>();
+                services.AddSingleton<IDeviceMethodInvoker>(
+                    provider => provider.GetRequiredService<IotHubDeviceMethodInvoker>());
+                services.AddHostedService<IotHubClientWarmup>();
+                services.AddSingleton<IDevicePresenceSource, IotHubDevicePresenceSource>();
+            }
+
+            // Devices known offline are not waited for
+            services.AddSingleton<IDevicePresence, DevicePresenceCache>();
+            services.AddHostedService<DevicePresenceMonitor>();
+
+            // Items are sent in background, browser follows progress by job ID
+            services.AddSingleton<ISendJobQueue, SendJobQueue>();
 
         }
 
@@ -10,16 +10,22 @@ using Newtonsoft.Json;
 using System.Text;
 using System.Threading.Tasks;
 
+using SpherePasswordManager.Services;
+
 namespace sphere_simulator
 {
     class SphereSimulator
     {
         private static DeviceClient s_deviceClient;
 
-        // The device connection string to authenticate the device with your IoT hub.
+        // The device connection string to authenticate the device with your IoT hub,
+        // passed as first argument or in SPHERE_SIMULATOR_CONNECTION_STRING.
         // Using the Azure CLI:
         // az iot hub device-identity show-connection-string --hub-name {YourIoTHubName} --device-id IotTestDevice --output table
-        private readonly static string s_connectionString = "HostName=JGTestIoTHub.azure-devices.net;DeviceId=SphereSimulator;SharedAccessKey=KTGeyIUBbC8j8xWQ3Nlye/DY+sl0GuFc/1ix8Y/llCM=";
+        private readonly static string s_connectionStringVariable = "SPHERE_SIMULATOR_CONNECTION_STRING";
+
+        // Answers set_item_data as the device application does
+        private static SimulatedDevice s_device;
 
         private static int s_telemetryInterval = 100; // Seconds
 
@@ -48,13 +54,15 @@ namespace sphere_simulator
             }
         }
 
-        private static Task<MethodResponse> SetSiteLoginData(MethodRequest methodRequest, object userContext)
+        private static Task<MethodResponse> SetItemData(MethodRequest methodRequest, object userContext)
         {
             var data = Encoding.UTF8.GetString(methodRequest.Data);
-            Console.WriteLine("{0} > Received message: {1}", DateTime.Now, data);
+            Console.WriteLine("{0} > Received item of {1} bytes", DateTime.Now, methodRequest.Data.Length);
+
+            DeviceMethodResult result = s_device.Invoke(methodRequest.Name, data);
+            Console.WriteLine("{0} > Response {1}: {2}", DateTime.Now, result.Status, result.PayloadJson);
 
-            string result = "{\"result\":\"Item loaded.\"}";
-            return Task.FromResult(new MethodResponse(Encoding.UTF8.GetBytes(result), 200));
+            return Task.FromResult(new MethodResponse(Encoding.UTF8.GetBytes(result.PayloadJson), result.Status));
         }
 
 
@@ -95,14 +103,25 @@ namespace sphere_simulator
         {
             Console.WriteLine("Azure Sphere Simulated Device. Ctrl-C to exit.\n");
 
+            string connectionString = (args.Length > 0) ? args[0] :
+                Environment.GetEnvironmentVariable(s_connectionStringVariable);
+            if (string.IsNullOrEmpty(connectionString))
+            {
+                Console.WriteLine("Device connection string missing, pass it as argument or set {0}",
+                    s_connectionStringVariable);
+                return;
+            }
+
+            s_device = new SimulatedDevice("SphereSimulator", new SimulatedDeviceOptions());
+
             // Connect to the IoT hub using the MQTT protocol
-            s_deviceClient = DeviceClient.CreateFromConnectionString(s_connectionString, TransportType.Mqtt);
+            s_deviceClient = DeviceClient.CreateFromConnectionString(connectionString, TransportType.Mqtt);
 
             // Create a handler for the direct method call
             s_deviceClient.SetMethodHandlerAsync("SetTelemetryInterval", SetTelemetryInterval, null).Wait();
 
             // Create a handler for the direct method call
-            s_deviceClient.SetMethodHandlerAsync("SetSiteLoginData", SetSiteLoginData, null).Wait();
+            s_deviceClient.SetMethodHandlerAsync("set_item_data", SetItemData, null).Wait();
 
 
             SendDeviceToCloudMessagesAsync();
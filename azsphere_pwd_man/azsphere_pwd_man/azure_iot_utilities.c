@@ -1,6 +1,8 @@
 ﻿#include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
 
 #include <azureiot/iothub.h>
@@ -9,11 +11,13 @@
 #include <azureiot/iothub_device_client_ll.h>
 #include <azureiot/iothubtransportmqtt.h>
 
-#include <applibs/log.h>
-
 #include "azure_iot_utilities.h"
 #include "build_options.h"
 
+#define LOG_MODULE_NAME "iot"
+#define LOG_MODULE_LEVEL LOG_LEVEL_AZURE_IOT
+#include "log_ring.h"
+
 
 // Refer to https://docs.microsoft.com/en-us/azure/iot-hub/iot-hub-device-sdk-c-intro for more
 // information on Azure IoT SDK for C
@@ -30,10 +34,11 @@
 static const char connectionString[] = MY_CONNECTION_STRING;
 
 /// <summary>
-///     Maximum amount of time to attempt reconnection when the connection to the IoT Hub drops.
+///     Maximum amount of time the IoT Hub client attempts reconnection on its own when the
+///     connection to the IoT Hub drops. The client is recreated afterwards.
 /// </summary>
 /// <remarks>Time expressed in seconds. A value of 0 means to retry forever.</remarks>
-static const size_t retryTimeoutSeconds = 0;
+static const size_t retryTimeoutSeconds = 60;
 
 /// <summary>
 ///     Function invoked to provide the result of the Device Twin reported properties
@@ -51,6 +56,11 @@ static DirectMethodCallFnType directMethodCallCb = 0;
 /// </summary>
 static TwinUpdateFnType twinUpdateCb = 0;
 
+/// <summary>
+///     Function invoked for every desired property changed by a Device Twin update.
+/// </summary>
+static TwinPropertyChangedFnType twinPropertyChangedCb = 0;
+
 /// <summary>
 ///     Function invoked whenever the connection status to the IoT Hub changes.
 /// </summary>
@@ -73,10 +83,243 @@ static MessageDeliveryConfirmationFnType messageDeliveryConfirmationCb = 0;
 IOTHUB_DEVICE_CLIENT_LL_HANDLE iothubClientHandle = NULL;
 
 /// <summary>
-///     Used to set the keepalive period over MQTT to 20 seconds.
+///     Precompiled path of the desired properties in the Device Twin document.
+/// </summary>
+static JSON_Path *desiredPropertiesPath = NULL;
+
+/// <summary>
+///     Cached Device Twin desired properties, updates are merged into it.
+/// </summary>
+static JSON_Value *desiredPropertiesCache = NULL;
+
+/// <summary>
+///     Maximum length of a dot separated desired property path reported to the application.
+/// </summary>
+#define TWIN_PROPERTY_PATH_MAX 128
+
+/// <summary>
+///     Reported properties set since the last flush, sent as a single PATCH.
+/// </summary>
+static JSON_Value *reportedStatePending = NULL;
+
+/// <summary>
+///     Reported properties already handed over to the IoT Hub, used to skip unchanged values.
+/// </summary>
+static JSON_Value *reportedStateSent = NULL;
+
+/// <summary>
+///     Time of the last reported properties flush.
+/// </summary>
+static struct timespec reportedStateLastFlush = {0, 0};
+
+/// <summary>
+///     How often pending reported properties are sent to the IoT Hub.
+/// </summary>
+static const time_t reportedStateFlushPeriodSeconds = 5;
+
+/// <summary>
+///     Reported properties coalescing counters.
+/// </summary>
+static ReportedStateStatistics reportedStateStatistics;
+
+/// <summary>
+///     Maximum number of telemetry events waiting in the queue.
+/// </summary>
+#define TELEMETRY_QUEUE_CAPACITY 32
+
+/// <summary>
+///     Maximum total size in bytes of the telemetry events waiting in the queue.
+/// </summary>
+#define TELEMETRY_QUEUE_MAX_BYTES 8192
+
+/// <summary>
+///     Telemetry event waiting in the queue to be sent.
+/// </summary>
+typedef struct {
+    char *payload;
+    size_t size;
+    int64_t enqueuedMs;
+} TelemetryEvent;
+
+/// <summary>
+///     Telemetry batch handed over to the IoT Hub client, passed to sendMessageCallback.
+/// </summary>
+typedef struct {
+    size_t eventCount;
+    int64_t oldestEnqueuedMs;
+} TelemetryBatch;
+
+/// <summary>
+///     Ring buffer of the telemetry events waiting to be sent.
+/// </summary>
+static TelemetryEvent telemetryQueue[TELEMETRY_QUEUE_CAPACITY];
+static size_t telemetryQueueHead = 0;
+static size_t telemetryQueueCount = 0;
+static size_t telemetryQueueBytes = 0;
+
+/// <summary>
+///     Time of the last telemetry event enqueued, used to flush the queue when idle.
+/// </summary>
+static int64_t telemetryLastEnqueuedMs = 0;
+
+/// <summary>
+///     Number of telemetry batches handed over to the IoT Hub client and not confirmed yet.
+/// </summary>
+static size_t telemetryInFlight = 0;
+
+/// <summary>
+///     Maximum size in bytes of a telemetry batch message.
+/// </summary>
+static const size_t telemetryBatchMaxBytes = 2048;
+
+/// <summary>
+///     Maximum number of telemetry events in a batch message.
+/// </summary>
+static const size_t telemetryBatchMaxEvents = 16;
+
+/// <summary>
+///     Queued telemetry events are sent at the latest after this time in milliseconds.
+/// </summary>
+static const int64_t telemetryBatchMaxAgeMs = 2000;
+
+/// <summary>
+///     Queued telemetry events are sent when no new event arrived for this time in milliseconds.
+/// </summary>
+static const int64_t telemetryBatchIdleMs = 200;
+
+/// <summary>
+///     Maximum number of telemetry batches awaiting delivery confirmation.
+/// </summary>
+static const size_t telemetryMaxInFlight = 2;
+
+/// <summary>
+///     What to do with a new telemetry event when the queue is full.
+/// </summary>
+static TelemetryDropPolicy telemetryDropPolicy = TelemetryDropPolicy_DropOldest;
+
+/// <summary>
+///     Telemetry queue counters.
+/// </summary>
+static TelemetryStatistics telemetryStatistics;
+
+/// <summary>
+///     Whether the client is currently authenticated with the IoT Hub.
+/// </summary>
+static bool hubAuthenticated = false;
+
+/// <summary>
+///     Current state of the connection to the IoT Hub.
+/// </summary>
+static ConnectionState connectionState = ConnectionState_NoClient;
+
+/// <summary>
+///     Set when the client has to be destroyed and created again.
+/// </summary>
+static bool connectionRecreateRequested = false;
+
+/// <summary>
+///     Set when the network went down while the client was connecting or connected.
+/// </summary>
+static bool connectionNetworkLost = false;
+
+/// <summary>
+///     Time of the first connection step, time when the current outage started and time of the
+///     next client creation attempt.
+/// </summary>
+static int64_t connectionStartMs = 0;
+static int64_t connectionOutageStartMs = 0;
+static int64_t connectionNextAttemptMs = 0;
+
+/// <summary>
+///     Number of consecutive failed client creations or recreations, drives the back-off.
+/// </summary>
+static unsigned int connectionFailures = 0;
+
+/// <summary>
+///     First and maximum delay before creating the client again, in milliseconds.
+/// </summary>
+static const int64_t connectionBackoffMinMs = 1000;
+static const int64_t connectionBackoffMaxMs = 5 * 60 * 1000;
+
+/// <summary>
+///     How often the network state is checked while the client cannot connect, in milliseconds.
+/// </summary>
+static const unsigned int connectionPollIntervalMs = 500;
+
+/// <summary>
+///     Connection counters and timings.
+/// </summary>
+static ConnectionStatistics connectionStatistics;
+
+/// <summary>
+///     Used to set the keepalive period over MQTT, 20 seconds unless changed by
+///     AzureIoT_SetKeepAlivePeriod().
 /// </summary>
 static int keepalivePeriodSeconds = 20;
 
+/// <summary>
+///     Number of reported properties updates awaiting the IoT Hub response.
+/// </summary>
+static size_t reportedStateInFlight = 0;
+
+/// <summary>
+///     Interval between DoWork calls while the client is busy, in milliseconds.
+/// </summary>
+static const unsigned int doWorkMinIntervalMs = 100;
+
+/// <summary>
+///     Longest interval between DoWork calls, in milliseconds. Incoming direct method calls are
+///     only received by DoWork, so it bounds how long an idle device takes to pick up a call,
+///     regardless of the keepalive period.
+/// </summary>
+static const unsigned int doWorkMaxIntervalMs = 1000;
+
+/// <summary>
+///     How long the client is considered busy after the last activity, in milliseconds.
+/// </summary>
+static const int64_t doWorkActiveHoldMs = 2000;
+
+/// <summary>
+///     Period of the DoWork statistics window, in milliseconds.
+/// </summary>
+static const int64_t doWorkStatisticsPeriodMs = 60000;
+
+/// <summary>
+///     Interval until the next DoWork call, doubled on every idle call.
+/// </summary>
+static unsigned int doWorkIntervalMs = 100;
+
+/// <summary>
+///     Time of the last message, method call, twin update or connection status change.
+/// </summary>
+static int64_t doWorkLastActivityMs = 0;
+
+/// <summary>
+///     Start of the current DoWork statistics window.
+/// </summary>
+static int64_t doWorkWindowStartMs = 0;
+
+/// <summary>
+///     DoWork calls and time spent in DoWork within the current window.
+/// </summary>
+static unsigned long doWorkWindowCalls = 0;
+static int64_t doWorkWindowBusyUs = 0;
+
+/// <summary>
+///     DoWork scheduling counters.
+/// </summary>
+static DoWorkStatistics doWorkStatistics;
+
+/// <summary>
+///     Duration of DoWork calls in microseconds.
+/// </summary>
+static histogram_t doWorkDurationUs;
+
+/// <summary>
+///     Duration of the application Direct Method callback in microseconds.
+/// </summary>
+static histogram_t directMethodDurationUs;
+
 /// <summary>
 ///     Set of bundle of root certificate authorities.
 /// </summary>
@@ -165,6 +408,13 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
 static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                         IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason,
                                         void *userContextCallback);
+static bool twinValuesEqual(const JSON_Value *a, const JSON_Value *b);
+static void telemetryFlush(bool force);
+static void doWorkScheduleNext(int64_t nowMs);
+static void doWorkAccount(int64_t durationUs, int64_t nowMs);
+static bool setupClientOptions(IOTHUB_DEVICE_CLIENT_LL_HANDLE clientHandle);
+static void connectionAuthenticated(int64_t nowMs);
+static void connectionLost(int64_t nowMs);
 
 #if (defined(IOT_CENTRAL_APPLICATION) || defined(IOT_HUB_APPLICATION))
 #define MAXS_SIZE 512
@@ -207,19 +457,21 @@ static const char *getReasonString(IOTHUB_CLIENT_CONNECTION_STATUS_REASON reason
 }
 
 /// <summary>
-///     Log a message related to the Azure IoT Hub client with
-///     prefix [Azure IoT Hub client]:"
+///     Gets the current time of the monotonic clock in microseconds.
+/// </summary>
+static int64_t getMonotonicTimeUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/// <summary>
+///     Gets the current time of the monotonic clock in milliseconds.
 /// </summary>
-/// <param name="message">The format string containing the error to output along with
-/// placeholders</param>
-/// <param name="...">The list of arguments to populate the format string placeholders</param>
-void LogMessage(char *message, ...)
+static int64_t getMonotonicTimeMs(void)
 {
-    va_list args;
-    va_start(args, message);
-    Log_Debug("[Azure IoT Hub client] ");
-    Log_DebugVarArgs(message, args);
-    va_end(args);
+    return getMonotonicTimeUs() / 1000;
 }
 
 /// <summary>
@@ -228,9 +480,9 @@ void LogMessage(char *message, ...)
 ///     The client is created by using the IoT Hub connection string that is provisioned
 ///     on the device or hardcoded into the source. The client is setup with the following
 ///     options:
-///     - IOTHUB_CLIENT_RETRY_INTERVAL retry policy which, when the network connection
-///       to the IoT Hub drops, attempts a reconnection each 5 seconds for a period of time
-///       of 5000 seconds before giving up;
+///     - IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER retry policy which, when the
+///       network connection to the IoT Hub drops, attempts reconnection for 60 seconds before
+///       giving up; the client is then recreated by AzureIoT_DoPeriodicTasks();
 ///     - MQTT procotol 'keepalive' value of 20 seconds; when no PINGRESP is received after
 ///       20 seconds, the connection is believed to be down and the retry policy kicks in;
 /// </summary>
@@ -251,34 +503,55 @@ bool AzureIoT_SetupClient(void)
         return false;
     }
 
-    if (IoTHubDeviceClient_LL_SetOption(iothubClientHandle, "TrustedCerts",
-                                        azureIoTCertificatesX) != IOTHUB_CLIENT_OK) {
-        LogMessage("ERROR: failure to set option \"TrustedCerts\"\n");
+    if (!setupClientOptions(iothubClientHandle)) {
+        IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
+        iothubClientHandle = NULL;
         return false;
     }
 
-    if (IoTHubDeviceClient_LL_SetOption(iothubClientHandle, OPTION_KEEP_ALIVE,
+    connectionStatistics.clientsCreated++;
+    if (connectionState == ConnectionState_NoClient) {
+        connectionState = ConnectionState_ClientCreated;
+    }
+    return true;
+}
+
+/// <summary>
+///     Sets the options and callbacks of a newly created IoT Hub client. The same certificate
+///     bundle and settings are used every time the client is created.
+/// </summary>
+/// <returns>'true' if all options have been set.</returns>
+static bool setupClientOptions(IOTHUB_DEVICE_CLIENT_LL_HANDLE clientHandle)
+{
+    if (IoTHubDeviceClient_LL_SetOption(clientHandle, "TrustedCerts", azureIoTCertificatesX) !=
+        IOTHUB_CLIENT_OK) {
+        LOG_ERROR("failure to set option \"TrustedCerts\"\n");
+        return false;
+    }
+
+    if (IoTHubDeviceClient_LL_SetOption(clientHandle, OPTION_KEEP_ALIVE,
                                         &keepalivePeriodSeconds) != IOTHUB_CLIENT_OK) {
-        LogMessage("ERROR: failure setting option \"%s\"\n", OPTION_KEEP_ALIVE);
+        LOG_ERROR("failure setting option \"%s\"\n", OPTION_KEEP_ALIVE);
         return false;
     }
 
     // Set callbacks for Message, MethodCall and Device Twin features.
-    IoTHubDeviceClient_LL_SetMessageCallback(iothubClientHandle, receiveMessageCallback, NULL);
-    IoTHubDeviceClient_LL_SetDeviceMethodCallback(iothubClientHandle, directMethodCallback, NULL);
-    IoTHubDeviceClient_LL_SetDeviceTwinCallback(iothubClientHandle, twinCallback, NULL);
+    IoTHubDeviceClient_LL_SetMessageCallback(clientHandle, receiveMessageCallback, NULL);
+    IoTHubDeviceClient_LL_SetDeviceMethodCallback(clientHandle, directMethodCallback, NULL);
+    IoTHubDeviceClient_LL_SetDeviceTwinCallback(clientHandle, twinCallback, NULL);
 
     // Set callbacks for connection status related events.
     if (IoTHubDeviceClient_LL_SetConnectionStatusCallback(
-            iothubClientHandle, hubConnectionStatusCallback, NULL) != IOTHUB_CLIENT_OK) {
-        LogMessage("ERROR: failure setting callback\n");
+            clientHandle, hubConnectionStatusCallback, NULL) != IOTHUB_CLIENT_OK) {
+        LOG_ERROR("failure setting callback\n");
         return false;
     }
 
     // Set retry policy for the connection to the IoT Hub.
-    if (IoTHubDeviceClient_LL_SetRetryPolicy(iothubClientHandle, IOTHUB_CLIENT_RETRY_INTERVAL,
+    if (IoTHubDeviceClient_LL_SetRetryPolicy(clientHandle,
+                                             IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER,
                                              retryTimeoutSeconds) != IOTHUB_CLIENT_OK) {
-        LogMessage("ERROR: failure setting retry policy\n");
+        LOG_ERROR("failure setting retry policy\n");
         return false;
     }
 
@@ -294,34 +567,155 @@ void AzureIoT_DestroyClient(void)
         IoTHubDeviceClient_LL_Destroy(iothubClientHandle);
         iothubClientHandle = NULL;
     }
+    connectionLost(getMonotonicTimeMs());
+    telemetryInFlight = 0;
+    reportedStateInFlight = 0;
+    // The hub state is unknown now, do not skip any value on next report.
+    json_object_clear(json_value_get_object(reportedStateSent));
+    connectionState = ConnectionState_NoClient;
+}
+
+/// <summary>
+///     Schedules the next client creation attempt after a jittered exponential back-off.
+/// </summary>
+/// <remarks>
+///     The delay doubles with every consecutive failure up to connectionBackoffMaxMs, a random
+///     part of up to half of the delay spreads reconnecting devices over time.
+/// </remarks>
+static void connectionScheduleRetry(int64_t nowMs)
+{
+    int64_t delayMs = connectionBackoffMinMs;
+    for (unsigned int i = 0; i < connectionFailures && delayMs < connectionBackoffMaxMs; i++) {
+        delayMs *= 2;
+    }
+    if (delayMs > connectionBackoffMaxMs) {
+        delayMs = connectionBackoffMaxMs;
+    }
+    delayMs = delayMs / 2 + rand() % (delayMs / 2 + 1);
+
+    connectionFailures++;
+    connectionNextAttemptMs = nowMs + delayMs;
+    LOG_INFO("creating the IoT Hub client again in %lld ms\n", (long long)delayMs);
+}
+
+/// <summary>
+///     Advances the connection state machine.
+/// </summary>
+/// <returns>'true' if the client should do its work now, i.e. the network is up.</returns>
+static bool connectionStep(int64_t nowMs)
+{
+    if (connectionStartMs == 0) {
+        connectionStartMs = nowMs;
+        srand((unsigned int)getMonotonicTimeUs());
+    }
+
+    // The client cannot recover on its own, e.g. expired SAS token or retries exhausted.
+    if (connectionRecreateRequested) {
+        connectionRecreateRequested = false;
+        AzureIoT_DestroyClient();
+        connectionScheduleRetry(nowMs);
+    }
+
+    // Create the client up front, it does not need the network until it connects.
+    if (connectionState == ConnectionState_NoClient) {
+        if (nowMs < connectionNextAttemptMs) {
+            return false;
+        }
+        if (!AzureIoT_SetupClient()) {
+            LOG_ERROR("failed to create the IoT Hub client\n");
+            connectionScheduleRetry(nowMs);
+            return false;
+        }
+    }
+
+    bool networkReady = false;
+    if (Networking_IsNetworkingReady(&networkReady) != 0) {
+        networkReady = false;
+    }
+
+    if (!networkReady) {
+        if (connectionState != ConnectionState_ClientCreated) {
+            LOG_INFO("network is down\n");
+            connectionNetworkLost = true;
+            connectionLost(nowMs);
+        }
+        connectionState = ConnectionState_ClientCreated;
+        return false;
+    }
+
+    if (connectionState == ConnectionState_ClientCreated) {
+        // After an outage the client may be waiting out its own retry back-off, start over with
+        // a fresh client so that it connects as soon as the network is back.
+        if (connectionNetworkLost) {
+            connectionNetworkLost = false;
+            AzureIoT_DestroyClient();
+            if (!AzureIoT_SetupClient()) {
+                LOG_ERROR("failed to create the IoT Hub client\n");
+                connectionScheduleRetry(nowMs);
+                return false;
+            }
+        }
+        connectionState = ConnectionState_Connecting;
+    }
+
+    return true;
 }
 
 /// <summary>
-///     Periodically outputs a provided format string with a variable number of arguments.
+///     Starts an outage when the authenticated connection has been lost.
 /// </summary>
-/// <param name="lastInvokedTime">Pointer where to store the 'last time this function has been
-/// invoked' information</param>
-/// <param name="periodInSeconds">The desired period of the output</param>
-/// <param name="format">The format string</param>
-static void PeriodicLogVarArgs(time_t *lastInvokedTime, time_t periodInSeconds, const char *format,
-                               ...)
+static void connectionLost(int64_t nowMs)
 {
-    struct timespec ts;
-    int timeOk = timespec_get(&ts, TIME_UTC);
-    if (!timeOk) {
+    if (!hubAuthenticated) {
         return;
     }
+    hubAuthenticated = false;
+    connectionOutageStartMs = nowMs;
+    connectionStatistics.outages++;
+    if (hubConnectionStatusCb) {
+        hubConnectionStatusCb(false);
+    }
+}
+
+/// <summary>
+///     Records the connection timings when the client has been authenticated.
+/// </summary>
+static void connectionAuthenticated(int64_t nowMs)
+{
+    connectionState = ConnectionState_Authenticated;
+    connectionFailures = 0;
+
+    if (connectionStatistics.bootToAuthenticatedMs == 0) {
+        connectionStatistics.bootToAuthenticatedMs = (unsigned long)(nowMs - connectionStartMs);
+        AzureIoT_TwinReportValue(
+            "connection.bootToAuthenticatedMs",
+            json_value_init_number(connectionStatistics.bootToAuthenticatedMs));
+    }
 
-    if (ts.tv_sec > *lastInvokedTime + periodInSeconds) {
-        va_list args;
-        va_start(args, format);
-        Log_Debug("[Azure IoT Hub client] ");
-        Log_DebugVarArgs(format, args);
-        va_end(args);
-        *lastInvokedTime = ts.tv_sec;
+    if (connectionOutageStartMs != 0) {
+        connectionStatistics.lastRecoveryMs = (unsigned long)(nowMs - connectionOutageStartMs);
+        if (connectionStatistics.lastRecoveryMs > connectionStatistics.maxRecoveryMs) {
+            connectionStatistics.maxRecoveryMs = connectionStatistics.lastRecoveryMs;
+        }
+        connectionOutageStartMs = 0;
+        AzureIoT_TwinReportValue("connection.lastRecoveryMs",
+                                 json_value_init_number(connectionStatistics.lastRecoveryMs));
+        AzureIoT_TwinReportValue("connection.maxRecoveryMs",
+                                 json_value_init_number(connectionStatistics.maxRecoveryMs));
+        AzureIoT_TwinReportValue("connection.outages",
+                                 json_value_init_number((double)connectionStatistics.outages));
     }
 }
 
+/// <summary>
+///     Gets the connection counters and timings.
+/// </summary>
+void AzureIoT_GetConnectionStatistics(ConnectionStatistics *statistics)
+{
+    *statistics = connectionStatistics;
+    statistics->state = connectionState;
+}
+
 /// <summary>
 ///     Keeps IoT Hub Client alive by exchanging data with the Azure IoT Hub.
 /// </summary>
@@ -332,41 +726,372 @@ static void PeriodicLogVarArgs(time_t *lastInvokedTime, time_t periodInSeconds,
 /// </remarks>
 void AzureIoT_DoPeriodicTasks(void)
 {
-    static time_t lastTimeLogged = 0;
-    PeriodicLogVarArgs(&lastTimeLogged, 5, "INFO: %s calls in progress...\n", __func__);
+    static int64_t lastTimeLoggedMs = 0;
+    int64_t nowMs = getMonotonicTimeMs();
+    if (nowMs - lastTimeLoggedMs > 5000) {
+        LOG_DEBUG("%s calls in progress...\n", __func__);
+        lastTimeLoggedMs = nowMs;
+    }
+
+    // Nothing to do until the client exists and the network is up.
+    if (!connectionStep(nowMs)) {
+        doWorkIntervalMs = connectionPollIntervalMs;
+        return;
+    }
+
+    // Send reported properties accumulated since the last flush.
+    struct timespec now;
+    if (hubAuthenticated && json_object_get_count(json_value_get_object(reportedStatePending)) > 0 &&
+        clock_gettime(CLOCK_MONOTONIC, &now) == 0 &&
+        now.tv_sec - reportedStateLastFlush.tv_sec >= reportedStateFlushPeriodSeconds) {
+        AzureIoT_TwinFlushReportedState();
+    }
+
+    // Hand over telemetry batches which are full, old enough or not growing any more.
+    telemetryFlush(false);
 
     // DoWork - send some of the buffered events to the IoT Hub, and receive some of the buffered
     // events from the IoT Hub.
+    int64_t doWorkStartUs = getMonotonicTimeUs();
     IoTHubDeviceClient_LL_DoWork(iothubClientHandle);
+    int64_t doWorkEndUs = getMonotonicTimeUs();
+
+    doWorkScheduleNext(doWorkEndUs / 1000);
+    doWorkAccount(doWorkEndUs - doWorkStartUs, doWorkEndUs / 1000);
 }
 
 /// <summary>
-///     Creates and enqueues a message to be delivered the IoT Hub. The message is not actually sent
-///     immediately, but it is sent on the next invocation of AzureIoT_DoPeriodicTasks().
+///     Chooses the interval until the next DoWork call.
 /// </summary>
-/// <param name="messagePayload">The payload of the message to send.</param>
-void AzureIoT_SendMessage(const char *messagePayload)
+/// <remarks>
+///     While messages or reported properties wait for delivery, or shortly after any activity,
+///     DoWork runs every doWorkMinIntervalMs. Otherwise the interval doubles on every call up to
+///     doWorkMaxIntervalMs, or half of the MQTT keepalive period if shorter, so that the keepalive
+///     ping is still sent in time.
+/// </remarks>
+static void doWorkScheduleNext(int64_t nowMs)
 {
-    if (iothubClientHandle == NULL) {
-        LogMessage("WARNING: IoT Hub client not initialized\n");
-        return;
+    unsigned int maxIntervalMs = (unsigned int)keepalivePeriodSeconds * 1000 / 2;
+    if (maxIntervalMs > doWorkMaxIntervalMs) {
+        maxIntervalMs = doWorkMaxIntervalMs;
     }
 
-    IOTHUB_MESSAGE_HANDLE messageHandle = IoTHubMessage_CreateFromString(messagePayload);
+    bool busy = !hubAuthenticated || telemetryQueueCount > 0 || telemetryInFlight > 0 ||
+                reportedStateInFlight > 0 ||
+                json_object_get_count(json_value_get_object(reportedStatePending)) > 0 ||
+                nowMs - doWorkLastActivityMs < doWorkActiveHoldMs;
 
-    if (messageHandle == 0) {
-        LogMessage("WARNING: unable to create a new IoTHubMessage\n");
+    if (busy) {
+        doWorkIntervalMs = doWorkMinIntervalMs;
+    } else if (doWorkIntervalMs < maxIntervalMs / 2) {
+        doWorkIntervalMs *= 2;
+    } else {
+        doWorkIntervalMs = maxIntervalMs;
+    }
+}
+
+/// <summary>
+///     Accounts a DoWork call, publishes the statistics once per window.
+/// </summary>
+/// <param name="durationUs">Time spent in DoWork in microseconds.</param>
+/// <param name="nowMs">Current monotonic time in milliseconds.</param>
+static void doWorkAccount(int64_t durationUs, int64_t nowMs)
+{
+    doWorkStatistics.intervalMs = doWorkIntervalMs;
+    doWorkStatistics.calls++;
+    doWorkWindowCalls++;
+    doWorkWindowBusyUs += durationUs;
+    histogram_record(&doWorkDurationUs, (uint32_t)durationUs);
+
+    if (doWorkWindowStartMs == 0) {
+        doWorkWindowStartMs = nowMs;
+        return;
+    }
+    if (nowMs - doWorkWindowStartMs < doWorkStatisticsPeriodMs) {
         return;
     }
 
-    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, sendMessageCallback,
-                                             /*&callback_param*/ 0) != IOTHUB_CLIENT_OK) {
-        LogMessage("WARNING: failed to hand over the message to IoTHubClient\n");
+    // Normalize to a minute, the window may be longer when DoWork runs rarely.
+    int64_t windowMs = nowMs - doWorkWindowStartMs;
+    doWorkStatistics.callsPerMinute = (unsigned long)(doWorkWindowCalls * 60000 / windowMs);
+    doWorkStatistics.busyMsPerMinute = (unsigned long)(doWorkWindowBusyUs * 60 / windowMs);
+    doWorkWindowStartMs = nowMs;
+    doWorkWindowCalls = 0;
+    doWorkWindowBusyUs = 0;
+
+    AzureIoT_TwinReportValue("doWork.intervalMs", json_value_init_number(doWorkIntervalMs));
+    AzureIoT_TwinReportValue("doWork.callsPerMinute",
+                             json_value_init_number(doWorkStatistics.callsPerMinute));
+    AzureIoT_TwinReportValue("doWork.busyMsPerMinute",
+                             json_value_init_number(doWorkStatistics.busyMsPerMinute));
+}
+
+/// <summary>
+///     Gets the interval until AzureIoT_DoPeriodicTasks() should be called again.
+/// </summary>
+unsigned int AzureIoT_GetDoWorkIntervalMs(void)
+{
+    return doWorkIntervalMs;
+}
+
+/// <summary>
+///     Marks the client as busy so that DoWork runs at the fastest rate again.
+/// </summary>
+void AzureIoT_NotifyActivity(void)
+{
+    doWorkLastActivityMs = getMonotonicTimeMs();
+    doWorkIntervalMs = doWorkMinIntervalMs;
+}
+
+/// <summary>
+///     Gets the DoWork scheduling counters.
+/// </summary>
+void AzureIoT_GetDoWorkStatistics(DoWorkStatistics *statistics)
+{
+    *statistics = doWorkStatistics;
+}
+
+/// <summary>
+///     Sets the MQTT keepalive period.
+/// </summary>
+void AzureIoT_SetKeepAlivePeriod(int seconds)
+{
+    keepalivePeriodSeconds = seconds;
+
+    if (iothubClientHandle != NULL &&
+        IoTHubDeviceClient_LL_SetOption(iothubClientHandle, OPTION_KEEP_ALIVE,
+                                        &keepalivePeriodSeconds) != IOTHUB_CLIENT_OK) {
+        LOG_ERROR("failure setting option \"%s\"\n", OPTION_KEEP_ALIVE);
+    }
+
+    // The longest DoWork interval follows the keepalive period.
+    doWorkIntervalMs = doWorkMinIntervalMs;
+}
+
+/// <summary>
+///     Gets the histogram of DoWork durations.
+/// </summary>
+const histogram_t *AzureIoT_GetDoWorkHistogram(void)
+{
+    return &doWorkDurationUs;
+}
+
+/// <summary>
+///     Gets the histogram of Direct Method callback durations.
+/// </summary>
+const histogram_t *AzureIoT_GetDirectMethodHistogram(void)
+{
+    return &directMethodDurationUs;
+}
+
+/// <summary>
+///     Removes the oldest telemetry event from the queue.
+/// </summary>
+static void telemetryQueuePop(void)
+{
+    TelemetryEvent *event = &telemetryQueue[telemetryQueueHead];
+    telemetryQueueBytes -= event->size;
+    free(event->payload);
+    event->payload = NULL;
+    telemetryQueueHead = (telemetryQueueHead + 1) % TELEMETRY_QUEUE_CAPACITY;
+    telemetryQueueCount--;
+}
+
+/// <summary>
+///     Enqueues a telemetry event to be delivered to the IoT Hub.
+/// </summary>
+bool AzureIoT_SendMessage(const char *messagePayload)
+{
+    if (messagePayload == NULL) {
+        return false;
+    }
+
+    size_t size = strlen(messagePayload);
+    if (size > TELEMETRY_QUEUE_MAX_BYTES) {
+        LOG_WARNING("telemetry event of %zu bytes is too large\n", size);
+        telemetryStatistics.dropped++;
+        return false;
+    }
+
+    // Make room for the new event according to the drop policy.
+    while (telemetryQueueCount == TELEMETRY_QUEUE_CAPACITY ||
+           telemetryQueueBytes + size > TELEMETRY_QUEUE_MAX_BYTES) {
+        telemetryStatistics.dropped++;
+        if (telemetryDropPolicy == TelemetryDropPolicy_RejectNew) {
+            return false;
+        }
+        telemetryQueuePop();
+    }
+
+    char *payload = malloc(size + 1);
+    if (payload == NULL) {
+        LOG_WARNING("unable to allocate telemetry event\n");
+        telemetryStatistics.dropped++;
+        return false;
+    }
+    memcpy(payload, messagePayload, size + 1);
+
+    telemetryLastEnqueuedMs = getMonotonicTimeMs();
+    TelemetryEvent *event =
+        &telemetryQueue[(telemetryQueueHead + telemetryQueueCount) % TELEMETRY_QUEUE_CAPACITY];
+    event->payload = payload;
+    event->size = size;
+    event->enqueuedMs = telemetryLastEnqueuedMs;
+    telemetryQueueCount++;
+    telemetryQueueBytes += size;
+
+    telemetryStatistics.enqueued++;
+    doWorkIntervalMs = doWorkMinIntervalMs;
+    telemetryStatistics.queueDepth = telemetryQueueCount;
+    if (telemetryQueueCount > telemetryStatistics.queueDepthMax) {
+        telemetryStatistics.queueDepthMax = telemetryQueueCount;
+    }
+    return true;
+}
+
+/// <summary>
+///     Determines how many of the queued telemetry events fit into the next batch.
+/// </summary>
+/// <param name="batchBytes">Where to store the size of the batch message.</param>
+/// <returns>The number of events in the batch.</returns>
+static size_t telemetryNextBatch(size_t *batchBytes)
+{
+    size_t count = 1;
+    size_t bytes = telemetryQueue[telemetryQueueHead].size;
+
+    // More than one event is sent as a JSON array, i.e. brackets and separating commas.
+    while (count < telemetryQueueCount && count < telemetryBatchMaxEvents) {
+        const TelemetryEvent *event =
+            &telemetryQueue[(telemetryQueueHead + count) % TELEMETRY_QUEUE_CAPACITY];
+        size_t next = bytes + (count == 1 ? 2 : 0) + 1 + event->size;
+        if (next > telemetryBatchMaxBytes) {
+            break;
+        }
+        bytes = next;
+        count++;
+    }
+
+    *batchBytes = bytes;
+    return count;
+}
+
+/// <summary>
+///     Hands over the next telemetry batch to the IoT Hub client.
+/// </summary>
+/// <returns>'true' if the batch has been accepted by the IoT Hub client.</returns>
+static bool telemetrySendBatch(size_t eventCount, size_t batchBytes)
+{
+    TelemetryBatch *batch = malloc(sizeof(TelemetryBatch));
+    if (batch == NULL) {
+        return false;
+    }
+    batch->eventCount = eventCount;
+    batch->oldestEnqueuedMs = telemetryQueue[telemetryQueueHead].enqueuedMs;
+
+    IOTHUB_MESSAGE_HANDLE messageHandle;
+    if (eventCount == 1) {
+        messageHandle = IoTHubMessage_CreateFromString(telemetryQueue[telemetryQueueHead].payload);
     } else {
-        LogMessage("INFO: IoTHubClient accepted the message for delivery\n");
+        char *payload = malloc(batchBytes + 1);
+        if (payload == NULL) {
+            free(batch);
+            return false;
+        }
+        char *p = payload;
+        *p++ = '[';
+        for (size_t i = 0; i < eventCount; i++) {
+            const TelemetryEvent *event =
+                &telemetryQueue[(telemetryQueueHead + i) % TELEMETRY_QUEUE_CAPACITY];
+            if (i > 0) {
+                *p++ = ',';
+            }
+            memcpy(p, event->payload, event->size);
+            p += event->size;
+        }
+        *p++ = ']';
+        *p = '\0';
+        messageHandle = IoTHubMessage_CreateFromString(payload);
+        free(payload);
+    }
+
+    if (messageHandle == 0) {
+        LOG_WARNING("unable to create a new IoTHubMessage\n");
+        free(batch);
+        return false;
     }
 
+    if (IoTHubDeviceClient_LL_SendEventAsync(iothubClientHandle, messageHandle, sendMessageCallback,
+                                             batch) != IOTHUB_CLIENT_OK) {
+        LOG_WARNING("failed to hand over the message to IoTHubClient\n");
+        IoTHubMessage_Destroy(messageHandle);
+        free(batch);
+        return false;
+    }
     IoTHubMessage_Destroy(messageHandle);
+
+    for (size_t i = 0; i < eventCount; i++) {
+        telemetryQueuePop();
+    }
+    telemetryInFlight++;
+    telemetryStatistics.batchesSent++;
+    telemetryStatistics.lastBatchSize = eventCount;
+    telemetryStatistics.queueDepth = telemetryQueueCount;
+    return true;
+}
+
+/// <summary>
+///     Hands over queued telemetry batches to the IoT Hub client.
+/// </summary>
+/// <remarks>
+///     Events are held back while the client is not authenticated or too many batches await
+///     confirmation. A batch is sent when it is full, its oldest event is older than
+///     telemetryBatchMaxAgeMs or no event has been enqueued for telemetryBatchIdleMs.
+/// </remarks>
+/// <param name="force">'true' to send all queued events regardless of the batch timers.</param>
+static void telemetryFlush(bool force)
+{
+    int64_t now = getMonotonicTimeMs();
+
+    while (telemetryQueueCount > 0 && iothubClientHandle != NULL && hubAuthenticated &&
+           telemetryInFlight < telemetryMaxInFlight) {
+        size_t batchBytes;
+        size_t eventCount = telemetryNextBatch(&batchBytes);
+
+        bool full = eventCount < telemetryQueueCount || eventCount == telemetryBatchMaxEvents;
+        bool aged = now - telemetryQueue[telemetryQueueHead].enqueuedMs >= telemetryBatchMaxAgeMs;
+        bool idle = now - telemetryLastEnqueuedMs >= telemetryBatchIdleMs;
+        if (!force && !full && !aged && !idle) {
+            break;
+        }
+
+        if (!telemetrySendBatch(eventCount, batchBytes)) {
+            break;
+        }
+    }
+}
+
+/// <summary>
+///     Hands over all queued telemetry events to the IoT Hub client.
+/// </summary>
+void AzureIoT_FlushTelemetry(void)
+{
+    telemetryFlush(true);
+}
+
+/// <summary>
+///     Sets what to do with a new telemetry event when the queue is full.
+/// </summary>
+void AzureIoT_SetTelemetryDropPolicy(TelemetryDropPolicy policy)
+{
+    telemetryDropPolicy = policy;
+}
+
+/// <summary>
+///     Gets the telemetry queue counters.
+/// </summary>
+void AzureIoT_GetTelemetryStatistics(TelemetryStatistics *statistics)
+{
+    *statistics = telemetryStatistics;
 }
 
 /// <summary>
@@ -385,67 +1110,138 @@ void AzureIoT_SetDeviceTwinDeliveryConfirmationCallback(
 /// </summary>
 static void reportStatusCallback(int result, void *context)
 {
-    LogMessage("INFO: Device Twin reported properties update result: HTTP status code %d\n",
+    if (reportedStateInFlight > 0) {
+        reportedStateInFlight--;
+    }
+    LOG_INFO("Device Twin reported properties update result: HTTP status code %d\n",
                result);
+    if (result < 200 || result >= 300) {
+        // The hub state is unknown now, do not skip any value on next report.
+        json_object_clear(json_value_get_object(reportedStateSent));
+    }
     if (deviceTwinConfirmationCb)
         deviceTwinConfirmationCb(result);
 }
 
 /// <summary>
-///     Creates and enqueues a report containing the name and value pair of a Device Twin reported
-///     property.
-///     The report is not actually sent immediately, but it is sent on the next invocation of
-///     AzureIoT_DoPeriodicTasks().
+///     Merges reported properties into an object, values are copied.
 /// </summary>
-void AzureIoT_TwinReportState(const char *propertyName, size_t propertyValue)
+static void reportedStateMerge(JSON_Object *target, const JSON_Object *source)
 {
-    if (iothubClientHandle == NULL) {
-        LogMessage("ERROR: client not initialized\n");
+    for (size_t i = 0; i < json_object_get_count(source); i++) {
+        const char *name = json_object_get_name(source, i);
+        JSON_Value *sourceValue = json_object_get_value_at(source, i);
+        JSON_Object *targetObject = json_object_get_object(target, name);
+        if (json_value_get_type(sourceValue) == JSONObject && targetObject != NULL) {
+            reportedStateMerge(targetObject, json_value_get_object(sourceValue));
+        } else {
+            JSON_Value *copy = json_value_deep_copy(sourceValue);
+            if (copy != NULL && json_object_set_value(target, name, copy) != JSONSuccess) {
+                json_value_free(copy);
+            }
+        }
+    }
+}
+
+/// <summary>
+///     Sets a Device Twin reported property. Properties are accumulated and sent as a single
+///     report on the next flush. Setting a property again before the flush replaces the pending
+///     value, values equal to the last reported ones are skipped.
+/// </summary>
+/// <param name="propertyName">The name of the property, dots address nested objects.</param>
+/// <param name="propertyValue">The value of the property, ownership is taken over.</param>
+void AzureIoT_TwinReportValue(const char *propertyName, JSON_Value *propertyValue)
+{
+    if (propertyValue == NULL) {
+        LOG_ERROR("could not create the JSON_Value for Device Twin reporting.\n");
         return;
     }
 
-    char *reportedPropertiesString = NULL;
-    JSON_Value *reportedPropertiesRootJson = json_value_init_object();
-    if (reportedPropertiesRootJson == NULL) {
-        LogMessage("ERROR: could not create the JSON_Value for Device Twin reporting.\n");
+    if (reportedStatePending == NULL) {
+        reportedStatePending = json_value_init_object();
+    }
+    if (reportedStateSent == NULL) {
+        reportedStateSent = json_value_init_object();
+    }
+    JSON_Object *pending = json_value_get_object(reportedStatePending);
+    JSON_Object *sent = json_value_get_object(reportedStateSent);
+    if (pending == NULL || sent == NULL) {
+        LOG_ERROR("could not get the JSON_Object for Device Twin reporting.\n");
+        json_value_free(propertyValue);
         return;
     }
 
-    JSON_Object *reportedPropertiesJson = json_value_get_object(reportedPropertiesRootJson);
-    if (reportedPropertiesJson == NULL) {
-        LogMessage("ERROR: could not get the JSON_Object for Device Twin reporting.\n");
-        goto cleanup;
+    reportedStateStatistics.writes++;
+
+    JSON_Value *pendingValue = json_object_dotget_value(pending, propertyName);
+    JSON_Value *sentValue = json_object_dotget_value(sent, propertyName);
+    if (pendingValue == NULL && sentValue != NULL && twinValuesEqual(sentValue, propertyValue)) {
+        reportedStateStatistics.unchanged++;
+        json_value_free(propertyValue);
+        return;
+    }
+    if (pendingValue != NULL) {
+        reportedStateStatistics.coalesced++;
     }
+    doWorkIntervalMs = doWorkMinIntervalMs;
 
-    if (JSONSuccess !=
-        json_object_set_number(reportedPropertiesJson, propertyName, propertyValue)) {
-        LogMessage("ERROR: could not set the property value for Device Twin reporting.\n");
-        goto cleanup;
+    if (json_object_dotset_value(pending, propertyName, propertyValue) != JSONSuccess) {
+        LOG_ERROR("could not set the property value for Device Twin reporting.\n");
+        json_value_free(propertyValue);
+    }
+}
+
+/// <summary>
+///     Sets a numeric Device Twin reported property.
+///     The report is not actually sent immediately, but it is sent on the next flush.
+/// </summary>
+void AzureIoT_TwinReportState(const char *propertyName, size_t propertyValue)
+{
+    AzureIoT_TwinReportValue(propertyName, json_value_init_number((double)propertyValue));
+}
+
+/// <summary>
+///     Sends all pending reported properties to the IoT Hub as a single report.
+/// </summary>
+void AzureIoT_TwinFlushReportedState(void)
+{
+    JSON_Object *pending = json_value_get_object(reportedStatePending);
+    if (iothubClientHandle == NULL || json_object_get_count(pending) == 0) {
+        return;
     }
 
-    reportedPropertiesString = json_serialize_to_string(reportedPropertiesRootJson);
+    clock_gettime(CLOCK_MONOTONIC, &reportedStateLastFlush);
+
+    char *reportedPropertiesString = json_serialize_to_string(reportedStatePending);
     if (reportedPropertiesString == NULL) {
-        LogMessage(
-            "ERROR: could not serialize the JSON payload to string for Device "
+        LOG_ERROR(
+            "could not serialize the JSON payload to string for Device "
             "Twin reporting.\n");
-        goto cleanup;
+        return;
     }
 
     if (IoTHubDeviceClient_LL_SendReportedState(
             iothubClientHandle, (unsigned char *)reportedPropertiesString,
             strlen(reportedPropertiesString), reportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
-        LogMessage("ERROR: failed to set reported property '%s'.\n", propertyName);
+        LOG_ERROR("failed to set reported state as '%s'.\n", reportedPropertiesString);
     } else {
-        LogMessage("INFO: Set reported property '%s' to value %d.\n", propertyName, propertyValue);
+        LOG_INFO("Reported state as '%s'.\n", reportedPropertiesString);
+        reportedStateStatistics.flushes++;
+        reportedStateInFlight++;
+        reportedStateMerge(json_value_get_object(reportedStateSent), pending);
+        json_object_clear(pending);
     }
 
-cleanup:
-    if (reportedPropertiesRootJson != NULL) {
-        json_value_free(reportedPropertiesRootJson);
-    }
-    if (reportedPropertiesString != NULL) {
-        json_free_serialized_string(reportedPropertiesString);
-    }
+    json_free_serialized_string(reportedPropertiesString);
+}
+
+/// <summary>
+///     Gets the reported properties coalescing counters.
+/// </summary>
+/// <param name="statistics">Where to store the counters.</param>
+void AzureIoT_GetReportedStateStatistics(ReportedStateStatistics *statistics)
+{
+    *statistics = reportedStateStatistics;
 }
 
 /// <summary>
@@ -473,7 +1269,28 @@ void AzureIoT_SetMessageConfirmationCallback(MessageDeliveryConfirmationFnType c
 /// <param name="context">User specified context</param>
 static void sendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *context)
 {
-    LogMessage("INFO: Message received by IoT Hub. Result is: %d\n", result);
+    TelemetryBatch *batch = (TelemetryBatch *)context;
+    if (batch != NULL) {
+        if (telemetryInFlight > 0) {
+            telemetryInFlight--;
+        }
+        int64_t latencyMs = getMonotonicTimeMs() - batch->oldestEnqueuedMs;
+        if (result == IOTHUB_CLIENT_CONFIRMATION_OK) {
+            telemetryStatistics.eventsDelivered += batch->eventCount;
+            telemetryStatistics.lastDeliveryLatencyMs = (unsigned long)latencyMs;
+            if (telemetryStatistics.lastDeliveryLatencyMs >
+                telemetryStatistics.maxDeliveryLatencyMs) {
+                telemetryStatistics.maxDeliveryLatencyMs =
+                    telemetryStatistics.lastDeliveryLatencyMs;
+            }
+        } else {
+            telemetryStatistics.eventsFailed += batch->eventCount;
+        }
+        LOG_INFO("batch of %zu event(s) confirmed by IoT Hub, result %d, latency %lld ms, "
+                   "%zu queued\n",
+                   batch->eventCount, result, (long long)latencyMs, telemetryQueueCount);
+        free(batch);
+    }
     if (messageDeliveryConfirmationCb) {
         messageDeliveryConfirmationCb(result == IOTHUB_CLIENT_CONFIRMATION_OK);
     }
@@ -490,17 +1307,18 @@ static void sendMessageCallback(IOTHUB_CLIENT_CONFIRMATION_RESULT result, void *
 static IOTHUBMESSAGE_DISPOSITION_RESULT receiveMessageCallback(IOTHUB_MESSAGE_HANDLE message,
                                                                void *context)
 {
+    AzureIoT_NotifyActivity();
     const unsigned char *buffer = NULL;
     size_t size = 0;
     if (IoTHubMessage_GetByteArray(message, &buffer, &size) != IOTHUB_MESSAGE_OK) {
-        LogMessage("WARNING: failure performing IoTHubMessage_GetByteArray\n");
+        LOG_WARNING("failure performing IoTHubMessage_GetByteArray\n");
         return IOTHUBMESSAGE_REJECTED;
     }
 
     // 'buffer' is not zero terminated.
     unsigned char *str_msg = (unsigned char *)malloc(size + 1);
     if (str_msg == NULL) {
-        LogMessage("ERROR: could not allocate buffer for incoming message\n");
+        LOG_ERROR("could not allocate buffer for incoming message\n");
         abort();
     }
     memcpy(str_msg, buffer, size);
@@ -509,10 +1327,10 @@ static IOTHUBMESSAGE_DISPOSITION_RESULT receiveMessageCallback(IOTHUB_MESSAGE_HA
     if (messageReceivedCb != 0) {
         messageReceivedCb(str_msg);
     } else {
-        LogMessage("WARNING: no user callback set up for event 'message received from IoT Hub'\n");
+        LOG_WARNING("no user callback set up for event 'message received from IoT Hub'\n");
     }
 
-    LogMessage("INFO: Received message '%s' from IoT Hub\n", str_msg);
+    LOG_INFO("Received message '%s' from IoT Hub\n", str_msg);
     free(str_msg);
 
     return IOTHUBMESSAGE_ACCEPTED;
@@ -539,6 +1357,124 @@ void AzureIoT_SetDeviceTwinUpdateCallback(TwinUpdateFnType callback)
     twinUpdateCb = callback;
 }
 
+/// <summary>
+///     Sets the function callback invoked for every desired property changed by a Device Twin
+///     update.
+/// </summary>
+/// <param name="callback">The callback function invoked for every changed property</param>
+void AzureIoT_SetDeviceTwinPropertyChangedCallback(TwinPropertyChangedFnType callback)
+{
+    twinPropertyChangedCb = callback;
+}
+
+/// <summary>
+///     Gets the cached Device Twin desired properties.
+/// </summary>
+const JSON_Object *AzureIoT_GetDesiredProperties(void)
+{
+    return json_value_get_object(desiredPropertiesCache);
+}
+
+/// <summary>
+///     Compares two JSON values, numbers are compared exactly.
+/// </summary>
+static bool twinValuesEqual(const JSON_Value *a, const JSON_Value *b)
+{
+    if (json_value_get_type(a) == JSONNumber && json_value_get_type(b) == JSONNumber) {
+        return json_value_get_number(a) == json_value_get_number(b);
+    }
+    return json_value_equals(a, b) != 0;
+}
+
+/// <summary>
+///     Reports a changed desired property to the application.
+/// </summary>
+static void twinReportPropertyChanged(const char *path, const JSON_Value *value)
+{
+    LOG_INFO("Desired property '%s' %s\n", path, value != NULL ? "changed" : "removed");
+    if (twinPropertyChangedCb != NULL) {
+        twinPropertyChangedCb(path, value);
+    }
+}
+
+/// <summary>
+///     Applies a JSON merge patch (RFC 7386) to the cached desired properties in place and reports
+///     every property whose value changed.
+/// </summary>
+/// <param name="target">Cached object the patch is applied to.</param>
+/// <param name="patch">The patch object. Null members remove properties from the target.</param>
+/// <param name="removeMissing">'true' when patch is a complete document, target members missing
+/// in it are removed as well.</param>
+/// <param name="path">Buffer holding the path of the target object.</param>
+/// <param name="pathLength">Length of the path of the target object.</param>
+static void twinMergePatch(JSON_Object *target, const JSON_Object *patch, bool removeMissing,
+                           char *path, size_t pathLength)
+{
+    if (removeMissing) {
+        // Iterate backwards, removal moves the last member into the removed slot.
+        for (size_t i = json_object_get_count(target); i > 0; i--) {
+            const char *name = json_object_get_name(target, i - 1);
+            if (name[0] != '$' && json_object_get_value(patch, name) == NULL) {
+                snprintf(path + pathLength, TWIN_PROPERTY_PATH_MAX - pathLength, "%s%s",
+                         pathLength > 0 ? "." : "", name);
+                twinReportPropertyChanged(path, NULL);
+                path[pathLength] = '\0';
+                json_object_remove(target, name);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < json_object_get_count(patch); i++) {
+        const char *name = json_object_get_name(patch, i);
+        JSON_Value *patchValue = json_object_get_value_at(patch, i);
+        JSON_Value *targetValue = json_object_get_value(target, name);
+        bool isMetadata = (name[0] == '$');
+
+        int written = snprintf(path + pathLength, TWIN_PROPERTY_PATH_MAX - pathLength, "%s%s",
+                               pathLength > 0 ? "." : "", name);
+        size_t childPathLength = pathLength + (size_t)written;
+        if (childPathLength >= TWIN_PROPERTY_PATH_MAX) {
+            childPathLength = TWIN_PROPERTY_PATH_MAX - 1;
+        }
+
+        if (json_value_get_type(patchValue) == JSONNull) {
+            if (targetValue != NULL) {
+                if (!isMetadata) {
+                    twinReportPropertyChanged(path, NULL);
+                }
+                json_object_remove(target, name);
+            }
+        } else if (json_value_get_type(patchValue) == JSONObject) {
+            if (json_value_get_type(targetValue) != JSONObject) {
+                targetValue = json_value_init_object();
+                if (targetValue == NULL ||
+                    json_object_set_value(target, name, targetValue) != JSONSuccess) {
+                    LOG_ERROR("could not update the cached Device Twin.\n");
+                    json_value_free(targetValue);
+                    path[pathLength] = '\0';
+                    continue;
+                }
+                if (json_object_get_count(json_value_get_object(patchValue)) == 0 && !isMetadata) {
+                    twinReportPropertyChanged(path, targetValue);
+                }
+            }
+            twinMergePatch(json_value_get_object(targetValue), json_value_get_object(patchValue),
+                           removeMissing, path, childPathLength);
+        } else if (targetValue == NULL || !twinValuesEqual(targetValue, patchValue)) {
+            JSON_Value *newValue = json_value_deep_copy(patchValue);
+            if (newValue == NULL ||
+                json_object_set_value(target, name, newValue) != JSONSuccess) {
+                LOG_ERROR("could not update the cached Device Twin.\n");
+                json_value_free(newValue);
+            } else if (!isMetadata) {
+                twinReportPropertyChanged(path, newValue);
+            }
+        }
+
+        path[pathLength] = '\0';
+    }
+}
+
 /// <summary>
 ///     Callback when direct method is called.
 /// </summary>
@@ -546,7 +1482,8 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
                                 unsigned char **response, size_t *responseSize,
                                 void *userContextCallback)
 {
-    LogMessage("INFO: Trying to invoke method %s\n", methodName);
+    LOG_INFO("Trying to invoke method %s\n", methodName);
+    AzureIoT_NotifyActivity();
 
     int result = 404;
 
@@ -554,19 +1491,21 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
         char *responseFromCallback = NULL;
         size_t responseFromCallbackSize = 0;
 
+        int64_t startUs = getMonotonicTimeUs();
         result = directMethodCallCb(methodName, payload, size, &responseFromCallback,
                                     &responseFromCallbackSize);
+        histogram_record(&directMethodDurationUs, (uint32_t)(getMonotonicTimeUs() - startUs));
         *responseSize = responseFromCallbackSize;
         *response = responseFromCallback;
     } else {
-        LogMessage("INFO: No method '%s' found, HttpStatus=%d\n", methodName, result);
+        LOG_INFO("No method '%s' found, HttpStatus=%d\n", methodName, result);
         static const char methodNotFound[] = "\"No method found\"";
         *responseSize = strlen(methodNotFound);
         *response = (unsigned char *)malloc(*responseSize);
         if (*response != NULL) {
             strncpy((char *)(*response), methodNotFound, *responseSize);
         } else {
-            LogMessage("ERROR: Cannot create response message for method call.\n");
+            LOG_ERROR("Cannot create response message for method call.\n");
             abort();
         }
     }
@@ -580,10 +1519,11 @@ static int directMethodCallback(const char *methodName, const unsigned char *pay
 static void twinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned char *payLoad,
                          size_t payLoadSize, void *userContextCallback)
 {
+    AzureIoT_NotifyActivity();
     size_t nullTerminatedJsonSize = payLoadSize + 1;
     char *nullTerminatedJsonString = (char *)malloc(nullTerminatedJsonSize);
     if (nullTerminatedJsonString == NULL) {
-        LogMessage("ERROR: Could not allocate buffer for twin update payload.\n");
+        LOG_ERROR("Could not allocate buffer for twin update payload.\n");
         abort();
     }
 
@@ -595,15 +1535,35 @@ static void twinCallback(DEVICE_TWIN_UPDATE_STATE updateState, const unsigned ch
     JSON_Value *rootProperties = NULL;
     rootProperties = json_parse_string(nullTerminatedJsonString);
     if (rootProperties == NULL) {
-        LogMessage("WARNING: Cannot parse the string as JSON content.\n");
+        LOG_WARNING("Cannot parse the string as JSON content.\n");
         goto cleanup;
     }
 
+    if (desiredPropertiesPath == NULL) {
+        desiredPropertiesPath = json_path_compile("desired");
+    }
+
+    // A complete update carries the whole twin document, a partial update carries only the
+    // changed desired properties.
     JSON_Object *rootObject = json_value_get_object(rootProperties);
-    JSON_Object *desiredProperties = json_object_dotget_object(rootObject, "desired");
+    JSON_Object *desiredProperties = NULL;
+    if (updateState == DEVICE_TWIN_UPDATE_COMPLETE) {
+        desiredProperties = json_object_pathget_object(rootObject, desiredPropertiesPath);
+    }
     if (desiredProperties == NULL) {
         desiredProperties = rootObject;
     }
+
+    // Merge the update into the cached desired properties, a complete update replaces the cache.
+    if (desiredPropertiesCache == NULL) {
+        desiredPropertiesCache = json_value_init_object();
+    }
+    if (desiredPropertiesCache != NULL && desiredProperties != NULL) {
+        char propertyPath[TWIN_PROPERTY_PATH_MAX] = "";
+        twinMergePatch(json_value_get_object(desiredPropertiesCache), desiredProperties,
+                       updateState == DEVICE_TWIN_UPDATE_COMPLETE, propertyPath, 0);
+    }
+
     // Call the provided Twin Device callback if any.
     if (twinUpdateCb != NULL) {
         twinUpdateCb(desiredProperties);
@@ -636,15 +1596,37 @@ static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
                                         void *userContextCallback)
 {
     bool authenticated = (result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
-    if (hubConnectionStatusCb) {
-        hubConnectionStatusCb(result == IOTHUB_CLIENT_CONNECTION_AUTHENTICATED);
+    int64_t nowMs = getMonotonicTimeMs();
+    AzureIoT_NotifyActivity();
+    if (!authenticated) {
+        connectionLost(nowMs);
+    } else {
+        hubAuthenticated = true;
+        if (hubConnectionStatusCb) {
+            hubConnectionStatusCb(true);
+        }
     }
     const char *reasonString = getReasonString(reason);
     if (!authenticated) {
-        LogMessage("INFO: IoT Hub connection is down (%s), retrying connection in 5 seconds...\n",
-                   reasonString);
+        LOG_INFO("IoT Hub connection is down (%s).\n", reasonString);
+        if (connectionState == ConnectionState_Authenticated) {
+            connectionState = ConnectionState_Connecting;
+        }
+        switch (reason) {
+        case IOTHUB_CLIENT_CONNECTION_EXPIRED_SAS_TOKEN:
+        case IOTHUB_CLIENT_CONNECTION_DEVICE_DISABLED:
+        case IOTHUB_CLIENT_CONNECTION_BAD_CREDENTIAL:
+        case IOTHUB_CLIENT_CONNECTION_RETRY_EXPIRED:
+            // The client does not retry any more, create a new one.
+            connectionRecreateRequested = true;
+            break;
+        default:
+            // The client keeps retrying on its own.
+            break;
+        }
     } else {
-        LogMessage("INFO: connection to the IoT Hub has been established (%s).\n", reasonString);
+        LOG_INFO("connection to the IoT Hub has been established (%s).\n", reasonString);
+        connectionAuthenticated(nowMs);
     }
 }
 
@@ -655,7 +1637,7 @@ static void hubConnectionStatusCallback(IOTHUB_CLIENT_CONNECTION_STATUS result,
 bool AzureIoT_Initialize(void)
 {
     if (IoTHub_Init() != 0) {
-        LogMessage("ERROR: failed initializing platform.\n");
+        LOG_ERROR("failed initializing platform.\n");
         return false;
     }
     return true;
@@ -666,35 +1648,53 @@ bool AzureIoT_Initialize(void)
 /// </summary>
 void AzureIoT_Deinitialize(void)
 {
+    json_path_free(desiredPropertiesPath);
+    desiredPropertiesPath = NULL;
+    json_value_free(desiredPropertiesCache);
+    desiredPropertiesCache = NULL;
+    json_value_free(reportedStatePending);
+    reportedStatePending = NULL;
+    json_value_free(reportedStateSent);
+    reportedStateSent = NULL;
+    while (telemetryQueueCount > 0) {
+        telemetryQueuePop();
+    }
+    telemetryStatistics.queueDepth = 0;
     IoTHub_Deinit();
 }
 /// <summary>
-///     Creates and enqueues reported properties state using a prepared json string.
-///     The report is not actually sent immediately, but it is sent on the next 
-///     invocation of AzureIoT_DoPeriodicTasks().
+///     Enqueues reported properties state using a prepared json string. Every top level member of
+///     the json object is set as a pending reported property and sent on the next flush.
 /// </summary>
 void AzureIoT_TwinReportStateJson(
 	char *reportedPropertiesString,
 	size_t reportedPropertiesSize)
 {
+	if (reportedPropertiesString == NULL) {
+		LOG_ERROR("no JSON string for Device Twin reporting.\n");
+		return;
+	}
+
+	char *nullTerminatedJsonString = (char *)malloc(reportedPropertiesSize + 1);
+	if (nullTerminatedJsonString == NULL) {
+		LOG_ERROR("Could not allocate buffer for reported properties.\n");
+		abort();
+	}
+	memcpy(nullTerminatedJsonString, reportedPropertiesString, reportedPropertiesSize);
+	nullTerminatedJsonString[reportedPropertiesSize] = 0;
 
-	if (iothubClientHandle == NULL) {
-		LogMessage("ERROR: client not initialized\n");
+	JSON_Value *reportedProperties = json_parse_string(nullTerminatedJsonString);
+	JSON_Object *reportedObject = json_value_get_object(reportedProperties);
+	if (reportedObject == NULL) {
+		LOG_ERROR("invalid JSON string for Device Twin reporting.\n");
 	}
 	else {
-		if (reportedPropertiesString != NULL) {
-			if (IoTHubDeviceClient_LL_SendReportedState(iothubClientHandle,
-				(unsigned char *)reportedPropertiesString, reportedPropertiesSize,
-				reportStatusCallback, 0) != IOTHUB_CLIENT_OK) {
-				LogMessage("ERROR: failed to set reported state as '%s'.\n",
-					reportedPropertiesString);
-			}
-			else {
-				LogMessage("INFO: Reported state as '%s'.\n", reportedPropertiesString);
-			}
-		}
-		else {
-			LogMessage("ERROR: no JSON string for Device Twin reporting.\n");
+		for (size_t i = 0; i < json_object_get_count(reportedObject); i++) {
+			AzureIoT_TwinReportValue(json_object_get_name(reportedObject, i),
+				json_value_deep_copy(json_object_get_value_at(reportedObject, i)));
 		}
 	}
-}
\ No newline at end of file
+
+	json_value_free(reportedProperties);
+	free(nullTerminatedJsonString);
+}
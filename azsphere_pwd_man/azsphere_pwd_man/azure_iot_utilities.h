@@ -7,6 +7,7 @@
 #include <azureiot/iothubtransportmqtt.h>
 #include <applibs/networking.h>
 #include "parson.h"
+#include "histogram.h"
 
 /// <summary>
 ///     Sets up the client in order to establish the communication channel to Azure IoT Hub.
@@ -14,11 +15,14 @@
 ///     The client is created by using the IoT Hub connection string that is provisioned
 ///     on the device or hardcoded into the source. The client is setup with the following
 ///     options:
-///     - IOTHUB_CLIENT_RETRY_INTERVAL retry policy which, when the network connection
-///       to the IoT Hub drops, attempts a reconnection each 5 seconds for a period of time
-///       of 5000 seconds before giving up;
+///     - IOTHUB_CLIENT_RETRY_EXPONENTIAL_BACKOFF_WITH_JITTER retry policy which, when the
+///       network connection to the IoT Hub drops, attempts reconnection for 60 seconds before
+///       giving up; the client is then recreated by AzureIoT_DoPeriodicTasks();
 ///     - MQTT procotol 'keepalive' value of 20 seconds; when no PINGRESP is received after
 ///       20 seconds, the connection is believed to be down and the retry policy kicks in;
+///
+///     Calling this function is optional, AzureIoT_DoPeriodicTasks() creates the client when
+///     needed. Creating it early does not require the network.
 /// </summary>
 /// <returns>'true' if the client has been properly set up. 'false' when a fatal error occurred
 /// while setting up the client.</returns>
@@ -32,30 +36,172 @@ bool AzureIoT_SetupClient(void);
 void AzureIoT_DestroyClient(void);
 
 /// <summary>
-///     Creates and enqueues reported properties state using a prepared json string.
-///     The report is not actually sent immediately, but it is sent on the next 
-///     invocation of AzureIoT_DoPeriodicTasks().
+///     State of the connection to the IoT Hub, advanced by AzureIoT_DoPeriodicTasks().
+/// </summary>
+typedef enum {
+    /// <summary>No client exists, waiting for the next creation attempt.</summary>
+    ConnectionState_NoClient,
+    /// <summary>The client exists, waiting for the network.</summary>
+    ConnectionState_ClientCreated,
+    /// <summary>The network is up, the client is connecting.</summary>
+    ConnectionState_Connecting,
+    /// <summary>The client is authenticated with the IoT Hub.</summary>
+    ConnectionState_Authenticated
+} ConnectionState;
+
+/// <summary>
+///     Connection counters and timings. The timings are also reported as the "connection"
+///     Device Twin reported property whenever the client gets authenticated.
+/// </summary>
+typedef struct {
+    /// <summary>Current state of the connection.</summary>
+    ConnectionState state;
+    /// <summary>Number of clients created.</summary>
+    unsigned long clientsCreated;
+    /// <summary>Number of times the authenticated connection has been lost.</summary>
+    unsigned long outages;
+    /// <summary>Time from the first AzureIoT_DoPeriodicTasks() call to the first
+    /// authentication, in milliseconds.</summary>
+    unsigned long bootToAuthenticatedMs;
+    /// <summary>Time from the loss of the connection to authentication for the last outage,
+    /// in milliseconds.</summary>
+    unsigned long lastRecoveryMs;
+    /// <summary>Longest recovery from an outage in milliseconds.</summary>
+    unsigned long maxRecoveryMs;
+} ConnectionStatistics;
+
+/// <summary>
+///     Gets the connection counters and timings.
+/// </summary>
+/// <param name="statistics">Where to store the counters.</param>
+void AzureIoT_GetConnectionStatistics(ConnectionStatistics *statistics);
+
+/// <summary>
+///     Enqueues reported properties state using a prepared json string. Every top level member
+///     of the json object is set as a pending reported property.
+///     The report is not actually sent immediately, but it is sent on the next flush.
 /// </summary>
 void AzureIoT_TwinReportStateJson(
 	char *reportedPropertiesString,
 	size_t reportedPropertiesSize);
 
 /// <summary>
-///     Creates and enqueues a report containing the name and value pair of a Device Twin reported
-///     property.
-///     The report is not actually sent immediately, but it is sent on the next invocation of
-///     AzureIoT_DoPeriodicTasks().
+///     Enqueues the name and value pair of a numeric Device Twin reported property.
+///     The report is not actually sent immediately, but it is sent on the next flush.
 /// </summary>
 /// <param name="propertyName">The name of the property to report.</param>
 /// <param name="propertyValue">The value of the property.</param>
 void AzureIoT_TwinReportState(const char *propertyName, size_t propertyValue);
 
 /// <summary>
-///     Creates and enqueues a message to be delivered the IoT Hub. The message is not actually sent
-///     immediately, but it is sent on the next invocation of AzureIoT_DoPeriodicTasks().
+///     Enqueues the name and value pair of a Device Twin reported property.
+///
+///     Reported properties are accumulated and sent as a single report either periodically
+///     from AzureIoT_DoPeriodicTasks() or on AzureIoT_TwinFlushReportedState(). Setting
+///     a property again before the flush replaces the pending value, values equal to the last
+///     reported ones are not sent again.
+/// </summary>
+/// <param name="propertyName">The name of the property to report, dots address nested
+/// objects.</param>
+/// <param name="propertyValue">The value of the property. Ownership is taken over, the value
+/// must not be freed by the caller.</param>
+void AzureIoT_TwinReportValue(const char *propertyName, JSON_Value *propertyValue);
+
+/// <summary>
+///     Sends all pending reported properties to the IoT Hub as a single report.
+/// </summary>
+void AzureIoT_TwinFlushReportedState(void);
+
+/// <summary>
+///     Reported properties coalescing counters.
+/// </summary>
+typedef struct {
+    /// <summary>Number of properties set.</summary>
+    size_t writes;
+    /// <summary>Number of pending properties replaced before they were sent.</summary>
+    size_t coalesced;
+    /// <summary>Number of properties skipped as equal to the last reported value.</summary>
+    size_t unchanged;
+    /// <summary>Number of reports sent to the IoT Hub.</summary>
+    size_t flushes;
+} ReportedStateStatistics;
+
+/// <summary>
+///     Gets the reported properties coalescing counters.
+/// </summary>
+/// <param name="statistics">Where to store the counters.</param>
+void AzureIoT_GetReportedStateStatistics(ReportedStateStatistics *statistics);
+
+/// <summary>
+///     Enqueues a telemetry event to be delivered the IoT Hub. The event is not actually sent
+///     immediately, but it is sent from AzureIoT_DoPeriodicTasks() or on
+///     AzureIoT_FlushTelemetry().
+///
+///     Queued events are coalesced into batches of up to 16 events and 2 KiB. A batch is sent
+///     when it is full, its oldest event is 2 seconds old or no event has been enqueued for
+///     200 ms. A single event is sent as is, more events are sent as a JSON array of the event
+///     payloads, so the payloads are expected to be JSON values. While the IoT Hub is not
+///     reachable events stay in the queue, bounded to 32 events and 8 KiB.
 /// </summary>
 /// <param name="messagePayload">The payload of the message to send.</param>
-void AzureIoT_SendMessage(const char *messagePayload);
+/// <returns>'false' if the event has been dropped, see AzureIoT_SetTelemetryDropPolicy().</returns>
+bool AzureIoT_SendMessage(const char *messagePayload);
+
+/// <summary>
+///     Hands over all queued telemetry events to the IoT Hub client regardless of the batch
+///     timers.
+/// </summary>
+void AzureIoT_FlushTelemetry(void);
+
+/// <summary>
+///     What to do with a new telemetry event when the queue is full.
+/// </summary>
+typedef enum {
+    /// <summary>Discard the oldest queued events to make room for the new one.</summary>
+    TelemetryDropPolicy_DropOldest,
+    /// <summary>Reject the new event, AzureIoT_SendMessage() returns 'false'.</summary>
+    TelemetryDropPolicy_RejectNew
+} TelemetryDropPolicy;
+
+/// <summary>
+///     Sets what to do with a new telemetry event when the queue is full. The default is
+///     TelemetryDropPolicy_DropOldest.
+/// </summary>
+/// <param name="policy">The drop policy.</param>
+void AzureIoT_SetTelemetryDropPolicy(TelemetryDropPolicy policy);
+
+/// <summary>
+///     Telemetry queue counters, updated on delivery confirmations from the IoT Hub.
+/// </summary>
+typedef struct {
+    /// <summary>Number of events currently waiting in the queue.</summary>
+    size_t queueDepth;
+    /// <summary>Highest number of events waiting in the queue.</summary>
+    size_t queueDepthMax;
+    /// <summary>Number of events enqueued.</summary>
+    size_t enqueued;
+    /// <summary>Number of events dropped by the drop policy.</summary>
+    size_t dropped;
+    /// <summary>Number of batch messages handed over to the IoT Hub client.</summary>
+    size_t batchesSent;
+    /// <summary>Number of events in the last batch message.</summary>
+    size_t lastBatchSize;
+    /// <summary>Number of events confirmed as delivered.</summary>
+    size_t eventsDelivered;
+    /// <summary>Number of events whose delivery failed.</summary>
+    size_t eventsFailed;
+    /// <summary>Time from enqueueing the oldest event of the last delivered batch to its
+    /// confirmation, in milliseconds.</summary>
+    unsigned long lastDeliveryLatencyMs;
+    /// <summary>Highest delivery latency in milliseconds.</summary>
+    unsigned long maxDeliveryLatencyMs;
+} TelemetryStatistics;
+
+/// <summary>
+///     Gets the telemetry queue counters.
+/// </summary>
+/// <param name="statistics">Where to store the counters.</param>
+void AzureIoT_GetTelemetryStatistics(TelemetryStatistics *statistics);
 
 /// <summary>
 ///     Keeps IoT Hub Client alive by exchanging data with the Azure IoT Hub.
@@ -64,9 +210,79 @@ void AzureIoT_SendMessage(const char *messagePayload);
 ///     This function must to be invoked periodically so that the Azure IoT Hub
 ///     SDK can accomplish its work (e.g. sending messages, invokation of callbacks, reconnection
 ///     attempts, and so forth).
+///
+///     It also runs the connection state machine: the client is created up front, DoWork runs
+///     only while the network is up, and a client which cannot recover on its own is recreated
+///     after a jittered exponential back-off of 1 second up to 5 minutes. When the network comes
+///     back after an outage the client is recreated immediately instead of waiting for its own
+///     retry back-off.
 /// </remarks>
 void AzureIoT_DoPeriodicTasks(void);
 
+/// <summary>
+///     Gets the interval until AzureIoT_DoPeriodicTasks() should be called again.
+/// </summary>
+/// <remarks>
+///     The interval is 100 ms while messages or reported properties wait for delivery, while the
+///     client is not authenticated and for 2 seconds after any message, method call, twin update
+///     or connection status change. When idle, the interval doubles on every call up to 1
+///     second, or half of the MQTT keepalive period if shorter. Incoming direct method calls are
+///     only received by DoWork, so the cap keeps an idle device picking up the first call within
+///     about a second.
+/// </remarks>
+/// <returns>The interval in milliseconds.</returns>
+unsigned int AzureIoT_GetDoWorkIntervalMs(void);
+
+/// <summary>
+///     Marks the client as busy so that DoWork runs at the fastest rate again, e.g. when the
+///     application expects an answer from the IoT Hub soon.
+/// </summary>
+void AzureIoT_NotifyActivity(void);
+
+/// <summary>
+///     DoWork scheduling counters. The per minute values are also reported as the "doWork"
+///     Device Twin reported property once a minute.
+/// </summary>
+typedef struct {
+    /// <summary>Current interval between DoWork calls in milliseconds.</summary>
+    unsigned int intervalMs;
+    /// <summary>Number of DoWork calls.</summary>
+    unsigned long calls;
+    /// <summary>Number of DoWork calls per minute in the last window.</summary>
+    unsigned long callsPerMinute;
+    /// <summary>Time spent in DoWork per minute in the last window, in milliseconds.</summary>
+    unsigned long busyMsPerMinute;
+} DoWorkStatistics;
+
+/// <summary>
+///     Gets the DoWork scheduling counters.
+/// </summary>
+/// <param name="statistics">Where to store the counters.</param>
+void AzureIoT_GetDoWorkStatistics(DoWorkStatistics *statistics);
+
+/// <summary>
+///     Sets the MQTT keepalive period. The IoT Hub client sends it to the IoT Hub when
+///     connecting, so a changed period takes effect on the next connection. The longest
+///     interval between DoWork calls follows the new period immediately, if it is shorter than
+///     the DoWork interval cap.
+/// </summary>
+/// <param name="seconds">The keepalive period in seconds.</param>
+void AzureIoT_SetKeepAlivePeriod(int seconds);
+
+/// <summary>
+///     Gets the histogram of IoTHubDeviceClient_LL_DoWork() durations in microseconds. The
+///     histogram is written by the thread calling AzureIoT_DoPeriodicTasks().
+/// </summary>
+/// <returns>The histogram.</returns>
+const histogram_t *AzureIoT_GetDoWorkHistogram(void);
+
+/// <summary>
+///     Gets the histogram of Direct Method callback durations in microseconds. The histogram
+///     is written by the thread calling AzureIoT_DoPeriodicTasks().
+/// </summary>
+/// <returns>The histogram.</returns>
+const histogram_t *AzureIoT_GetDirectMethodHistogram(void);
+
 /// <summary>
 ///     Type of the function callback invoked whenever a message is received from IoT Hub.
 /// </summary>
@@ -93,6 +309,36 @@ typedef void (*TwinUpdateFnType)(JSON_Object *desiredProperties);
 /// received</param>
 void AzureIoT_SetDeviceTwinUpdateCallback(TwinUpdateFnType callback);
 
+/// <summary>
+///     Type of the function callback invoked for every desired property changed by a Device Twin
+///     update.
+/// </summary>
+/// <param name="propertyPath">Dot separated path of the changed property, e.g. "a.b.c".</param>
+/// <param name="propertyValue">The new value of the property, NULL when the property has been
+/// removed.</param>
+typedef void (*TwinPropertyChangedFnType)(const char *propertyPath,
+                                          const JSON_Value *propertyValue);
+
+/// <summary>
+///     Sets the function callback invoked for every desired property changed by a Device Twin
+///     update.
+/// </summary>
+/// <remarks>
+///     Desired properties are cached between updates. Complete updates are compared against the
+///     cache, partial updates are applied to it as JSON merge patches (RFC 7386). Only the
+///     properties whose value actually changed are reported. Metadata properties starting with
+///     '$' are not reported.
+/// </remarks>
+/// <param name="callback">The callback function invoked for every changed property</param>
+void AzureIoT_SetDeviceTwinPropertyChangedCallback(TwinPropertyChangedFnType callback);
+
+/// <summary>
+///     Gets the cached Device Twin desired properties.
+/// </summary>
+/// <returns>The JSON object with all desired properties received so far, NULL when no Device
+/// Twin update has been received yet.</returns>
+const JSON_Object *AzureIoT_GetDesiredProperties(void);
+
 /// <summary>
 ///     Type of the function callback invoked when a Direct Method call from the IoT Hub is
 ///     received.
@@ -138,6 +384,7 @@ typedef void (*MessageDeliveryConfirmationFnType)(bool delivered);
 /// <summary>
 ///     Sets the function to be invoked whenever the message to the Iot Hub has been delivered.
 /// </summary>
+/// <remarks>The callback is invoked once per batch message.</remarks>
 /// <param name="callback">The function pointer to the callback function.</param>
 void AzureIoT_SetMessageConfirmationCallback(MessageDeliveryConfirmationFnType callback);
 
@@ -29,4 +29,18 @@
 #define ACCEL_READ_PERIOD_NANO_SECONDS 0
 
 // Enables I2C read/write debug
-//#define ENABLE_READ_WRITE_DEBUG
\ No newline at end of file
+//#define ENABLE_READ_WRITE_DEBUG
+
+// Compile time log levels of project modules, see log_ring.h. Messages below
+// the level are removed from the build.
+#define LOG_LEVEL_MAIN          LOG_LEVEL_INFO
+#define LOG_LEVEL_AZURE_IOT     LOG_LEVEL_INFO
+#define LOG_LEVEL_QUEUE         LOG_LEVEL_INFO
+#define LOG_LEVEL_TUNABLES      LOG_LEVEL_INFO
+#define LOG_LEVEL_LAN           LOG_LEVEL_INFO
+
+// Enable to accept items from the local network, bypassing IoT Hub. Requires
+// MY_LAN_PRE_SHARED_KEY in connection_strings.h shared with the web
+// application and the UDP port allowed in app_manifest.json.
+//#define LAN_LISTENER_ENABLED
+#define LAN_LISTENER_PORT       50505
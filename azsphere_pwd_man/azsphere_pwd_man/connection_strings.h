@@ -2,3 +2,7 @@
 
 // Define your connection string here.  The connection string is required to connect to Azure.
 #define MY_CONNECTION_STRING "<YOUR-IOT-DEVICE-CONNECTION-STRING>"
+
+// Define your local network pre-shared key here, at least 16 characters.  The same key
+// has to be configured in the web application as LocalDevice:preSharedKey.
+#define MY_LAN_PRE_SHARED_KEY "<YOUR-LAN-PRE-SHARED-KEY>"
@@ -2,12 +2,49 @@
    Licensed under the MIT License. */
 
 #include <errno.h>
+#include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/timerfd.h>
 #include <applibs/log.h>
 #include "epoll_timerfd_utilities.h"
 
+/// <summary>
+///     Converts a timespec to microseconds.
+/// </summary>
+static int64_t TimespecToUs(const struct timespec *time)
+{
+    return (int64_t)time->tv_sec * 1000000 + time->tv_nsec / 1000;
+}
+
+/// <summary>
+///     Records the absolute time of the oldest unhandled expiry of a periodic timer. Periodic
+///     timerfd expiries fall on a fixed grid, the oldest unhandled one is the first grid point
+///     after handledUs. Handlers consume the timer event first thing, so expiries after the
+///     handler was called are treated as not handled.
+/// </summary>
+static void TrackTimerExpiry(EventData *eventData, int64_t handledUs)
+{
+    struct itimerspec timerValue;
+    struct timespec now;
+
+    eventData->timerExpiryUs = 0;
+    if (timerfd_gettime(eventData->fd, &timerValue) != 0 ||
+        clock_gettime(CLOCK_MONOTONIC, &now) != 0) {
+        return;
+    }
+
+    eventData->timerPeriodUs = TimespecToUs(&timerValue.it_interval);
+    if (eventData->timerPeriodUs == 0) {
+        // Single expiry or disarmed timer
+        return;
+    }
+
+    int64_t nextExpiryUs = TimespecToUs(&now) + TimespecToUs(&timerValue.it_value);
+    int64_t missedPeriods = (nextExpiryUs - handledUs) / eventData->timerPeriodUs;
+    eventData->timerExpiryUs = nextExpiryUs - missedPeriods * eventData->timerPeriodUs;
+}
+
 int CreateEpollFd(void)
 {
     int epollFd = -1;
@@ -112,6 +149,10 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
     }
 
     persistentEventData->fd = timerFd;
+    persistentEventData->isTimer = true;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    TrackTimerExpiry(persistentEventData, TimespecToUs(&now));
     if (RegisterEventHandlerToEpoll(epollFd, timerFd, persistentEventData, epollEventMask) != 0) {
         return -1;
     }
@@ -135,7 +176,37 @@ int WaitForEventAndCallHandler(int epollFd)
 
     if (numEventsOccurred == 1 && event.data.ptr != NULL) {
         EventData *eventData = event.data.ptr;
+
+        // Lateness of a periodic timer is measured from the oldest expiry not handled yet, so
+        // missed expiries add whole periods. A timer re-armed with another period since the
+        // expiry was recorded is skipped once. Single expiry timers are not measured.
+        struct itimerspec timerValue;
+        struct timespec now;
+        if (eventData->isTimer && eventData->timerExpiryUs != 0 &&
+            timerfd_gettime(eventData->fd, &timerValue) == 0 &&
+            TimespecToUs(&timerValue.it_interval) == eventData->timerPeriodUs &&
+            clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+            int64_t latenessUs = TimespecToUs(&now) - eventData->timerExpiryUs;
+            if (latenessUs >= 0) {
+                histogram_record(&eventData->timerLatenessUs,
+                                 latenessUs > UINT32_MAX ? UINT32_MAX : (uint32_t)latenessUs);
+            }
+        }
+
+        struct timespec start;
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
         eventData->eventHandler(eventData);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        // Handler consumed the expiries up to its start
+        if (eventData->isTimer) {
+            TrackTimerExpiry(eventData, TimespecToUs(&start));
+        }
+
+        int64_t executionUs = TimespecToUs(&end) - TimespecToUs(&start);
+        histogram_record(&eventData->executionTimeUs,
+                         executionUs > UINT32_MAX ? UINT32_MAX : (uint32_t)executionUs);
     }
 
     return 0;
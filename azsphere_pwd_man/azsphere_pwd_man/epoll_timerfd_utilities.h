@@ -2,10 +2,14 @@
    Licensed under the MIT License. */
 
 #pragma once
+#include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 
+#include "histogram.h"
+
 /// Forward declaration of the data type passed to the handlers.
 struct EventData;
 
@@ -31,6 +35,29 @@ typedef struct EventData {
     /// The file descriptor that generated the event.
     /// </summary>
     int fd;
+    /// <summary>
+    /// Set when the file descriptor is a timerfd created by CreateTimerFdAndAddToEpoll.
+    /// </summary>
+    bool isTimer;
+    /// <summary>
+    /// Handler execution time in microseconds, recorded by WaitForEventAndCallHandler.
+    /// </summary>
+    histogram_t executionTimeUs;
+    /// <summary>
+    /// Delay in microseconds between timer expiry and the handler call, recorded by
+    /// WaitForEventAndCallHandler for periodic timers only.
+    /// </summary>
+    histogram_t timerLatenessUs;
+    /// <summary>
+    /// CLOCK_MONOTONIC time in microseconds of the oldest expiry of a periodic timer not yet
+    /// handled, or 0 when unknown. Maintained by CreateTimerFdAndAddToEpoll and
+    /// WaitForEventAndCallHandler.
+    /// </summary>
+    int64_t timerExpiryUs;
+    /// <summary>
+    /// Timer period in microseconds timerExpiryUs was computed for.
+    /// </summary>
+    int64_t timerPeriodUs;
 } EventData;
 
 /// <summary>
@@ -97,7 +124,8 @@ int CreateTimerFdAndAddToEpoll(int epollFd, const struct timespec *period,
                                EventData *persistentEventData, const uint32_t epollEventMask);
 
 /// <summary>
-///     Waits for an event on an epoll instance and triggers the handler.
+///     Waits for an event on an epoll instance and triggers the handler. Handler execution time
+///     and, for periodic timers, timer lateness are recorded to histograms of its EventData.
 /// </summary>
 /// <param name="epollFd">
 ///     Epoll file descriptor which was created with <see cref="CreateEpollFd" />.
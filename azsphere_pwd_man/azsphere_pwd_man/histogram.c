@@ -0,0 +1,148 @@
+﻿/***************************************************************************//**
+* @file    histogram.c
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Fixed bucket log2 histogram of durations.
+*
+*    Writer updates counters with relaxed load and store instead of atomic
+*    read-modify-write, there is only one writer per histogram. Readers may
+*    see a value in flight missing, never a torn counter.
+*
+*******************************************************************************/
+
+#include "histogram.h"
+
+/*******************************************************************************
+* Function declarations
+*******************************************************************************/
+
+/**
+ * @brief Copy bucket counts.
+ *
+ * @param p_histogram Histogram.
+ * @param p_counts Output array of HISTOGRAM_BUCKETS counts.
+ *
+ * @return Sum of counts.
+ */
+static uint32_t
+read_counts(const histogram_t *p_histogram, uint32_t *p_counts);
+
+/*******************************************************************************
+* Function definitions
+*******************************************************************************/
+
+void
+histogram_record(histogram_t *p_histogram, uint32_t value)
+{
+    unsigned bucket = (value == 0) ? 0 : 32 - (unsigned)__builtin_clz(value);
+    if (bucket >= HISTOGRAM_BUCKETS)
+    {
+        bucket = HISTOGRAM_BUCKETS - 1;
+    }
+
+    atomic_uint *p_count = &p_histogram->counts[bucket];
+    atomic_store_explicit(p_count,
+        atomic_load_explicit(p_count, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+
+    if (value > atomic_load_explicit(&p_histogram->max, memory_order_relaxed))
+    {
+        atomic_store_explicit(&p_histogram->max, value, memory_order_relaxed);
+    }
+}
+
+uint32_t
+histogram_percentile(const histogram_t *p_histogram, unsigned percent)
+{
+    uint32_t counts[HISTOGRAM_BUCKETS];
+    uint32_t total = read_counts(p_histogram, counts);
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    uint32_t max = atomic_load_explicit(&p_histogram->max,
+        memory_order_relaxed);
+    uint64_t rank = ((uint64_t)total * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS - 1; i++)
+    {
+        seen += counts[i];
+        if ((seen >= rank) && (seen > 0))
+        {
+            // Bucket upper bound, never above the largest value seen
+            uint32_t bound = (i == 0) ? 0 : (1u << i) - 1;
+            return (bound < max) ? bound : max;
+        }
+    }
+
+    // Percentile falls to overflow bucket
+    return max;
+}
+
+JSON_Value
+*histogram_to_json(const histogram_t *p_histogram)
+{
+    uint32_t counts[HISTOGRAM_BUCKETS];
+    uint32_t total = read_counts(p_histogram, counts);
+
+    JSON_Value *p_value = json_value_init_object();
+    JSON_Value *p_buckets_value = json_value_init_array();
+    if ((p_value == NULL) || (p_buckets_value == NULL))
+    {
+        json_value_free(p_value);
+        json_value_free(p_buckets_value);
+        return NULL;
+    }
+
+    JSON_Object *p_object = json_value_get_object(p_value);
+    json_object_set_number(p_object, "n", total);
+    json_object_set_number(p_object, "max",
+        atomic_load_explicit(&p_histogram->max, memory_order_relaxed));
+    json_object_set_number(p_object, "p50",
+        histogram_percentile(p_histogram, 50));
+    json_object_set_number(p_object, "p90",
+        histogram_percentile(p_histogram, 90));
+    json_object_set_number(p_object, "p99",
+        histogram_percentile(p_histogram, 99));
+
+    int used = HISTOGRAM_BUCKETS;
+    while ((used > 0) && (counts[used - 1] == 0))
+    {
+        used--;
+    }
+
+    JSON_Array *p_buckets = json_value_get_array(p_buckets_value);
+    for (int i = 0; i < used; i++)
+    {
+        json_array_append_number(p_buckets, counts[i]);
+    }
+    json_object_set_value(p_object, "b", p_buckets_value);
+
+    return p_value;
+}
+
+/*******************************************************************************
+* Private function definitions
+*******************************************************************************/
+
+static uint32_t
+read_counts(const histogram_t *p_histogram, uint32_t *p_counts)
+{
+    uint32_t total = 0;
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        p_counts[i] = atomic_load_explicit(
+            (atomic_uint *)&p_histogram->counts[i], memory_order_relaxed);
+        total += p_counts[i];
+    }
+
+    return total;
+}
+
+/* [] END OF FILE */
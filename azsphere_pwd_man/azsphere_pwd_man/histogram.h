@@ -0,0 +1,81 @@
+﻿/***************************************************************************//**
+* @file    histogram.h
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Fixed bucket log2 histogram of durations. Bucket n counts values of
+*    bit length n, i.e. bucket 0 holds 0, bucket 1 holds 1, bucket 2 holds
+*    2 - 3, bucket 3 holds 4 - 7 and so forth, the last bucket collects all
+*    larger values.
+*
+*    Recording is a few instructions without locks. Each histogram must have
+*    a single writer thread, any thread can read it.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "parson.h"
+
+/*******************************************************************************
+*   Macros and #define Constants
+*******************************************************************************/
+
+// Number of buckets, values from 2^(HISTOGRAM_BUCKETS - 2) up go to last one
+#define HISTOGRAM_BUCKETS       20
+
+/*******************************************************************************
+*   Type definitions
+*******************************************************************************/
+
+typedef struct histogram_s
+{
+    atomic_uint counts[HISTOGRAM_BUCKETS];  // Number of values per bucket
+    atomic_uint max;                        // Largest recorded value
+} histogram_t;
+
+/*******************************************************************************
+* Function prototypes
+*******************************************************************************/
+
+/**
+ * @brief Record value. Must be called from histogram writer thread only.
+ *
+ * @param p_histogram Histogram.
+ * @param value Value to record.
+ */
+void
+histogram_record(histogram_t *p_histogram, uint32_t value);
+
+/**
+ * @brief Estimate percentile as upper bound of bucket where it falls,
+ *    limited to the largest recorded value.
+ *
+ * @param p_histogram Histogram.
+ * @param percent Percentile, 0 - 100.
+ *
+ * @return Percentile estimate, 0 if histogram is empty.
+ */
+uint32_t
+histogram_percentile(const histogram_t *p_histogram, unsigned percent);
+
+/**
+ * @brief Export histogram as JSON object with number of values "n", "max",
+ *    percentile estimates "p50", "p90", "p99" and bucket counts "b" without
+ *    trailing empty buckets.
+ *
+ * @param p_histogram Histogram.
+ *
+ * @return JSON value owned by caller, NULL on allocation failure.
+ */
+JSON_Value
+*histogram_to_json(const histogram_t *p_histogram);
+
+/* [] END OF FILE */
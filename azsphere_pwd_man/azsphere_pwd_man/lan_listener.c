@@ -0,0 +1,406 @@
+﻿/***************************************************************************//**
+* @file    lan_listener.c
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Local network UDP listener accepting requests directly from the web
+*    application, bypassing IoT Hub.
+*
+*    Unauthenticated datagrams are dropped without response, so the listener
+*    does not reveal itself to anyone not knowing the pre-shared key.
+*
+*******************************************************************************/
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "build_options.h"
+#include "epoll_timerfd_utilities.h"
+#include "lan_listener.h"
+#include "sha256.h"
+
+#define LOG_MODULE_NAME     "lan"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_LAN
+#include "log_ring.h"
+
+/*******************************************************************************
+*   Macros and #define Constants
+*******************************************************************************/
+
+#define LAN_DATAGRAM_MAX        (LAN_HEADER_LENGTH + LAN_PAYLOAD_MAX + \
+                                    LAN_TAG_LENGTH)
+
+// Number of nonces remembered to reject replayed requests, a nonce is kept
+// until its request timestamp leaves the replay window
+#define LAN_NONCE_HISTORY       32
+
+// Response plaintext starts with status code
+#define LAN_STATUS_LENGTH       2
+
+/*******************************************************************************
+*   Type definitions
+*******************************************************************************/
+
+typedef struct
+{
+    uint8_t nonce[LAN_NONCE_LENGTH];
+    int64_t timestamp;                  // 0 if slot is free
+} lan_nonce_t;
+
+/*******************************************************************************
+* Function declarations
+*******************************************************************************/
+
+/**
+ * @brief Socket event handler, processes one datagram.
+ */
+static void
+event_handler_lan(EventData *event_data);
+
+/**
+ * @brief Encrypt or decrypt buffer in place.
+ *
+ * @param p_key Encryption key.
+ * @param p_nonce Request nonce.
+ * @param p_data Data.
+ * @param length Data length.
+ */
+static void
+lan_crypt(const uint8_t *p_key, const uint8_t *p_nonce, uint8_t *p_data,
+    size_t length);
+
+/**
+ * @brief Compute authentication tag.
+ *
+ * @param p_key Authentication key.
+ * @param p_frame Frame without tag.
+ * @param length Frame length without tag.
+ * @param p_tag Output buffer of LAN_TAG_LENGTH bytes.
+ */
+static void
+lan_tag(const uint8_t *p_key, const uint8_t *p_frame, size_t length,
+    uint8_t *p_tag);
+
+/**
+ * @brief Check request timestamp and nonce, remember nonce if accepted.
+ *
+ * @param p_header Authenticated request header.
+ *
+ * @return true if request is fresh.
+ */
+static bool
+lan_is_fresh(const uint8_t *p_header);
+
+/*******************************************************************************
+* Global variables
+*******************************************************************************/
+
+static int g_fd_socket = -1;
+
+static lan_request_fn_t g_request_cb = NULL;
+
+static EventData g_event_data_lan = {
+    .eventHandler = &event_handler_lan
+};
+
+static uint8_t g_key_request_encryption[SHA256_DIGEST_LENGTH];
+static uint8_t g_key_request_authentication[SHA256_DIGEST_LENGTH];
+static uint8_t g_key_response_encryption[SHA256_DIGEST_LENGTH];
+static uint8_t g_key_response_authentication[SHA256_DIGEST_LENGTH];
+
+static lan_nonce_t g_nonces[LAN_NONCE_HISTORY];
+
+// Newest timestamp of nonce evicted before leaving replay window, requests
+// not newer than this are rejected
+static int64_t g_timestamp_floor = 0;
+
+// Listener start, CLOCK_MONOTONIC. Nonces accepted before restart are lost,
+// so requests are rejected until they would have left the replay window.
+static struct timespec g_start_time;
+
+/*******************************************************************************
+* Function definitions
+*******************************************************************************/
+
+int
+lan_listener_init(int fd_epoll, uint16_t port, const char *p_psk,
+    lan_request_fn_t request_cb)
+{
+    size_t psk_length = strlen(p_psk);
+    if ((psk_length < LAN_PSK_LENGTH_MIN) || (p_psk[0] == '<'))
+    {
+        LOG_ERROR("LAN pre-shared key not defined or shorter than %d "
+            "characters.\n", LAN_PSK_LENGTH_MIN);
+        return -1;
+    }
+
+    hmac_sha256(p_psk, psk_length, LAN_LABEL_REQUEST_ENCRYPTION,
+        strlen(LAN_LABEL_REQUEST_ENCRYPTION), g_key_request_encryption);
+    hmac_sha256(p_psk, psk_length, LAN_LABEL_REQUEST_AUTHENTICATION,
+        strlen(LAN_LABEL_REQUEST_AUTHENTICATION), g_key_request_authentication);
+    hmac_sha256(p_psk, psk_length, LAN_LABEL_RESPONSE_ENCRYPTION,
+        strlen(LAN_LABEL_RESPONSE_ENCRYPTION), g_key_response_encryption);
+    hmac_sha256(p_psk, psk_length, LAN_LABEL_RESPONSE_AUTHENTICATION,
+        strlen(LAN_LABEL_RESPONSE_AUTHENTICATION),
+        g_key_response_authentication);
+    memset(g_nonces, 0, sizeof(g_nonces));
+    g_timestamp_floor = 0;
+    clock_gettime(CLOCK_MONOTONIC, &g_start_time);
+    g_request_cb = request_cb;
+
+    g_fd_socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_fd_socket < 0)
+    {
+        LOG_ERROR("Could not create LAN socket: %s (%d).\n", strerror(errno),
+            errno);
+        return -1;
+    }
+
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY)
+    };
+    if (bind(g_fd_socket, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        LOG_ERROR("Could not bind LAN socket to port %u: %s (%d).\n",
+            (unsigned)port, strerror(errno), errno);
+        return -1;
+    }
+
+    if (RegisterEventHandlerToEpoll(fd_epoll, g_fd_socket, &g_event_data_lan,
+        EPOLLIN) != 0)
+    {
+        return -1;
+    }
+
+    LOG_INFO("Listening for LAN requests on UDP port %u.\n", (unsigned)port);
+
+    return 0;
+}
+
+void
+lan_listener_deinit(void)
+{
+    if (g_fd_socket >= 0)
+    {
+        close(g_fd_socket);
+        g_fd_socket = -1;
+    }
+
+    memset(g_key_request_encryption, 0, SHA256_DIGEST_LENGTH);
+    memset(g_key_request_authentication, 0, SHA256_DIGEST_LENGTH);
+    memset(g_key_response_encryption, 0, SHA256_DIGEST_LENGTH);
+    memset(g_key_response_authentication, 0, SHA256_DIGEST_LENGTH);
+}
+
+/*******************************************************************************
+* Private function definitions
+*******************************************************************************/
+
+static void
+event_handler_lan(EventData *event_data)
+{
+    uint8_t frame[LAN_DATAGRAM_MAX + 1];
+    uint8_t tag[LAN_TAG_LENGTH];
+    struct sockaddr_in sender;
+    socklen_t sender_length = sizeof(sender);
+
+    ssize_t received = recvfrom(g_fd_socket, frame, sizeof(frame), 0,
+        (struct sockaddr *)&sender, &sender_length);
+    if (received < 0)
+    {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+        {
+            LOG_ERROR("Could not receive LAN datagram: %s (%d).\n",
+                strerror(errno), errno);
+        }
+        return;
+    }
+
+    // Drop anything not carrying a valid tag
+    size_t length = (size_t)received;
+    if ((length < LAN_HEADER_LENGTH + LAN_TAG_LENGTH) ||
+        (length > LAN_DATAGRAM_MAX) ||
+        (memcmp(frame, LAN_MAGIC, LAN_MAGIC_LENGTH) != 0))
+    {
+        LOG_WARNING("Malformed LAN datagram dropped.\n");
+        return;
+    }
+
+    size_t payload_size = length - LAN_HEADER_LENGTH - LAN_TAG_LENGTH;
+    lan_tag(g_key_request_authentication, frame, length - LAN_TAG_LENGTH, tag);
+    if (!sha256_equal(tag, frame + length - LAN_TAG_LENGTH, LAN_TAG_LENGTH))
+    {
+        LOG_WARNING("Unauthenticated LAN datagram dropped.\n");
+        return;
+    }
+
+    if (!lan_is_fresh(frame))
+    {
+        return;
+    }
+
+    uint8_t *p_payload = frame + LAN_HEADER_LENGTH;
+    lan_crypt(g_key_request_encryption, frame + LAN_MAGIC_LENGTH +
+        LAN_TIMESTAMP_LENGTH, p_payload, payload_size);
+
+    char *p_response = NULL;
+    size_t response_size = 0;
+    int status = g_request_cb((const char *)p_payload, payload_size,
+        &p_response, &response_size);
+
+    // Request carries credentials, do not leave them on stack
+    memset(p_payload, 0, payload_size);
+
+    if (response_size > LAN_PAYLOAD_MAX - LAN_STATUS_LENGTH)
+    {
+        response_size = LAN_PAYLOAD_MAX - LAN_STATUS_LENGTH;
+    }
+
+    // Response reuses request header, only payload and tag change
+    p_payload[0] = (uint8_t)(status >> 8);
+    p_payload[1] = (uint8_t)status;
+    if (p_response != NULL)
+    {
+        memcpy(p_payload + LAN_STATUS_LENGTH, p_response, response_size);
+        free(p_response);
+    }
+    payload_size = LAN_STATUS_LENGTH + response_size;
+    lan_crypt(g_key_response_encryption, frame + LAN_MAGIC_LENGTH +
+        LAN_TIMESTAMP_LENGTH, p_payload, payload_size);
+
+    length = LAN_HEADER_LENGTH + payload_size;
+    lan_tag(g_key_response_authentication, frame, length, frame + length);
+    length += LAN_TAG_LENGTH;
+
+    if (sendto(g_fd_socket, frame, length, 0, (struct sockaddr *)&sender,
+        sender_length) < 0)
+    {
+        LOG_ERROR("Could not send LAN response: %s (%d).\n", strerror(errno),
+            errno);
+    }
+
+    return;
+}
+
+static void
+lan_crypt(const uint8_t *p_key, const uint8_t *p_nonce, uint8_t *p_data,
+    size_t length)
+{
+    uint8_t block_input[LAN_NONCE_LENGTH + 4];
+    uint8_t keystream[SHA256_DIGEST_LENGTH];
+
+    memcpy(block_input, p_nonce, LAN_NONCE_LENGTH);
+    for (uint32_t block = 0; (size_t)block * SHA256_DIGEST_LENGTH < length;
+        block++)
+    {
+        block_input[LAN_NONCE_LENGTH] = (uint8_t)(block >> 24);
+        block_input[LAN_NONCE_LENGTH + 1] = (uint8_t)(block >> 16);
+        block_input[LAN_NONCE_LENGTH + 2] = (uint8_t)(block >> 8);
+        block_input[LAN_NONCE_LENGTH + 3] = (uint8_t)block;
+        hmac_sha256(p_key, SHA256_DIGEST_LENGTH, block_input,
+            sizeof(block_input), keystream);
+
+        size_t offset = (size_t)block * SHA256_DIGEST_LENGTH;
+        for (size_t i = 0; (i < SHA256_DIGEST_LENGTH) && (offset + i < length);
+            i++)
+        {
+            p_data[offset + i] ^= keystream[i];
+        }
+    }
+
+    memset(keystream, 0, sizeof(keystream));
+}
+
+static void
+lan_tag(const uint8_t *p_key, const uint8_t *p_frame, size_t length,
+    uint8_t *p_tag)
+{
+    hmac_sha256(p_key, SHA256_DIGEST_LENGTH, p_frame, length, p_tag);
+}
+
+static bool
+lan_is_fresh(const uint8_t *p_header)
+{
+    const uint8_t *p_timestamp = p_header + LAN_MAGIC_LENGTH;
+    const uint8_t *p_nonce = p_timestamp + LAN_TIMESTAMP_LENGTH;
+
+    int64_t timestamp = 0;
+    for (int i = 0; i < LAN_TIMESTAMP_LENGTH; i++)
+    {
+        timestamp = (timestamp << 8) | p_timestamp[i];
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - g_start_time.tv_sec <= LAN_REPLAY_WINDOW_SEC)
+    {
+        LOG_WARNING("LAN request dropped, listener started less than %d s "
+            "ago.\n", LAN_REPLAY_WINDOW_SEC);
+        return false;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t oldest = (int64_t)now.tv_sec - LAN_REPLAY_WINDOW_SEC;
+    if ((timestamp < oldest) ||
+        (timestamp > (int64_t)now.tv_sec + LAN_REPLAY_WINDOW_SEC))
+    {
+        LOG_WARNING("LAN request %lld s off device time dropped, check "
+            "time synchronization.\n", (long long)(timestamp - now.tv_sec));
+        return false;
+    }
+
+    if (timestamp <= g_timestamp_floor)
+    {
+        LOG_WARNING("LAN request older than nonce history dropped.\n");
+        return false;
+    }
+
+    // Nonces of requests outside replay window are no longer needed, their
+    // slots are reused first, otherwise the oldest nonce is evicted
+    size_t slot = 0;
+    for (size_t i = 0; i < LAN_NONCE_HISTORY; i++)
+    {
+        if (g_nonces[i].timestamp < oldest)
+        {
+            g_nonces[i].timestamp = 0;
+        }
+        else if (memcmp(g_nonces[i].nonce, p_nonce, LAN_NONCE_LENGTH) == 0)
+        {
+            LOG_WARNING("Replayed LAN request dropped.\n");
+            return false;
+        }
+
+        if (g_nonces[i].timestamp < g_nonces[slot].timestamp)
+        {
+            slot = i;
+        }
+    }
+
+    if (g_nonces[slot].timestamp != 0)
+    {
+        if (timestamp <= g_nonces[slot].timestamp)
+        {
+            LOG_WARNING("LAN request older than nonce history dropped.\n");
+            return false;
+        }
+        g_timestamp_floor = g_nonces[slot].timestamp;
+    }
+
+    memcpy(g_nonces[slot].nonce, p_nonce, LAN_NONCE_LENGTH);
+    g_nonces[slot].timestamp = timestamp;
+
+    return true;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,109 @@
+﻿/***************************************************************************//**
+* @file    lan_listener.h
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Local network UDP listener accepting requests directly from the web
+*    application, bypassing IoT Hub. Runs in epoll loop of the calling thread.
+*
+*    Requests and responses are single datagrams encrypted and authenticated
+*    with keys derived from a pre-shared key:
+*
+*        magic "SPM1" | timestamp | nonce | ciphertext | tag
+*
+*    - timestamp: 8 byte big endian UNIX time of request, requests outside
+*      LAN_REPLAY_WINDOW_SEC of device time are rejected, as are all requests
+*      during first LAN_REPLAY_WINDOW_SEC after listener start,
+*    - nonce: 16 random bytes chosen by requester, response repeats the
+*      request timestamp and nonce, nonces seen within replay window are
+*      rejected,
+*    - ciphertext: plaintext XOR keystream, keystream block i is
+*      HMAC-SHA256(encryption key, nonce | 4 byte big endian i),
+*    - tag: HMAC-SHA256(authentication key, all preceding bytes).
+*
+*    Request and response have separate encryption and authentication keys,
+*    key = HMAC-SHA256(pre-shared key, label). Request plaintext is the
+*    set_item_data direct method payload, response plaintext is 2 byte
+*    big endian status code followed by the direct method response payload.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************************************
+*   Macros and #define Constants
+*******************************************************************************/
+
+#define LAN_MAGIC               "SPM1"
+#define LAN_MAGIC_LENGTH        4
+#define LAN_TIMESTAMP_LENGTH    8
+#define LAN_NONCE_LENGTH        16
+#define LAN_HEADER_LENGTH       (LAN_MAGIC_LENGTH + LAN_TIMESTAMP_LENGTH + \
+                                    LAN_NONCE_LENGTH)
+#define LAN_TAG_LENGTH          32
+
+// Longest request or response plaintext
+#define LAN_PAYLOAD_MAX         512
+
+// Accepted difference between request timestamp and device time
+#define LAN_REPLAY_WINDOW_SEC   30
+
+// Shortest accepted pre-shared key
+#define LAN_PSK_LENGTH_MIN      16
+
+// Key derivation labels
+#define LAN_LABEL_REQUEST_ENCRYPTION        "SPM1 request encryption"
+#define LAN_LABEL_REQUEST_AUTHENTICATION    "SPM1 request authentication"
+#define LAN_LABEL_RESPONSE_ENCRYPTION       "SPM1 response encryption"
+#define LAN_LABEL_RESPONSE_AUTHENTICATION   "SPM1 response authentication"
+
+/*******************************************************************************
+*   Type definitions
+*******************************************************************************/
+
+/**
+ * @brief Request handler, called in thread running the epoll loop.
+ *
+ * @param p_payload Decrypted request payload, not null terminated.
+ * @param payload_size Request payload size.
+ * @param pp_response Heap allocated null terminated response, freed by
+ *    listener.
+ * @param p_response_size Response size.
+ *
+ * @return HTTP-like status code.
+ */
+typedef int (*lan_request_fn_t)(const char *p_payload, size_t payload_size,
+    char **pp_response, size_t *p_response_size);
+
+/*******************************************************************************
+* Function prototypes
+*******************************************************************************/
+
+/**
+ * @brief Open UDP socket and register it in epoll.
+ *
+ * @param fd_epoll Epoll file descriptor.
+ * @param port UDP port to listen on.
+ * @param p_psk Pre-shared key, at least LAN_PSK_LENGTH_MIN characters.
+ * @param request_cb Handler of authenticated requests.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int
+lan_listener_init(int fd_epoll, uint16_t port, const char *p_psk,
+    lan_request_fn_t request_cb);
+
+/**
+ * @brief Close socket and wipe keys.
+ */
+void
+lan_listener_deinit(void);
+
+/* [] END OF FILE */
@@ -0,0 +1,441 @@
+﻿/***************************************************************************//**
+* @file    log_ring.c
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Deferred logging to lock-free ring buffer.
+*
+*    Ring buffer is a bounded multiple producer queue. Every slot carries
+*    a sequence number: producer claims a slot by advancing write position
+*    when slot sequence equals the position and publishes the record by
+*    release store of position + 1. Consumer takes the record when sequence
+*    equals read position + 1 and frees the slot by storing position +
+*    capacity. Records are dropped, not overwritten, when the ring is full.
+*
+*******************************************************************************/
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <applibs/log.h>
+
+#include "log_ring.h"
+
+/*******************************************************************************
+*   Macros and #define Constants
+*******************************************************************************/
+
+#define LOG_LINE_LENGTH     256
+#define LOG_SPEC_LENGTH     16
+
+/*******************************************************************************
+*   Type definitions
+*******************************************************************************/
+
+typedef struct log_slot_s
+{
+    atomic_size_t sequence;
+    struct timespec time;
+    int level;
+    const char *p_module;
+    const char *p_format;
+    size_t arg_count;
+    log_arg_t args[LOG_RING_ARGS_MAX];
+    char strings[LOG_RING_STRING_SPACE];
+} log_slot_t;
+
+/*******************************************************************************
+* Function declarations
+*******************************************************************************/
+
+/**
+ * @brief Format one record to buffer.
+ *
+ * @param p_slot Record to format.
+ * @param p_buffer Output buffer.
+ * @param size Size of output buffer.
+ */
+static void
+format_record(const log_slot_t *p_slot, char *p_buffer, size_t size);
+
+/**
+ * @brief Format one conversion specification with its argument.
+ *
+ * @param p_spec Conversion specification without length modifier.
+ * @param p_length Length modifier found in format string.
+ * @param p_arg Argument, NULL if missing.
+ * @param p_buffer Output buffer.
+ * @param size Size of output buffer.
+ *
+ * @return Number of characters written as returned by snprintf.
+ */
+static int
+format_argument(char *p_spec, const char *p_length, const log_arg_t *p_arg,
+    char *p_buffer, size_t size);
+
+/*******************************************************************************
+* Global variables
+*******************************************************************************/
+
+static log_slot_t g_slots[LOG_RING_CAPACITY];
+static atomic_size_t g_write_position;
+static size_t g_read_position;
+static atomic_flag g_flush_lock = ATOMIC_FLAG_INIT;
+
+static atomic_ulong g_recorded;
+static atomic_ulong g_dropped;
+static atomic_ulong g_flushed;
+static unsigned long g_dropped_reported;
+
+static const char g_level_letters[] = { 'D', 'I', 'W', 'E' };
+
+/*******************************************************************************
+* Function definitions
+*******************************************************************************/
+
+void
+log_ring_init(void)
+{
+    for (size_t i = 0; i < LOG_RING_CAPACITY; i++)
+    {
+        atomic_init(&g_slots[i].sequence, i);
+    }
+    atomic_init(&g_write_position, 0);
+    g_read_position = 0;
+}
+
+void
+log_ring_record(int level, const char *p_module, const char *p_format,
+    const log_arg_t *p_args, size_t arg_count)
+{
+    log_slot_t *p_slot;
+    size_t position = atomic_load_explicit(&g_write_position,
+        memory_order_relaxed);
+
+    // Claim a slot
+    for (;;)
+    {
+        p_slot = &g_slots[position & (LOG_RING_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&p_slot->sequence,
+            memory_order_acquire);
+        ptrdiff_t difference = (ptrdiff_t)(sequence - position);
+
+        if (difference == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&g_write_position,
+                &position, position + 1, memory_order_relaxed,
+                memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // Ring is full
+            atomic_fetch_add_explicit(&g_dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = atomic_load_explicit(&g_write_position,
+                memory_order_relaxed);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &p_slot->time);
+    p_slot->level = level;
+    p_slot->p_module = p_module;
+    p_slot->p_format = p_format;
+
+    if (arg_count > LOG_RING_ARGS_MAX)
+    {
+        arg_count = LOG_RING_ARGS_MAX;
+    }
+    p_slot->arg_count = arg_count;
+
+    // Copy arguments, strings may not exist any more when record is flushed
+    size_t string_used = 0;
+    for (size_t i = 0; i < arg_count; i++)
+    {
+        p_slot->args[i] = p_args[i];
+        if (p_args[i].type != LOG_ARG_STRING)
+        {
+            continue;
+        }
+
+        char *p_copy = &p_slot->strings[string_used];
+        size_t space = LOG_RING_STRING_SPACE - string_used;
+        if (p_args[i].value.s == NULL)
+        {
+            p_slot->args[i].value.s = "(null)";
+        }
+        else if (space == 0)
+        {
+            p_slot->args[i].value.s = "";
+        }
+        else
+        {
+            size_t length = strnlen(p_args[i].value.s, space - 1);
+            memcpy(p_copy, p_args[i].value.s, length);
+            p_copy[length] = '\0';
+            p_slot->args[i].value.s = p_copy;
+            string_used += length + 1;
+        }
+    }
+
+    atomic_store_explicit(&p_slot->sequence, position + 1,
+        memory_order_release);
+    atomic_fetch_add_explicit(&g_recorded, 1, memory_order_relaxed);
+}
+
+size_t
+log_ring_flush(size_t max_records)
+{
+    if (atomic_flag_test_and_set_explicit(&g_flush_lock,
+        memory_order_acquire))
+    {
+        // Other thread is flushing
+        return 0;
+    }
+
+    char line[LOG_LINE_LENGTH];
+    size_t flushed = 0;
+
+    while ((max_records == 0) || (flushed < max_records))
+    {
+        log_slot_t *p_slot =
+            &g_slots[g_read_position & (LOG_RING_CAPACITY - 1)];
+        size_t sequence = atomic_load_explicit(&p_slot->sequence,
+            memory_order_acquire);
+        if (sequence != g_read_position + 1)
+        {
+            // Ring is empty
+            break;
+        }
+
+        format_record(p_slot, line, sizeof(line));
+        atomic_store_explicit(&p_slot->sequence,
+            g_read_position + LOG_RING_CAPACITY, memory_order_release);
+        g_read_position++;
+
+        Log_Debug("%s", line);
+        flushed++;
+    }
+
+    unsigned long dropped = atomic_load_explicit(&g_dropped,
+        memory_order_relaxed);
+    if (dropped != g_dropped_reported)
+    {
+        Log_Debug("WARNING: %lu log records dropped.\n",
+            dropped - g_dropped_reported);
+        g_dropped_reported = dropped;
+    }
+
+    atomic_fetch_add_explicit(&g_flushed, flushed, memory_order_relaxed);
+    atomic_flag_clear_explicit(&g_flush_lock, memory_order_release);
+
+    return flushed;
+}
+
+void
+log_ring_get_statistics(log_ring_statistics_t *p_statistics)
+{
+    p_statistics->recorded = atomic_load(&g_recorded);
+    p_statistics->dropped = atomic_load(&g_dropped);
+    p_statistics->flushed = atomic_load(&g_flushed);
+}
+
+/*******************************************************************************
+* Private function definitions
+*******************************************************************************/
+
+static void
+format_record(const log_slot_t *p_slot, char *p_buffer, size_t size)
+{
+    int written = snprintf(p_buffer, size, "%5ld.%03ld %c [%s] ",
+        (long)p_slot->time.tv_sec, p_slot->time.tv_nsec / 1000000L,
+        g_level_letters[p_slot->level], p_slot->p_module);
+    size_t used = (written > 0) ? (size_t)written : 0;
+    size_t arg_index = 0;
+    const char *p_char = p_slot->p_format;
+
+    while ((*p_char != '\0') && (used + 1 < size))
+    {
+        if (*p_char != '%')
+        {
+            p_buffer[used++] = *p_char++;
+            continue;
+        }
+
+        if (p_char[1] == '%')
+        {
+            p_buffer[used++] = '%';
+            p_char += 2;
+            continue;
+        }
+
+        // Split conversion specification to flags, width and precision,
+        // length modifier and conversion character
+        char spec[LOG_SPEC_LENGTH];
+        char length[3] = "";
+        size_t spec_length = 0;
+
+        spec[spec_length++] = *p_char++;
+        while ((*p_char != '\0') && (strchr("-+ #0123456789.", *p_char) != NULL)
+            && (spec_length < LOG_SPEC_LENGTH - 2))
+        {
+            spec[spec_length++] = *p_char++;
+        }
+
+        size_t length_length = 0;
+        while ((*p_char != '\0') && (strchr("hljztL", *p_char) != NULL))
+        {
+            if (length_length < sizeof(length) - 1)
+            {
+                length[length_length++] = *p_char;
+                length[length_length] = '\0';
+            }
+            p_char++;
+        }
+
+        if (*p_char == '\0')
+        {
+            break;
+        }
+        spec[spec_length++] = *p_char++;
+        spec[spec_length] = '\0';
+
+        const log_arg_t *p_arg = NULL;
+        if (arg_index < p_slot->arg_count)
+        {
+            p_arg = &p_slot->args[arg_index];
+        }
+        arg_index++;
+
+        written = format_argument(spec, length, p_arg, &p_buffer[used],
+            size - used);
+        if (written > 0)
+        {
+            used += (size_t)written;
+        }
+        if (used >= size)
+        {
+            used = size - 1;
+        }
+    }
+
+    p_buffer[used] = '\0';
+}
+
+static int
+format_argument(char *p_spec, const char *p_length, const log_arg_t *p_arg,
+    char *p_buffer, size_t size)
+{
+    size_t spec_length = strlen(p_spec);
+    char conversion = p_spec[spec_length - 1];
+
+    if ((p_arg == NULL) || (p_arg->type == LOG_ARG_NONE))
+    {
+        return snprintf(p_buffer, size, "(?)");
+    }
+
+    if (p_arg->type == LOG_ARG_STRING)
+    {
+        if (conversion != 's')
+        {
+            return snprintf(p_buffer, size, "%s", p_arg->value.s);
+        }
+        return snprintf(p_buffer, size, p_spec, p_arg->value.s);
+    }
+
+    if (p_arg->type == LOG_ARG_DOUBLE)
+    {
+        if (strchr("fFeEgGaA", conversion) == NULL)
+        {
+            return snprintf(p_buffer, size, "%g", p_arg->value.d);
+        }
+        return snprintf(p_buffer, size, p_spec, p_arg->value.d);
+    }
+
+    if ((conversion == 'p') || (p_arg->type == LOG_ARG_POINTER))
+    {
+        return snprintf(p_buffer, size, "%p", p_arg->value.p);
+    }
+
+    // Integer argument, width of value follows the length modifier
+    unsigned long long value = p_arg->value.u;
+    if (strchr("di", conversion) != NULL)
+    {
+        long long signed_value = p_arg->value.i;
+        if (strcmp(p_length, "hh") == 0)
+        {
+            signed_value = (signed char)signed_value;
+        }
+        else if (strcmp(p_length, "h") == 0)
+        {
+            signed_value = (short)signed_value;
+        }
+        else if (p_length[0] == '\0')
+        {
+            signed_value = (int)signed_value;
+        }
+        else if (strcmp(p_length, "l") == 0)
+        {
+            signed_value = (long)signed_value;
+        }
+
+        // Rebuild specification with "ll" length modifier
+        char spec_ll[LOG_SPEC_LENGTH + 2];
+        snprintf(spec_ll, sizeof(spec_ll), "%.*sll%c",
+            (int)(spec_length - 1), p_spec, conversion);
+        return snprintf(p_buffer, size, spec_ll, signed_value);
+    }
+
+    if (strchr("uoxX", conversion) != NULL)
+    {
+        if (strcmp(p_length, "hh") == 0)
+        {
+            value = (unsigned char)value;
+        }
+        else if (strcmp(p_length, "h") == 0)
+        {
+            value = (unsigned short)value;
+        }
+        else if (p_length[0] == '\0')
+        {
+            value = (unsigned int)value;
+        }
+        else if (strcmp(p_length, "l") == 0)
+        {
+            value = (unsigned long)value;
+        }
+
+        char spec_ll[LOG_SPEC_LENGTH + 2];
+        snprintf(spec_ll, sizeof(spec_ll), "%.*sll%c",
+            (int)(spec_length - 1), p_spec, conversion);
+        return snprintf(p_buffer, size, spec_ll, value);
+    }
+
+    if (conversion == 'c')
+    {
+        return snprintf(p_buffer, size, p_spec, (int)value);
+    }
+
+    if (strchr("fFeEgGaA", conversion) != NULL)
+    {
+        double double_value = (p_arg->type == LOG_ARG_SIGNED) ?
+            (double)p_arg->value.i : (double)p_arg->value.u;
+        return snprintf(p_buffer, size, p_spec, double_value);
+    }
+
+    // Unsupported conversion
+    return snprintf(p_buffer, size, "(?)");
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,233 @@
+﻿/***************************************************************************//**
+* @file    log_ring.h
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Deferred logging. Log macros store format string pointer and raw
+*    arguments to a lock-free ring buffer, formatting and output to debug
+*    log is done later by log_ring_flush() when the application is idle.
+*
+*    Every module selects its log level at compile time before including
+*    this header:
+*
+*        #define LOG_MODULE_NAME     "main"
+*        #define LOG_MODULE_LEVEL    LOG_LEVEL_MAIN
+*        #include "log_ring.h"
+*
+*    Messages below module level are removed by the compiler. Format string
+*    must be a string literal, its address identifies the message. String
+*    arguments are copied to the record and truncated if too long, width
+*    and precision given by '*' are not supported.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************************************
+*   Macros and #define Constants
+*******************************************************************************/
+
+#define LOG_LEVEL_DEBUG     0
+#define LOG_LEVEL_INFO      1
+#define LOG_LEVEL_WARNING   2
+#define LOG_LEVEL_ERROR     3
+#define LOG_LEVEL_NONE      4
+
+// Maximum number of arguments of one log message
+#define LOG_RING_ARGS_MAX           6
+
+// Space for copies of string arguments in one record
+#define LOG_RING_STRING_SPACE       80
+
+// Number of records in ring buffer, power of two
+#define LOG_RING_CAPACITY           64
+
+#ifndef LOG_MODULE_NAME
+#define LOG_MODULE_NAME     "app"
+#endif
+
+#ifndef LOG_MODULE_LEVEL
+#define LOG_MODULE_LEVEL    LOG_LEVEL_INFO
+#endif
+
+#define LOG_DEBUG(fmt, ...)     LOG_RECORD(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)      LOG_RECORD(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_WARNING(fmt, ...)   LOG_RECORD(LOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(fmt, ...)     LOG_RECORD(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+
+// Level check is a compile time constant, disabled messages are removed
+// together with evaluation of their arguments
+#define LOG_RECORD(level, fmt, ...) \
+    do \
+    { \
+        if ((level) >= (LOG_MODULE_LEVEL)) \
+        { \
+            const log_arg_t log_args_[] = { \
+                { LOG_ARG_NONE, { 0 } }, \
+                LOG_CAT(LOG_ARGS_, LOG_COUNT(__VA_ARGS__))(__VA_ARGS__) \
+            }; \
+            log_ring_record((level), LOG_MODULE_NAME, (fmt), \
+                &log_args_[1], LOG_COUNT(__VA_ARGS__)); \
+        } \
+    } while (0)
+
+// Argument type is selected at compile time
+#define LOG_ARG(x) _Generic((x), \
+    char *: log_arg_string, \
+    const char *: log_arg_string, \
+    unsigned char *: log_arg_ustring, \
+    const unsigned char *: log_arg_ustring, \
+    _Bool: log_arg_unsigned, \
+    char: log_arg_signed, \
+    signed char: log_arg_signed, \
+    short: log_arg_signed, \
+    int: log_arg_signed, \
+    long: log_arg_signed, \
+    long long: log_arg_signed, \
+    unsigned char: log_arg_unsigned, \
+    unsigned short: log_arg_unsigned, \
+    unsigned int: log_arg_unsigned, \
+    unsigned long: log_arg_unsigned, \
+    unsigned long long: log_arg_unsigned, \
+    float: log_arg_double, \
+    double: log_arg_double, \
+    default: log_arg_pointer)(x)
+
+#define LOG_ARGS_0()
+#define LOG_ARGS_1(a) LOG_ARG(a)
+#define LOG_ARGS_2(a, b) LOG_ARG(a), LOG_ARG(b)
+#define LOG_ARGS_3(a, b, c) LOG_ARGS_2(a, b), LOG_ARG(c)
+#define LOG_ARGS_4(a, b, c, d) LOG_ARGS_3(a, b, c), LOG_ARG(d)
+#define LOG_ARGS_5(a, b, c, d, e) LOG_ARGS_4(a, b, c, d), LOG_ARG(e)
+#define LOG_ARGS_6(a, b, c, d, e, f) LOG_ARGS_5(a, b, c, d, e), LOG_ARG(f)
+
+#define LOG_COUNT(...) LOG_COUNT_(_0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_COUNT_(_0, _1, _2, _3, _4, _5, _6, n, ...) n
+
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+
+/*******************************************************************************
+*   Type definitions
+*******************************************************************************/
+
+typedef enum log_arg_type_e
+{
+    LOG_ARG_NONE,
+    LOG_ARG_SIGNED,
+    LOG_ARG_UNSIGNED,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_POINTER,
+    LOG_ARG_STRING
+} log_arg_type_t;
+
+typedef struct log_arg_s
+{
+    log_arg_type_t type;
+    union
+    {
+        long long i;
+        unsigned long long u;
+        double d;
+        const void *p;
+        const char *s;
+    } value;
+} log_arg_t;
+
+typedef struct log_ring_statistics_s
+{
+    unsigned long recorded;     // Records stored to ring buffer
+    unsigned long dropped;      // Records lost because ring buffer was full
+    unsigned long flushed;      // Records formatted and written to log
+} log_ring_statistics_t;
+
+/*******************************************************************************
+* Function prototypes
+*******************************************************************************/
+
+/**
+ * @brief Initialize ring buffer. Must be called before first log message.
+ */
+void
+log_ring_init(void);
+
+/**
+ * @brief Store log message to ring buffer. Called by log macros, safe to
+ *    call from any thread.
+ *
+ * @param level Message level.
+ * @param p_module Module name, string literal.
+ * @param p_format Format string, string literal.
+ * @param p_args Message arguments.
+ * @param arg_count Number of message arguments.
+ */
+void
+log_ring_record(int level, const char *p_module, const char *p_format,
+    const log_arg_t *p_args, size_t arg_count);
+
+/**
+ * @brief Format stored messages and write them to debug log.
+ *
+ * Only one thread flushes at a time, call from another thread returns
+ * immediately.
+ *
+ * @param max_records Maximum number of records to flush, 0 for all.
+ *
+ * @return Number of records flushed.
+ */
+size_t
+log_ring_flush(size_t max_records);
+
+/**
+ * @brief Get ring buffer statistics.
+ *
+ * @param p_statistics Statistics output.
+ */
+void
+log_ring_get_statistics(log_ring_statistics_t *p_statistics);
+
+static inline log_arg_t
+log_arg_signed(long long value)
+{
+    return (log_arg_t) { LOG_ARG_SIGNED, { .i = value } };
+}
+
+static inline log_arg_t
+log_arg_unsigned(unsigned long long value)
+{
+    return (log_arg_t) { LOG_ARG_UNSIGNED, { .u = value } };
+}
+
+static inline log_arg_t
+log_arg_double(double value)
+{
+    return (log_arg_t) { LOG_ARG_DOUBLE, { .d = value } };
+}
+
+static inline log_arg_t
+log_arg_pointer(const void *value)
+{
+    return (log_arg_t) { LOG_ARG_POINTER, { .p = value } };
+}
+
+static inline log_arg_t
+log_arg_string(const char *value)
+{
+    return (log_arg_t) { LOG_ARG_STRING, { .s = value } };
+}
+
+static inline log_arg_t
+log_arg_ustring(const unsigned char *value)
+{
+    return (log_arg_t) { LOG_ARG_STRING, { .s = (const char *)value } };
+}
+
+/* [] END OF FILE */
@@ -29,11 +29,17 @@
 
 #include <stdbool.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <time.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 // applibs_versions.h defines the API struct versions to use for applibs APIs.
 #include "applibs_versions.h"
@@ -44,14 +50,28 @@
 // property "Target Hardware Definition Directory"
 #include <hw/project_hardware.h>
 
-// Using a single-thread event loop pattern based on Epoll and timerfd
+// Using an event loop pattern based on Epoll and timerfd for UI thread
 #include "epoll_timerfd_utilities.h"
 
+// Lock-free queues between UI thread and IoT thread
+#include "spsc_queue.h"
+
+// Parameters tunable from Device Twin
+#include "tunables.h"
+
+// Item delivery from local network
+#include "lan_listener.h"
+
 // Azure IoT 
 #include "azure_iot_utilities.h"
 #include "connection_strings.h"
 #include "build_options.h"
 
+// Deferred logging
+#define LOG_MODULE_NAME     "main"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_MAIN
+#include "log_ring.h"
+
 // OLED display support library
 #include "lib_u8g2.h"
 
@@ -61,7 +81,6 @@
 
 #define I2C_ISU                 PROJECT_ISU2_I2C
 #define I2C_BUS_SPEED           I2C_BUS_SPEED_STANDARD
-#define I2C_TIMEOUT_MS          (100u)
 
 #define I2C_ADDR_OLED           (0x3C)
 #define I2C_ADDR_USB_KEYBOARD   (0x08)
@@ -71,6 +90,11 @@
 // Max size of direct method call payload
 #define DIRECT_METHOD_CALL_PAYLOAD_MAX      400
 
+// Response to 'set_item_data' without valid item data
+#define RESPONSE_NO_PAYLOAD     "{ \"success\" : false, \"message\" : " \
+                                "\"Request does not contain an identifiable " \
+                                "payload\" }"
+
 // Names of properties in JSON incoming from IoT Hub
 #define JSON_NAME_NAME          "Name"
 #define JSON_USERNAME_NAME      "Username"
@@ -79,11 +103,13 @@
 #define JSON_PASSWORDENTER_NAME "PasswordEnter"
 #define JSON_TABJOIN_NAME       "UnameTabPass"
 #define JSON_LOADSEND_NAME      "LoadAndSend"
+#define JSON_REQUESTID_NAME     "RequestId"
 
 // Max allowed length of JSON string properties
 #define JSON_NAME_LENGTH        30
 #define JSON_USERNAME_LENGTH    50
 #define JSON_PASSWORD_LENGTH    50
+#define JSON_REQUESTID_LENGTH   16
 
 #define STRING_NL               "\n"
 #define STRING_TAB              "\t"
@@ -94,8 +120,31 @@
 #define STRING_BUTTON2          "B2: "
 #define STRING_3DOT             "..."
 
-// How long the loaded item will be available before erasing
-#define PERIOD_TO_FORGET_SEC      (5 * 60)
+// How long the loaded item will be available before erasing, I2C timeout,
+// button poll period and keyboard emulator chunk length and delay between
+// chunks are tunable from Device Twin, see tunables.c
+
+// Number of attempts to write a chunk again after I2C error
+#define USB_KEYBOARD_WRITE_RETRIES  2
+
+// Longest text typed by a single action: username, separator, password, enter
+#define TYPING_BUFFER_LENGTH    (JSON_USERNAME_LENGTH + JSON_PASSWORD_LENGTH + 2)
+
+// Telemetry event reporting the result of typing a loaded item
+#define TELEMETRY_EVENT_ITEM_TYPED  "item_typed"
+
+// Telemetry event with aggregated item delivery metrics
+#define TELEMETRY_EVENT_DELIVERY_STATS  "delivery_stats"
+
+// Period of sending item delivery metrics, sent only when changed
+#define DELIVERY_STATS_PERIOD_SEC   (15 * 60)
+
+// Capacity of queues between UI thread and IoT thread
+#define ITEM_QUEUE_CAPACITY         4
+#define TELEMETRY_QUEUE_CAPACITY    16
+
+// Period of reporting latency histograms as Device Twin reported properties
+#define LATENCY_REPORT_PERIOD_SEC   (15 * 60)
 
 typedef struct item_data_s
 {
@@ -106,8 +155,58 @@ typedef struct item_data_s
     bool send_password_enter;                   // Send Enter after password
     bool send_uname_tab_pass;                   // Send username <TAB> password
     bool send_immediately;            // Send login immediately after receiving
+    char request_id[JSON_REQUESTID_LENGTH + 1]; // Sender's request ID
+    struct timespec received_time;    // Direct method receive time, monotonic
 } item_data_t;
 
+// Startup phases recorded for boot time profiling
+typedef enum boot_phase_e
+{
+    BOOT_PHASE_HANDLERS,            // Signal handlers, epoll and queues
+    BOOT_PHASE_IOT_THREAD,          // IoT thread started
+    BOOT_PHASE_I2C,                 // I2C bus opened
+    BOOT_PHASE_DISPLAY,             // OLED display initialized
+    BOOT_PHASE_GPIO,                // Buttons and timers set up
+    BOOT_PHASE_READY,               // "Ready" shown on OLED
+    BOOT_PHASE_HUB_AUTHENTICATED,   // First authentication with IoT Hub
+    BOOT_PHASE_COUNT
+} boot_phase_t;
+
+typedef struct typing_state_s
+{
+    unsigned char buffer[TYPING_BUFFER_LENGTH + 1]; // Text waiting to be typed
+    size_t length;                              // Length of text in buffer
+    size_t position;                            // Next character to be typed
+    bool b_is_active;                           // Chunk delay timer is armed
+    bool b_is_failed;                           // Typing error occurred
+    bool b_report;                              // Report result as telemetry
+    char item_name[JSON_NAME_LENGTH + 1];       // Name of the reported item
+    char request_id[JSON_REQUESTID_LENGTH + 1]; // Request ID of reported item
+    struct timespec received_time;              // Reported item receive time
+    bool b_is_started;                          // First chunk written
+    struct timespec start_time;                 // First chunk write time
+    unsigned int retries_left;                  // Retries of current chunk
+} typing_state_t;
+
+// Item delivery metrics. Each counter and histogram has a single writer
+// thread noted below, delivery_stats_report() reads them in UI thread.
+typedef struct delivery_metrics_s
+{
+    atomic_uint items_received;     // Items accepted by direct method, IoT
+    atomic_uint items_received_lan; // Items accepted from local network, UI
+    atomic_uint items_duplicate;    // Items dropped as already delivered, UI
+    atomic_uint items_rejected;     // Direct method payload errors, IoT
+    atomic_uint items_typed;        // Typing finished successfully, UI
+    atomic_uint typing_failures;    // Typing failed or cancelled, UI
+    atomic_uint i2c_bytes;          // Bytes written to USB keyboard, UI
+    atomic_uint i2c_retries;        // Chunk writes repeated, UI
+    atomic_uint forget_wipes;       // Items wiped after forget period, UI
+    histogram_t parse_us;           // Direct method payload parsing, IoT
+    histogram_t render_us;          // Rendering item on OLED, UI
+    histogram_t typing_ms;          // First to last chunk written, UI
+    histogram_t delivery_ms;        // Item received to last chunk, UI
+} delivery_metrics_t;
+
 /*******************************************************************************
 * Forward declarations of private functions
 *******************************************************************************/
@@ -124,6 +223,14 @@ typedef struct item_data_s
 static void
 termination_handler(int signal_number);
 
+/**
+ * @brief Request application termination. Sets termination flag and wakes
+ *    up IoT thread sleeping in poll(). Async-signal-safe, called from any
+ *    thread and from signal handler.
+ */
+static void
+termination_request(void);
+
 /**
  * @brief Initialize signal handlers.
  *
@@ -163,11 +270,167 @@ static void
 handle_button2_press(void);
 
 /**
- * @brief Send null terminated string via I2C to keyboard emulator
+ * @brief Queue null terminated string to be typed by keyboard emulator.
+ *
+ * The string is sent via I2C in the background, one chunk per
+ * TUNABLE_CHUNK_DELAY_MS, so the event loop is never blocked.
  */
 static void
 send_string_to_usb_keyboard(const unsigned char* p_string);
 
+/**
+ * @brief Send next chunk of queued text via I2C to keyboard emulator.
+ */
+static void
+usb_keyboard_write_chunk(void);
+
+/**
+ * @brief Discard queued text, report cancellation if requested.
+ */
+static void
+typing_cancel(void);
+
+/**
+ * @brief Finish typing, report result if requested.
+ */
+static void
+typing_finish(void);
+
+/**
+ * @brief Send telemetry event with the result of typing an item.
+ *
+ * @param p_error Error description, NULL on success.
+ */
+static void
+report_typing_result(const char *p_error);
+
+/**
+ * @brief Timer event handler for typing queued text.
+ */
+static void
+event_handler_timer_typing(EventData *event_data);
+
+/**
+ * @brief Queue event handler for item data received by IoT thread.
+ *
+ * Item data is handed over from IoT thread, this is the only place where
+ * g_item_data gets loaded.
+ */
+static void
+event_handler_item_queue(EventData *event_data);
+
+/**
+ * @brief Queue telemetry message to be sent by IoT thread.
+ *
+ * @param p_message Message allocated by json_serialize_to_string(),
+ *    ownership is taken over.
+ */
+static void
+send_telemetry(char *p_message);
+
+/**
+ * @brief Record time of reaching a startup phase.
+ *
+ * Phases up to BOOT_PHASE_READY are recorded by UI thread,
+ * BOOT_PHASE_HUB_AUTHENTICATED by IoT thread.
+ *
+ * @param phase Phase reached.
+ */
+static void
+boot_phase_reached(boot_phase_t phase);
+
+/**
+ * @brief Report startup phase times as Device Twin reported properties.
+ *
+ * Called in IoT thread, reports once after both UI thread is ready and
+ * the IoT Hub client got authenticated.
+ */
+static void
+boot_profile_report(void);
+
+/**
+ * @brief Export latency histograms of UI thread event handlers and of IoT Hub
+ *    client as JSON object.
+ *
+ * @return JSON value owned by caller, NULL on allocation failure.
+ */
+static JSON_Value
+*latency_to_json(void);
+
+/**
+ * @brief Report latency histograms as Device Twin reported property
+ *    "latency" every LATENCY_REPORT_PERIOD_SEC. Called in IoT thread.
+ */
+static void
+latency_report(void);
+
+/**
+ * @brief Get time elapsed since given monotonic time.
+ *
+ * @param p_since Start time, CLOCK_MONOTONIC.
+ *
+ * @return Elapsed time in microseconds.
+ */
+static int64_t
+elapsed_us(const struct timespec *p_since);
+
+/**
+ * @brief Send aggregated item delivery metrics as telemetry event every
+ *    DELIVERY_STATS_PERIOD_SEC if any item was received, typed or wiped
+ *    since the last event. Called in UI thread.
+ */
+static void
+delivery_stats_report(void);
+
+/**
+ * @brief IoT Hub connection status callback, called in IoT thread.
+ *
+ * @param b_is_connected true when authenticated with IoT Hub.
+ */
+static void
+cb_connection_status(bool b_is_connected);
+
+/**
+ * @brief Device Twin desired property changed callback, called in IoT 
+ *    thread. Sets tunables and reports their values back.
+ *
+ * @param p_path Dot separated property path.
+ * @param p_value New property value, NULL when removed.
+ */
+static void
+cb_twin_property_changed(const char *p_path, const JSON_Value *p_value);
+
+/**
+ * @brief Report tunable value and validation result as Device Twin 
+ *    reported properties "tunables.<name>" and "tunablesError.<name>".
+ *    Called in IoT thread.
+ *
+ * @param id Tunable.
+ * @param p_error Reason of rejecting desired value, NULL if accepted.
+ */
+static void
+tunable_report(tunable_id_t id, const char *p_error);
+
+/**
+ * @brief Tunables change event handler, applies changed tunables to 
+ *    UI thread resources.
+ */
+static void
+event_handler_tunables(EventData *event_data);
+
+/**
+ * @brief IoT thread function.
+ *
+ * Keeps the IoT Hub client connected and working. Sends telemetry queued 
+ * by UI thread. Direct Method calls are executed in this thread.
+ *
+ * @param p_arg Unused.
+ *
+ * @return NULL.
+ */
+static void
+*iot_thread_main(void *p_arg);
+
 /**
  * @brief Timer event handler for polling button states.
  */
@@ -213,6 +476,9 @@ static void
  * @brief Direct Method callback function, called when a Direct Method call 
  * is received from the Azure IoT Hub.
  *
+ * Called in IoT thread. Received item data is handed over to UI thread,
+ * g_item_data must not be accessed here.
+ *
  * @param p_method_name The name of the method being called.
  * @param p_payload The payload of the method.
  * @param payload_size Direct method payload size.
@@ -225,25 +491,80 @@ static void
  *    200 HTTP status code if the method name is reconginized and 
  *        the payload is correctly parsed;
  *    400 HTTP status code if the payload is invalid;
- *    404 HTTP status code if the method name is unknown.
+ *    404 HTTP status code if the method name is unknown;
+ *    503 HTTP status code if the UI thread cannot accept the item.
  */
 static int
 cb_direct_method_call(const char* p_method_name,
     const char* p_payload, size_t payload_size,
     char** pp_response_payload, size_t* p_response_payload_size);
 
+#ifdef LAN_LISTENER_ENABLED
+/**
+ * @brief Local network request callback, called in UI thread. Accepts 
+ *    the same payload as 'set_item_data' Direct Method.
+ *
+ * @param p_payload Request payload.
+ * @param payload_size Request payload size.
+ * @param pp_response Heap allocated response payload.
+ * @param p_response_size Response payload size.
+ *
+ * @return HTTP status code as cb_direct_method_call().
+ */
+static int
+cb_lan_request(const char *p_payload, size_t payload_size,
+    char **pp_response, size_t *p_response_size);
+#endif
+
+/**
+ * @brief Parse item data from 'set_item_data' payload.
+ *
+ * @param p_payload Payload, not null terminated.
+ * @param payload_size Payload size.
+ * @param p_received_time Time of receiving payload, CLOCK_MONOTONIC.
+ *
+ * @return Heap allocated item data, NULL if payload is not valid.
+ */
+static item_data_t
+*item_data_parse(const char *p_payload, size_t payload_size, 
+    const struct timespec *p_received_time);
+
+/**
+ * @brief Allocate 'set_item_data' response for loaded item.
+ *
+ * @param p_item Item data.
+ *
+ * @return Heap allocated response string.
+ */
+static char
+*item_data_response(const item_data_t *p_item);
+
+/**
+ * @brief Show item received from IoT Hub or local network, called in 
+ *    UI thread. Item with request ID same as the last one is dropped, 
+ *    it is a retry of already delivered request. Item memory is wiped 
+ *    and released.
+ *
+ * @param p_item Heap allocated item data.
+ */
+static void
+item_data_accept(item_data_t *p_item);
+
 /*******************************************************************************
 * Global variables
 *******************************************************************************/
 
-// Termination state flag
-volatile sig_atomic_t gb_is_termination_requested = false;
+// Termination state flag, set and read by UI thread, IoT thread and
+// signal handler
+atomic_bool gb_is_termination_requested = false;
+static int g_fd_shutdown_event = -1;        // Wakes IoT thread on termination
 
 static int g_fd_epoll = -1;        // Epoll file descriptor
 static int g_fd_i2c = -1;          // I2C interface file descriptor
 static int g_fd_gpio_button1 = -1; // GPIO button1 file descriptor
 static int g_fd_gpio_button2 = -1; // GPIO button2 file descriptor
 static int g_fd_poll_timer_button = -1;    // Poll timer button press file desc.
+static int g_fd_timer_typing = -1;         // Typing chunk delay timer file desc.
 
 static GPIO_Value_Type g_state_button1 = GPIO_Value_High;
 static GPIO_Value_Type g_state_button2 = GPIO_Value_High;
@@ -252,10 +573,60 @@ static EventData g_event_data_button = {          // Button Event data
     .eventHandler = &event_handler_timer_button
 };
 
+static EventData g_event_data_typing = {          // Typing Event data
+    .eventHandler = &event_handler_timer_typing
+};
+
+static EventData g_event_data_item_queue = {      // Item queue Event data
+    .eventHandler = &event_handler_item_queue
+};
+
+static EventData g_event_data_tunables = {        // Tunables Event data
+    .eventHandler = &event_handler_tunables
+};
+
+static char g_last_request_id[JSON_REQUESTID_LENGTH + 1]; // Last shown item
+
+static int g_applied_button_poll_ms = 0;    // Button poll period in use
+static int g_applied_i2c_timeout_ms = 0;    // I2C timeout in use
+
+static pthread_t g_iot_thread;              // IoT thread
+static bool gb_is_iot_thread_running = false;
+
+static spsc_queue_t g_queue_item = {        // Item data, IoT to UI thread
+    .fd_event = -1
+};
+static spsc_queue_t g_queue_telemetry = {   // Telemetry, UI to IoT thread
+    .fd_event = -1
+};
+
+static struct timespec g_boot_start;        // Time of entering main()
+static long g_boot_phase_ms[BOOT_PHASE_COUNT];  // Phase times since start
+static atomic_bool gb_is_boot_ui_ready = false; // UI phases recorded
+static bool gb_is_boot_reported = false;    // Boot profile reported
+
+static time_t g_latency_report_time = 0;    // Last latency report, seconds
+
+static delivery_metrics_t g_delivery;       // Item delivery metrics
+static time_t g_delivery_report_time = 0;   // Last metrics event, seconds
+static unsigned int g_delivery_reported_events = 0; // Events at last report
+
+static const char *g_boot_phase_names[BOOT_PHASE_COUNT] = {
+    "handlersMs",
+    "iotThreadMs",
+    "i2cMs",
+    "displayMs",
+    "gpioMs",
+    "readyMs",
+    "hubAuthenticatedMs"
+};
+
 static u8g2_t g_u8g2;           // OLED device descriptor for u8g2
 
 static item_data_t g_item_data;
 
+static typing_state_t g_typing;
+
 static struct timespec g_time;
 static long g_time_to_forget;
 
@@ -266,62 +637,77 @@ static long g_time_to_forget;
 int
 main(int argc, char *argv[])
 {
-    gb_is_termination_requested = false;
+    clock_gettime(CLOCK_MONOTONIC, &g_boot_start);
+    log_ring_init();
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+    {
+        g_boot_phase_ms[i] = -1;
+    }
+
+    atomic_store(&gb_is_termination_requested, false);
 
     // Initialize handlers
     if (init_handlers() != 0)
     {
         // Failed to init handlers
-        gb_is_termination_requested = true;
+        termination_request();
+    }
+    boot_phase_reached(BOOT_PHASE_HANDLERS);
+
+    // Communication with IoT Hub runs in its own thread. Start it first,
+    // the client connects while peripherals are being initialized.
+    if (!atomic_load(&gb_is_termination_requested))
+    {
+        if (pthread_create(&g_iot_thread, NULL, iot_thread_main, NULL) != 0)
+        {
+            LOG_ERROR("Could not start IoT thread.\n");
+            termination_request();
+        }
+        else
+        {
+            gb_is_iot_thread_running = true;
+            boot_phase_reached(BOOT_PHASE_IOT_THREAD);
+        }
     }
 
     // Initialize peripherals
-    if (!gb_is_termination_requested)
+    if (!atomic_load(&gb_is_termination_requested))
     {
         if (init_peripherals() != 0)
         {
             // Failed to init peripherals
-            gb_is_termination_requested = true;
+            termination_request();
         }
     }
 
-    if (!gb_is_termination_requested)
+    if (!atomic_load(&gb_is_termination_requested))
     {
         // All handlers and peripherals are initialized properly at this point
 
-        u8g2_ClearDisplay(&g_u8g2);
-
+        // Standby screen overwrites whole display, no need to clear it first
         show_standby_state();
+        boot_phase_reached(BOOT_PHASE_READY);
+        atomic_store_explicit(&gb_is_boot_ui_ready, true, 
+            memory_order_release);
 
         // Main program loop
-        while (!gb_is_termination_requested)
+        while (!atomic_load(&gb_is_termination_requested))
         {
-            // Handle timers
+            // Handle timers and queues
             if (WaitForEventAndCallHandler(g_fd_epoll) != 0)
             {
-                gb_is_termination_requested = true;
+                termination_request();
             }
 
-            // Setup the IoT Hub client.
-            // Notes:
-            // - it is safe to call this function even if the client has already
-            //   been set up, as in this case it would have no effect;
-            // - a failure to setup the client is a fatal error.
-            if (!AzureIoT_SetupClient()) {
-                Log_Debug("ERROR: Failed to set up IoT Hub client\n");
-                gb_is_termination_requested = true;
-                break;
-            }
-
-            // AzureIoT_DoPeriodicTasks() needs to be called frequently in order
-            // to keep active the flow of data with the Azure IoT Hub
-            AzureIoT_DoPeriodicTasks();
+            // Events handled, write out log messages recorded meanwhile
+            log_ring_flush(0);
+            delivery_stats_report();
 
             // Check if time to keep login data expired
             if (clock_gettime(CLOCK_REALTIME, &g_time) == -1) {
-                Log_Debug("ERROR: clock_gettime failed: %s (%d).\n",
+                LOG_ERROR("clock_gettime failed: %s (%d).\n",
                     strerror(errno), errno);
-                gb_is_termination_requested = true;
+                termination_request();
             }
             else if ((g_time.tv_sec > g_time_to_forget) &&
                 (strlen(g_item_data.password) > 0))
@@ -329,6 +715,8 @@ main(int argc, char *argv[])
                 // Erase item
                 strcpy(g_item_data.username, "");
                 strcpy(g_item_data.password, "");
+                atomic_fetch_add_explicit(&g_delivery.forget_wipes, 1,
+                    memory_order_relaxed);
 
                 show_standby_state();
             }
@@ -338,6 +726,7 @@ main(int argc, char *argv[])
     }
 
     close_peripherals_and_handlers();
+    log_ring_flush(0);
     Log_Debug("*** Terminated ***\n");
     return 0;
 }
@@ -349,7 +738,24 @@ main(int argc, char *argv[])
 static void
 termination_handler(int signal_number)
 {
-    gb_is_termination_requested = true;
+    // Interrupted code may be about to read errno
+    int saved_errno = errno;
+    termination_request();
+    errno = saved_errno;
+}
+
+static void
+termination_request(void)
+{
+    atomic_store(&gb_is_termination_requested, true);
+
+    if (g_fd_shutdown_event >= 0)
+    {
+        // Result is ignored, the counter can only saturate if it was
+        // already signalled
+        uint64_t increment = 1;
+        (void)write(g_fd_shutdown_event, &increment, sizeof(increment));
+    }
 }
 
 static int
@@ -364,7 +770,7 @@ init_handlers(void)
     result = sigaction(SIGTERM, &term_action, NULL);
     if (result != 0)
     {
-        Log_Debug("ERROR: %s - SIGTERM: errno=%d (%s)\n",
+        LOG_ERROR("%s - SIGTERM: errno=%d (%s)\n",
             __FUNCTION__, errno, strerror(errno));
     }
 
@@ -375,7 +781,7 @@ init_handlers(void)
     result = sigaction(SIGTERM, &abort_action, NULL);
     if (result != 0)
     {
-        Log_Debug("ERROR: %s - SIGABRT: errno=%d (%s)\n",
+        LOG_ERROR("%s - SIGABRT: errno=%d (%s)\n",
             __FUNCTION__, errno, strerror(errno));
     }
 
@@ -389,10 +795,71 @@ init_handlers(void)
         }
     }
 
+    // IoT thread may sleep for minutes between IoT Hub client tasks, wake it
+    // up when termination is requested
+    if (result == 0)
+    {
+        g_fd_shutdown_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (g_fd_shutdown_event < 0)
+        {
+            LOG_ERROR("Could not create shutdown eventfd: %s (%d).\n",
+                strerror(errno), errno);
+            result = -1;
+        }
+    }
+
+    // Create queues between UI thread and IoT thread
+    if (result == 0)
+    {
+        if ((spsc_queue_init(&g_queue_item, ITEM_QUEUE_CAPACITY) != 0) ||
+            (spsc_queue_init(&g_queue_telemetry, TELEMETRY_QUEUE_CAPACITY) != 0))
+        {
+            result = -1;
+        }
+    }
+
+    // Wake up UI thread when IoT thread hands over item data
+    if (result == 0)
+    {
+        result = RegisterEventHandlerToEpoll(g_fd_epoll, g_queue_item.fd_event,
+            &g_event_data_item_queue, EPOLLIN);
+    }
+
+    // Apply tunables changed by IoT thread
+    if (result == 0)
+    {
+        result = tunables_init();
+    }
+    if (result == 0)
+    {
+        result = RegisterEventHandlerToEpoll(g_fd_epoll, 
+            tunables_get_event_fd(), &g_event_data_tunables, EPOLLIN);
+    }
+
+#ifdef LAN_LISTENER_ENABLED
+    // Local network fast path is optional, run without it on failure
+    if (result == 0)
+    {
+        if (lan_listener_init(g_fd_epoll, LAN_LISTENER_PORT, 
+            MY_LAN_PRE_SHARED_KEY, &cb_lan_request) != 0)
+        {
+            LOG_WARNING("LAN listener not started, items are delivered "
+                "via IoT Hub only.\n");
+            lan_listener_deinit();
+        }
+    }
+#endif
+
     // Tell the system about the callback function to call when we receive 
     // a Direct Method message from Azure
     AzureIoT_SetDirectMethodCallback(&cb_direct_method_call);
 
+    // Get notified about IoT Hub authentication for boot time profiling
+    AzureIoT_SetConnectionStatusCallback(&cb_connection_status);
+
+    // Tunables are set from Device Twin desired properties
+    AzureIoT_SetDeviceTwinPropertyChangedCallback(&cb_twin_property_changed);
+
     return result;
 }
 
@@ -405,7 +872,7 @@ init_peripherals(void)
     g_fd_i2c = I2CMaster_Open(I2C_ISU);
     if (g_fd_i2c < 0)
     {
-        Log_Debug("ERROR: I2CMaster_Open: errno=%d (%s)\n",
+        LOG_ERROR("I2CMaster_Open: errno=%d (%s)\n",
             errno, strerror(errno));
     }
     else
@@ -413,15 +880,17 @@ init_peripherals(void)
         result = I2CMaster_SetBusSpeed(g_fd_i2c, I2C_BUS_SPEED);
         if (result != 0)
         {
-            Log_Debug("ERROR: I2CMaster_SetBusSpeed: errno=%d (%s)\n",
+            LOG_ERROR("I2CMaster_SetBusSpeed: errno=%d (%s)\n",
                 errno, strerror(errno));
         }
         else
         {
-            result = I2CMaster_SetTimeout(g_fd_i2c, I2C_TIMEOUT_MS);
+            g_applied_i2c_timeout_ms = tunables_get(TUNABLE_I2C_TIMEOUT_MS);
+            result = I2CMaster_SetTimeout(g_fd_i2c, 
+                (unsigned int)g_applied_i2c_timeout_ms);
             if (result != 0)
             {
-                Log_Debug("ERROR: I2CMaster_SetTimeout: errno=%d (%s)\n",
+                LOG_ERROR("I2CMaster_SetTimeout: errno=%d (%s)\n",
                     errno, strerror(errno));
             }
         }
@@ -430,6 +899,8 @@ init_peripherals(void)
     // Initialize 128x64 SSD1306 OLED
     if (result != -1)
     {
+        boot_phase_reached(BOOT_PHASE_I2C);
+
         // Set lib_u8g2 I2C interface file descriptor and device address
         lib_u8g2_set_i2c(g_fd_i2c, I2C_ADDR_OLED);
 
@@ -442,6 +913,8 @@ init_peripherals(void)
 
         // Wake up display
         u8g2_SetPowerSave(&g_u8g2, 0);
+
+        boot_phase_reached(BOOT_PHASE_DISPLAY);
     }
 
     // Initialize development kit button GPIO
@@ -451,7 +924,7 @@ init_peripherals(void)
         g_fd_gpio_button1 = GPIO_OpenAsInput(PROJECT_BUTTON_1);
         if (g_fd_gpio_button1 < 0)
         {
-            Log_Debug("ERROR: Could not open button GPIO: %s (%d).\n",
+            LOG_ERROR("Could not open button GPIO: %s (%d).\n",
                 strerror(errno), errno);
             result = -1;
         }
@@ -464,7 +937,7 @@ init_peripherals(void)
         g_fd_gpio_button2 = GPIO_OpenAsInput(PROJECT_BUTTON_2);
         if (g_fd_gpio_button2 < 0)
         {
-            Log_Debug("ERROR: Could not open button GPIO: %s (%d).\n",
+            LOG_ERROR("Could not open button GPIO: %s (%d).\n",
                 strerror(errno), errno);
             result = -1;
         }
@@ -473,27 +946,87 @@ init_peripherals(void)
     // Create timer for button press check poll
     if (result != -1)
     {
-        struct timespec button_press_check_period = { 0, 1000000 };
+        g_applied_button_poll_ms = tunables_get(TUNABLE_BUTTON_POLL_MS);
+        struct timespec button_press_check_period = { 
+            g_applied_button_poll_ms / 1000, 
+            (g_applied_button_poll_ms % 1000) * 1000000 };
 
         g_fd_poll_timer_button = CreateTimerFdAndAddToEpoll(g_fd_epoll,
             &button_press_check_period, &g_event_data_button, EPOLLIN);
         if (g_fd_poll_timer_button < 0)
         {
-            Log_Debug("ERROR: Could not create button poll timer: %s (%d).\n",
+            LOG_ERROR("Could not create button poll timer: %s (%d).\n",
+                strerror(errno), errno);
+            result = -1;
+        }
+    }
+
+    // Create disarmed timer for typing text in chunks
+    if (result != -1)
+    {
+        struct timespec typing_period = { 0, 0 };
+
+        g_fd_timer_typing = CreateTimerFdAndAddToEpoll(g_fd_epoll,
+            &typing_period, &g_event_data_typing, EPOLLIN);
+        if (g_fd_timer_typing < 0)
+        {
+            LOG_ERROR("Could not create typing timer: %s (%d).\n",
                 strerror(errno), errno);
             result = -1;
         }
     }
 
+    if (result != -1)
+    {
+        boot_phase_reached(BOOT_PHASE_GPIO);
+    }
+
     return result;
 }
 
 static void
 close_peripherals_and_handlers(void)
 {
+    // Stop IoT thread, termination has been requested already
+    if (gb_is_iot_thread_running)
+    {
+        pthread_join(g_iot_thread, NULL);
+        gb_is_iot_thread_running = false;
+    }
+
+    // Signal handler must not write to a closed descriptor
+    int fd_shutdown_event = g_fd_shutdown_event;
+    g_fd_shutdown_event = -1;
+    CloseFdAndPrintError(fd_shutdown_event, "Shutdown event");
+
+    // Release data left in queues
+    item_data_t *p_item;
+    while ((p_item = spsc_queue_pop(&g_queue_item)) != NULL)
+    {
+        memset(p_item, 0, sizeof(item_data_t));
+        free(p_item);
+    }
+    spsc_queue_deinit(&g_queue_item);
+
+    char *p_message;
+    while ((p_message = spsc_queue_pop(&g_queue_telemetry)) != NULL)
+    {
+        json_free_serialized_string(p_message);
+    }
+    spsc_queue_deinit(&g_queue_telemetry);
+
+    tunables_deinit();
+
+#ifdef LAN_LISTENER_ENABLED
+    lan_listener_deinit();
+#endif
+
     // Close Epoll fd
     CloseFdAndPrintError(g_fd_epoll, "Epoll");
 
+    // Close typing timer fd
+    CloseFdAndPrintError(g_fd_timer_typing, "Typing timer");
+
     // Close I2C
     CloseFdAndPrintError(g_fd_i2c, "I2C");
 
@@ -559,60 +1092,628 @@ send_string_to_usb_keyboard(const unsigned char *p_string)
         return;
     }
 
-    const struct timespec sleep_time = { 0, 150 * 1000000 };    // 150 ms
+    size_t string_length = strlen(p_string);
 
-    int string_length = (int)strlen(p_string);
-    int length_to_send;
+    // Drop already typed text to make room at the buffer end
+    if (g_typing.position > 0)
+    {
+        memmove(g_typing.buffer, g_typing.buffer + g_typing.position,
+            g_typing.length - g_typing.position);
+        g_typing.length -= g_typing.position;
+        g_typing.position = 0;
+    }
 
-    // Send string to I2c in 32-byte chunks since receiving Arduino's Wire
-    // library has 32 byte buffer
-    for (int i = 0; i < string_length; i += 32)
+    if (g_typing.length + string_length > TYPING_BUFFER_LENGTH)
     {
-        if ((string_length - i) > 32)
-        {
-            length_to_send = 32;
-        }
-        else
-        {
-            length_to_send = string_length - i;
-        }
+        LOG_ERROR("USB keyboard typing buffer full.\n");
+        g_typing.b_is_failed = true;
+        return;
+    }
 
-        if (I2CMaster_Write(g_fd_i2c, I2C_ADDR_USB_KEYBOARD, p_string + i, 
-            (size_t)length_to_send) == -1)
-        {
-            Log_Debug("ERROR Sending data to USB keyboard via I2C.\n");
-        }
+    memcpy(g_typing.buffer + g_typing.length, p_string, string_length);
+    g_typing.length += string_length;
 
-        // Delay before sending the next chunk
-        nanosleep(&sleep_time, NULL);
+    // Start typing unless waiting for the previous chunk delay
+    if (!g_typing.b_is_active)
+    {
+        usb_keyboard_write_chunk();
     }
 
     return;
 }
 
 static void
-event_handler_timer_button(EventData *event_data)
+usb_keyboard_write_chunk(void)
 {
-    bool b_is_all_ok = true;
-    GPIO_Value_Type state_button1_current;
-    GPIO_Value_Type state_button2_current;
+    int chunk_delay_ms = tunables_get(TUNABLE_CHUNK_DELAY_MS);
+    const struct timespec chunk_delay = { chunk_delay_ms / 1000, 
+        (chunk_delay_ms % 1000) * 1000000 };
+    size_t chunk_length = (size_t)tunables_get(TUNABLE_CHUNK_LENGTH);
 
-    // Consume timer event
-    if (ConsumeTimerFdEvent(g_fd_poll_timer_button) != 0)
+    // Send string to I2c in 32-byte chunks since receiving Arduino's Wire
+    // library has 32 byte buffer
+    size_t length_to_send = g_typing.length - g_typing.position;
+    if (length_to_send > chunk_length)
     {
-        // Failed to consume timer event
-        gb_is_termination_requested = true;
-        b_is_all_ok = false;
+        length_to_send = chunk_length;
     }
 
-    if (b_is_all_ok)
+    if (!g_typing.b_is_started)
     {
-        // Check for a button1 press
-        if (GPIO_GetValue(g_fd_gpio_button1, &state_button1_current) != 0)
-        {
-            Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n",
-                strerror(errno), errno);
-            gb_is_termination_requested = true;
+        g_typing.b_is_started = true;
+        g_typing.retries_left = USB_KEYBOARD_WRITE_RETRIES;
+        clock_gettime(CLOCK_MONOTONIC, &g_typing.start_time);
+    }
+
+    if (I2CMaster_Write(g_fd_i2c, I2C_ADDR_USB_KEYBOARD, 
+        g_typing.buffer + g_typing.position, length_to_send) == -1)
+    {
+        if (g_typing.retries_left > 0)
+        {
+            // Keyboard may be busy, write the same chunk after chunk delay
+            LOG_WARNING("Sending data to USB keyboard via I2C, retrying.\n");
+            g_typing.retries_left--;
+            atomic_fetch_add_explicit(&g_delivery.i2c_retries, 1,
+                memory_order_relaxed);
+            length_to_send = 0;
+        }
+        else
+        {
+            LOG_ERROR("Sending data to USB keyboard via I2C.\n");
+            g_typing.b_is_failed = true;
+            g_typing.retries_left = USB_KEYBOARD_WRITE_RETRIES;
+        }
+    }
+    else
+    {
+        atomic_fetch_add_explicit(&g_delivery.i2c_bytes, length_to_send,
+            memory_order_relaxed);
+        g_typing.retries_left = USB_KEYBOARD_WRITE_RETRIES;
+    }
+    g_typing.position += length_to_send;
+
+    // Delay before sending the next chunk
+    if (SetTimerFdToSingleExpiry(g_fd_timer_typing, &chunk_delay) != 0)
+    {
+        termination_request();
+        return;
+    }
+    g_typing.b_is_active = true;
+
+    return;
+}
+
+static void
+typing_finish(void)
+{
+    if (g_typing.b_report)
+    {
+        report_typing_result(g_typing.b_is_failed ? "i2c" : NULL);
+    }
+
+    if (g_typing.b_is_started)
+    {
+        histogram_record(&g_delivery.typing_ms,
+            (uint32_t)(elapsed_us(&g_typing.start_time) / 1000));
+        if ((g_typing.request_id[0] != '\0') && !g_typing.b_is_failed)
+        {
+            histogram_record(&g_delivery.delivery_ms,
+                (uint32_t)(elapsed_us(&g_typing.received_time) / 1000));
+        }
+        atomic_fetch_add_explicit(g_typing.b_is_failed ? 
+            &g_delivery.typing_failures : &g_delivery.items_typed, 1,
+            memory_order_relaxed);
+    }
+
+    // Do not keep typed credentials in memory
+    memset(g_typing.buffer, 0, sizeof(g_typing.buffer));
+    g_typing.length = 0;
+    g_typing.position = 0;
+    g_typing.b_is_failed = false;
+    g_typing.b_report = false;
+    g_typing.b_is_started = false;
+    g_typing.request_id[0] = '\0';
+
+    return;
+}
+
+static void
+typing_cancel(void)
+{
+    if (g_typing.position < g_typing.length)
+    {
+        g_typing.b_is_failed = true;
+        if (g_typing.b_report)
+        {
+            report_typing_result("cancelled");
+            g_typing.b_report = false;
+        }
+    }
+
+    // Pending chunk delay timer still expires, then finds nothing to type
+    g_typing.position = g_typing.length;
+    typing_finish();
+
+    return;
+}
+
+static void
+report_typing_result(const char *p_error)
+{
+    JSON_Value *p_event_value = json_value_init_object();
+    JSON_Object *p_event_object = json_value_get_object(p_event_value);
+    if (p_event_object == NULL)
+    {
+        LOG_ERROR("Could not allocate typing result event.\n");
+        return;
+    }
+
+    json_object_set_string(p_event_object, "event", 
+        TELEMETRY_EVENT_ITEM_TYPED);
+    json_object_set_string(p_event_object, "name", g_typing.item_name);
+    json_object_set_boolean(p_event_object, "success", p_error == NULL);
+    if (p_error != NULL)
+    {
+        json_object_set_string(p_event_object, "error", p_error);
+    }
+
+    // Device side of item delivery, correlated with sender by request ID
+    if (g_typing.request_id[0] != '\0')
+    {
+        json_object_set_string(p_event_object, "requestId", 
+            g_typing.request_id);
+        json_object_set_number(p_event_object, "deliveryMs",
+            (double)(elapsed_us(&g_typing.received_time) / 1000));
+    }
+    if (g_typing.b_is_started)
+    {
+        json_object_set_number(p_event_object, "typingMs",
+            (double)(elapsed_us(&g_typing.start_time) / 1000));
+    }
+
+    char *p_event_string = json_serialize_to_string(p_event_value);
+    if (p_event_string != NULL)
+    {
+        send_telemetry(p_event_string);
+    }
+    json_value_free(p_event_value);
+
+    return;
+}
+
+static void
+send_telemetry(char *p_message)
+{
+    if (!spsc_queue_push(&g_queue_telemetry, p_message))
+    {
+        LOG_ERROR("Telemetry queue full, message dropped.\n");
+        json_free_serialized_string(p_message);
+    }
+
+    return;
+}
+
+static void
+event_handler_item_queue(EventData *event_data)
+{
+    // Consume queue event before draining the queue
+    if (spsc_queue_consume_event(&g_queue_item) != 0)
+    {
+        termination_request();
+        return;
+    }
+
+    item_data_t *p_item;
+    while ((p_item = spsc_queue_pop(&g_queue_item)) != NULL)
+    {
+        item_data_accept(p_item);
+    }
+
+    return;
+}
+
+static void
+boot_phase_reached(boot_phase_t phase)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    g_boot_phase_ms[phase] = (now.tv_sec - g_boot_start.tv_sec) * 1000 +
+        (now.tv_nsec - g_boot_start.tv_nsec) / 1000000;
+
+    return;
+}
+
+static void
+boot_profile_report(void)
+{
+    if (gb_is_boot_reported ||
+        (g_boot_phase_ms[BOOT_PHASE_HUB_AUTHENTICATED] < 0) ||
+        !atomic_load_explicit(&gb_is_boot_ui_ready, memory_order_acquire))
+    {
+        return;
+    }
+
+    char property_name[40];
+    for (int i = 0; i < BOOT_PHASE_COUNT; i++)
+    {
+        snprintf(property_name, sizeof(property_name), "boot.%s", 
+            g_boot_phase_names[i]);
+        AzureIoT_TwinReportValue(property_name, 
+            json_value_init_number(g_boot_phase_ms[i]));
+    }
+
+    // Time the application started after device boot
+    struct timespec now;
+    struct timespec since_boot;
+    if ((clock_gettime(CLOCK_MONOTONIC, &now) == 0) &&
+        (clock_gettime(CLOCK_BOOTTIME, &since_boot) == 0))
+    {
+        long running_ms = (now.tv_sec - g_boot_start.tv_sec) * 1000 +
+            (now.tv_nsec - g_boot_start.tv_nsec) / 1000000;
+        long process_start_ms = since_boot.tv_sec * 1000 + 
+            since_boot.tv_nsec / 1000000 - running_ms;
+        AzureIoT_TwinReportValue("boot.processStartMs", 
+            json_value_init_number(process_start_ms));
+    }
+
+    gb_is_boot_reported = true;
+    LOG_INFO("Ready after %ld ms, authenticated after %ld ms.\n",
+        g_boot_phase_ms[BOOT_PHASE_READY], 
+        g_boot_phase_ms[BOOT_PHASE_HUB_AUTHENTICATED]);
+
+    return;
+}
+
+static JSON_Value
+*latency_to_json(void)
+{
+    JSON_Value *p_value = json_value_init_object();
+    if (p_value == NULL)
+    {
+        return NULL;
+    }
+    JSON_Object *p_object = json_value_get_object(p_value);
+
+    // Handler execution times, button handler is driven by periodic timer
+    json_object_dotset_value(p_object, "button.execUs",
+        histogram_to_json(&g_event_data_button.executionTimeUs));
+    json_object_dotset_value(p_object, "button.lateUs",
+        histogram_to_json(&g_event_data_button.timerLatenessUs));
+    json_object_dotset_value(p_object, "typing.execUs",
+        histogram_to_json(&g_event_data_typing.executionTimeUs));
+    json_object_dotset_value(p_object, "itemQueue.execUs",
+        histogram_to_json(&g_event_data_item_queue.executionTimeUs));
+
+    // IoT thread
+    json_object_dotset_value(p_object, "doWork.execUs",
+        histogram_to_json(AzureIoT_GetDoWorkHistogram()));
+    json_object_dotset_value(p_object, "directMethod.execUs",
+        histogram_to_json(AzureIoT_GetDirectMethodHistogram()));
+
+    return p_value;
+}
+
+static void
+latency_report(void)
+{
+    struct timespec now;
+    if ((clock_gettime(CLOCK_MONOTONIC, &now) != 0) ||
+        (now.tv_sec - g_latency_report_time < LATENCY_REPORT_PERIOD_SEC))
+    {
+        return;
+    }
+    g_latency_report_time = now.tv_sec;
+
+    JSON_Value *p_latency = latency_to_json();
+    if (p_latency != NULL)
+    {
+        AzureIoT_TwinReportValue("latency", p_latency);
+    }
+
+    return;
+}
+
+static int64_t
+elapsed_us(const struct timespec *p_since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (int64_t)(now.tv_sec - p_since->tv_sec) * 1000000 +
+        (now.tv_nsec - p_since->tv_nsec) / 1000;
+}
+
+static void
+delivery_stats_report(void)
+{
+    struct timespec now;
+    if ((clock_gettime(CLOCK_MONOTONIC, &now) != 0) ||
+        (now.tv_sec - g_delivery_report_time < DELIVERY_STATS_PERIOD_SEC))
+    {
+        return;
+    }
+    g_delivery_report_time = now.tv_sec;
+
+    unsigned int received = atomic_load(&g_delivery.items_received) +
+        atomic_load(&g_delivery.items_received_lan);
+    unsigned int rejected = atomic_load(&g_delivery.items_rejected);
+    unsigned int typed = atomic_load(&g_delivery.items_typed);
+    unsigned int failed = atomic_load(&g_delivery.typing_failures);
+    unsigned int wipes = atomic_load(&g_delivery.forget_wipes);
+
+    unsigned int events = received + rejected + typed + failed + wipes;
+    if (events == g_delivery_reported_events)
+    {
+        return;
+    }
+    g_delivery_reported_events = events;
+
+    JSON_Value *p_event_value = json_value_init_object();
+    JSON_Object *p_event_object = json_value_get_object(p_event_value);
+    if (p_event_object == NULL)
+    {
+        LOG_ERROR("Could not allocate delivery metrics event.\n");
+        return;
+    }
+
+    // Counters since start, durations as [p50, p99, max]
+    json_object_set_string(p_event_object, "event", 
+        TELEMETRY_EVENT_DELIVERY_STATS);
+    json_object_set_number(p_event_object, "received", received);
+    json_object_set_number(p_event_object, "receivedLan", 
+        atomic_load(&g_delivery.items_received_lan));
+    json_object_set_number(p_event_object, "duplicates", 
+        atomic_load(&g_delivery.items_duplicate));
+    json_object_set_number(p_event_object, "rejected", rejected);
+    json_object_set_number(p_event_object, "typed", typed);
+    json_object_set_number(p_event_object, "failed", failed);
+    json_object_set_number(p_event_object, "wipes", wipes);
+    json_object_set_number(p_event_object, "i2cBytes", 
+        atomic_load(&g_delivery.i2c_bytes));
+    json_object_set_number(p_event_object, "i2cRetries", 
+        atomic_load(&g_delivery.i2c_retries));
+
+    static const char *p_names[] = {
+        "parseUs", "renderUs", "typingMs", "deliveryMs"
+    };
+    const histogram_t *p_histograms[] = {
+        &g_delivery.parse_us, &g_delivery.render_us,
+        &g_delivery.typing_ms, &g_delivery.delivery_ms
+    };
+    for (size_t i = 0; i < sizeof(p_names) / sizeof(p_names[0]); i++)
+    {
+        JSON_Value *p_array_value = json_value_init_array();
+        JSON_Array *p_array = json_value_get_array(p_array_value);
+        if (p_array == NULL)
+        {
+            continue;
+        }
+        json_array_append_number(p_array, 
+            histogram_percentile(p_histograms[i], 50));
+        json_array_append_number(p_array, 
+            histogram_percentile(p_histograms[i], 99));
+        json_array_append_number(p_array, 
+            atomic_load(&p_histograms[i]->max));
+        json_object_set_value(p_event_object, p_names[i], p_array_value);
+    }
+
+    char *p_event_string = json_serialize_to_string(p_event_value);
+    if (p_event_string != NULL)
+    {
+        send_telemetry(p_event_string);
+    }
+    json_value_free(p_event_value);
+
+    return;
+}
+
+static void
+cb_connection_status(bool b_is_connected)
+{
+    if (b_is_connected && (g_boot_phase_ms[BOOT_PHASE_HUB_AUTHENTICATED] < 0))
+    {
+        boot_phase_reached(BOOT_PHASE_HUB_AUTHENTICATED);
+    }
+
+    return;
+}
+
+static void
+cb_twin_property_changed(const char *p_path, const JSON_Value *p_value)
+{
+    tunable_id_t id;
+    char error[64];
+
+    if ((strcmp(p_path, TUNABLES_PROPERTY) == 0) && 
+        (json_value_get_type(p_value) != JSONObject))
+    {
+        // Whole tunables object removed, restore all defaults
+        for (int i = 0; i < TUNABLE_COUNT; i++)
+        {
+            tunables_set((tunable_id_t)i, NULL, error, sizeof(error));
+            tunable_report((tunable_id_t)i, NULL);
+        }
+        AzureIoT_SetKeepAlivePeriod(tunables_get(TUNABLE_KEEPALIVE_SEC));
+    }
+    else if (tunables_find(p_path, &id))
+    {
+        if (tunables_set(id, p_value, error, sizeof(error)))
+        {
+            tunable_report(id, NULL);
+            if (id == TUNABLE_KEEPALIVE_SEC)
+            {
+                AzureIoT_SetKeepAlivePeriod(tunables_get(id));
+            }
+        }
+        else
+        {
+            LOG_WARNING("Rejected desired %s: %s.\n", p_path, error);
+            tunable_report(id, error);
+        }
+    }
+
+    return;
+}
+
+static void
+tunable_report(tunable_id_t id, const char *p_error)
+{
+    char property_name[64];
+
+    snprintf(property_name, sizeof(property_name), TUNABLES_PROPERTY ".%s",
+        tunables_get_name(id));
+    AzureIoT_TwinReportValue(property_name, 
+        json_value_init_number(tunables_get(id)));
+
+    snprintf(property_name, sizeof(property_name), 
+        TUNABLES_PROPERTY "Error.%s", tunables_get_name(id));
+    AzureIoT_TwinReportValue(property_name, (p_error == NULL) ? 
+        json_value_init_null() : json_value_init_string(p_error));
+
+    return;
+}
+
+static void
+event_handler_tunables(EventData *event_data)
+{
+    if (tunables_consume_event() != 0)
+    {
+        termination_request();
+        return;
+    }
+
+    // Chunk length, chunk delay and forget period are read when used,
+    // only timers and I2C settings need to be updated
+    int button_poll_ms = tunables_get(TUNABLE_BUTTON_POLL_MS);
+    if (button_poll_ms != g_applied_button_poll_ms)
+    {
+        struct timespec button_press_check_period = { 
+            button_poll_ms / 1000, (button_poll_ms % 1000) * 1000000 };
+        if (SetTimerFdToPeriod(g_fd_poll_timer_button, 
+            &button_press_check_period) == 0)
+        {
+            g_applied_button_poll_ms = button_poll_ms;
+        }
+    }
+
+    int i2c_timeout_ms = tunables_get(TUNABLE_I2C_TIMEOUT_MS);
+    if ((i2c_timeout_ms != g_applied_i2c_timeout_ms) && (g_fd_i2c >= 0))
+    {
+        if (I2CMaster_SetTimeout(g_fd_i2c, (unsigned int)i2c_timeout_ms) == 0)
+        {
+            g_applied_i2c_timeout_ms = i2c_timeout_ms;
+        }
+        else
+        {
+            LOG_ERROR("I2CMaster_SetTimeout: errno=%d (%s)\n", errno, 
+                strerror(errno));
+        }
+    }
+
+    return;
+}
+
+static void
+*iot_thread_main(void *p_arg)
+{
+    struct pollfd poll_fds[] = {
+        { .fd = g_queue_telemetry.fd_event, .events = POLLIN },
+        { .fd = g_fd_shutdown_event, .events = POLLIN }
+    };
+
+    // Report tunables in effect, desired properties override them later
+    AzureIoT_SetKeepAlivePeriod(tunables_get(TUNABLE_KEEPALIVE_SEC));
+    for (int i = 0; i < TUNABLE_COUNT; i++)
+    {
+        tunable_report((tunable_id_t)i, NULL);
+    }
+
+    while (!atomic_load(&gb_is_termination_requested))
+    {
+        // Hand over telemetry queued by UI thread
+        char *p_message;
+        while ((p_message = spsc_queue_pop(&g_queue_telemetry)) != NULL)
+        {
+            AzureIoT_SendMessage(p_message);
+            json_free_serialized_string(p_message);
+        }
+
+        // AzureIoT_DoPeriodicTasks() needs to be called frequently in order
+        // to keep active the flow of data with the Azure IoT Hub. It also
+        // creates the client and reconnects it after network outages.
+        AzureIoT_DoPeriodicTasks();
+
+        // Report startup profile once both threads are up
+        boot_profile_report();
+        latency_report();
+
+        // Write out log messages before going idle
+        log_ring_flush(0);
+
+        // Sleep for the interval chosen by IoT Hub client, until UI thread
+        // queues telemetry or until termination is requested. Shutdown
+        // event is left signalled, the loop ends on the next check.
+        if ((poll(poll_fds, 2, (int)AzureIoT_GetDoWorkIntervalMs()) > 0) &&
+            (poll_fds[0].revents & POLLIN))
+        {
+            spsc_queue_consume_event(&g_queue_telemetry);
+        }
+    }
+
+    AzureIoT_DestroyClient();
+
+    return NULL;
+}
+
+static void
+event_handler_timer_typing(EventData *event_data)
+{
+    // Consume timer event
+    if (ConsumeTimerFdEvent(g_fd_timer_typing) != 0)
+    {
+        // Failed to consume timer event
+        termination_request();
+        return;
+    }
+
+    g_typing.b_is_active = false;
+
+    if (g_typing.position < g_typing.length)
+    {
+        usb_keyboard_write_chunk();
+    }
+    else
+    {
+        typing_finish();
+    }
+
+    return;
+}
+
+static void
+event_handler_timer_button(EventData *event_data)
+{
+    bool b_is_all_ok = true;
+    GPIO_Value_Type state_button1_current;
+    GPIO_Value_Type state_button2_current;
+
+    // Consume timer event
+    if (ConsumeTimerFdEvent(g_fd_poll_timer_button) != 0)
+    {
+        // Failed to consume timer event
+        termination_request();
+        b_is_all_ok = false;
+    }
+
+    if (b_is_all_ok)
+    {
+        // Check for a button1 press
+        if (GPIO_GetValue(g_fd_gpio_button1, &state_button1_current) != 0)
+        {
+            LOG_ERROR("Could not read button GPIO: %s (%d).\n",
+                strerror(errno), errno);
+            termination_request();
             b_is_all_ok = false;
         }
         else if (state_button1_current != g_state_button1)
@@ -630,9 +1731,9 @@ event_handler_timer_button(EventData *event_data)
         // Check for a button2 press
         if (GPIO_GetValue(g_fd_gpio_button2, &state_button2_current) != 0)
         {
-            Log_Debug("ERROR: Could not read button GPIO: %s (%d).\n",
+            LOG_ERROR("Could not read button GPIO: %s (%d).\n",
                 strerror(errno), errno);
-            gb_is_termination_requested = true;
+            termination_request();
             b_is_all_ok = false;
         }
         else if (state_button2_current != g_state_button2)
@@ -651,7 +1752,8 @@ event_handler_timer_button(EventData *event_data)
 static void
 show_standby_state(void)
 {
-    u8g2_ClearDisplay(&g_u8g2);
+    // Full frame buffer is sent, clearing the display first would only
+    // double the I2C traffic
     u8g2_ClearBuffer(&g_u8g2);
 
     u8g2_SetFont(&g_u8g2, u8g2_font_t0_22b_tr);
@@ -665,13 +1767,19 @@ setup_item_sender(void)
 {
     // Set time delay to forget
     if (clock_gettime(CLOCK_REALTIME, &g_time) == -1) {
-        Log_Debug("ERROR: clock_gettime failed with error code: %s (%d).\n", 
+        LOG_ERROR("clock_gettime failed with error code: %s (%d).\n", 
             strerror(errno), errno);
-        gb_is_termination_requested = true;
+        termination_request();
         return;
     }
 
-    g_time_to_forget = g_time.tv_sec + PERIOD_TO_FORGET_SEC;
+    g_time_to_forget = g_time.tv_sec + tunables_get(TUNABLE_FORGET_SEC);
+
+    // Do not continue typing previously loaded item
+    typing_cancel();
+
+    struct timespec render_start;
+    clock_gettime(CLOCK_MONOTONIC, &render_start);
 
     // Setup display
     u8g2_ClearDisplay(&g_u8g2);
@@ -716,9 +1824,19 @@ setup_item_sender(void)
 
     u8g2_SendBuffer(&g_u8g2);
 
-    // If requested, send item data immediately to USB
+    histogram_record(&g_delivery.render_us, 
+        (uint32_t)elapsed_us(&render_start));
+
+    // If requested, send item data immediately to USB. Typing runs in 
+    // the background, result is reported as telemetry event.
     if (g_item_data.send_immediately)
     {
+        g_typing.b_report = true;
+        strncpy(g_typing.item_name, g_item_data.name, JSON_NAME_LENGTH);
+        g_typing.item_name[JSON_NAME_LENGTH] = '\0';
+        strcpy(g_typing.request_id, g_item_data.request_id);
+        g_typing.received_time = g_item_data.received_time;
+
         send_username();
 
         if (!g_item_data.send_uname_tab_pass)
@@ -750,21 +1868,13 @@ cb_direct_method_call(const char *p_method_name,
     char **pp_response_payload, size_t *p_response_payload_size)
 {
     int result = 404; // HTTP status code.
+    item_data_t *p_item = NULL;
+
+    struct timespec received_time;
+    clock_gettime(CLOCK_MONOTONIC, &received_time);
 
     if (payload_size < DIRECT_METHOD_CALL_PAYLOAD_MAX) 
     {
-        // Declare a char buffer on the stack where we'll operate 
-        // on a copy of the payload.
-        char payload_string[payload_size + 1];
-
-        if (payload_string == NULL)
-        {
-            // Not enough memory for local payload buffer
-            Log_Debug("ERROR: Could not allocate buffer for direct method "
-                "request payload.\n");
-            abort();
-        }
-
         // Prepare the payload for the response. This is a heap allocated null 
         // terminated string. The Azure IoT Hub SDK is responsible of freeing it.
         *pp_response_payload = NULL;  // Reponse payload content.
@@ -775,108 +1885,72 @@ cb_direct_method_call(const char *p_method_name,
         {
             result = 200;
 
-            // Copy the payload into our local buffer then null terminate it.
-            memcpy(payload_string, p_payload, payload_size);
-            payload_string[payload_size] = 0; // Null terminated string.
-
-            JSON_Value *payload_json_value = json_parse_string(payload_string);
-
-            // Verify we have a valid JSON string from the payload
-            if (payload_json_value == NULL) 
+            // Item data is parsed here and owned by UI thread once queued
+            p_item = item_data_parse(p_payload, payload_size, &received_time);
+            if (p_item == NULL)
             {
                 goto payloadError;
             }
 
-            // Verify that the payload_json_value contains a valid JSON object
-            JSON_Object *payload_json_object = json_value_get_object(
-                payload_json_value);
-            if (payload_json_object == NULL) 
-            {
-                goto payloadError;
-            }
-
-            // Get item data from JSON object
-            const char* p_value_string;
-            int value_int;
-
-            strcpy(g_item_data.name, "\0");
-            p_value_string = json_object_get_string(payload_json_object, 
-                JSON_NAME_NAME);
-            if (p_value_string != NULL)
-            {
-                strncpy(g_item_data.name, p_value_string, JSON_NAME_LENGTH + 1);
-            }
-
-            strcpy(g_item_data.username, "\0");
-            p_value_string = json_object_get_string(payload_json_object, 
-                JSON_USERNAME_NAME);
-            if (p_value_string != NULL)
-            {
-                strncpy(g_item_data.username, p_value_string, 
-                    JSON_USERNAME_LENGTH + 1);
-            }
-
-            strcpy(g_item_data.password, "\0");
-            p_value_string = json_object_get_string(payload_json_object, 
-                JSON_PASSWORD_NAME);
-            if (p_value_string != NULL)
-            {
-                strncpy(g_item_data.password, p_value_string, 
-                    JSON_PASSWORD_LENGTH + 1);
-            }
+            // Construct the response message.  This will be displayed 
+            // in the cloud when calling the direct method
+            *pp_response_payload = item_data_response(p_item);
+            *p_response_payload_size = strlen(*pp_response_payload);
 
-            g_item_data.send_username_enter = false;
-            value_int = json_object_get_boolean(payload_json_object, 
-                JSON_USERNAMEENTER_NAME);
-            if (value_int != -1)
-            {
-                g_item_data.send_username_enter = (bool)value_int;
-            }
+            histogram_record(&g_delivery.parse_us, 
+                (uint32_t)elapsed_us(&received_time));
 
-            g_item_data.send_password_enter = false;
-            value_int = json_object_get_boolean(payload_json_object, 
-                JSON_PASSWORDENTER_NAME);
-            if (value_int != -1)
+            // Hand over item data to UI thread
+            if (!spsc_queue_push(&g_queue_item, p_item))
             {
-                g_item_data.send_password_enter = (bool)value_int;
+                LOG_ERROR("Item queue full, item dropped.\n");
+                memset(p_item, 0, sizeof(item_data_t));
+                free(p_item);
+                free(*pp_response_payload);
+
+                result = 503;
+                static const char busyResponse[] =
+                    "{ \"success\" : false, \"message\" : \"Device busy\" }";
+                *pp_response_payload = setup_heap_message(busyResponse,
+                    sizeof(busyResponse));
+                if (*pp_response_payload == NULL)
+                {
+                    LOG_ERROR("Could not allocate buffer for direct "
+                        "method response payload.\n");
+                    abort();
+                }
+                *p_response_payload_size = strlen(*pp_response_payload);
             }
-
-            g_item_data.send_uname_tab_pass = false;
-            value_int = json_object_get_boolean(payload_json_object, 
-                JSON_TABJOIN_NAME);
-            if (value_int != -1)
+            else
             {
-                g_item_data.send_uname_tab_pass = (bool)value_int;
+                atomic_fetch_add_explicit(&g_delivery.items_received, 1,
+                    memory_order_relaxed);
             }
 
-            g_item_data.send_immediately = false;
-            value_int = json_object_get_boolean(payload_json_object, 
-                JSON_LOADSEND_NAME);
-            if (value_int != -1)
-            {
-                g_item_data.send_immediately = (bool)value_int;
-            }
+            return result;
+        }
+        // Direct method 'get_latency'
+        else if (strcmp(p_method_name, "get_latency") == 0)
+        {
+            result = 200;
 
-            if ((strlen(g_item_data.name) == 0) ||
-                (strlen(g_item_data.password) == 0))
+            JSON_Value *p_response_value = json_value_init_object();
+            JSON_Value *p_latency = latency_to_json();
+            if ((p_response_value == NULL) || (p_latency == NULL))
             {
-                goto payloadError;
+                LOG_ERROR("Could not allocate latency histograms.\n");
+                abort();
             }
+            JSON_Object *p_response_object = 
+                json_value_get_object(p_response_value);
+            json_object_set_boolean(p_response_object, "success", true);
+            json_object_set_value(p_response_object, "latency", p_latency);
 
-            // Prepare item data to be sent to USB
-            setup_item_sender();
-
-            // Construct the response message.  This will be displayed 
-            // in the cloud when calling the direct method
-            static const char newPollTimeResponse[] =
-                "{ \"success\" : true, \"message\" : \"'%s' loaded\" }";
-            size_t responseMaxLength = sizeof(newPollTimeResponse) + 
-                strlen(g_item_data.name);
-            *pp_response_payload = setup_heap_message(newPollTimeResponse, 
-                responseMaxLength, g_item_data.name);
+            *pp_response_payload = json_serialize_to_string(p_response_value);
+            json_value_free(p_response_value);
             if (*pp_response_payload == NULL)
             {
-                Log_Debug("ERROR: Could not allocate buffer for direct method "
+                LOG_ERROR("Could not allocate buffer for direct method "
                     "response payload.\n");
                 abort();
             }
@@ -887,7 +1961,7 @@ cb_direct_method_call(const char *p_method_name,
         else 
         {
             result = 404;
-            Log_Debug("INFO: Direct Method called \"%s\" not found.\n", 
+            LOG_INFO("Direct Method called \"%s\" not found.\n", 
                 p_method_name);
 
             static const char noMethodFound[] = "\"method not found '%s'\"";
@@ -897,7 +1971,7 @@ cb_direct_method_call(const char *p_method_name,
                 responseMaxLength, p_method_name);
             if (*pp_response_payload == NULL) 
             {
-                Log_Debug("ERROR: Could not allocate buffer for direct method "
+                LOG_ERROR("Could not allocate buffer for direct method "
                     "response payload.\n");
                 abort();
             }
@@ -908,7 +1982,7 @@ cb_direct_method_call(const char *p_method_name,
     }
     else 
     {
-        Log_Debug("Payload size over limit, aborting Direct Method execution\n");
+        LOG_WARNING("Payload size over limit, aborting Direct Method execution\n");
         goto payloadError;
     }
 
@@ -916,17 +1990,21 @@ cb_direct_method_call(const char *p_method_name,
     // response message and send it back to the IoT Hub for the user to see
 payloadError:
 
-    result = 400; // Bad request.
-    Log_Debug("INFO: Unrecognised direct method payload format.\n");
+    if (p_item != NULL)
+    {
+        memset(p_item, 0, sizeof(item_data_t));
+        free(p_item);
+    }
 
-    static const char noPayloadResponse[] =
-        "{ \"success\" : false, \"message\" : \"Request does not contain an "
-        "identifiable payload\" }";
+    result = 400; // Bad request.
+    LOG_INFO("Unrecognised direct method payload format.\n");
+    atomic_fetch_add_explicit(&g_delivery.items_rejected, 1,
+        memory_order_relaxed);
 
-    *pp_response_payload = setup_heap_message(noPayloadResponse, 
-        sizeof(noPayloadResponse));
+    *pp_response_payload = setup_heap_message(RESPONSE_NO_PAYLOAD, 
+        sizeof(RESPONSE_NO_PAYLOAD));
     if (*pp_response_payload == NULL) {
-        Log_Debug("ERROR: Could not allocate buffer for direct method "
+        LOG_ERROR("Could not allocate buffer for direct method "
             "response payload.\n");
         abort();
     }
@@ -935,4 +2013,227 @@ payloadError:
     return result;
 }
 
+#ifdef LAN_LISTENER_ENABLED
+static int
+cb_lan_request(const char *p_payload, size_t payload_size,
+    char **pp_response, size_t *p_response_size)
+{
+    struct timespec received_time;
+    clock_gettime(CLOCK_MONOTONIC, &received_time);
+
+    // Already in UI thread, item is shown without passing the queue
+    item_data_t *p_item = NULL;
+    if (payload_size < DIRECT_METHOD_CALL_PAYLOAD_MAX)
+    {
+        p_item = item_data_parse(p_payload, payload_size, &received_time);
+    }
+
+    if (p_item == NULL)
+    {
+        LOG_INFO("Unrecognised LAN request payload format.\n");
+        atomic_fetch_add_explicit(&g_delivery.items_rejected, 1,
+            memory_order_relaxed);
+
+        *pp_response = setup_heap_message(RESPONSE_NO_PAYLOAD, 
+            sizeof(RESPONSE_NO_PAYLOAD));
+        if (*pp_response == NULL)
+        {
+            LOG_ERROR("Could not allocate buffer for LAN response.\n");
+            abort();
+        }
+        *p_response_size = strlen(*pp_response);
+        return 400;
+    }
+
+    *pp_response = item_data_response(p_item);
+    *p_response_size = strlen(*pp_response);
+
+    histogram_record(&g_delivery.parse_us, 
+        (uint32_t)elapsed_us(&received_time));
+    atomic_fetch_add_explicit(&g_delivery.items_received_lan, 1,
+        memory_order_relaxed);
+
+    item_data_accept(p_item);
+
+    return 200;
+}
+#endif
+
+static item_data_t
+*item_data_parse(const char *p_payload, size_t payload_size, 
+    const struct timespec *p_received_time)
+{
+    // Declare a char buffer on the stack where we'll operate 
+    // on a copy of the payload.
+    char payload_string[payload_size + 1];
+
+    // Copy the payload into our local buffer then null terminate it.
+    memcpy(payload_string, p_payload, payload_size);
+    payload_string[payload_size] = 0; // Null terminated string.
+
+    JSON_Value *payload_json_value = json_parse_string(payload_string);
+
+    // Do not leave credentials on stack
+    memset(payload_string, 0, payload_size);
+
+    // Verify we have a valid JSON string from the payload
+    if (payload_json_value == NULL) 
+    {
+        return NULL;
+    }
+
+    // Verify that the payload_json_value contains a valid JSON object
+    JSON_Object *payload_json_object = json_value_get_object(
+        payload_json_value);
+    if (payload_json_object == NULL) 
+    {
+        json_value_free(payload_json_value);
+        return NULL;
+    }
+
+    item_data_t *p_item = calloc(1, sizeof(item_data_t));
+    if (p_item == NULL)
+    {
+        LOG_ERROR("Could not allocate item data.\n");
+        abort();
+    }
+    p_item->received_time = *p_received_time;
+
+    // Get item data from JSON object
+    const char* p_value_string;
+    int value_int;
+
+    strcpy(p_item->name, "\0");
+    p_value_string = json_object_get_string(payload_json_object, 
+        JSON_NAME_NAME);
+    if (p_value_string != NULL)
+    {
+        strncpy(p_item->name, p_value_string, JSON_NAME_LENGTH + 1);
+    }
+
+    strcpy(p_item->username, "\0");
+    p_value_string = json_object_get_string(payload_json_object, 
+        JSON_USERNAME_NAME);
+    if (p_value_string != NULL)
+    {
+        strncpy(p_item->username, p_value_string, 
+            JSON_USERNAME_LENGTH + 1);
+    }
+
+    strcpy(p_item->password, "\0");
+    p_value_string = json_object_get_string(payload_json_object, 
+        JSON_PASSWORD_NAME);
+    if (p_value_string != NULL)
+    {
+        strncpy(p_item->password, p_value_string, 
+            JSON_PASSWORD_LENGTH + 1);
+    }
+
+    p_item->send_username_enter = false;
+    value_int = json_object_get_boolean(payload_json_object, 
+        JSON_USERNAMEENTER_NAME);
+    if (value_int != -1)
+    {
+        p_item->send_username_enter = (bool)value_int;
+    }
+
+    p_item->send_password_enter = false;
+    value_int = json_object_get_boolean(payload_json_object, 
+        JSON_PASSWORDENTER_NAME);
+    if (value_int != -1)
+    {
+        p_item->send_password_enter = (bool)value_int;
+    }
+
+    p_item->send_uname_tab_pass = false;
+    value_int = json_object_get_boolean(payload_json_object, 
+        JSON_TABJOIN_NAME);
+    if (value_int != -1)
+    {
+        p_item->send_uname_tab_pass = (bool)value_int;
+    }
+
+    p_item->send_immediately = false;
+    value_int = json_object_get_boolean(payload_json_object, 
+        JSON_LOADSEND_NAME);
+    if (value_int != -1)
+    {
+        p_item->send_immediately = (bool)value_int;
+    }
+
+    // Request ID is echoed in response and telemetry, accept only
+    // characters safe to put in JSON without escaping
+    strcpy(p_item->request_id, "\0");
+    p_value_string = json_object_get_string(payload_json_object, 
+        JSON_REQUESTID_NAME);
+    if ((p_value_string != NULL) && 
+        (strlen(p_value_string) <= JSON_REQUESTID_LENGTH) &&
+        (strspn(p_value_string, "0123456789abcdefABCDEF-") ==
+            strlen(p_value_string)))
+    {
+        strcpy(p_item->request_id, p_value_string);
+    }
+
+    // Item data copied, release parsed payload
+    json_value_free(payload_json_value);
+
+    if ((strlen(p_item->name) == 0) ||
+        (strlen(p_item->password) == 0))
+    {
+        memset(p_item, 0, sizeof(item_data_t));
+        free(p_item);
+        return NULL;
+    }
+
+    return p_item;
+}
+
+static char
+*item_data_response(const item_data_t *p_item)
+{
+    static const char loadedResponse[] =
+        "{ \"success\" : true, \"message\" : \"'%s' loaded\", "
+        "\"requestId\" : \"%s\" }";
+    size_t responseMaxLength = sizeof(loadedResponse) + 
+        strlen(p_item->name) + strlen(p_item->request_id);
+    char *p_response = setup_heap_message(loadedResponse, 
+        responseMaxLength, p_item->name, p_item->request_id);
+    if (p_response == NULL)
+    {
+        LOG_ERROR("Could not allocate buffer for item response.\n");
+        abort();
+    }
+
+    return p_response;
+}
+
+static void
+item_data_accept(item_data_t *p_item)
+{
+    // Web application retries request via IoT Hub when LAN response 
+    // got lost, item must not be typed twice
+    if ((strlen(p_item->request_id) > 0) &&
+        (strcmp(p_item->request_id, g_last_request_id) == 0))
+    {
+        LOG_INFO("Request %s already delivered, duplicate dropped.\n",
+            p_item->request_id);
+        atomic_fetch_add_explicit(&g_delivery.items_duplicate, 1,
+            memory_order_relaxed);
+    }
+    else
+    {
+        strcpy(g_last_request_id, p_item->request_id);
+        memcpy(&g_item_data, p_item, sizeof(item_data_t));
+
+        // Prepare item data to be sent to USB
+        setup_item_sender();
+    }
+
+    // Do not leave credentials in released memory
+    memset(p_item, 0, sizeof(item_data_t));
+    free(p_item);
+
+    return;
+}
+
 /* [] END OF FILE */
@@ -3,6 +3,11 @@
     https://github.com/kgabis/parson at commit id 4f3eaa6
     Patched to avoid any usage of fopen(), and removed implicit
     cast warnings by making them explicit.
+    Number parsing uses an exact fast path for short decimals before
+    falling back to strtod, numbers are serialized with Grisu2 instead
+    of sprintf("%1.17g").
+    Object names are hashed and precompiled dot-paths (JSON_Path) were
+    added.
 */
 
 /*
@@ -41,6 +46,7 @@
 #include <ctype.h>
 #include <math.h>
 #include <errno.h>
+#include <stdint.h>
 
 /* Apparently sscanf is not implemented in some "standard" libraries, so don't use it, if you
  * don't have to. */
@@ -49,10 +55,14 @@
 #define STARTING_CAPACITY 16
 #define MAX_NESTING 2048
 
-#define FLOAT_FORMAT "%1.17g" /* do not increase precision without incresing NUM_BUF_SIZE */
-/* double printed with "%1.17g" shouldn't be longer than 25 bytes so let's use 64 */
+/* number formatted by format_number is never longer than 25 bytes so let's use 64 */
 #define NUM_BUF_SIZE 64
 
+/* integers up to 2^53 are represented exactly by double */
+#define MAX_EXACT_INTEGER 9007199254740992ULL
+/* powers of ten up to 10^22 are represented exactly by double */
+#define MAX_EXACT_POW10 22
+
 #define SIZEOF_TOKEN(a) (sizeof(a) - 1)
 #define SKIP_CHAR(str) ((*str)++)
 #define SKIP_WHITESPACES(str)                 \
@@ -88,11 +98,24 @@ struct json_value_t {
 struct json_object_t {
     JSON_Value *wrapping_value;
     char **names;
+    unsigned long *hashes;
     JSON_Value **values;
     size_t count;
     size_t capacity;
 };
 
+typedef struct json_path_segment_t {
+    const char *name;
+    size_t name_len;
+    unsigned long hash;
+} JSON_Path_Segment;
+
+struct json_path_t {
+    char *names; /* copy of the dotted name with dots replaced by '\0' */
+    JSON_Path_Segment *segments;
+    size_t count;
+};
+
 struct json_array_t {
     JSON_Value *wrapping_value;
     JSON_Value **items;
@@ -110,6 +133,7 @@ static int num_bytes_in_utf8_sequence(unsigned char c);
 static int verify_utf8_sequence(const unsigned char *string, int *len);
 static int is_valid_utf8(const char *string, size_t string_len);
 static int is_decimal(const char *string, size_t length);
+static unsigned long hash_string(const char *string, size_t n);
 
 /* JSON Object */
 static JSON_Object *json_object_init(JSON_Value *wrapping_value);
@@ -119,12 +143,20 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity);
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len);
+static JSON_Value *json_object_getn_value_hashed(const JSON_Object *object, const char *name,
+                                                 size_t name_len, unsigned long hash);
 static JSON_Status json_object_remove_internal(JSON_Object *object, const char *name,
                                                int free_value);
 static JSON_Status json_object_dotremove_internal(JSON_Object *object, const char *name,
                                                   int free_value);
 static void json_object_free(JSON_Object *object);
 
+/* JSON Path */
+static JSON_Status json_object_pathset_value_r(JSON_Object *object, const JSON_Path *path,
+                                               size_t level, JSON_Value *value);
+static JSON_Status json_object_pathremove_internal(JSON_Object *object, const JSON_Path *path,
+                                                   size_t level, int free_value);
+
 /* JSON Array */
 static JSON_Array *json_array_init(JSON_Value *wrapping_value);
 static JSON_Status json_array_add(JSON_Array *array, JSON_Value *value);
@@ -147,6 +179,23 @@ static JSON_Value *parse_number_value(const char **string);
 static JSON_Value *parse_null_value(const char **string);
 static JSON_Value *parse_value(const char **string, size_t nesting);
 
+/* Numbers */
+typedef struct parson_diy_fp {
+    uint64_t f;
+    int e;
+} parson_diy_fp;
+
+static int parse_number_fast(const char *string, double *number, const char **end);
+static parson_diy_fp diy_fp_from_double(double d);
+static parson_diy_fp diy_fp_normalize(parson_diy_fp x);
+static parson_diy_fp diy_fp_multiply(parson_diy_fp x, parson_diy_fp y);
+static parson_diy_fp diy_fp_cached_power(int e, int *k);
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa,
+                        uint64_t wp_w);
+static int grisu2(double d, char *buf, int *k);
+static int format_integer(uint64_t number, char *buf);
+static int format_number(double number, char *buf);
+
 /* Serialization */
 static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int level, int is_pretty,
                                       char *num_buf);
@@ -286,6 +335,16 @@ static int is_decimal(const char *string, size_t length)
     return 1;
 }
 
+static unsigned long hash_string(const char *string, size_t n)
+{
+    unsigned long hash = 5381; /* djb2 */
+    size_t i;
+    for (i = 0; i < n; i++) {
+        hash = ((hash << 5) + hash) + (unsigned char)string[i];
+    }
+    return hash;
+}
+
 static void remove_comments(char *string, const char *start_token, const char *end_token)
 {
     int in_string = 0, escaped = 0;
@@ -331,6 +390,7 @@ static JSON_Object *json_object_init(JSON_Value *wrapping_value)
     }
     new_obj->wrapping_value = wrapping_value;
     new_obj->names = (char **)NULL;
+    new_obj->hashes = (unsigned long *)NULL;
     new_obj->values = (JSON_Value **)NULL;
     new_obj->capacity = 0;
     new_obj->count = 0;
@@ -366,6 +426,7 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
     if (object->names[index] == NULL) {
         return JSONFailure;
     }
+    object->hashes[index] = hash_string(name, name_len);
     value->parent = json_object_get_wrapping_value(object);
     object->values[index] = value;
     object->count++;
@@ -375,6 +436,7 @@ static JSON_Status json_object_addn(JSON_Object *object, const char *name, size_
 static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 {
     char **temp_names = NULL;
+    unsigned long *temp_hashes = NULL;
     JSON_Value **temp_values = NULL;
 
     if ((object->names == NULL && object->values != NULL) ||
@@ -385,18 +447,27 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
     if (temp_names == NULL) {
         return JSONFailure;
     }
+    temp_hashes = (unsigned long *)parson_malloc(new_capacity * sizeof(unsigned long));
+    if (temp_hashes == NULL) {
+        parson_free(temp_names);
+        return JSONFailure;
+    }
     temp_values = (JSON_Value **)parson_malloc(new_capacity * sizeof(JSON_Value *));
     if (temp_values == NULL) {
         parson_free(temp_names);
+        parson_free(temp_hashes);
         return JSONFailure;
     }
     if (object->names != NULL && object->values != NULL && object->count > 0) {
         memcpy(temp_names, object->names, object->count * sizeof(char *));
+        memcpy(temp_hashes, object->hashes, object->count * sizeof(unsigned long));
         memcpy(temp_values, object->values, object->count * sizeof(JSON_Value *));
     }
     parson_free(object->names);
+    parson_free(object->hashes);
     parson_free(object->values);
     object->names = temp_names;
+    object->hashes = temp_hashes;
     object->values = temp_values;
     object->capacity = new_capacity;
     return JSONSuccess;
@@ -404,9 +475,18 @@ static JSON_Status json_object_resize(JSON_Object *object, size_t new_capacity)
 
 static JSON_Value *json_object_getn_value(const JSON_Object *object, const char *name,
                                           size_t name_len)
+{
+    return json_object_getn_value_hashed(object, name, name_len, hash_string(name, name_len));
+}
+
+static JSON_Value *json_object_getn_value_hashed(const JSON_Object *object, const char *name,
+                                                 size_t name_len, unsigned long hash)
 {
     size_t i, name_length;
     for (i = 0; i < json_object_get_count(object); i++) {
+        if (object->hashes[i] != hash) {
+            continue;
+        }
         name_length = strlen(object->names[i]);
         if (name_length != name_len) {
             continue;
@@ -434,6 +514,7 @@ static JSON_Status json_object_remove_internal(JSON_Object *object, const char *
             }
             if (i != last_item_index) { /* Replace key value pair with one from the end */
                 object->names[i] = object->names[last_item_index];
+                object->hashes[i] = object->hashes[last_item_index];
                 object->values[i] = object->values[last_item_index];
             }
             object->count -= 1;
@@ -468,10 +549,68 @@ static void json_object_free(JSON_Object *object)
         json_value_free(object->values[i]);
     }
     parson_free(object->names);
+    parson_free(object->hashes);
     parson_free(object->values);
     parson_free(object);
 }
 
+/* JSON Path */
+static JSON_Status json_object_pathset_value_r(JSON_Object *object, const JSON_Path *path,
+                                               size_t level, JSON_Value *value)
+{
+    const JSON_Path_Segment *segment = &path->segments[level];
+    JSON_Value *temp_value = NULL, *new_value = NULL;
+    JSON_Object *new_object = NULL;
+    JSON_Status status = JSONFailure;
+    if (level == path->count - 1) {
+        return json_object_set_value(object, segment->name, value);
+    }
+    temp_value =
+        json_object_getn_value_hashed(object, segment->name, segment->name_len, segment->hash);
+    if (temp_value) {
+        /* Don't overwrite existing non-object, same as json_object_dotset_value */
+        if (json_value_get_type(temp_value) != JSONObject) {
+            return JSONFailure;
+        }
+        return json_object_pathset_value_r(json_value_get_object(temp_value), path, level + 1,
+                                           value);
+    }
+    new_value = json_value_init_object();
+    if (new_value == NULL) {
+        return JSONFailure;
+    }
+    new_object = json_value_get_object(new_value);
+    status = json_object_pathset_value_r(new_object, path, level + 1, value);
+    if (status != JSONSuccess) {
+        json_value_free(new_value);
+        return JSONFailure;
+    }
+    status = json_object_addn(object, segment->name, segment->name_len, new_value);
+    if (status != JSONSuccess) {
+        json_object_pathremove_internal(new_object, path, level + 1, 0);
+        json_value_free(new_value);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+static JSON_Status json_object_pathremove_internal(JSON_Object *object, const JSON_Path *path,
+                                                   size_t level, int free_value)
+{
+    const JSON_Path_Segment *segment = NULL;
+    JSON_Value *temp_value = NULL;
+    for (; level < path->count - 1; level++) {
+        segment = &path->segments[level];
+        temp_value =
+            json_object_getn_value_hashed(object, segment->name, segment->name_len, segment->hash);
+        if (json_value_get_type(temp_value) != JSONObject) {
+            return JSONFailure;
+        }
+        object = json_value_get_object(temp_value);
+    }
+    return json_object_remove_internal(object, path->segments[level].name, free_value);
+}
+
 /* JSON Array */
 static JSON_Array *json_array_init(JSON_Value *wrapping_value)
 {
@@ -878,7 +1017,15 @@ static JSON_Value *parse_boolean_value(const char **string)
 static JSON_Value *parse_number_value(const char **string)
 {
     char *end;
+    const char *fast_end = NULL;
     double number = 0;
+    if (parse_number_fast(*string, &number, &fast_end)) {
+        if (!is_decimal(*string, (size_t)(fast_end - *string))) {
+            return NULL;
+        }
+        *string = fast_end;
+        return json_value_init_number(number);
+    }
     errno = 0;
     number = strtod(*string, &end);
     if (errno || !is_decimal(*string, (size_t)(end - *string))) {
@@ -898,6 +1045,353 @@ static JSON_Value *parse_null_value(const char **string)
     return NULL;
 }
 
+/* Numbers */
+static const double pow10_exact[MAX_EXACT_POW10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static const uint64_t pow10_u64[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL};
+
+/* Normalized 64-bit approximations of 10^k for k = -348, -340, ..., 340 */
+static const parson_diy_fp cached_powers[] = {
+    {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193}, {0x8b16fb203055ac76ULL, -1166},
+    {0xcf42894a5dce35eaULL, -1140}, {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+    {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034}, {0xbe5691ef416bd60cULL, -1007},
+    {0x8dd01fad907ffc3cULL, -980}, {0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+    {0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874}, {0x823c12795db6ce57ULL, -847},
+    {0xc21094364dfb5637ULL, -821}, {0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+    {0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715}, {0xb23867fb2a35b28eULL, -688},
+    {0x84c8d4dfd2c63f3bULL, -661}, {0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+    {0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555}, {0xf3e2f893dec3f126ULL, -529},
+    {0xb5b5ada8aaff80b8ULL, -502}, {0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+    {0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396}, {0xa6dfbd9fb8e5b88fULL, -369},
+    {0xf8a95fcf88747d94ULL, -343}, {0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+    {0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236}, {0xe45c10c42a2b3b06ULL, -210},
+    {0xaa242499697392d3ULL, -183}, {0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+    {0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77}, {0x9c40000000000000ULL, -50},
+    {0xe8d4a51000000000ULL, -24}, {0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+    {0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83}, {0xd5d238a4abe98068ULL, 109},
+    {0x9f4f2726179a2245ULL, 136}, {0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+    {0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242}, {0x924d692ca61be758ULL, 269},
+    {0xda01ee641a708deaULL, 295}, {0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+    {0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402}, {0xc83553c5c8965d3dULL, 428},
+    {0x952ab45cfa97a0b3ULL, 455}, {0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+    {0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561}, {0x88fcf317f22241e2ULL, 588},
+    {0xcc20ce9bd35c78a5ULL, 614}, {0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+    {0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720}, {0xbb764c4ca7a44410ULL, 747},
+    {0x8bab8eefb6409c1aULL, 774}, {0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+    {0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880}, {0x80444b5e7aa7cf85ULL, 907},
+    {0xbf21e44003acdd2dULL, 933}, {0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+    {0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039}, {0xaf87023b9bf0ee6bULL, 1066}
+};
+
+/* Parses numbers whose mantissa fits into 2^53 and whose decimal exponent is small enough for
+   a single correctly rounded multiplication or division (Clinger's fast path). Returns 0 when the
+   number has to be handed over to strtod. */
+static int parse_number_fast(const char *string, double *number, const char **end)
+{
+    const char *p = string;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0, exp_value = 0, exp_digits = 0, is_negative = 0,
+        is_exp_negative = 0;
+    double result = 0;
+
+    if (*p == '-') {
+        is_negative = 1;
+        p++;
+    }
+    if (!isdigit((unsigned char)*p)) {
+        return 0;
+    }
+    while (isdigit((unsigned char)*p)) {
+        if (mantissa != 0 || *p != '0') {
+            if (++digits > 19) {
+                return 0;
+            }
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        }
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (!isdigit((unsigned char)*p)) {
+            return 0;
+        }
+        while (isdigit((unsigned char)*p)) {
+            if (mantissa != 0 || *p != '0') {
+                if (++digits > 19) {
+                    return 0;
+                }
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            }
+            exponent--;
+            p++;
+        }
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '-' || *p == '+') {
+            is_exp_negative = (*p == '-');
+            p++;
+        }
+        if (!isdigit((unsigned char)*p)) {
+            return 0;
+        }
+        while (isdigit((unsigned char)*p)) {
+            if (++exp_digits > 4) {
+                return 0;
+            }
+            exp_value = exp_value * 10 + (*p - '0');
+            p++;
+        }
+        exponent += is_exp_negative ? -exp_value : exp_value;
+    }
+    /* leave anything that doesn't look like a plain decimal number (e.g. hex) to strtod */
+    if (isalnum((unsigned char)*p) || *p == '.') {
+        return 0;
+    }
+    if (mantissa > MAX_EXACT_INTEGER) {
+        return 0;
+    }
+    if (mantissa == 0) {
+        result = 0.0;
+    } else if (exponent == 0) {
+        result = (double)mantissa;
+    } else if (exponent > 0 && exponent <= MAX_EXACT_POW10) {
+        result = (double)mantissa * pow10_exact[exponent];
+    } else if (exponent < 0 && exponent >= -MAX_EXACT_POW10) {
+        result = (double)mantissa / pow10_exact[-exponent];
+    } else {
+        return 0;
+    }
+    *number = is_negative ? -result : result;
+    *end = p;
+    return 1;
+}
+
+static parson_diy_fp diy_fp_from_double(double d)
+{
+    parson_diy_fp result;
+    uint64_t bits = 0;
+    int biased_e = 0;
+    memcpy(&bits, &d, sizeof(bits));
+    biased_e = (int)((bits >> 52) & 0x7FF);
+    result.f = bits & 0x000FFFFFFFFFFFFFULL;
+    if (biased_e != 0) {
+        result.f += 0x0010000000000000ULL; /* hidden bit */
+        result.e = biased_e - 1075;
+    } else {
+        result.e = 1 - 1075;
+    }
+    return result;
+}
+
+static parson_diy_fp diy_fp_normalize(parson_diy_fp x)
+{
+    while (!(x.f & 0x8000000000000000ULL)) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+static parson_diy_fp diy_fp_multiply(parson_diy_fp x, parson_diy_fp y)
+{
+    parson_diy_fp result;
+    const uint64_t m32 = 0xFFFFFFFFULL;
+    uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t tmp = (bd >> 32) + (ad & m32) + (bc & m32);
+    tmp += 1ULL << 31; /* round */
+    result.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    result.e = x.e + y.e + 64;
+    return result;
+}
+
+static parson_diy_fp diy_fp_cached_power(int e, int *k)
+{
+    /* 0.30102999566398114 = log10(2) */
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int ik = (int)dk;
+    size_t index = 0;
+    if (dk - ik > 0.0) {
+        ik++;
+    }
+    index = (size_t)((ik >> 3) + 1);
+    *k = -(-348 + (int)(index << 3));
+    return cached_powers[index];
+}
+
+static void grisu_round(char *buf, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa,
+                        uint64_t wp_w)
+{
+    while (rest < wp_w && delta - rest >= ten_kappa &&
+           (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+        buf[len - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+/* Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with
+   Integers"). Writes shortest digits that round-trip into buf and returns their count, the value
+   equals digits * 10^k. d has to be positive and finite. */
+static int grisu2(double d, char *buf, int *k)
+{
+    parson_diy_fp v = diy_fp_from_double(d), w, w_plus, w_minus, c_mk, one;
+    uint64_t delta = 0, wp_w = 0, p2 = 0, tmp = 0;
+    uint32_t p1 = 0, digit = 0;
+    int kappa = 0, len = 0;
+
+    /* boundaries m+ and m- with the same exponent */
+    w_plus.f = (v.f << 1) + 1;
+    w_plus.e = v.e - 1;
+    while (!(w_plus.f & (0x0010000000000000ULL << 1))) {
+        w_plus.f <<= 1;
+        w_plus.e--;
+    }
+    w_plus.f <<= 64 - 52 - 2;
+    w_plus.e -= 64 - 52 - 2;
+    if (v.f == 0x0010000000000000ULL) {
+        w_minus.f = (v.f << 2) - 1;
+        w_minus.e = v.e - 2;
+    } else {
+        w_minus.f = (v.f << 1) - 1;
+        w_minus.e = v.e - 1;
+    }
+    w_minus.f <<= w_minus.e - w_plus.e;
+    w_minus.e = w_plus.e;
+
+    c_mk = diy_fp_cached_power(w_plus.e, k);
+    w = diy_fp_multiply(diy_fp_normalize(v), c_mk);
+    w_plus = diy_fp_multiply(w_plus, c_mk);
+    w_minus = diy_fp_multiply(w_minus, c_mk);
+    w_minus.f++;
+    w_plus.f--;
+
+    /* digit generation */
+    delta = w_plus.f - w_minus.f;
+    one.e = w_plus.e;
+    one.f = 1ULL << -one.e;
+    wp_w = w_plus.f - w.f;
+    p1 = (uint32_t)(w_plus.f >> -one.e);
+    p2 = w_plus.f & (one.f - 1);
+    for (kappa = 10; kappa > 1 && p1 < pow10_u64[kappa - 1]; kappa--) {
+    }
+    while (kappa > 0) {
+        digit = p1 / (uint32_t)pow10_u64[kappa - 1];
+        p1 %= (uint32_t)pow10_u64[kappa - 1];
+        if (digit || len) {
+            buf[len++] = (char)('0' + digit);
+        }
+        kappa--;
+        tmp = ((uint64_t)p1 << -one.e) + p2;
+        if (tmp <= delta) {
+            *k += kappa;
+            grisu_round(buf, len, delta, tmp, pow10_u64[kappa] << -one.e, wp_w);
+            return len;
+        }
+    }
+    for (;;) {
+        p2 *= 10;
+        delta *= 10;
+        digit = (uint32_t)(p2 >> -one.e);
+        if (digit || len) {
+            buf[len++] = (char)('0' + digit);
+        }
+        p2 &= one.f - 1;
+        kappa--;
+        if (p2 < delta) {
+            *k += kappa;
+            grisu_round(buf, len, delta, p2, one.f, -kappa < 20 ? wp_w * pow10_u64[-kappa] : 0);
+            return len;
+        }
+    }
+}
+
+static int format_integer(uint64_t number, char *buf)
+{
+    char digits[20];
+    int len = 0, i = 0;
+    do {
+        digits[len++] = (char)('0' + number % 10);
+        number /= 10;
+    } while (number != 0);
+    for (i = 0; i < len; i++) {
+        buf[i] = digits[len - 1 - i];
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/* Formats finite double so that it parses back to the same value. Integers up to 2^53 are printed
+   directly, other values use Grisu2 digits, which are the shortest possible in all but a small
+   fraction of cases. buf has to be at least NUM_BUF_SIZE bytes long. */
+static int format_number(double number, char *buf)
+{
+    char digits[18];
+    int written = 0, len = 0, k = 0, point = 0, exp = 0, i = 0;
+
+    if (signbit(number)) {
+        buf[written++] = '-';
+        number = -number;
+    }
+    if (number < (double)MAX_EXACT_INTEGER && number == (double)(uint64_t)number) {
+        return written + format_integer((uint64_t)number, buf + written);
+    }
+
+    len = grisu2(number, digits, &k);
+    point = len + k; /* position of decimal point relative to the first digit */
+    if (k >= 0 && point <= 21) {
+        /* 1234e5 -> 123400000 */
+        memcpy(buf + written, digits, (size_t)len);
+        written += len;
+        for (i = 0; i < k; i++) {
+            buf[written++] = '0';
+        }
+    } else if (point > 0 && point <= 21) {
+        /* 1234e-2 -> 12.34 */
+        memcpy(buf + written, digits, (size_t)point);
+        written += point;
+        buf[written++] = '.';
+        memcpy(buf + written, digits + point, (size_t)(len - point));
+        written += len - point;
+    } else if (point > -6 && point <= 0) {
+        /* 1234e-6 -> 0.001234 */
+        buf[written++] = '0';
+        buf[written++] = '.';
+        for (i = point; i < 0; i++) {
+            buf[written++] = '0';
+        }
+        memcpy(buf + written, digits, (size_t)len);
+        written += len;
+    } else {
+        /* 1234e30 -> 1.234e+33 */
+        buf[written++] = digits[0];
+        if (len > 1) {
+            buf[written++] = '.';
+            memcpy(buf + written, digits + 1, (size_t)(len - 1));
+            written += len - 1;
+        }
+        exp = point - 1;
+        buf[written++] = 'e';
+        buf[written++] = exp < 0 ? '-' : '+';
+        if (exp < 0) {
+            exp = -exp;
+        }
+        if (exp < 10) {
+            buf[written++] = '0';
+        }
+        written += format_integer((uint64_t)exp, buf + written);
+        return written;
+    }
+    buf[written] = '\0';
+    return written;
+}
+
 /* Serialization */
 #define APPEND_STRING(str)                   \
     do {                                     \
@@ -1041,7 +1535,7 @@ static int json_serialize_to_buffer_r(const JSON_Value *value, char *buf, int le
         if (buf != NULL) {
             num_buf = buf;
         }
-        written = sprintf(num_buf, FLOAT_FORMAT, num);
+        written = format_number(num, num_buf);
         if (written < 0) {
             return -1;
         }
@@ -2035,6 +2529,175 @@ JSON_Status json_object_clear(JSON_Object *object)
     return JSONSuccess;
 }
 
+/* JSON Path API */
+JSON_Path *json_path_compile(const char *name)
+{
+    JSON_Path *path = NULL;
+    char *segment_start = NULL, *dot_pos = NULL;
+    size_t count = 1, i = 0;
+    if (name == NULL) {
+        return NULL;
+    }
+    for (dot_pos = strchr(name, '.'); dot_pos != NULL; dot_pos = strchr(dot_pos + 1, '.')) {
+        count++;
+    }
+    path = (JSON_Path *)parson_malloc(sizeof(JSON_Path));
+    if (path == NULL) {
+        return NULL;
+    }
+    path->count = count;
+    path->names = parson_strdup(name);
+    path->segments = (JSON_Path_Segment *)parson_malloc(count * sizeof(JSON_Path_Segment));
+    if (path->names == NULL || path->segments == NULL) {
+        json_path_free(path);
+        return NULL;
+    }
+    segment_start = path->names;
+    for (i = 0; i < count; i++) {
+        dot_pos = strchr(segment_start, '.');
+        if (dot_pos != NULL) {
+            *dot_pos = '\0';
+        }
+        path->segments[i].name = segment_start;
+        path->segments[i].name_len = strlen(segment_start);
+        path->segments[i].hash = hash_string(segment_start, path->segments[i].name_len);
+        segment_start += path->segments[i].name_len + 1;
+    }
+    return path;
+}
+
+void json_path_free(JSON_Path *path)
+{
+    if (path == NULL) {
+        return;
+    }
+    parson_free(path->names);
+    parson_free(path->segments);
+    parson_free(path);
+}
+
+JSON_Value *json_object_pathget_value(const JSON_Object *object, const JSON_Path *path)
+{
+    const JSON_Path_Segment *segment = NULL;
+    JSON_Value *temp_value = NULL;
+    size_t i = 0;
+    if (object == NULL || path == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < path->count; i++) {
+        segment = &path->segments[i];
+        temp_value =
+            json_object_getn_value_hashed(object, segment->name, segment->name_len, segment->hash);
+        if (i < path->count - 1) {
+            object = json_value_get_object(temp_value);
+            if (object == NULL) {
+                return NULL;
+            }
+        }
+    }
+    return temp_value;
+}
+
+const char *json_object_pathget_string(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_string(json_object_pathget_value(object, path));
+}
+
+double json_object_pathget_number(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_number(json_object_pathget_value(object, path));
+}
+
+JSON_Object *json_object_pathget_object(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_object(json_object_pathget_value(object, path));
+}
+
+JSON_Array *json_object_pathget_array(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_array(json_object_pathget_value(object, path));
+}
+
+int json_object_pathget_boolean(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_value_get_boolean(json_object_pathget_value(object, path));
+}
+
+int json_object_pathhas_value(const JSON_Object *object, const JSON_Path *path)
+{
+    return json_object_pathget_value(object, path) != NULL;
+}
+
+JSON_Status json_object_pathset_value(JSON_Object *object, const JSON_Path *path,
+                                      JSON_Value *value)
+{
+    if (object == NULL || path == NULL || value == NULL) {
+        return JSONFailure;
+    }
+    return json_object_pathset_value_r(object, path, 0, value);
+}
+
+JSON_Status json_object_pathset_string(JSON_Object *object, const JSON_Path *path,
+                                       const char *string)
+{
+    JSON_Value *value = json_value_init_string(string);
+    if (value == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_pathset_value(object, path, value) == JSONFailure) {
+        json_value_free(value);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+JSON_Status json_object_pathset_number(JSON_Object *object, const JSON_Path *path, double number)
+{
+    JSON_Value *value = json_value_init_number(number);
+    if (value == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_pathset_value(object, path, value) == JSONFailure) {
+        json_value_free(value);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+JSON_Status json_object_pathset_boolean(JSON_Object *object, const JSON_Path *path, int boolean)
+{
+    JSON_Value *value = json_value_init_boolean(boolean);
+    if (value == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_pathset_value(object, path, value) == JSONFailure) {
+        json_value_free(value);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+JSON_Status json_object_pathset_null(JSON_Object *object, const JSON_Path *path)
+{
+    JSON_Value *value = json_value_init_null();
+    if (value == NULL) {
+        return JSONFailure;
+    }
+    if (json_object_pathset_value(object, path, value) == JSONFailure) {
+        json_value_free(value);
+        return JSONFailure;
+    }
+    return JSONSuccess;
+}
+
+JSON_Status json_object_pathremove(JSON_Object *object, const JSON_Path *path)
+{
+    if (object == NULL || path == NULL) {
+        return JSONFailure;
+    }
+    return json_object_pathremove_internal(object, path, 0, 1);
+}
+
 JSON_Status json_validate(const JSON_Value *schema, const JSON_Value *value)
 {
     JSON_Value *temp_schema_value = NULL, *temp_value = NULL;
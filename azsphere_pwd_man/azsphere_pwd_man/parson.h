@@ -41,6 +41,7 @@ extern "C" {
 typedef struct json_object_t JSON_Object;
 typedef struct json_array_t JSON_Array;
 typedef struct json_value_t JSON_Value;
+typedef struct json_path_t JSON_Path;
 
 enum json_value_type {
     JSONError = -1,
@@ -163,6 +164,35 @@ JSON_Status json_object_dotremove(JSON_Object *object, const char *key);
 /* Removes all name-value pairs in object */
 JSON_Status json_object_clear(JSON_Object *object);
 
+/*
+ * JSON Path
+ */
+/* Precompiled dot notation name. Compiling splits and hashes the name once, so resolving it costs
+ only a lookup per nesting level. Returned path has to be freed with json_path_free. pathget,
+ pathset and pathremove functions behave exactly like their dot counterparts. */
+JSON_Path *json_path_compile(const char *name); /* returns NULL on fail */
+void json_path_free(JSON_Path *path);
+
+JSON_Value *json_object_pathget_value(const JSON_Object *object, const JSON_Path *path);
+const char *json_object_pathget_string(const JSON_Object *object, const JSON_Path *path);
+JSON_Object *json_object_pathget_object(const JSON_Object *object, const JSON_Path *path);
+JSON_Array *json_object_pathget_array(const JSON_Object *object, const JSON_Path *path);
+double json_object_pathget_number(const JSON_Object *object,
+                                  const JSON_Path *path); /* returns 0 on fail */
+int json_object_pathget_boolean(const JSON_Object *object,
+                                const JSON_Path *path); /* returns -1 on fail */
+int json_object_pathhas_value(const JSON_Object *object, const JSON_Path *path);
+
+JSON_Status json_object_pathset_value(JSON_Object *object, const JSON_Path *path,
+                                      JSON_Value *value);
+JSON_Status json_object_pathset_string(JSON_Object *object, const JSON_Path *path,
+                                       const char *string);
+JSON_Status json_object_pathset_number(JSON_Object *object, const JSON_Path *path, double number);
+JSON_Status json_object_pathset_boolean(JSON_Object *object, const JSON_Path *path, int boolean);
+JSON_Status json_object_pathset_null(JSON_Object *object, const JSON_Path *path);
+
+JSON_Status json_object_pathremove(JSON_Object *object, const JSON_Path *path);
+
 /*
  *JSON Array
  */
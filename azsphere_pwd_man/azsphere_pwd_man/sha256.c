@@ -0,0 +1,275 @@
+﻿/***************************************************************************//**
+* @file    sha256.c
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    SHA-256 hash (FIPS 180-4) and HMAC-SHA256 (RFC 2104).
+*
+*******************************************************************************/
+
+#include <string.h>
+
+#include "sha256.h"
+
+/*******************************************************************************
+*   Macros and #define Constants
+*******************************************************************************/
+
+#define ROTR(x, n)      (((x) >> (n)) | ((x) << (32 - (n))))
+
+/*******************************************************************************
+* Function declarations
+*******************************************************************************/
+
+/**
+ * @brief Process one 64 byte block.
+ *
+ * @param p_ctx Hash context.
+ * @param p_block Input block.
+ */
+static void
+sha256_transform(sha256_t *p_ctx, const uint8_t *p_block);
+
+/*******************************************************************************
+* Global variables
+*******************************************************************************/
+
+static const uint32_t g_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/*******************************************************************************
+* Function definitions
+*******************************************************************************/
+
+void
+sha256_init(sha256_t *p_ctx)
+{
+    static const uint32_t initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+    memcpy(p_ctx->state, initial_state, sizeof(initial_state));
+    p_ctx->length = 0;
+    p_ctx->block_used = 0;
+}
+
+void
+sha256_update(sha256_t *p_ctx, const void *p_data, size_t length)
+{
+    const uint8_t *p_bytes = p_data;
+
+    p_ctx->length += length;
+    while (length > 0)
+    {
+        size_t chunk = SHA256_BLOCK_LENGTH - p_ctx->block_used;
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        memcpy(p_ctx->block + p_ctx->block_used, p_bytes, chunk);
+        p_ctx->block_used += chunk;
+        p_bytes += chunk;
+        length -= chunk;
+
+        if (p_ctx->block_used == SHA256_BLOCK_LENGTH)
+        {
+            sha256_transform(p_ctx, p_ctx->block);
+            p_ctx->block_used = 0;
+        }
+    }
+}
+
+void
+sha256_final(sha256_t *p_ctx, uint8_t *p_digest)
+{
+    uint64_t bit_length = p_ctx->length * 8;
+
+    // Pad with 0x80, zeros and message bit length in the last 8 bytes
+    p_ctx->block[p_ctx->block_used++] = 0x80;
+    if (p_ctx->block_used > SHA256_BLOCK_LENGTH - 8)
+    {
+        memset(p_ctx->block + p_ctx->block_used, 0,
+            SHA256_BLOCK_LENGTH - p_ctx->block_used);
+        sha256_transform(p_ctx, p_ctx->block);
+        p_ctx->block_used = 0;
+    }
+    memset(p_ctx->block + p_ctx->block_used, 0,
+        SHA256_BLOCK_LENGTH - 8 - p_ctx->block_used);
+    for (int i = 0; i < 8; i++)
+    {
+        p_ctx->block[SHA256_BLOCK_LENGTH - 1 - i] = (uint8_t)(bit_length >> (8 * i));
+    }
+    sha256_transform(p_ctx, p_ctx->block);
+
+    for (int i = 0; i < 8; i++)
+    {
+        p_digest[4 * i] = (uint8_t)(p_ctx->state[i] >> 24);
+        p_digest[4 * i + 1] = (uint8_t)(p_ctx->state[i] >> 16);
+        p_digest[4 * i + 2] = (uint8_t)(p_ctx->state[i] >> 8);
+        p_digest[4 * i + 3] = (uint8_t)p_ctx->state[i];
+    }
+}
+
+void
+hmac_sha256_init(hmac_sha256_t *p_ctx, const void *p_key, size_t key_length)
+{
+    uint8_t key_block[SHA256_BLOCK_LENGTH] = { 0 };
+    uint8_t pad[SHA256_BLOCK_LENGTH];
+
+    if (key_length > SHA256_BLOCK_LENGTH)
+    {
+        sha256_init(&p_ctx->inner);
+        sha256_update(&p_ctx->inner, p_key, key_length);
+        sha256_final(&p_ctx->inner, key_block);
+    }
+    else
+    {
+        memcpy(key_block, p_key, key_length);
+    }
+
+    for (int i = 0; i < SHA256_BLOCK_LENGTH; i++)
+    {
+        pad[i] = key_block[i] ^ 0x36;
+    }
+    sha256_init(&p_ctx->inner);
+    sha256_update(&p_ctx->inner, pad, sizeof(pad));
+
+    for (int i = 0; i < SHA256_BLOCK_LENGTH; i++)
+    {
+        pad[i] = key_block[i] ^ 0x5c;
+    }
+    sha256_init(&p_ctx->outer);
+    sha256_update(&p_ctx->outer, pad, sizeof(pad));
+
+    // Do not leave key material on stack
+    memset(key_block, 0, sizeof(key_block));
+    memset(pad, 0, sizeof(pad));
+}
+
+void
+hmac_sha256_update(hmac_sha256_t *p_ctx, const void *p_data, size_t length)
+{
+    sha256_update(&p_ctx->inner, p_data, length);
+}
+
+void
+hmac_sha256_final(hmac_sha256_t *p_ctx, uint8_t *p_mac)
+{
+    uint8_t inner_digest[SHA256_DIGEST_LENGTH];
+
+    sha256_final(&p_ctx->inner, inner_digest);
+    sha256_update(&p_ctx->outer, inner_digest, sizeof(inner_digest));
+    sha256_final(&p_ctx->outer, p_mac);
+
+    memset(inner_digest, 0, sizeof(inner_digest));
+    memset(p_ctx, 0, sizeof(hmac_sha256_t));
+}
+
+void
+hmac_sha256(const void *p_key, size_t key_length, const void *p_data,
+    size_t length, uint8_t *p_mac)
+{
+    hmac_sha256_t ctx;
+
+    hmac_sha256_init(&ctx, p_key, key_length);
+    hmac_sha256_update(&ctx, p_data, length);
+    hmac_sha256_final(&ctx, p_mac);
+}
+
+bool
+sha256_equal(const uint8_t *p_a, const uint8_t *p_b, size_t length)
+{
+    uint8_t difference = 0;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        difference |= p_a[i] ^ p_b[i];
+    }
+
+    return difference == 0;
+}
+
+/*******************************************************************************
+* Private function definitions
+*******************************************************************************/
+
+static void
+sha256_transform(sha256_t *p_ctx, const uint8_t *p_block)
+{
+    uint32_t w[64];
+
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = ((uint32_t)p_block[4 * i] << 24) |
+            ((uint32_t)p_block[4 * i + 1] << 16) |
+            ((uint32_t)p_block[4 * i + 2] << 8) |
+            (uint32_t)p_block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = p_ctx->state[0];
+    uint32_t b = p_ctx->state[1];
+    uint32_t c = p_ctx->state[2];
+    uint32_t d = p_ctx->state[3];
+    uint32_t e = p_ctx->state[4];
+    uint32_t f = p_ctx->state[5];
+    uint32_t g = p_ctx->state[6];
+    uint32_t h = p_ctx->state[7];
+
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + g_k[i] + w[i];
+        uint32_t s0 = ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    p_ctx->state[0] += a;
+    p_ctx->state[1] += b;
+    p_ctx->state[2] += c;
+    p_ctx->state[3] += d;
+    p_ctx->state[4] += e;
+    p_ctx->state[5] += f;
+    p_ctx->state[6] += g;
+    p_ctx->state[7] += h;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,131 @@
+﻿/***************************************************************************//**
+* @file    sha256.h
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    SHA-256 hash (FIPS 180-4) and HMAC-SHA256 (RFC 2104) for authenticating
+*    local network requests.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*******************************************************************************
+*   Macros and #define Constants
+*******************************************************************************/
+
+#define SHA256_BLOCK_LENGTH     64
+#define SHA256_DIGEST_LENGTH    32
+
+/*******************************************************************************
+*   Type definitions
+*******************************************************************************/
+
+typedef struct sha256_s
+{
+    uint32_t state[8];                      // Intermediate hash value
+    uint64_t length;                        // Number of bytes hashed
+    uint8_t block[SHA256_BLOCK_LENGTH];     // Partial input block
+    size_t block_used;                      // Bytes in partial block
+} sha256_t;
+
+typedef struct hmac_sha256_s
+{
+    sha256_t inner;                         // Hash of inner padded key
+    sha256_t outer;                         // Hash of outer padded key
+} hmac_sha256_t;
+
+/*******************************************************************************
+* Function prototypes
+*******************************************************************************/
+
+/**
+ * @brief Start new hash.
+ *
+ * @param p_ctx Hash context.
+ */
+void
+sha256_init(sha256_t *p_ctx);
+
+/**
+ * @brief Add data to hash.
+ *
+ * @param p_ctx Hash context.
+ * @param p_data Data.
+ * @param length Data length.
+ */
+void
+sha256_update(sha256_t *p_ctx, const void *p_data, size_t length);
+
+/**
+ * @brief Finish hash. Context has to be initialized again to be reused.
+ *
+ * @param p_ctx Hash context.
+ * @param p_digest Output buffer of SHA256_DIGEST_LENGTH bytes.
+ */
+void
+sha256_final(sha256_t *p_ctx, uint8_t *p_digest);
+
+/**
+ * @brief Start new HMAC with given key.
+ *
+ * @param p_ctx HMAC context.
+ * @param p_key Key.
+ * @param key_length Key length, keys longer than block are hashed first.
+ */
+void
+hmac_sha256_init(hmac_sha256_t *p_ctx, const void *p_key, size_t key_length);
+
+/**
+ * @brief Add data to HMAC.
+ *
+ * @param p_ctx HMAC context.
+ * @param p_data Data.
+ * @param length Data length.
+ */
+void
+hmac_sha256_update(hmac_sha256_t *p_ctx, const void *p_data, size_t length);
+
+/**
+ * @brief Finish HMAC and wipe context.
+ *
+ * @param p_ctx HMAC context.
+ * @param p_mac Output buffer of SHA256_DIGEST_LENGTH bytes.
+ */
+void
+hmac_sha256_final(hmac_sha256_t *p_ctx, uint8_t *p_mac);
+
+/**
+ * @brief Compute HMAC of a single buffer.
+ *
+ * @param p_key Key.
+ * @param key_length Key length.
+ * @param p_data Data.
+ * @param length Data length.
+ * @param p_mac Output buffer of SHA256_DIGEST_LENGTH bytes.
+ */
+void
+hmac_sha256(const void *p_key, size_t key_length, const void *p_data,
+    size_t length, uint8_t *p_mac);
+
+/**
+ * @brief Compare buffers in time independent of their content.
+ *
+ * @param p_a First buffer.
+ * @param p_b Second buffer.
+ * @param length Length of buffers.
+ *
+ * @return true if buffers are equal.
+ */
+bool
+sha256_equal(const uint8_t *p_a, const uint8_t *p_b, size_t length);
+
+/* [] END OF FILE */
@@ -0,0 +1,144 @@
+﻿/***************************************************************************//**
+* @file    spsc_queue.c
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Lock-free single producer, single consumer queue of pointers.
+*
+*    Head and tail are free running counters, slot index is the counter
+*    masked by capacity. Producer publishes a slot by release store of tail,
+*    consumer frees a slot by release store of head.
+*
+*******************************************************************************/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "build_options.h"
+#include "spsc_queue.h"
+
+#define LOG_MODULE_NAME     "queue"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_QUEUE
+#include "log_ring.h"
+
+/*******************************************************************************
+* Function definitions
+*******************************************************************************/
+
+int
+spsc_queue_init(spsc_queue_t *p_queue, size_t capacity)
+{
+    size_t capacity_pow2 = 1;
+    while (capacity_pow2 < capacity)
+    {
+        capacity_pow2 <<= 1;
+    }
+
+    p_queue->pp_slots = calloc(capacity_pow2, sizeof(void *));
+    if (p_queue->pp_slots == NULL)
+    {
+        LOG_ERROR("Could not allocate queue slots.\n");
+        return -1;
+    }
+
+    p_queue->capacity = capacity_pow2;
+    atomic_init(&p_queue->head, 0);
+    atomic_init(&p_queue->tail, 0);
+
+    p_queue->fd_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (p_queue->fd_event < 0)
+    {
+        LOG_ERROR("Could not create queue eventfd: %s (%d).\n",
+            strerror(errno), errno);
+        free(p_queue->pp_slots);
+        p_queue->pp_slots = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+spsc_queue_deinit(spsc_queue_t *p_queue)
+{
+    if (p_queue->fd_event >= 0)
+    {
+        close(p_queue->fd_event);
+        p_queue->fd_event = -1;
+    }
+
+    free(p_queue->pp_slots);
+    p_queue->pp_slots = NULL;
+    p_queue->capacity = 0;
+}
+
+bool
+spsc_queue_push(spsc_queue_t *p_queue, void *p_item)
+{
+    size_t tail = atomic_load_explicit(&p_queue->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&p_queue->head, memory_order_acquire);
+
+    if (tail - head == p_queue->capacity)
+    {
+        // Queue is full
+        return false;
+    }
+
+    p_queue->pp_slots[tail & (p_queue->capacity - 1)] = p_item;
+    atomic_store_explicit(&p_queue->tail, tail + 1, memory_order_release);
+
+    // Wake up consumer
+    uint64_t increment = 1;
+    if (write(p_queue->fd_event, &increment, sizeof(increment)) < 0 &&
+        errno != EAGAIN)
+    {
+        LOG_ERROR("Could not signal queue eventfd: %s (%d).\n",
+            strerror(errno), errno);
+    }
+
+    return true;
+}
+
+void
+*spsc_queue_pop(spsc_queue_t *p_queue)
+{
+    size_t head = atomic_load_explicit(&p_queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&p_queue->tail, memory_order_acquire);
+
+    if (head == tail)
+    {
+        // Queue is empty
+        return NULL;
+    }
+
+    void *p_item = p_queue->pp_slots[head & (p_queue->capacity - 1)];
+    atomic_store_explicit(&p_queue->head, head + 1, memory_order_release);
+
+    return p_item;
+}
+
+int
+spsc_queue_consume_event(spsc_queue_t *p_queue)
+{
+    uint64_t counter;
+
+    if (read(p_queue->fd_event, &counter, sizeof(counter)) < 0 &&
+        errno != EAGAIN)
+    {
+        LOG_ERROR("Could not consume queue eventfd: %s (%d).\n",
+            strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,93 @@
+﻿/***************************************************************************//**
+* @file    spsc_queue.h
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Lock-free single producer, single consumer queue of pointers for passing
+*    data between two threads. Every push signals an eventfd, so the consumer
+*    can wait for data in epoll or poll.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*******************************************************************************
+*   Type definitions
+*******************************************************************************/
+
+typedef struct spsc_queue_s
+{
+    void **pp_slots;            // Ring buffer of queued pointers
+    size_t capacity;            // Number of slots, power of two
+    atomic_size_t head;         // Next slot to pop, written by consumer only
+    atomic_size_t tail;         // Next slot to push, written by producer only
+    int fd_event;               // Eventfd signalled on every push
+} spsc_queue_t;
+
+/*******************************************************************************
+* Function prototypes
+*******************************************************************************/
+
+/**
+ * @brief Initialize queue.
+ *
+ * @param p_queue Queue to initialize.
+ * @param capacity Maximum number of queued pointers, rounded up to
+ *    a power of two.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int
+spsc_queue_init(spsc_queue_t *p_queue, size_t capacity);
+
+/**
+ * @brief Release queue resources. Pointers still queued are not freed.
+ *
+ * @param p_queue Queue to release.
+ */
+void
+spsc_queue_deinit(spsc_queue_t *p_queue);
+
+/**
+ * @brief Push pointer to queue. Must be called from producer thread only.
+ *
+ * @param p_queue Queue.
+ * @param p_item Pointer to push, must not be NULL.
+ *
+ * @return true on success, false if queue is full.
+ */
+bool
+spsc_queue_push(spsc_queue_t *p_queue, void *p_item);
+
+/**
+ * @brief Pop pointer from queue. Must be called from consumer thread only.
+ *
+ * @param p_queue Queue.
+ *
+ * @return Oldest queued pointer, NULL if queue is empty.
+ */
+void
+*spsc_queue_pop(spsc_queue_t *p_queue);
+
+/**
+ * @brief Reset queue eventfd before draining the queue.
+ *
+ * Must be called from consumer thread only. Pushes made after this call
+ * signal the eventfd again.
+ *
+ * @param p_queue Queue.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int
+spsc_queue_consume_event(spsc_queue_t *p_queue);
+
+/* [] END OF FILE */
@@ -0,0 +1,201 @@
+﻿/***************************************************************************//**
+* @file    tunables.c
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Registry of runtime tunable integer parameters.
+*
+*******************************************************************************/
+
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "build_options.h"
+#include "tunables.h"
+
+#define LOG_MODULE_NAME     "tunables"
+#define LOG_MODULE_LEVEL    LOG_LEVEL_TUNABLES
+#include "log_ring.h"
+
+/*******************************************************************************
+*   Type definitions
+*******************************************************************************/
+
+typedef struct tunable_s
+{
+    const char *p_name;         // Name in Device Twin
+    int default_value;          // Value until set from Device Twin
+    int min;                    // Lowest accepted value
+    int max;                    // Highest accepted value
+} tunable_t;
+
+/*******************************************************************************
+* Global variables
+*******************************************************************************/
+
+static const tunable_t g_tunables[TUNABLE_COUNT] = {
+    // Buttons are polled, longer period saves CPU, delays button response
+    [TUNABLE_BUTTON_POLL_MS] = { "buttonPollMs", 1, 1, 100 },
+
+    // Keyboard needs time to type a chunk before receiving the next one
+    [TUNABLE_CHUNK_DELAY_MS] = { "chunkDelayMs", 150, 10, 2000 },
+
+    // Receiving Arduino's Wire library has 32 byte buffer
+    [TUNABLE_CHUNK_LENGTH] = { "chunkLength", 32, 1, 32 },
+
+    [TUNABLE_I2C_TIMEOUT_MS] = { "i2cTimeoutMs", 100, 10, 1000 },
+
+    [TUNABLE_FORGET_SEC] = { "forgetSec", 5 * 60, 10, 60 * 60 },
+
+    // IoT Hub limits MQTT keepalive to 1767 seconds, DoWork interval is capped
+    // separately so long keepalive does not delay direct method calls
+    [TUNABLE_KEEPALIVE_SEC] = { "keepaliveSec", 20, 5, 1740 },
+};
+
+static atomic_int g_values[TUNABLE_COUNT];
+
+static int g_fd_event = -1;
+
+/*******************************************************************************
+* Function definitions
+*******************************************************************************/
+
+int
+tunables_init(void)
+{
+    for (int i = 0; i < TUNABLE_COUNT; i++)
+    {
+        atomic_init(&g_values[i], g_tunables[i].default_value);
+    }
+
+    g_fd_event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_fd_event < 0)
+    {
+        LOG_ERROR("Could not create tunables eventfd: %s (%d).\n",
+            strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+tunables_deinit(void)
+{
+    if (g_fd_event >= 0)
+    {
+        close(g_fd_event);
+        g_fd_event = -1;
+    }
+}
+
+int
+tunables_get(tunable_id_t id)
+{
+    return atomic_load_explicit(&g_values[id], memory_order_relaxed);
+}
+
+const char
+*tunables_get_name(tunable_id_t id)
+{
+    return g_tunables[id].p_name;
+}
+
+bool
+tunables_find(const char *p_path, tunable_id_t *p_id)
+{
+    size_t prefix_length = strlen(TUNABLES_PROPERTY);
+    if ((strncmp(p_path, TUNABLES_PROPERTY, prefix_length) != 0) ||
+        (p_path[prefix_length] != '.'))
+    {
+        return false;
+    }
+
+    const char *p_name = p_path + prefix_length + 1;
+    for (int i = 0; i < TUNABLE_COUNT; i++)
+    {
+        if (strcmp(p_name, g_tunables[i].p_name) == 0)
+        {
+            *p_id = (tunable_id_t)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool
+tunables_set(tunable_id_t id, const JSON_Value *p_value, char *p_error,
+    size_t error_size)
+{
+    const tunable_t *p_tunable = &g_tunables[id];
+    int value = p_tunable->default_value;
+
+    if (p_value != NULL)
+    {
+        double number = json_value_get_number(p_value);
+        if ((json_value_get_type(p_value) != JSONNumber) ||
+            (number != floor(number)))
+        {
+            snprintf(p_error, error_size, "%s must be an integer",
+                p_tunable->p_name);
+            return false;
+        }
+        if ((number < p_tunable->min) || (number > p_tunable->max))
+        {
+            snprintf(p_error, error_size, "%s must be within %d - %d",
+                p_tunable->p_name, p_tunable->min, p_tunable->max);
+            return false;
+        }
+        value = (int)number;
+    }
+
+    int previous = atomic_exchange_explicit(&g_values[id], value,
+        memory_order_relaxed);
+    if (previous != value)
+    {
+        LOG_INFO("Tunable %s changed from %d to %d.\n", p_tunable->p_name,
+            previous, value);
+
+        uint64_t increment = 1;
+        if (write(g_fd_event, &increment, sizeof(increment)) < 0)
+        {
+            LOG_ERROR("Could not signal tunables eventfd: %s (%d).\n",
+                strerror(errno), errno);
+        }
+    }
+
+    return true;
+}
+
+int
+tunables_get_event_fd(void)
+{
+    return g_fd_event;
+}
+
+int
+tunables_consume_event(void)
+{
+    uint64_t count;
+    if ((read(g_fd_event, &count, sizeof(count)) < 0) && (errno != EAGAIN))
+    {
+        LOG_ERROR("Could not consume tunables eventfd: %s (%d).\n",
+            strerror(errno), errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* [] END OF FILE */
@@ -0,0 +1,127 @@
+﻿/***************************************************************************//**
+* @file    tunables.h
+* @version 1.0.0
+* @authors Jaroslav Groman
+*
+* @par Project Name
+*     Azure Sphere Password Manager.
+*
+* @par Description
+*    Registry of runtime tunable integer parameters. Values are set from
+*    Device Twin desired properties "tunables.<name>", validated against
+*    bounds and readable from any thread. Every accepted change signals
+*    an eventfd, so the thread owning affected resources can apply it.
+*
+*******************************************************************************/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "parson.h"
+
+/*******************************************************************************
+*   Macros and #define Constants
+*******************************************************************************/
+
+// Device Twin property holding the tunables
+#define TUNABLES_PROPERTY       "tunables"
+
+/*******************************************************************************
+*   Type definitions
+*******************************************************************************/
+
+typedef enum tunable_id_e
+{
+    TUNABLE_BUTTON_POLL_MS,     // Button poll timer period
+    TUNABLE_CHUNK_DELAY_MS,     // Delay between USB keyboard chunks
+    TUNABLE_CHUNK_LENGTH,       // USB keyboard chunk length
+    TUNABLE_I2C_TIMEOUT_MS,     // I2C transfer timeout
+    TUNABLE_FORGET_SEC,         // Time to keep loaded item
+    TUNABLE_KEEPALIVE_SEC,      // MQTT keepalive period
+    TUNABLE_COUNT
+} tunable_id_t;
+
+/*******************************************************************************
+* Function prototypes
+*******************************************************************************/
+
+/**
+ * @brief Set all tunables to defaults and create change eventfd.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int
+tunables_init(void);
+
+/**
+ * @brief Close change eventfd.
+ */
+void
+tunables_deinit(void);
+
+/**
+ * @brief Get current value of tunable. Safe to call from any thread.
+ *
+ * @param id Tunable.
+ *
+ * @return Current value.
+ */
+int
+tunables_get(tunable_id_t id);
+
+/**
+ * @brief Get tunable name used in Device Twin.
+ *
+ * @param id Tunable.
+ *
+ * @return Tunable name.
+ */
+const char
+*tunables_get_name(tunable_id_t id);
+
+/**
+ * @brief Find tunable by Device Twin property path.
+ *
+ * @param p_path Property path "tunables.<name>".
+ * @param p_id Found tunable.
+ *
+ * @return true if path addresses a known tunable.
+ */
+bool
+tunables_find(const char *p_path, tunable_id_t *p_id);
+
+/**
+ * @brief Set tunable from desired property value. NULL value restores
+ *    default. Accepted change signals change eventfd.
+ *
+ * @param id Tunable.
+ * @param p_value Desired value, NULL to restore default.
+ * @param p_error Buffer for reason of rejection.
+ * @param error_size Size of error buffer.
+ *
+ * @return true if value was accepted, false if it is not an integer
+ *    within bounds.
+ */
+bool
+tunables_set(tunable_id_t id, const JSON_Value *p_value, char *p_error,
+    size_t error_size);
+
+/**
+ * @brief Get change eventfd to be registered in epoll.
+ *
+ * @return Eventfd signalled on every accepted change.
+ */
+int
+tunables_get_event_fd(void);
+
+/**
+ * @brief Reset change eventfd before applying changes.
+ *
+ * @return 0 on success, -1 otherwise.
+ */
+int
+tunables_consume_event(void);
+
+/* [] END OF FILE */